@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""
+Benchmark suite for tis.
+
+Generates a fixed set of workloads, runs each for a fixed number of cycles, and reports simulated cycles per second,
+simulated instructions per second, peak RSS and start-up time as JSON. Times are the median of several runs. The
+instruction count of each workload comes from one extra run with --profile, which counts them, and the peak RSS
+from one with --perf-counters, which reports it. Start-up time is that of a run of one cycle.
+
+Usage:
+    bench/bench.py [--tis ./tis] [--out bench.json] [--repeat 5] [--scale 1.0] [--only name,...]
+
+Compare two result files with bench/compare.py.
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import statistics
+import sys
+import tempfile
+import time
+
+
+def compute_single(d):
+    """One node doing arithmetic and jumps, with no io: the cost of running an instruction."""
+    code = "@0\nL: ADD 3\nSAV\nSUB 1\nSWP\nNEG\nJGZ L\nJLZ L\nJRO 1\nJMP L\n"
+    return code, "1 1 C", 20000000
+
+
+def pipeline_long(d):
+    """A value passed along a row of 64 nodes: the cost of the port handshake."""
+    cols = 64
+    code = "@0\nADD 1\nMOV ACC, RIGHT\n"
+    for i in range(1, cols - 1):
+        code += "@%d\nMOV LEFT, RIGHT\n" % i
+    code += "@%d\nMOV LEFT, DOWN\n" % (cols - 1)
+    return code, "1 %d %s O%d NUMERIC /dev/null" % (cols, "C" * cols, cols - 1), 100000
+
+
+def any_fanin(d):
+    """Blocks of four nodes writing to a centre node that reads ANY: the cost of ANY."""
+    blocks = 20
+    rows = ["DCD" * blocks, "CCC" * blocks, "DCD" * blocks]
+    # compute nodes are numbered in row order, skipping the others
+    ids = {}
+    for r, row in enumerate(rows):
+        for c, kind in enumerate(row):
+            if kind == "C":
+                ids[(r, c)] = len(ids)
+    code = ""
+    for b in range(blocks):
+        c = 3 * b + 1
+        parts = [
+            ((0, c), "MOV 1, DOWN"),
+            ((1, c - 1), "MOV 2, RIGHT"),
+            ((1, c), "MOV ANY, ACC\nADD ACC"),
+            ((1, c + 1), "MOV 3, LEFT"),
+            ((2, c), "MOV 4, UP"),
+        ]
+        for pos, text in parts:
+            code += "@%d\n%s\n" % (ids[pos], text)
+    return code, "3 %d %s" % (3 * blocks, "".join(rows)), 200000
+
+
+def stack_heavy(d):
+    """Nodes pushing to and popping from the stack node below: the cost of stack nodes."""
+    pairs = 32
+    code = ""
+    for i in range(pairs):
+        code += "@%d\nMOV ACC, DOWN\nADD 1\nMOV ACC, DOWN\nADD 1\nMOV ACC, DOWN\nMOV DOWN, ACC\nMOV DOWN, ACC\nMOV DOWN, ACC\n" % i
+    return code, "2 %d %s %s" % (2 * pairs, "CD" * pairs, "SD" * pairs), 200000
+
+
+def sparse_large(d):
+    """A 200x200 grid with one node in 50 running: the cost of nodes that never run, and of loading a big grid."""
+    size = 200
+    code = "".join("@%d\nADD 1\nSUB 1\n" % i for i in range(0, size * size, 50))
+    return code, "%d %d %s" % (size, size, "C" * size * size), 20000
+
+
+def io_numeric(d):
+    """Eight columns copying NUMERIC input to NUMERIC output: the cost of text io."""
+    cols = 8
+    cycles = 100000
+    path = os.path.join(d, "numbers.txt")
+    with open(path, "w") as f:
+        f.write(" ".join(str(i % 1999 - 999) for i in range(cycles // 2 + 10)) + "\n")
+    code = "".join("@%d\nMOV UP, DOWN\n" % i for i in range(cols))
+    io = " ".join("I%d NUMERIC %s O%d NUMERIC /dev/null" % (c, path, c) for c in range(cols))
+    return code, "1 %d %s %s" % (cols, "C" * cols, io), cycles
+
+
+WORKLOADS = [compute_single, pipeline_long, any_fanin, stack_heavy, sparse_large, io_numeric]
+
+
+def run(args, cycles, stderr=os.devnull):
+    """Run tis for this many cycles, and return the wall clock seconds"""
+    argv = args[:1] + ["-c", str(cycles)] + args[1:]
+    actions = [(os.POSIX_SPAWN_OPEN, 0, os.devnull, os.O_RDONLY, 0),
+               (os.POSIX_SPAWN_OPEN, 1, os.devnull, os.O_WRONLY, 0),
+               (os.POSIX_SPAWN_OPEN, 2, stderr, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)]
+    start = time.perf_counter()
+    pid = os.posix_spawn(argv[0], argv, os.environ, file_actions=actions)
+    _, status = os.waitpid(pid, 0)
+    seconds = time.perf_counter() - start
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        sys.exit("bench: %s failed with status %d" % (" ".join(argv), status))
+    return seconds
+
+
+def peak_rss(args, cycles, d):
+    """The peak RSS in KiB, as reported by --perf-counters. The rusage of a child is no use here, since it includes
+    the memory of this process, which it was started from."""
+    path = os.path.join(d, "perf.txt")
+    run([args[0], "--perf-counters"] + args[1:], cycles, stderr=path)
+    with open(path) as f:
+        match = re.search(r"peak RSS (\d+) KiB", f.read())
+    return int(match.group(1)) if match else None
+
+
+def instructions(args, cycles, d):
+    """The instructions run by compute nodes in this many cycles, from a profile"""
+    path = os.path.join(d, "profile.json")
+    run([args[0], "-q", "--profile=" + path] + args[1:], cycles)
+    with open(path) as f:
+        profile = json.load(f)
+    return sum(line["runs"] for node in profile["nodes"] for line in node.get("lines", []))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the tis benchmark suite")
+    parser.add_argument("--tis", default="./tis", help="the binary to benchmark")
+    parser.add_argument("--out", help="write the results here instead of stdout")
+    parser.add_argument("--repeat", type=int, default=5, help="runs of each workload, the median is kept")
+    parser.add_argument("--scale", type=float, default=1.0, help="multiply the cycles of every workload")
+    parser.add_argument("--only", help="comma-separated workloads to run")
+    opts = parser.parse_args()
+
+    tis = os.path.abspath(opts.tis)
+    only = opts.only.split(",") if opts.only else None
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="tis-bench-") as d:
+        for workload in WORKLOADS:
+            name = workload.__name__
+            if only is not None and name not in only:
+                continue
+            code, layout, cycles = workload(d)
+            cycles = max(1, int(cycles * opts.scale))
+            source = os.path.join(d, name + ".tisasm")
+            config = os.path.join(d, name + ".tiscfg")
+            with open(source, "w") as f:
+                f.write(code)
+            with open(config, "w") as f:
+                f.write(layout + "\n")
+            args = [tis, source, config]
+
+            print("bench: %s, %d cycles" % (name, cycles), file=sys.stderr)
+            seconds = statistics.median(run(args, cycles) for _ in range(opts.repeat))
+            startup = statistics.median(run(args, 1) for _ in range(opts.repeat))
+            count = instructions(args, cycles, d)
+            results[name] = {
+                # -c n runs n + 1 cycles
+                "cycles": cycles + 1,
+                "seconds": seconds,
+                "cycles_per_sec": (cycles + 1) / seconds,
+                "instructions": count,
+                "instructions_per_sec": count / seconds,
+                "peak_rss_kib": peak_rss(args, cycles, d),
+                "startup_sec": startup,
+            }
+
+    report = {
+        "tis": tis,
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "repeat": opts.repeat,
+        "scale": opts.scale,
+        "workloads": results,
+    }
+    text = json.dumps(report, indent=2) + "\n"
+    if opts.out:
+        with open(opts.out, "w") as f:
+            f.write(text)
+        print("bench: wrote %s" % opts.out, file=sys.stderr)
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Compare two results of bench/bench.py, and flag regressions.
+
+A metric regresses if it is worse in the new results by more than the threshold (5% by default): lower simulated
+cycles or instructions per second, or higher peak RSS or start-up time. Changes to those last two that are too small
+to measure reliably are not counted. The exit status is 1 if anything regressed, so that this can gate a build.
+
+Usage:
+    bench/compare.py [--threshold 5] <old.json> <new.json>
+"""
+
+import argparse
+import json
+import sys
+
+# name, True if higher is better, and the smallest change that counts, since start-up takes about a millisecond
+METRICS = [
+    ("cycles_per_sec", True, 0),
+    ("instructions_per_sec", True, 0),
+    ("peak_rss_kib", False, 64),
+    ("startup_sec", False, 0.0005),
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two tis benchmark results")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=5.0, help="percent change that counts as a regression")
+    opts = parser.parse_args()
+
+    with open(opts.old) as f:
+        old = json.load(f)["workloads"]
+    with open(opts.new) as f:
+        new = json.load(f)["workloads"]
+
+    regressed = []
+    print("%-16s %-22s %14s %14s %9s" % ("workload", "metric", "old", "new", "change"))
+    for name in old:
+        if name not in new:
+            print("%-16s missing from %s" % (name, opts.new))
+            continue
+        if old[name].get("cycles") != new[name].get("cycles"):
+            print("%-16s ran %s cycles before and %s now, not comparable" % (name, old[name].get("cycles"), new[name].get("cycles")))
+            continue
+        for metric, higher_is_better, noise in METRICS:
+            a, b = old[name].get(metric), new[name].get(metric)
+            if a is None or b is None:
+                continue
+            change = 0.0 if a == 0 else 100.0 * (b - a) / a
+            worse = -change if higher_is_better else change
+            flag = ""
+            if abs(b - a) <= noise:
+                pass
+            elif worse > opts.threshold:
+                flag = "  REGRESSION"
+                regressed.append((name, metric))
+            elif -worse > opts.threshold:
+                flag = "  improved"
+            print("%-16s %-22s %14.6g %14.6g %+8.1f%%%s" % (name, metric, a, b, change, flag))
+
+    if regressed:
+        print("%d regression%s over %.1f%%" % (len(regressed), "" if len(regressed) == 1 else "s", opts.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
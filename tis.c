@@ -1,5 +1,9 @@
-#define _POSIX_C_SOURCE 200809L // for strdup() and fmemopen()
+#define _POSIX_C_SOURCE 200809L // for getopt()
 #include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,78 +13,323 @@
 #include "tis_types.h"
 #include "tis_node.h"
 #include "tis_io.h"
+#include "tis_image.h"
+#include "tis_lex.h"
+#include "tis_part.h"
+#include "tis_perf.h"
+#include "tis_comp.h"
+#include "tis_crit.h"
+#include "tis_diff.h"
+#include "tis_est.h"
+#include "tis_link.h"
+#include "tis_metrics.h"
+#include "tis_prof.h"
+#include "tis_score.h"
+#include "tis_trace.h"
+#include "tis_travel.h"
+#include "tis_tui.h"
 
 #define INIT_OK 0
 #define INIT_FAIL 1
 
 #define BUFSIZE 128
 
-#define STR(x) _STR(x)
-#define _STR(x) #x
-
 tis_t tis = {0};
 tis_opt_t opts = {0};
 
 /*
- * This is a linked list of file handles to close when destroying things.
- * This is to be used only for file handles that are non-trivial to close the normal way.
- * This can cause double-frees if not used with care.
+ * Parse one argument of a SHM io definition: the ring name, then optionally the capacity
+ */
+int parse_shm_arg(tis_t* tis, tis_io_shm_t* shm, char* buf) {
+    unsigned int capacity;
+    char extra;
+    if(shm->name == NULL) {
+        char name[BUFSIZE + 2] = "/"; // shm_open() wants a leading slash
+        strcat(name, buf[0] == '/' ? &buf[1] : buf);
+        shm->name = arena_strdup(&(tis->arena), name);
+        return INIT_OK;
+    } else if(shm->capacity == 0 && sscanf(buf, "%u%c", &capacity, &extra) == 1 && capacity > 0) {
+        shm->capacity = capacity;
+        return INIT_OK;
+    }
+    return INIT_FAIL;
+}
+
+/*
+ * Repeat groups in the node map, see map_next()
  */
-typedef struct file_list {
-    FILE* file;
-    struct file_list* next;
-} file_list_t;
-static file_list_t* files_to_close = NULL;
-void register_file_handle(FILE* file) {
-    file_list_t* temp = calloc(1, sizeof(file_list_t));
-    temp->file = file;
-    temp->next = files_to_close;
-    files_to_close = temp;
+#define MAP_MAX_DEPTH 16
+#define MAP_ERROR (-2) // distinct from EOF and any character
+typedef struct map_state {
+    int depth;
+    size_t emitted; // node specifiers returned so far
+    struct {
+        const char* start; // first character inside the parentheses
+        size_t left; // passes remaining including this one, or 0 to repeat until the map is full
+        size_t mark; // value of emitted when this pass began
+    } groups[MAP_MAX_DEPTH];
+} map_state_t;
+
+/*
+ * Skip to the end of the innermost open group without expanding it
+ */
+static int map_close_group(tis_scan_t* layout, map_state_t* map) {
+    int nesting = 0;
+    for(;;) {
+        int ch = scan_getc(layout);
+        if(ch == EOF) {
+            error("Unexpected EOF while reading node specifiers\n");
+            return INIT_FAIL;
+        } else if(ch == '(') {
+            nesting++;
+        } else if(ch == ')' && nesting-- == 0) {
+            map->depth--;
+            return INIT_OK;
+        }
+    }
+}
+
+/*
+ * Return the next node specifier from the map, skipping whitespace.
+ * A group "<n>(...)" repeats its contents n times, and "*(...)" repeats them until every node is specified;
+ * groups may be nested. The contents are re-read for each pass rather than copied, so a map of any size is
+ * expanded in constant memory.
+ */
+static int map_next(tis_scan_t* layout, map_state_t* map) {
+    for(;;) {
+        int ch;
+        while(isspace(ch = scan_getc(layout))) {
+            // discard whitespace
+        }
+        if(isdigit(ch) || ch == '*') {
+            size_t count = 0;
+            if(ch != '*') {
+                layout->p--;
+                scan_size(layout, &count);
+            }
+            scan_space(layout);
+            if(scan_getc(layout) != '(') {
+                error("Expected '(' after repeat count in node specifiers\n");
+                return MAP_ERROR;
+            }
+            if(map->depth == MAP_MAX_DEPTH) {
+                error("Repeat groups in node specifiers are nested more than %d deep\n", MAP_MAX_DEPTH);
+                return MAP_ERROR;
+            }
+            if(ch != '*' && count == 0) {
+                map->groups[map->depth].left = 1;
+                map->depth++;
+                if(map_close_group(layout, map) != INIT_OK) { // zero passes, so skip straight past the contents
+                    return MAP_ERROR;
+                }
+                continue;
+            }
+            map->groups[map->depth].start = layout->p;
+            map->groups[map->depth].left = count;
+            map->groups[map->depth].mark = map->emitted;
+            map->depth++;
+        } else if(ch == ')') {
+            if(map->depth == 0) {
+                error("Unmatched ')' in node specifiers\n");
+                return MAP_ERROR;
+            }
+            int top = map->depth - 1;
+            if(map->emitted == map->groups[top].mark || map->groups[top].left == 1) {
+                map->depth--; // done, or an empty group that would repeat forever
+            } else {
+                if(map->groups[top].left > 1) {
+                    map->groups[top].left--;
+                }
+                map->groups[top].mark = map->emitted;
+                layout->p = map->groups[top].start;
+            }
+        } else {
+            if(ch != EOF) {
+                map->emitted++;
+            }
+            return ch;
+        }
+    }
 }
-void close_file_handles() {
-    while(files_to_close != NULL) {
-        fclose(files_to_close->file);
-        file_list_t* temp = files_to_close->next;
-        free(files_to_close);
-        files_to_close = temp;
+
+/*
+ * Called once every node is specified: finish any groups that are still open.
+ * Leftover repetitions are dropped, which is expected inside "*(...)" but worth a warning otherwise.
+ */
+static int map_close(tis_scan_t* layout, map_state_t* map) {
+    int fill = 0, extra = 0;
+    for(int i = 0; i < map->depth; i++) {
+        fill = fill || map->groups[i].left == 0;
+        extra = extra || map->groups[i].left > 1;
+    }
+    while(map->depth > 0) {
+        const char* from = layout->p;
+        if(map_close_group(layout, map) != INIT_OK) {
+            return INIT_FAIL;
+        }
+        for(const char* p = from; p < layout->p - 1; p++) {
+            extra = extra || isalpha((unsigned char)*p);
+        }
+    }
+    if(extra && !fill) {
+        warn("Repeat groups in node specifiers give more nodes than the layout holds, the extras are ignored\n");
     }
+    scan_space(layout);
+    return INIT_OK;
+}
+
+/*
+ * Copy an io token, replacing each "%d" with the index; the result is truncated to BUFSIZE characters
+ */
+static void expand_index(char* dst, const char* src, size_t index) {
+    char digits[24];
+    size_t len = 0;
+    int ndigits = snprintf(digits, sizeof(digits), "%zu", index);
+    while(*src != '\0' && len < BUFSIZE) {
+        if(src[0] == '%' && src[1] == 'd') {
+            for(int i = 0; i < ndigits && len < BUFSIZE; i++) {
+                dst[len++] = digits[i];
+            }
+            src += 2;
+        } else {
+            dst[len++] = *(src++);
+        }
+    }
+    dst[len] = '\0';
+}
+
+/*
+ * Apply one argument token of an io definition to this io node: its type first, then the type's arguments.
+ * The token is shared if every node of a range is given it as is; it may then not name an output file or a ring,
+ * which would be written by several nodes at once (or read by several, for a ring).
+ */
+static int parse_io_token(tis_t* tis, tis_io_node_t* io, char* buf, int is_output, int shared) {
+    char dir = is_output ? 'O' : 'I';
+    if(is_output && io->type != TIS_IO_TYPE_INVALID) {
+        if(io->expect.keyword != NULL && strcmp(io->expect.keyword, "EXPECT") == 0) {
+            open_expect(io, arena_strdup(&(tis->arena), buf));
+            io->expect.keyword = NULL;
+            return INIT_OK;
+        } else if(io->expect.keyword != NULL) {
+            char* end;
+            io->expect.count = strtoul(buf, &end, 10);
+            if(end == buf || *end != '\0' || buf[0] == '-' || io->expect.count == 0) {
+                error("Invalid COUNT '%s' for %c%zu\n", buf, dir, io->col);
+                return INIT_FAIL;
+            }
+            debug("Set %c%zu to stop after %zu values\n", dir, io->col, io->expect.count);
+            io->expect.keyword = NULL;
+            return INIT_OK;
+        } else if(io->expect.path == NULL && strcasecmp(buf, "EXPECT") == 0) {
+            io->expect.keyword = "EXPECT"; // the file is the next token
+            return INIT_OK;
+        } else if(strcasecmp(buf, "COUNT") == 0) {
+            io->expect.keyword = "COUNT"; // the number is the next token
+            return INIT_OK;
+        }
+    }
+    if(io->type == TIS_IO_TYPE_INVALID) {
+        if(strcasecmp(buf, "ASCII") == 0) {
+            debug("Set %c%zu to ASCII mode\n", dir, io->col);
+            io->type = TIS_IO_TYPE_IOSTREAM_ASCII;
+        } else if(strcasecmp(buf, "NUMERIC") == 0) {
+            debug("Set %c%zu to NUMERIC mode\n", dir, io->col);
+            io->type = TIS_IO_TYPE_IOSTREAM_NUMERIC;
+            if(is_output) {
+                io->file.sep = -1;
+            }
+        } else if(strcasecmp(buf, "BINARY16") == 0) {
+            debug("Set %c%zu to BINARY16 mode\n", dir, io->col);
+            io->type = TIS_IO_TYPE_IOSTREAM_BINARY16;
+        } else if(strcasecmp(buf, "BINARY32") == 0) {
+            debug("Set %c%zu to BINARY32 mode\n", dir, io->col);
+            io->type = TIS_IO_TYPE_IOSTREAM_BINARY32;
+        } else if(strcasecmp(buf, "SHM") == 0) {
+            debug("Set %c%zu to SHM mode\n", dir, io->col);
+            io->type = TIS_IO_TYPE_IOSTREAM_SHM;
+        } else if(!is_output && strcasecmp(buf, "RANDOM") == 0) {
+            debug("Set %c%zu to RANDOM mode\n", dir, io->col);
+            io->type = TIS_IO_TYPE_IGENERATOR_RANDOM;
+            io->random.min = -999;
+            io->random.max = 999;
+            io->random.count = TIS_RANDOM_COUNT;
+        } else {
+            return INIT_FAIL;
+        }
+    } else if(is_file_io(io->type)) {
+        if(io->file.file == NULL && io->file.path == NULL) {
+            if(shared && is_output && strcasecmp(buf, "STDOUT") != 0 && strcasecmp(buf, "STDERR") != 0 && strcmp(buf, "-") != 0) {
+                error("Outputs in a range would all write to %s, use %%d in the name to give each its own file\n", buf);
+                return INIT_FAIL;
+            }
+            open_io_file(io, arena_strdup(&(tis->arena), buf), is_output);
+        } else if(is_output && io->type == TIS_IO_TYPE_IOSTREAM_NUMERIC &&
+                  sscanf(buf, "%d", &(io->file.sep)) == 1) {
+            debug("Set %c%zu separator to %d\n", dir, io->col, io->file.sep);
+        } else {
+            return INIT_FAIL;
+        }
+    } else if(io->type == TIS_IO_TYPE_IGENERATOR_RANDOM) {
+        char* end;
+        long arg = strtol(buf, &end, 10);
+        if(end == buf || *end != '\0' || io->random.args > 2 || arg < (io->random.args < 2 ? -999 : 0) || (io->random.args < 2 && arg > 999)) {
+            return INIT_FAIL;
+        }
+        switch(io->random.args++) { // the interval, then the number of values
+            case 0: io->random.min = (int)arg; break;
+            case 1: io->random.max = (int)arg; break;
+            default: io->random.count = (size_t)arg; break;
+        }
+    } else if(io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        if(shared && io->shm.name == NULL) {
+            error("%ss in a range would all use ring %s, use %%d in the name to give each its own ring\n", is_output ? "Output" : "Input", buf);
+            return INIT_FAIL;
+        }
+        if(parse_shm_arg(tis, &(io->shm), buf) != INIT_OK) {
+            return INIT_FAIL;
+        }
+        debug("Set %c%zu shared memory ring to %s (capacity %u)\n", dir, io->col, io->shm.name, io->shm.capacity);
+    } else {
+        // TODO io node type not implemented? internal error?
+        return INIT_FAIL;
+    }
+    return INIT_OK;
 }
 
 /*
  * Parse the layout file, allocate structural memory, initialize all things
  */
 int init_layout(tis_t* tis, char* layoutfile, int layoutmode) {
-    FILE* layout = NULL;
+    tis_text_t text;
+    tis_scan_t* layout = NULL;
+    tis_scan_t scan;
     if(layoutfile != NULL) {
         if(layoutmode == 0) { // default mode: layoutfile is a filename
-            if(strcasecmp(layoutfile, "-") == 0) {
-                layout = stdin;
-            } else {
-                layout = fopen(layoutfile, "r");
-                if(layout == NULL) {
-                    error("Unable to open layout file '%s' for reading\n", layoutfile);
-                    return INIT_FAIL;
-                }
-            }
-        } else { // alternate mode: layoutfile is a string representing the file contents
-            layout = fmemopen(layoutfile, strlen(layoutfile), "r");
-            if(layout == NULL) {
-                error("Unable to prepare layout string for reading\n");
+            if(text_open(&text, layoutfile) != 0) {
+                error("Unable to open layout file '%s' for reading\n", layoutfile);
                 return INIT_FAIL;
             }
+        } else { // alternate mode: layoutfile is a string representing the file contents
+            text_from_string(&text, layoutfile);
         }
+        scan.p = text.data;
+        scan.end = text.data + text.len;
+        layout = &scan;
     }
     if(layout != NULL) {
         // set size from file
-        if(fscanf(layout, " %zu %zu ", &(tis->rows), &(tis->cols)) != 2) {
-            if(feof(layout) || ferror(layout)) {
+        int result;
+        scan_space(layout);
+        if((result = scan_size(layout, &(tis->rows))) != 1 || (result = scan_size(layout, &(tis->cols))) != 1) {
+            if(result == EOF) {
                 error("Unexpected EOF when parsing dimensions\n");
             } else {
                 error("Unexpected token when parsing dimensions\n");
             }
-            fclose(layout);
+            text_close(&text);
             return INIT_FAIL;
         }
+        scan_space(layout);
         debug("Read dimensions %zur %zuc from layout '%s'\n", tis->rows, tis->cols, layoutfile);
     }
 
@@ -88,171 +337,127 @@ int init_layout(tis_t* tis, char* layoutfile, int layoutmode) {
 
     if(tis->cols == 0) {
         if(layout != NULL) {
-            fclose(layout);
+            text_close(&text);
         }
         error("Cannot initialize with zero columns\n"); // But zero rows are fine, it works as a translator: printf "hello" | ./tis -l /dev/null "0 1 I0 ASCII - O0 NUMERIC - 10"
         return INIT_FAIL;
     }
+    if(tis->rows > SIZE_MAX / sizeof(tis_node_t*) / tis->cols) {
+        if(layout != NULL) {
+            text_close(&text);
+        }
+        error("Grid of %zur %zuc is too large\n", tis->rows, tis->cols);
+        return INIT_FAIL;
+    }
 
-    tis->nodes = calloc(tis->size, sizeof(tis_node_t*));
-    tis->inputs = calloc(tis->cols, sizeof(tis_io_node_t*));
-    tis->outputs = calloc(tis->cols, sizeof(tis_io_node_t*));
+    tis->nodes = arena_calloc(&(tis->arena), tis->size, sizeof(tis_node_t*));
+    tis->inputs = arena_calloc(&(tis->arena), tis->cols, sizeof(tis_io_node_t*));
+    tis->outputs = arena_calloc(&(tis->arena), tis->cols, sizeof(tis_io_node_t*));
+    tis->nocode = arena_calloc(&(tis->arena), TIS_NODE_LINE_COUNT, sizeof(tis_op_t*));
 
     if(layout != NULL) {
-        // init node layout from file
-        int id = 0;
+        // init node layout from file, expanding repeat groups as they are read
+        char* names[] = {
+            [TIS_NODE_TYPE_COMPUTE] = arena_strdup(&(tis->arena), "COMPUTE"),
+            [TIS_NODE_TYPE_MEMORY_STACK] = arena_strdup(&(tis->arena), "STACK"),
+            [TIS_NODE_TYPE_MEMORY_RAM] = arena_strdup(&(tis->arena), "RAM"),
+        };
+        map_state_t map = {0};
+        long long id = 0;
         for(size_t i = 0; i < tis->size; i++) {
-            int ch;
-            while(isspace(ch = fgetc(layout))) {
-                // discard whitespace
-            }
-            tis->nodes[i] = calloc(1, sizeof(tis_node_t));
-            tis->nodes[i]->row = i / tis->cols;
-            tis->nodes[i]->col = i % tis->cols;
-            tis->nodes[i]->writereg = TIS_REGISTER_INVALID;
-            tis->nodes[i]->id = -1; // This is overwritten for compute nodes only
+            int ch = map_next(layout, &map);
+            tis_node_t* node = NULL;
             switch(ch) {
                 case 'C': // compute
                 case 'c':
-                    tis->nodes[i]->type = TIS_NODE_TYPE_COMPUTE;
-                    tis->nodes[i]->id = id++;
-                    tis->nodes[i]->last = TIS_REGISTER_NIL; // LAST behaves like NIL until an ANY occurs
-                    tis->nodes[i]->name = strdup("COMPUTE");
+                    node = new_node(tis, i, TIS_NODE_TYPE_COMPUTE, names[TIS_NODE_TYPE_COMPUTE]);
+                    node->id = id++;
                     break;
                 case 'M': // memory (assume stack memory)
                 case 'm':
                 case 'S': // stack memory
                 case 's':
-                    tis->nodes[i]->type = TIS_NODE_TYPE_MEMORY_STACK;
-                    tis->nodes[i]->index = 0;
-                    tis->nodes[i]->name = strdup("STACK");
+                    node = new_node(tis, i, TIS_NODE_TYPE_MEMORY_STACK, names[TIS_NODE_TYPE_MEMORY_STACK]);
                     break;
                 case 'R': // random access memory
                 case 'r':
-                    tis->nodes[i]->type = TIS_NODE_TYPE_MEMORY_RAM;
-                    tis->nodes[i]->index = 0;
-                    tis->nodes[i]->name = strdup("RAM");
+                    node = new_node(tis, i, TIS_NODE_TYPE_MEMORY_RAM, names[TIS_NODE_TYPE_MEMORY_RAM]);
                     error("Node type not yet implemented\n");
-                    fclose(layout);
+                    text_close(&text);
                     return INIT_FAIL;
                 case 'D': // damaged / disabled
                 case 'd':
-                    tis->nodes[i]->type = TIS_NODE_TYPE_DAMAGED;
-                    tis->nodes[i]->name = strdup("DAMAGED");
-                    break;
+                    break; // left NULL, a damaged node holds no state
+
+                case MAP_ERROR:
+                    // message was printed from map_next
+                    text_close(&text);
+                    return INIT_FAIL;
                 case EOF:
                     error("Unexpected EOF while reading node specifiers\n");
-                    fclose(layout);
+                    text_close(&text);
                     return INIT_FAIL;
                 default:
                     error("Unrecognized node specifier '%c'\n", ch);
-                    fclose(layout);
+                    text_close(&text);
                     return INIT_FAIL;
             }
         }
+        if(map_close(layout, &map) != INIT_OK) {
+            text_close(&text);
+            return INIT_FAIL;
+        }
 
         // init io node layout from file
-        size_t index;
-        char buf[BUFSIZE];
+        size_t first = 0, last = 0;
+        char buf[BUFSIZE + 1]; // room for the terminator after BUFSIZE characters
+        char tok[BUFSIZE + 1];
         int mode = -1; // -1 is invalid, 0 is input, 1 is output, 2 is ignore
-        while(!feof(layout) && !ferror(layout)) {
-            if(fscanf(layout, " I%zu ", &index) == 1) {
-                debug("Found an input for index %zu\n", index);
-                if(index >= tis->cols) {
-                    warn("Input I%zu is out-of-bounds for the current layout, ignoring definition\n", index);
-                    mode = 2;
-                    continue;
+        while(!scan_eof(layout)) {
+            char dir;
+            if(scan_prefixed_size(layout, dir = 'I', &first) == 1 || scan_prefixed_size(layout, dir = 'O', &first) == 1) {
+                tis_io_node_t** io = (dir == 'I') ? tis->inputs : tis->outputs;
+                const char* kind = (dir == 'I') ? "Input" : "Output";
+                last = first;
+                if(scan_range(layout, dir, &last) == 1) {
+                    debug("Found %ss for indices %zu..%zu\n", dir == 'I' ? "input" : "output", first, last);
+                    if(last < first) {
+                        warn("%ss %c%zu..%c%zu are an empty range, ignoring definition\n", kind, dir, first, dir, last);
+                        mode = 2;
+                        continue;
+                    }
+                } else {
+                    debug("Found an %s for index %zu\n", dir == 'I' ? "input" : "output", first);
                 }
-                mode = 0;
-                tis->inputs[index] = calloc(1, sizeof(tis_io_node_t));
-                tis->inputs[index]->col = index;
-                tis->inputs[index]->type = TIS_IO_TYPE_INVALID;
-                tis->inputs[index]->writereg = TIS_REGISTER_INVALID;
-            } else if(fscanf(layout, " O%zu ", &index) == 1) {
-                debug("Found an output for index %zu\n", index);
-                if(index >= tis->cols) {
-                    warn("Output O%zu is out-of-bounds for the current layout, ignoring definition\n", index);
+                if(first >= tis->cols) {
+                    warn("%s %c%zu is out-of-bounds for the current layout, ignoring definition\n", kind, dir, first);
                     mode = 2;
                     continue;
+                } else if(last >= tis->cols) {
+                    warn("%ss %c%zu..%c%zu extend out-of-bounds for the current layout, ignoring %c%zu and beyond\n", kind, dir, first, dir, last, dir, tis->cols);
+                    last = tis->cols - 1;
                 }
-                mode = 1;
-                tis->outputs[index] = calloc(1, sizeof(tis_io_node_t));
-                tis->outputs[index]->col = index;
-                tis->outputs[index]->type = TIS_IO_TYPE_INVALID;
-                tis->outputs[index]->writereg = TIS_REGISTER_INVALID;
-            } else if(fscanf(layout, " %"STR(BUFSIZE)"s ", buf) == 1) { // The format string is " %128s ", but changes with BUFSIZE
+                mode = (dir == 'I') ? 0 : 1;
+                for(size_t index = first; index <= last; index++) {
+                    io[index] = arena_alloc(&(tis->arena), sizeof(tis_io_node_t));
+                    io[index]->col = index;
+                    io[index]->type = TIS_IO_TYPE_INVALID;
+                    io[index]->writereg = TIS_REGISTER_INVALID;
+                }
+            } else if(scan_word(layout, buf, BUFSIZE) == 1) {
                 switch(mode) {
                     case 0:
-                        if(tis->inputs[index]->type == TIS_IO_TYPE_INVALID) {
-                            if(strcasecmp(buf, "ASCII") == 0) {
-                                debug("Set I%zu to ASCII mode\n", index);
-                                tis->inputs[index]->type = TIS_IO_TYPE_IOSTREAM_ASCII;
-                            } else if(strcasecmp(buf, "NUMERIC") == 0) {
-                                debug("Set I%zu to NUMERIC mode\n", index);
-                                tis->inputs[index]->type = TIS_IO_TYPE_IOSTREAM_NUMERIC;
-                            } else {
-                                goto skip_io_token;
-                            }
-                        } else if(tis->inputs[index]->type == TIS_IO_TYPE_IOSTREAM_ASCII ||
-                                  tis->inputs[index]->type == TIS_IO_TYPE_IOSTREAM_NUMERIC) {
-                            if(tis->inputs[index]->file.file == NULL) {
-                                if(strcasecmp(buf, "STDIN") == 0 ||
-                                    strcasecmp(buf, "-") == 0) {
-                                    debug("Set I%zu to use stdin\n", index);
-                                    tis->inputs[index]->file.file = stdin;
-                                } else {
-                                    debug("Set I%zu to use file %.*s\n", index, BUFSIZE, buf);
-                                    if((tis->inputs[index]->file.file = fopen(buf, "r")) == NULL) {
-                                        error("Unable to open %.*s for reading, will provide no data instead\n", BUFSIZE, buf);
-                                    }
-                                    register_file_handle(tis->inputs[index]->file.file);
-                                }
-                            } else {
-                                goto skip_io_token;
-                            }
-                        } else {
-                            // TODO io node type not implemented? internal error?
-                            goto skip_io_token;
-                        }
-                        break;
                     case 1:
-                        if(tis->outputs[index]->type == TIS_IO_TYPE_INVALID) {
-                            if(strcasecmp(buf, "ASCII") == 0) {
-                                debug("Set O%zu to ASCII mode\n", index);
-                                tis->outputs[index]->type = TIS_IO_TYPE_IOSTREAM_ASCII;
-                            } else if(strcasecmp(buf, "NUMERIC") == 0) {
-                                debug("Set O%zu to NUMERIC mode\n", index);
-                                tis->outputs[index]->type = TIS_IO_TYPE_IOSTREAM_NUMERIC;
-                                tis->outputs[index]->file.sep = -1;
+                        for(size_t index = first; index <= last; index++) {
+                            int shared = first != last && strstr(buf, "%d") == NULL;
+                            if(first != last) {
+                                expand_index(tok, buf, index); // a range gives each io node its own file, e.g. file%d.txt
                             } else {
-                                goto skip_io_token;
+                                strcpy(tok, buf);
                             }
-                        } else if(tis->outputs[index]->type == TIS_IO_TYPE_IOSTREAM_ASCII ||
-                                  tis->outputs[index]->type == TIS_IO_TYPE_IOSTREAM_NUMERIC) {
-                            if(tis->outputs[index]->file.file == NULL) {
-                                if(strcasecmp(buf, "STDOUT") == 0 ||
-                                    strcasecmp(buf, "-") == 0) {
-                                    debug("Set O%zu to use stdout\n", index);
-                                    tis->outputs[index]->file.file = stdout;
-                                } else if(strcasecmp(buf, "STDERR") == 0) {
-                                    debug("Set O%zu to use stderr\n", index);
-                                    tis->outputs[index]->file.file = stderr;
-                                } else {
-                                    debug("Set O%zu to use file %.*s\n", index, BUFSIZE, buf);
-                                    if((tis->outputs[index]->file.file = fopen(buf, "a")) == NULL) {
-                                        error("Unable to open %.*s for writing, will silently drop data instead\n", BUFSIZE, buf);
-                                    }
-                                    register_file_handle(tis->outputs[index]->file.file);
-                                }
-                            } else if(tis->outputs[index]->type == TIS_IO_TYPE_IOSTREAM_NUMERIC &&
-                                      sscanf(buf, "%d", &(tis->outputs[index]->file.sep)) == 1) {
-                                debug("Set O%zu separator to %d\n", index, tis->outputs[index]->file.sep);
-                            } else {
+                            if(parse_io_token(tis, (mode == 0 ? tis->inputs : tis->outputs)[index], tok, mode, shared) != INIT_OK) {
                                 goto skip_io_token;
                             }
-                        } else {
-                            // TODO io node type not implemented? internal error?
-                            goto skip_io_token;
                         }
                         break;
                     case 2:
@@ -267,30 +472,35 @@ skip_io_token:
             }
         }
 
-        if(layout != stdin) {
-            fclose(layout);
+        text_close(&text);
+        for(size_t i = 0; i < tis->cols; i++) {
+            if(tis->inputs[i] != NULL && tis->inputs[i]->type == TIS_IO_TYPE_IGENERATOR_RANDOM) {
+                if(tis->inputs[i]->random.min > tis->inputs[i]->random.max) {
+                    error("Input I%zu is given the empty interval %d..%d\n", i, tis->inputs[i]->random.min, tis->inputs[i]->random.max);
+                    return INIT_FAIL;
+                }
+                seed_random_input(tis->inputs[i], opts.seed);
+            }
+            if(tis->outputs[i] != NULL && tis->outputs[i]->expect.keyword != NULL) {
+                error("Output O%zu is given %s without its argument\n", i, tis->outputs[i]->expect.keyword);
+                return INIT_FAIL;
+            }
         }
     } else {
         // init default node & io node layout for dimensions
         // set all nodes to TIS_NODE_TYPE_COMPUTE
+        char* name = arena_strdup(&(tis->arena), "COMPUTE");
         for(size_t i = 0; i < tis->size; i++) {
-            tis->nodes[i] = calloc(1, sizeof(tis_node_t));
-            tis->nodes[i]->type = TIS_NODE_TYPE_COMPUTE;
-            tis->nodes[i]->id = i;
-            tis->nodes[i]->row = i / tis->cols;
-            tis->nodes[i]->col = i % tis->cols;
-            tis->nodes[i]->writereg = TIS_REGISTER_INVALID;
-            tis->nodes[i]->last = TIS_REGISTER_NIL; // LAST behaves like NIL until an ANY occurs
-            tis->nodes[i]->name = strdup("COMPUTE");
+            new_node(tis, i, TIS_NODE_TYPE_COMPUTE, name)->id = (long long)i;
         }
         // set first input to TIS_IO_TYPE_IOSTREAM_NUMERIC
-        tis->inputs[0] = calloc(1, sizeof(tis_io_node_t));
+        tis->inputs[0] = arena_alloc(&(tis->arena), sizeof(tis_io_node_t));
         tis->inputs[0]->col = 0;
         tis->inputs[0]->type = opts.default_i_type;
         tis->inputs[0]->file.file = stdin;
         tis->inputs[0]->writereg = TIS_REGISTER_INVALID;
         // set last output to TIS_IO_TYPE_IOSTREAM_NUMERIC
-        tis->outputs[tis->cols - 1] = calloc(1, sizeof(tis_io_node_t));
+        tis->outputs[tis->cols - 1] = arena_alloc(&(tis->arena), sizeof(tis_io_node_t));
         tis->outputs[tis->cols - 1]->col = tis->cols - 1;
         tis->outputs[tis->cols - 1]->type = opts.default_o_type;
         tis->outputs[tis->cols - 1]->file.file = stdout;
@@ -301,37 +511,130 @@ skip_io_token:
     return INIT_OK;
 }
 
+/*
+ * Matches the behavior of sscanf(str, "%d %c", ...): returns the number of fields, or 0 if there is no number.
+ * The number may be followed by "..<n>" to name a range of nodes that share the code, otherwise last is set to id.
+ * Returns -1 if a bound is negative or too large, or the range is empty.
+ */
+static int scan_node_header(const char* str, long long* id, long long* last) {
+    char* end;
+    errno = 0;
+    long long val = strtoll(str, &end, 10);
+    if(end == str) {
+        return 0;
+    }
+    if(val < 0 || errno == ERANGE) {
+        return -1;
+    }
+    *id = val;
+    *last = val;
+    if(end[0] == '.' && end[1] == '.') {
+        if(!isdigit((unsigned char)end[2])) {
+            return -1;
+        }
+        *last = strtoll(&end[2], &end, 10);
+        if(errno == ERANGE || *last < *id) {
+            return -1;
+        }
+    }
+    while(isspace((unsigned char)*end)) {
+        end++;
+    }
+    return *end != '\0' ? 2 : 1;
+}
+
+/*
+ * Parse an operand that is a register or (for sources) a constant.
+ * Returns 0 if the token is neither.
+ */
+static int parse_operand(char* temp, tis_op_arg_t* arg, int allow_constant, int line, long long id) {
+    char* temp2 = NULL;
+    int val;
+    tis_register_t reg;
+    if(allow_constant && (val = strtol(temp, &temp2, 0), temp != temp2 && *temp2 == '\0')) { // constants are only valid as sources
+        arg->type = TIS_OP_ARG_TYPE_CONSTANT;
+        arg->con = clamp(val);
+        if(arg->con != val) {
+            // produce a warning if the value is clamped
+            warn("Numeric operand %d is clamped to %d on line %d of @%lld\n", val, clamp(val), line+1, id);
+        }
+    } else if((reg = lex_register(temp)) != TIS_REGISTER_INVALID) {
+        arg->type = TIS_OP_ARG_TYPE_REGISTER;
+        arg->reg = reg;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Point every jump in this node at the first line carrying its label, so that no lookup is needed at runtime
+ */
+static void resolve_labels(tis_node_t* node) {
+    for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+        tis_op_t* op = node->code[line];
+        if(op == NULL || op->src.type != TIS_OP_ARG_TYPE_LABEL) {
+            continue;
+        }
+        op->src.target = -1;
+        for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
+            if(node->code[idx] != NULL && node->code[idx]->label != NULL && strcmp(op->src.label, node->code[idx]->label) == 0) {
+                op->src.target = idx;
+                break;
+            }
+        }
+    }
+}
+
 /*
  * Parse and load the code from the source file into the compute nodes.
  * Other nodes types need not be touched here.
+ * The whole file is loaded at once, then split into lines exactly as fgets() into a BUFSIZE buffer would.
  */
 int init_nodes(tis_t* tis, char* sourcefile) {
-    FILE* source = NULL;
-    if(strcasecmp(sourcefile, "-") == 0) {
-        source = stdin;
-    } else {
-        source = fopen(sourcefile, "r");
-        if(source == NULL) {
-            error("Unable to open source file '%s' for reading\n", sourcefile);
-            return INIT_FAIL;
+    tis_text_t source;
+    if(text_open(&source, sourcefile) != 0) {
+        error("Unable to open source file '%s' for reading\n", sourcefile);
+        return INIT_FAIL;
+    }
+
+    // compute node ids are assigned in order, so they index directly
+    size_t count = 0;
+    for(size_t i = 0; i < tis->size; i++) {
+        if(tis->nodes[i] != NULL && tis->nodes[i]->type == TIS_NODE_TYPE_COMPUTE) {
+            count++;
+        }
+    }
+    tis_node_t** byid = calloc(count + 1, sizeof(tis_node_t*));
+    for(size_t i = 0; i < tis->size; i++) {
+        if(tis->nodes[i] != NULL && tis->nodes[i]->type == TIS_NODE_TYPE_COMPUTE && tis->nodes[i]->id >= 0 && (size_t)tis->nodes[i]->id < count) {
+            byid[tis->nodes[i]->id] = tis->nodes[i];
         }
     }
 
-    char buf[BUFSIZE], extra;
-    int id = -1, preid = -1, nfields;
+    char buf[BUFSIZE];
+    long long id = -1, lastid = -1, preid = -1;
+    long long first = 0, last = -1; // range of node ids receiving the current lines
+    int nfields;
     int line = TIS_NODE_LINE_COUNT; // start with an out-of-bounds value
     tis_node_t* node = NULL;
-    while(fgets(buf, BUFSIZE, source) != NULL) {
-        char* nl = strchr(buf, '\n');
-        if(nl == NULL) {
-            if(!feof(source)) {
-                error("Line too long, unexpected things may occur:\n");
-                error("    %.*s\n", BUFSIZE, buf);
-            } else {
-                // this is fine and normal
-            }
+    size_t pos = 0;
+    while(pos < source.len) {
+        const char* start = &source.data[pos];
+        size_t len = source.len - pos < BUFSIZE - 1 ? source.len - pos : BUFSIZE - 1;
+        const char* nl = memchr(start, '\n', len);
+        if(nl != NULL) {
+            len = nl - start;
+            pos += len + 1;
         } else {
-            *nl = '\0';
+            pos += len;
+        }
+        memcpy(buf, start, len);
+        buf[len] = '\0';
+        if(nl == NULL && len == BUFSIZE - 1) {
+            // a full buffer without a newline, so fgets() would not have reached the end of the file either
+            error("Line too long, unexpected things may occur:\n");
+            error("    %.*s\n", BUFSIZE, buf);
         }
 
         spam("Parse line:  %.*s\n", BUFSIZE, buf);
@@ -339,58 +642,80 @@ int init_nodes(tis_t* tis, char* sourcefile) {
         if(buf[0] == '\0' && line >= TIS_NODE_LINE_COUNT) {
             // empty line; ignore
             // (when game writes saves, it adds an extra blank line at the end of each node, but doesn't require them for parsing)
-        } else if((nfields = sscanf(buf, "@%d %c", &id, &extra)) >= 1) {
+        } else if(buf[0] == '@' && (nfields = scan_node_header(&buf[1], &id, &lastid)) != 0) {
+            if(nfields < 0) {
+                error("Invalid node range '%.*s', ids must be in order and between 0 and %lld\n", BUFSIZE, buf, LLONG_MAX);
+                free(byid);
+                text_close(&source);
+                return INIT_FAIL;
+            }
             if(nfields > 1) {
                 // TODO strict mode: the game just ignores this whole line
-                error("Extra data appears on specifier line for @%d. Continuing anyway.\n", id);
+                error("Extra data appears on specifier line for @%lld. Continuing anyway.\n", id);
             }
             if(id < preid) {
                 // the game handles reorderings silently
-                warn("Nodes appear out of order, @%d is after @%d. Continuing anyway.\n", id, preid);
+                warn("Nodes appear out of order, @%lld is after @%lld. Continuing anyway.\n", id, preid);
             }
-            preid = id;
-            node = NULL;
+            preid = lastid;
             line = -1; // will be zero next line
-            for(size_t i = 0; i < tis->size; i++) {
-                if(tis->nodes[i]->type == TIS_NODE_TYPE_COMPUTE && tis->nodes[i]->id == id) {
-                    node = tis->nodes[i];
-                    break;
-                }
-            }
+            // a range @A..B assigns the same lines to every node in it
+            first = id;
+            last = (size_t)id < count ? lastid : -1;
+            node = first <= last ? byid[first] : NULL;
             if(node == NULL) {
                 // the game just adds the code to the last node, we ignore it instead
-                warn("@%d is out-of-bounds for the current layout. Contents will be ignored.\n", id);
-            } else if(node->code[0] != NULL) {
-                // replace the previous node contents with the new
-                warn("@%d has already been seen. Previous contents will be discarded and replaced.\n", id);
-                for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
-                    safe_free_op(node->code[idx]);
+                if(lastid != id) {
+                    warn("@%lld..%lld is out-of-bounds for the current layout. Contents will be ignored.\n", id, lastid);
+                } else {
+                    warn("@%lld is out-of-bounds for the current layout. Contents will be ignored.\n", id);
+                }
+            } else if((size_t)lastid >= count) {
+                error("@%lld..%lld is partly out-of-bounds for the current layout, which ends at @%zu\n", id, lastid, count - 1);
+                free(byid);
+                text_close(&source);
+                return INIT_FAIL;
+            }
+            tis_op_t** code = arena_calloc(&(tis->arena), TIS_NODE_LINE_COUNT, sizeof(tis_op_t*));
+            for(long long k = first; k <= last; k++) {
+                if(byid[k]->code[0] != NULL) {
+                    // replace the previous node contents with the new
+                    warn("@%lld has already been seen. Previous contents will be discarded and replaced.\n", k);
                 }
+                byid[k]->code = code; // the old lines stay in the arena until destroy()
             }
         } else if(node == NULL && line < TIS_NODE_LINE_COUNT) {
             // Nothing to do, just skipping past these lines
         } else if(node != NULL && line < TIS_NODE_LINE_COUNT) {
-            if(strlen(buf) > TIS_NODE_LINE_LENGTH) {
+            if(len > TIS_NODE_LINE_LENGTH) {
                 // TODO strict mode: truncate the line unconditionally
                 warn("Overlength line, continuing anyway:\n");
                 warn("    %.*s\n", BUFSIZE, buf);
             }
-            node->code[line] = calloc(1, sizeof(tis_op_t));
-            node->code[line]->linenum = line+1; // these are 1-indexed
-            node->code[line]->linetext = strdup(buf);
+            tis_op_t* op = arena_alloc(&(tis->arena), sizeof(tis_op_t));
+            node->code[line] = op; // shared by the whole range
+            op->linenum = line+1; // these are 1-indexed
+            op->linetext = arena_strdup(&(tis->arena), buf);
 
-            // TODO parse breakpoints (!) (possible future enhancement)
+            char* mark = lex_breakpoint(buf); // kept in linetext, for init_debug()
+            if(mark != NULL) {
+                memmove(mark, mark + 1, strlen(mark));
+            }
 
             char* temp = NULL;
-            char* temp2 = NULL;
-            int val = 0;
-            int nargs = 0;
             if(tis->name == NULL) {
                 // the game ignores any title beyond the first
                 if((temp = strstr(buf, "##")) != NULL) { // Save title, if present
                     temp += 2; // skip past ##
-                    temp = strtok(temp, " "); // strip whitespace
-                    tis->name = strdup(temp);
+                    char title[BUFSIZE];
+                    char* cursor = strcpy(title, temp);
+                    while(*cursor == ' ') { // strip whitespace
+                        cursor++;
+                    }
+                    if(*cursor != '\0') {
+                        cursor[strcspn(cursor, " ")] = '\0';
+                        tis->name = arena_strdup(&(tis->arena), cursor);
+                    }
                 }
             }
             if((temp = strchr(buf, '#')) != NULL) { // Remove comment, if present
@@ -399,155 +724,54 @@ int init_nodes(tis_t* tis, char* sourcefile) {
             if((temp = strchr(buf, ':')) != NULL) { // Save and remove label, if present
                 *temp = '\0';
                 temp++; // temp now points just after label
-                node->code[line]->label = strdup(buf); // TODO strip whitespace? (but rstrip would be invalid for real TIS), verify label is A-Z0-9~`$%^&*()_-+={}[]|\;"'<>,.?/,
-            } else {                                   // labels may be 17 chars (whole line + ':') but longest useful is 14 (for jmp <label>)
+                op->label = arena_strdup(&(tis->arena), buf); // TODO strip whitespace? (but rstrip would be invalid for real TIS), verify label is A-Z0-9~`$%^&*()_-+={}[]|\;"'<>,.?/,
+            } else {                                          // labels may be 17 chars (whole line + ':') but longest useful is 14 (for jmp <label>)
                 temp = buf;
             }
 
-            temp = strtok(temp, " ,");
+            char* cursor = temp;
+            int nargs = 0;
+            temp = lex_token(&cursor);
             if(temp == NULL) {
-                node->code[line]->type = TIS_OP_TYPE_INVALID; // line contains no code
-                nargs = 0;
-            } else if(strcasecmp(temp, "ADD") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_ADD;
-                nargs = 1;
-            } else if(strcasecmp(temp, "HCF") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_HCF;
-                nargs = 0;
-            } else if(strcasecmp(temp, "JEZ") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_JEZ;
-                nargs = 1;
-                val = 1; // set value to non-zero as a flag that this is a jump op that uses a label arg (JRO doesn't qualify)
-            } else if(strcasecmp(temp, "JGZ") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_JGZ;
-                nargs = 1;
-                val = 1;
-            } else if(strcasecmp(temp, "JLZ") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_JLZ;
-                nargs = 1;
-                val = 1;
-            } else if(strcasecmp(temp, "JMP") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_JMP;
-                nargs = 1;
-                val = 1;
-            } else if(strcasecmp(temp, "JNZ") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_JNZ;
-                nargs = 1;
-                val = 1;
-            } else if(strcasecmp(temp, "JRO") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_JRO;
-                nargs = 1;
-            } else if(strcasecmp(temp, "MOV") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_MOV;
-                nargs = 2;
-            } else if(strcasecmp(temp, "NEG") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_NEG;
-                nargs = 0;
-            } else if(strcasecmp(temp, "NOP") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_NOP;
-                nargs = 0;
-            } else if(strcasecmp(temp, "SAV") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_SAV;
-                nargs = 0;
-            } else if(strcasecmp(temp, "SUB") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_SUB;
-                nargs = 1;
-            } else if(strcasecmp(temp, "SWP") == 0) {
-                node->code[line]->type = TIS_OP_TYPE_SWP;
-                nargs = 0;
+                op->type = TIS_OP_TYPE_INVALID; // line contains no code
+            } else if((op->type = lex_opcode(temp)) != TIS_OP_TYPE_INVALID) {
+                nargs = op_arg_count(op->type);
             } else {
-                error("Unrecognized opcode \"%s\" on line %d of @%d\n", temp, line+1, id);
-                node->code[line]->type = TIS_OP_TYPE_INVALID;
-                nargs = 0;
+                error("Unrecognized opcode \"%s\" on line %d of @%lld\n", temp, line+1, id);
             }
             if(nargs > 0) {
-                temp = strtok(NULL, " ,");
+                temp = lex_token(&cursor);
                 if(temp == NULL) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_NONE;
-                } else if(val == 1) { // labels are only valid as sources (...syntactically. semantically, they are a dst; syntactically, they are actually a src)
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_LABEL; // note: the label type overrides everything else; "MOV" and "16" are both valid as labels
-                    node->code[line]->src.label = strdup(temp); // whitespace is already stripped by strtok
-                } else if((val = strtol(temp, &temp2, 0), temp != temp2 && *temp2 == '\0')) { // constants are only valid as sources
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_CONSTANT;
-                    node->code[line]->src.con = clamp(val);
-                    if(node->code[line]->src.con != val) {
-                        // produce a warning if the value is clamped
-                        warn("Numeric operand %d is clamped to %d on line %d of @%d\n", val, clamp(val), line+1, id);
-                    }
-                } else if(strcasecmp(temp, "ACC") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_ACC;
-                } else if(strcasecmp(temp, "NIL") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_NIL;
-                } else if(strcasecmp(temp, "UP") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_UP;
-                } else if(strcasecmp(temp, "DOWN") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_DOWN;
-                } else if(strcasecmp(temp, "LEFT") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_LEFT;
-                } else if(strcasecmp(temp, "RIGHT") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_RIGHT;
-                } else if(strcasecmp(temp, "ANY") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_ANY;
-                } else if(strcasecmp(temp, "LAST") == 0) {
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->src.reg = TIS_REGISTER_LAST;
-                } else {
-                    error("Invalid first operand \"%s\" on line %d of @%d\n", temp, line+1, id);
-                    node->code[line]->src.type = TIS_OP_ARG_TYPE_NONE; // This error also catches BAK usage
+                    op->src.type = TIS_OP_ARG_TYPE_NONE;
+                } else if(op_takes_label(op->type)) { // labels are only valid as sources (...syntactically. semantically, they are a dst; syntactically, they are actually a src)
+                    op->src.type = TIS_OP_ARG_TYPE_LABEL; // note: the label type overrides everything else; "MOV" and "16" are both valid as labels
+                    op->src.label = arena_strdup(&(tis->arena), temp); // whitespace is already stripped by lex_token
+                } else if(!parse_operand(temp, &(op->src), 1, line, id)) {
+                    error("Invalid first operand \"%s\" on line %d of @%lld\n", temp, line+1, id);
+                    op->src.type = TIS_OP_ARG_TYPE_NONE; // This error also catches BAK usage
                 }
             }
             if(nargs > 1) {
-                temp = strtok(NULL, " ,");
+                temp = lex_token(&cursor);
                 if(temp == NULL) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_NONE;
-                } else if(strcasecmp(temp, "ACC") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_ACC;
-                } else if(strcasecmp(temp, "NIL") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_NIL;
-                } else if(strcasecmp(temp, "UP") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_UP;
-                } else if(strcasecmp(temp, "DOWN") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_DOWN;
-                } else if(strcasecmp(temp, "LEFT") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_LEFT;
-                } else if(strcasecmp(temp, "RIGHT") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_RIGHT;
-                } else if(strcasecmp(temp, "ANY") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_ANY;
-                } else if(strcasecmp(temp, "LAST") == 0) {
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_REGISTER;
-                    node->code[line]->dst.reg = TIS_REGISTER_LAST;
-                } else {
-                    error("Invalid second operand \"%s\" on line %d of @%d\n", temp, line+1, id);
-                    node->code[line]->dst.type = TIS_OP_ARG_TYPE_NONE; // This error also catches BAK usage
+                    op->dst.type = TIS_OP_ARG_TYPE_NONE;
+                } else if(!parse_operand(temp, &(op->dst), 0, line, id)) {
+                    error("Invalid second operand \"%s\" on line %d of @%lld\n", temp, line+1, id);
+                    op->dst.type = TIS_OP_ARG_TYPE_NONE; // This error also catches BAK usage
                 }
             }
 
             // ensure nothing else (except whitespace) is on this line
-            while((temp = strtok(NULL, " ,")) != NULL) {
+            while((temp = lex_token(&cursor)) != NULL) {
                 // TODO strict mode: return INIT_FAIL
-                error("Extra operand \"%s\" on line %d of @%d\n", temp, line+1, id);
+                error("Extra operand \"%s\" on line %d of @%lld\n", temp, line+1, id);
             }
         } else {
             // the game just ignores most extra lines, we ignore all
             if(id < 0) {
                 warn("Ignoring out-of-node data at top of file:\n");
             } else {
-                warn("Ignoring out-of-node data after @%d:\n", id);
+                warn("Ignoring out-of-node data after @%lld:\n", id);
             }
             warn("    %.*s\n", BUFSIZE, buf);
         }
@@ -555,9 +779,14 @@ int init_nodes(tis_t* tis, char* sourcefile) {
         line++;
     }
 
-    if(source != stdin) {
-        fclose(source);
+    for(size_t i = 0; i < count; i++) {
+        if(byid[i] != NULL && (i == 0 || byid[i-1] == NULL || byid[i]->code != byid[i-1]->code)) {
+            resolve_labels(byid[i]); // nodes sharing a section share their lines, so those are resolved once
+        }
     }
+
+    free(byid);
+    text_close(&source);
     return INIT_OK;
 }
 
@@ -566,10 +795,14 @@ int init_nodes(tis_t* tis, char* sourcefile) {
  * Does not clean any non-pointer values.
  */
 void destroy(tis_t tis) {
-    safe_free(tis.name);
-    safe_free_list(tis.nodes, tis.size, safe_free_node);
-    safe_free_list(tis.inputs, tis.cols, safe_free_io_node);
-    safe_free_list(tis.outputs, tis.cols, safe_free_io_node);
+    for(size_t i = 0; tis.inputs != NULL && i < tis.cols; i++) {
+        close_input(tis.inputs[i]);
+    }
+    for(size_t i = 0; tis.outputs != NULL && i < tis.cols; i++) {
+        close_output(tis.outputs[i]);
+    }
+    arena_free(&(tis.arena)); // all nodes, io nodes, code and names live here
+    unmap_image(&tis);
 }
 
 /*
@@ -577,81 +810,126 @@ void destroy(tis_t tis) {
  * (register via atexit).
  */
 void pre_exit() {
+    finish_tui(&tis); // if drawing, so that what follows is seen
+    report_perf(&tis); // if counting, before the profile is freed
+    finish_trace(&tis); // if tracing
+    finish_metrics(&tis); // if writing metrics
+    free_stop(&tis); // if stopping on idle
+    report_profile(&tis, opts.profile_file); // if profiling
+    if(opts.critical) {
+        report_critical_path(&tis, opts.critical_file);
+    }
+    if(opts.links) {
+        report_links(&tis, opts.links_file);
+    }
+    free_links(&tis); // if counting link traffic or logging it
+    free_travel(&tis); // if going back and forth
     destroy(tis);
 }
 
 /*
- * Returns a true value if the system is quiescent.
- * This means that no node is actively running.
- * Unless waiting for additional input, the execution is done.
+ * Load another copy of the machine, from the same image, or source and layout
  */
-int tick(tis_t* tis) {
-    int quiescent = 1;
-    int offset = tis->cols;
-    char deferred_all[tis->size + 2*offset];
-    char *deferred_i = deferred_all;
-    char *deferred_n = deferred_all + offset;
-    char *deferred_o = deferred_all + offset + tis->size;
+static int load_copy(tis_t* copy, char* imagefile, char* sourcefile, char* layoutfile, int layoutmode) {
+    if(imagefile != NULL) {
+        return load_image(copy, imagefile) == 0 ? 0 : -1;
+    }
+    if(init_layout(copy, layoutfile, layoutmode) != INIT_OK || init_nodes(copy, sourcefile) != INIT_OK) {
+        return -1;
+    }
+    return 0;
+}
 
-    // First stage: run most things
-    for(size_t i = 0; i < tis->cols; i++) {
-        if(tis->inputs[i] != NULL) {
-            tis_node_state_t state = run_input(tis, tis->inputs[i]);
-            deferred_i[i] = (state == TIS_NODE_STATE_WRITE_WAIT);
-            if(!deferred_i[i]) {
-                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->inputs[i]->laststate;
-                tis->inputs[i]->laststate = state;
-            }
+/*
+ * Check every engine against tick() on count random machines, from this seed on (see tis_diff.h).
+ * A machine that shows a difference is left in a directory of its own, to be run again with --lockstep.
+ */
+static int run_fuzz(size_t count, unsigned seed, long long timelimit) {
+    size_t failed = 0;
+    for(size_t k = 0; k < count; k++) {
+        char dir[] = "/tmp/tis-fuzz-XXXXXX";
+        char source[64], layout[64];
+        if(mkdtemp(dir) == NULL) {
+            error("Unable to make a directory for the random machines\n");
+            return EXIT_FAILURE;
         }
-    }
-    for(size_t i = 0; i < tis->size; i++) {
-        tis_node_state_t state = run(tis, tis->nodes[i]);
-        deferred_n[i] = (state == TIS_NODE_STATE_WRITE_WAIT);
-        if(!deferred_n[i]) {
-            quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->nodes[i]->laststate;
-            tis->nodes[i]->laststate = state;
+        if(fuzz_machine(seed + (unsigned)k, dir, source, layout, sizeof(source), &opts.tile_size) != 0) {
+            return EXIT_FAILURE;
         }
-    }
-    for(size_t i = 0; i < tis->cols; i++) {
-        if(tis->outputs[i] != NULL) {
-            tis_node_state_t state = run_output(tis, tis->outputs[i]);
-            deferred_o[i] = (state == TIS_NODE_STATE_WRITE_WAIT);
-            if(!deferred_o[i]) {
-                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->outputs[i]->laststate;
-                tis->outputs[i]->laststate = state;
+        int differ = 0;
+        for(const tis_engine_t* engine = tis_engines; engine->name != NULL; engine++) {
+            tis_t ref = { 0 }, alt = { 0 };
+            int status;
+            if(load_copy(&ref, NULL, source, layout, 0) != 0 || load_copy(&alt, NULL, source, layout, 0) != 0) {
+                error("Unable to load the random machine in %s\n", dir);
+                return EXIT_FAILURE;
             }
-        }
-    }
-
-    // Second stage: run deferrals
-    for(size_t i = 0; i < tis->cols; i++) {
-        if(tis->inputs[i] != NULL) {
-            if(deferred_i[i]) {
-                tis_node_state_t state = run_input_defer(tis, tis->inputs[i]);
-                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->inputs[i]->laststate;
-                tis->inputs[i]->laststate = state;
+            for(size_t c = 0; c < ref.cols; c++) {
+                if(ref.outputs[c] != NULL) {
+                    ref.outputs[c]->file.file = NULL; // the values are compared, and need not be written
+                }
             }
+            if(run_lockstep(&ref, &alt, engine, 1, timelimit > 0 ? timelimit : TIS_FUZZ_CYCLES, &status) != 0) {
+                error("Seed %u differs, run again with: --lockstep=%s --tile-size=%zu %s %s\n", seed + (unsigned)k, engine->name, opts.tile_size, source, layout);
+                differ = 1;
+            }
+            destroy(ref);
+            destroy(alt);
+            close_file_handles();
         }
-    }
-    for(size_t i = 0; i < tis->size; i++) {
-        if(deferred_n[i]) {
-            tis_node_state_t state = run_defer(tis, tis->nodes[i]);
-            quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->nodes[i]->laststate;
-            tis->nodes[i]->laststate = state;
+        char option[32];
+        long long cycles = timelimit > 0 ? timelimit : TIS_FUZZ_CYCLES;
+        int result = run_end_to_end(dir, source, layout, cycles, option, sizeof(option));
+        if(result < 0) {
+            return EXIT_FAILURE;
+        } else if(result > 0) {
+            error("Seed %u differs end to end, run again with: -c %lld --tile-size=%zu %s %s %s\n", seed + (unsigned)k, cycles, opts.tile_size, option, source, layout);
+            differ = 1;
         }
-    }
-    for(size_t i = 0; i < tis->cols; i++) {
-        if(tis->outputs[i] != NULL) {
-            if(deferred_o[i]) {
-                tis_node_state_t state = run_output_defer(tis, tis->outputs[i]);
-                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->outputs[i]->laststate;
-                tis->outputs[i]->laststate = state;
+        if(differ) {
+            failed++;
+        } else {
+            // the names are those that fuzz_machine() may have written
+            char path[64];
+            for(size_t c = 0; c < TIS_FUZZ_MAX_SIDE; c++) {
+                snprintf(path, sizeof(path), "%s/in%zu.txt", dir, c);
+                unlink(path);
             }
+            unlink(source);
+            unlink(layout);
+            rmdir(dir);
         }
     }
+    fprintf(stderr, "Fuzzing: %zu of %zu random machines (seeds %u to %u) differ\n", failed, count, seed, seed + (unsigned)count - 1);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+_Thread_local void (*tis_halt_hook)(int status) = NULL;
 
-    spam("System quiescent? %d\n", quiescent);
-    return quiescent;
+/*
+ * This is what halt() and bork() do. A worker running only part of the machine may set a hook to stop just
+ * itself, which must not return.
+ */
+_Noreturn void tis_halt(int status) {
+    if(tis_halt_hook != NULL) {
+        tis_halt_hook(status);
+    }
+    exit(status);
+}
+
+/*
+ * Read a number of rows or columns given on the command line, which must be a whole non-negative number that
+ * fits in a size_t with nothing after it. Returns non-zero if it is not.
+ */
+static int parse_dimension(const char* arg, size_t* out) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if(end == arg || *end != '\0' || arg[0] == '-' || errno == ERANGE || value > SIZE_MAX) {
+        return 1;
+    }
+    *out = value;
+    return 0;
 }
 
 /*
@@ -659,13 +937,17 @@ int tick(tis_t* tis) {
  * ./tis <source>
  * ./tis <source> <layout>
  * ./tis <source> <rows> <cols>
+ * ./tis <image>
+ * ./tis --compile -o <image> <source> [<layout> | <rows> <cols>]
  */
 void print_usage(char* progname) {
     fprintf(stderr, "Usage:\n"
         "    %s [opts] <source>\n"
         "    %s [opts] <source> <layout>\n"
-        "    %s [opts] <source> <rows> <cols>\n\n",
-        progname, progname, progname);
+        "    %s [opts] <source> <rows> <cols>\n"
+        "    %s [opts] <image>\n"
+        "    %s [opts] --compile -o <image> <source> [<layout> | <rows> <cols>]\n\n",
+        progname, progname, progname, progname, progname);
     fprintf(stderr, "Options:\n"
         "    -c      cycle limit; prevent the emulator from running\n"
         "                for more than this many cycles\n"
@@ -675,10 +957,106 @@ void print_usage(char* progname) {
         "    -n      numeric; change the default layout to use\n"
         "                numeric io instead of ascii, only\n"
         "                relevant when not using a custom layout\n"
+        "    -o      output; the image file to write with --compile\n"
         "    -q      quiet; decrease verbosity by one level,\n"
         "                may be provided multiple times\n"
         "    -v      verbose; increase verbosity by one level,\n"
-        "                may be provided multiple times\n\n");
+        "                may be provided multiple times\n"
+        "    --compile\n"
+        "            compile; parse the source and layout, then save\n"
+        "                the machine as an image instead of running it.\n"
+        "                Images are run by giving them as the only\n"
+        "                argument, and skip all parsing\n"
+        "    --footprint\n"
+        "            footprint; print how many nodes are allocated and\n"
+        "                how much memory the machine uses, once loaded\n"
+        "    --partitions <n>\n"
+        "            partitions; split the rows into n bands, each run\n"
+        "                by its own process and pinned to a NUMA node\n"
+        "                if there are several. Results are the same\n"
+        "    --tile-size <n>\n"
+        "            tile size; run the nodes of each partition in\n"
+        "                bands n diagonals wide, 64 by default\n"
+        "    --components[=<n>]\n"
+        "            components; run the independent parts of the\n"
+        "                machine on up to n threads, one per cpu by\n"
+        "                default. Outputs get the same values\n");
+    fprintf(stderr,
+        "    --profile[=<file>]\n"
+        "            profile; count the cycles of each node in each\n"
+        "                state and the runs and stalls of each line,\n"
+        "                print the busiest nodes at exit, and write\n"
+        "                every count to the file as JSON\n"
+        "    --links[=<file>]\n"
+        "            links; count the values crossing each link and\n"
+        "                their waits, print a map of the grid at exit,\n"
+        "                and write every link's counts to the file\n"
+        "    --critical-path[=<file>]\n"
+        "            critical path; log every value handed between\n"
+        "                nodes, then print the chain that gated the\n"
+        "                last output value, and the slack of each node.\n"
+        "                The log grows with every value\n"
+        "    --estimate\n"
+        "            estimate; predict the cycles between values on\n"
+        "                each output from the code, then check it with\n"
+        "                a run of 10000 cycles (or -c)\n"
+        "    --perf-counters\n"
+        "            perf counters; read the hardware counters of the\n"
+        "                cpu around the main loop, and print them at\n"
+        "                exit with the simulated cycles per second\n");
+    fprintf(stderr,
+        "    --lockstep[=<engine>]\n"
+        "            lockstep; run a second copy of the machine with\n"
+        "                another engine (tick, profiled or tiled, the\n"
+        "                default) and stop at the first difference\n"
+        "    --lockstep-every <n>\n"
+        "            lockstep interval; compare every n cycles\n"
+        "    --fuzz <count>[,<seed>]\n"
+        "            fuzz; check every engine against tick() on\n"
+        "                count random machines, from seed 1 by default,\n"
+        "                and --partitions and --components end to end\n"
+        "    --trace <file>\n"
+        "            trace; write what changes in each cycle to the\n"
+        "                file as a compact binary trace\n"
+        "    --replay <file>\n"
+        "            replay; print a trace as text instead of running\n"
+        "    --travel[=<file>]\n"
+        "            travel; run under a command loop that can step\n"
+        "                back as well as forward, with breakpoints and\n"
+        "                watchpoints, reading commands from the\n"
+        "                terminal or the file (- for stdin)\n"
+        "    --travel-every <n>\n"
+        "            travel interval; take a snapshot every n cycles,\n"
+        "                1024 by default\n"
+        "    --tui\n"
+        "            terminal view; draw the grid live in the terminal,\n"
+        "                space pauses, s steps, + and - set the speed\n"
+        "                and q quits\n");
+    fprintf(stderr,
+        "    --metrics <file>\n"
+        "            metrics; keep a Prometheus text file of cycles,\n"
+        "                io counts and sampled node states up to date\n"
+        "    --metrics-every <seconds>\n"
+        "            metrics interval; write the file this often,\n"
+        "                every 10 seconds by default\n"
+        "    --dump[=<file>]\n"
+        "            dump; on SIGUSR1, write the state of every node\n"
+        "                to stderr or the file\n"
+        "    --stop-idle <n>\n"
+        "            stop when idle; stop once every input has ended\n"
+        "                and no output has taken a value for n cycles\n"
+        "    --stop-any\n"
+        "            stop on any; stop once any output with COUNT or\n"
+        "                EXPECT is done, rather than all of them\n"
+        "    --seed <n>\n"
+        "            seed; the seed of RANDOM inputs, 0 by default\n"
+        "    --score <k>\n"
+        "            score; run k times on random inputs from the\n"
+        "                seed on, and print the mean cycles, the nodes\n"
+        "                and the instructions, as the game does\n"
+        "    --score-threads <n>\n"
+        "            score threads; share the runs of --score among\n"
+        "                n threads, one per cpu by default\n\n");
     // TODO flesh this out a bit more
 }
 
@@ -691,19 +1069,87 @@ int main(int argc, char** argv) {
     int argcount = 0;
     char* sourcefile = NULL;
     char* layoutfile = NULL;
-    int timelimit = 0;
+    char* imagefile = NULL;
+    char* loadedimage = NULL;
+    long long timelimit = 0;
+    char* end;
     int layoutmode = 0;
+    unsigned fuzzseed = 1;
 
     opts.verbose = 0;
     opts.default_i_type = TIS_IO_TYPE_IOSTREAM_ASCII;
+    opts.tile_size = TIS_TILE_SIZE;
     opts.default_o_type = TIS_IO_TYPE_IOSTREAM_ASCII;
 
+    enum {
+        OPT_COMPILE = 256, // long opts without a short equivalent
+        OPT_FOOTPRINT,
+        OPT_PARTITIONS,
+        OPT_TILE_SIZE,
+        OPT_COMPONENTS,
+        OPT_PROFILE,
+        OPT_LINKS,
+        OPT_CRITICAL,
+        OPT_ESTIMATE,
+        OPT_PERF,
+        OPT_LOCKSTEP,
+        OPT_LOCKSTEP_EVERY,
+        OPT_FUZZ,
+        OPT_TRACE,
+        OPT_REPLAY,
+        OPT_TRAVEL,
+        OPT_TRAVEL_EVERY,
+        OPT_TUI,
+        OPT_METRICS,
+        OPT_METRICS_EVERY,
+        OPT_DUMP,
+        OPT_STOP_IDLE,
+        OPT_STOP_ANY,
+        OPT_SEED,
+        OPT_SCORE,
+        OPT_SCORE_THREADS,
+    };
+    static struct option longopts[] = {
+        {"compile", no_argument, NULL, OPT_COMPILE},
+        {"footprint", no_argument, NULL, OPT_FOOTPRINT},
+        {"partitions", required_argument, NULL, OPT_PARTITIONS},
+        {"tile-size", required_argument, NULL, OPT_TILE_SIZE},
+        {"components", optional_argument, NULL, OPT_COMPONENTS},
+        {"profile", optional_argument, NULL, OPT_PROFILE},
+        {"links", optional_argument, NULL, OPT_LINKS},
+        {"critical-path", optional_argument, NULL, OPT_CRITICAL},
+        {"estimate", no_argument, NULL, OPT_ESTIMATE},
+        {"perf-counters", no_argument, NULL, OPT_PERF},
+        {"lockstep", optional_argument, NULL, OPT_LOCKSTEP},
+        {"lockstep-every", required_argument, NULL, OPT_LOCKSTEP_EVERY},
+        {"fuzz", required_argument, NULL, OPT_FUZZ},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"replay", required_argument, NULL, OPT_REPLAY},
+        {"travel", optional_argument, NULL, OPT_TRAVEL},
+        {"travel-every", required_argument, NULL, OPT_TRAVEL_EVERY},
+        {"tui", no_argument, NULL, OPT_TUI},
+        {"metrics", required_argument, NULL, OPT_METRICS},
+        {"metrics-every", required_argument, NULL, OPT_METRICS_EVERY},
+        {"dump", optional_argument, NULL, OPT_DUMP},
+        {"stop-idle", required_argument, NULL, OPT_STOP_IDLE},
+        {"stop-any", no_argument, NULL, OPT_STOP_ANY},
+        {"seed", required_argument, NULL, OPT_SEED},
+        {"score", required_argument, NULL, OPT_SCORE},
+        {"score-threads", required_argument, NULL, OPT_SCORE_THREADS},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
     int c;
-    while((c = getopt(argc, argv, "-c:hlnqv")) != -1) {
-        // parse short opts
+    while((c = getopt_long(argc, argv, "-c:hlno:qv", longopts, NULL)) != -1) {
+        // parse opts
         switch(c) {
             case 'c': // cycle count limit
-                timelimit = atoi(optarg); // TODO ensure that there is nothing else in this arg
+                timelimit = strtoll(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || timelimit < 0) {
+                    error("Invalid cycle limit '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
                 break;
             case 'h': // help
             case '?': // (this is also used for an unrecognized opt)
@@ -716,6 +1162,146 @@ int main(int argc, char** argv) {
                 opts.default_i_type = TIS_IO_TYPE_IOSTREAM_NUMERIC;
                 opts.default_o_type = TIS_IO_TYPE_IOSTREAM_NUMERIC;
                 break;
+            case 'o': // image to write
+                imagefile = optarg;
+                break;
+            case OPT_COMPILE: // save instead of running
+                opts.compile = 1;
+                break;
+            case OPT_FOOTPRINT: // report memory use once loaded
+                opts.footprint = 1;
+                break;
+            case OPT_PARTITIONS: // worker processes
+                opts.partitions = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.partitions == 0) {
+                    error("Invalid partition count '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_TILE_SIZE: // width of the bands within each partition
+                opts.tile_size = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.tile_size == 0) {
+                    error("Invalid tile size '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_COMPONENTS: // threads for independent components
+                if(optarg == NULL) {
+                    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    opts.components = cpus > 0 ? (size_t)cpus : 1;
+                    break;
+                }
+                opts.components = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.components == 0) {
+                    error("Invalid thread count '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_PROFILE: // count where the cycles go
+                opts.profile = 1;
+                opts.profile_file = optarg;
+                break;
+            case OPT_LINKS: // count the traffic on each link
+                opts.links = 1;
+                opts.links_file = optarg;
+                break;
+            case OPT_CRITICAL: // log every handoff and find what gates the outputs
+                opts.critical = 1;
+                opts.critical_file = optarg;
+                break;
+            case OPT_ESTIMATE: // predict the throughput from the code, then check it
+                opts.estimate = 1;
+                break;
+            case OPT_PERF: // hardware counters around the main loop
+                opts.perf = 1;
+                break;
+            case OPT_LOCKSTEP: // run another engine beside tick() and compare
+                if((opts.lockstep = find_engine(optarg == NULL ? "tiled" : optarg)) == NULL) {
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_LOCKSTEP_EVERY: // cycles between comparisons
+                opts.lockstep_every = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.lockstep_every == 0) {
+                    error("Invalid cycle count '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_TRACE: // record what changes in each cycle
+                opts.trace_file = optarg;
+                break;
+            case OPT_REPLAY: // print a trace instead of running
+                opts.replay_file = optarg;
+                break;
+            case OPT_TRAVEL: // step forward and back under a command loop
+                opts.travel = 1;
+                opts.travel_file = optarg;
+                break;
+            case OPT_TRAVEL_EVERY: // cycles between snapshots
+                opts.travel_every = strtoull(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.travel_every == 0) {
+                    error("Invalid cycle count '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_TUI: // draw the machine live in the terminal
+                opts.tui = 1;
+                break;
+            case OPT_METRICS: // keep a metrics file up to date
+                opts.metrics_file = optarg;
+                break;
+            case OPT_METRICS_EVERY: // seconds between writes of the metrics
+                opts.metrics_every = strtod(optarg, &end);
+                if(end == optarg || *end != '\0' || !(opts.metrics_every > 0)) {
+                    error("Invalid number of seconds '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_DUMP: // dump the state on SIGUSR1
+                opts.dump = 1;
+                opts.dump_file = optarg;
+                break;
+            case OPT_STOP_IDLE: // stop once the inputs end and the outputs go quiet
+                opts.stop_idle = strtoull(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.stop_idle == 0) {
+                    error("Invalid number of cycles '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_STOP_ANY: // stop once any counted output is done
+                opts.stop_any = 1;
+                break;
+            case OPT_SEED: // for RANDOM inputs
+                opts.seed = strtoull(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-') {
+                    error("Invalid seed '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_SCORE: // the game's metrics over random inputs
+                opts.score = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.score == 0) {
+                    error("Invalid number of runs '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_SCORE_THREADS: // threads for the runs of --score
+                opts.score_threads = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.score_threads == 0) {
+                    error("Invalid thread count '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_FUZZ: // check the engines on random machines
+                opts.fuzz = strtoul(optarg, &end, 10);
+                if(*end == ',') {
+                    fuzzseed = strtoul(end + 1, &end, 10);
+                }
+                if(end == optarg || *end != '\0' || optarg[0] == '-' || opts.fuzz == 0) {
+                    error("Invalid fuzzing count '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'q': // quiet
                 opts.verbose--;
                 break;
@@ -749,6 +1335,28 @@ int main(int argc, char** argv) {
         }
     }
 
+    if(opts.compile && imagefile == NULL) {
+        error("No image file given for --compile, use -o\n");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(opts.fuzz > 0) {
+        exit(run_fuzz(opts.fuzz, fuzzseed, timelimit));
+    }
+    if(opts.replay_file != NULL) {
+        exit(replay_trace(opts.replay_file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if(argcount == 1 && !opts.compile && is_image(argvector[0])) {
+        if(load_image(&tis, argvector[0]) != 0) {
+            // an error has happened, message was printed from load_image
+            exit(EXIT_FAILURE);
+        }
+        loadedimage = argvector[0];
+        goto run;
+    }
+
     switch(argcount) { // do different things based on how many args are provided
         case 1:
             sourcefile = argvector[0];
@@ -762,8 +1370,14 @@ int main(int argc, char** argv) {
             break;
         case 3:
             sourcefile = argvector[0];
-            tis.rows = atoi(argvector[1]); // TODO ensure that there is nothing else in this arg
-            tis.cols = atoi(argvector[2]); // TODO ensure that there is nothing else in this arg
+            if(parse_dimension(argvector[1], &tis.rows) != 0) {
+                error("Invalid number of rows '%s'\n", argvector[1]);
+                exit(EXIT_FAILURE);
+            }
+            if(parse_dimension(argvector[2], &tis.cols) != 0) {
+                error("Invalid number of columns '%s'\n", argvector[2]);
+                exit(EXIT_FAILURE);
+            }
             debug("Read dimensions %zur %zuc from command line\n", tis.rows, tis.cols);
             break;
         case 0:
@@ -786,9 +1400,102 @@ int main(int argc, char** argv) {
         exit(EXIT_FAILURE);
     }
 
-    for(int time = 0; !tick(&tis) && (timelimit == 0 || time < timelimit); time++) {
+    if(opts.compile) {
+        exit(save_image(&tis, imagefile) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+run:
+    if(opts.lockstep != NULL) {
+        tis_t copy = { .rows = tis.rows, .cols = tis.cols };
+        int status;
+        if(load_copy(&copy, loadedimage, sourcefile, layoutfile, layoutmode) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        int differ = run_lockstep(&tis, &copy, opts.lockstep, opts.lockstep_every > 0 ? opts.lockstep_every : 1, timelimit, &status);
+        destroy(copy);
+        exit(differ != 0 ? EXIT_FAILURE : status);
+    }
+    init_tick(&tis);
+    if(opts.footprint) {
+        report_footprint(&tis);
+    }
+    if(opts.travel) {
+        run_travel(&tis, opts.travel_file, opts.travel_every > 0 ? opts.travel_every : TIS_TRAVEL_EVERY, timelimit); // does not return
+    }
+    if(opts.tui) {
+        run_tui(&tis, timelimit); // does not return
+    }
+    if(opts.estimate) {
+        run_estimate(&tis, timelimit); // does not return
+    }
+    if(opts.score > 0) {
+        run_score(&tis, opts.score, opts.score_threads, timelimit); // does not return
+    }
+    if(opts.metrics_file != NULL || opts.dump) {
+        if(opts.partitions > 1 || opts.components > 0) {
+            warn("Metrics are counted on one thread, ignoring --partitions and --components\n");
+            opts.partitions = 1;
+            opts.components = 0;
+        }
+        init_metrics(&tis, opts.metrics_file, opts.metrics_every > 0 ? opts.metrics_every : TIS_METRICS_EVERY, opts.dump_file);
+    }
+    if(opts.stop_idle > 0) {
+        if(opts.partitions > 1 || opts.components > 0) {
+            warn("Idle outputs are watched on one thread, ignoring --partitions and --components\n");
+            opts.partitions = 1;
+            opts.components = 0;
+        }
+        init_stop(&tis, opts.stop_idle);
+    }
+    if(opts.profile || opts.links || opts.critical || opts.trace_file != NULL) {
+        if(opts.partitions > 1 || opts.components > 0) {
+            warn("Profiling runs on one thread, ignoring --partitions and --components\n");
+        }
+        if(opts.trace_file != NULL) {
+            init_trace(&tis, opts.trace_file);
+        }
+        if(opts.profile) {
+            init_profile(&tis);
+        }
+        if(opts.links || opts.critical) {
+            init_links(&tis, opts.critical);
+        }
+        if(opts.perf) {
+            init_perf(&tis);
+        }
+        for(long long time = 0; !(opts.profile ? tick_profiled(&tis) : tick(&tis)) && (timelimit == 0 || time < timelimit); time++) {
+            // nothing
+        }
+        exit(expected_missing(&tis) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if(opts.perf) {
+        if(opts.partitions > 1 || opts.components > 0) {
+            warn("Perf counters measure one thread, ignoring --partitions and --components\n");
+        }
+        init_perf(&tis);
+        for(long long time = 0; !tick(&tis) && (timelimit == 0 || time < timelimit); time++) {
+            // nothing
+        }
+        exit(expected_missing(&tis) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if(opts.partitions > 1) {
+        run_partitioned(&tis, opts.partitions, timelimit); // only returns if the grid is too small to split
+    }
+    if(opts.components > 0) {
+        for(size_t i = 0; i < tis.cols; i++) {
+            if(tis.outputs[i] != NULL && tis.outputs[i]->expect.count != 0) {
+                warn("Outputs with COUNT or EXPECT are checked on one thread, ignoring --components\n");
+                opts.components = 0;
+                break;
+            }
+        }
+    }
+    if(opts.components > 0) {
+        run_components(&tis, opts.components, timelimit); // only returns if there is nothing to run in parallel
+    }
+    for(long long time = 0; !tick(&tis) && (timelimit == 0 || time < timelimit); time++) {
         // nothing
     }
 
-    exit(EXIT_SUCCESS);
+    exit(expected_missing(&tis) == 0 ? EXIT_SUCCESS : EXIT_FAILURE); // with EXPECT, the run must not stop short
 }
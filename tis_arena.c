@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tis_arena.h"
+#include "tis_types.h"
+
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (16 * 1024 * 1024)
+#define ARENA_ALIGN 16
+
+static void* region_alloc(tis_arena_region_t* region, size_t size, size_t align) {
+    tis_arena_chunk_t* chunk = region->head;
+    if(chunk != NULL) {
+        size_t start = (chunk->used + align - 1) & ~(align - 1);
+        if(start + size <= chunk->size) {
+            chunk->used = start + size;
+            return &(chunk->data[start]);
+        }
+    }
+    if(region->next_size < ARENA_MIN_CHUNK) {
+        region->next_size = ARENA_MIN_CHUNK;
+    }
+    size_t chunksize = region->next_size;
+    while(chunksize < size) {
+        chunksize *= 2;
+    }
+    if(region->next_size < ARENA_MAX_CHUNK) {
+        region->next_size *= 2;
+    }
+    chunk = malloc(sizeof(tis_arena_chunk_t) + chunksize);
+    if(chunk == NULL) {
+        error("Unable to allocate %zu bytes of memory\n", chunksize);
+        bork();
+    }
+    chunk->size = chunksize;
+    chunk->used = size;
+    chunk->next = region->head;
+    region->head = chunk;
+    return &(chunk->data[0]);
+}
+
+static void region_free(tis_arena_region_t* region) {
+    while(region->head != NULL) {
+        tis_arena_chunk_t* next = region->head->next;
+        free(region->head);
+        region->head = next;
+    }
+    region->next_size = 0;
+}
+
+static size_t region_bytes(tis_arena_region_t* region) {
+    size_t total = 0;
+    for(tis_arena_chunk_t* chunk = region->head; chunk != NULL; chunk = chunk->next) {
+        total += sizeof(tis_arena_chunk_t) + chunk->size;
+    }
+    return total;
+}
+
+/*
+ * Allocate zeroed memory that lives until arena_free()
+ */
+void* arena_alloc(tis_arena_t* arena, size_t size) {
+    void* ptr = region_alloc(&(arena->objects), size, ARENA_ALIGN);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void* arena_calloc(tis_arena_t* arena, size_t count, size_t size) {
+    if(size != 0 && count > SIZE_MAX / size) {
+        error("Unable to allocate %zu objects of %zu bytes\n", count, size);
+        bork();
+    }
+    return arena_alloc(arena, count * size);
+}
+
+static size_t hash_string(const char* str) {
+    size_t hash = 14695981039346656037ULL; // FNV-1a
+    for(; *str != '\0'; str++) {
+        hash = (hash ^ (unsigned char)*str) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void intern_grow(tis_arena_t* arena) {
+    size_t slots = arena->interned_slots == 0 ? 256 : arena->interned_slots * 2;
+    char** table = calloc(slots, sizeof(char*));
+    if(table == NULL) {
+        error("Unable to allocate string table\n");
+        bork();
+    }
+    for(size_t i = 0; i < arena->interned_slots; i++) {
+        char* str = arena->interned[i];
+        if(str != NULL) {
+            size_t j = hash_string(str) & (slots - 1);
+            while(table[j] != NULL) {
+                j = (j + 1) & (slots - 1);
+            }
+            table[j] = str;
+        }
+    }
+    free(arena->interned);
+    arena->interned = table;
+    arena->interned_slots = slots;
+}
+
+/*
+ * Return the arena's copy of this string; equal strings share the same copy, so these must never be modified
+ */
+char* arena_strdup(tis_arena_t* arena, const char* str) {
+    if(str == NULL) {
+        return NULL;
+    }
+    if(2 * (arena->interned_count + 1) > arena->interned_slots) {
+        intern_grow(arena);
+    }
+    size_t i = hash_string(str) & (arena->interned_slots - 1);
+    while(arena->interned[i] != NULL) {
+        if(strcmp(arena->interned[i], str) == 0) {
+            return arena->interned[i];
+        }
+        i = (i + 1) & (arena->interned_slots - 1);
+    }
+    size_t len = strlen(str) + 1;
+    char* copy = region_alloc(&(arena->strings), len, 1);
+    memcpy(copy, str, len);
+    arena->interned[i] = copy;
+    arena->interned_count++;
+    return copy;
+}
+
+/*
+ * Total bytes held by this arena, including unused chunk space
+ */
+size_t arena_bytes(tis_arena_t* arena) {
+    return region_bytes(&(arena->objects)) + region_bytes(&(arena->strings)) + arena->interned_slots * sizeof(char*);
+}
+
+void arena_free(tis_arena_t* arena) {
+    region_free(&(arena->objects));
+    region_free(&(arena->strings));
+    safe_free(arena->interned);
+    arena->interned_slots = 0;
+    arena->interned_count = 0;
+}
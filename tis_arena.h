@@ -0,0 +1,38 @@
+#ifndef _TIS_ARENA_
+#define _TIS_ARENA_
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for everything that lives as long as the loaded program (nodes, io nodes, instructions, strings).
+ * Nothing is freed individually; the whole arena is released at once by arena_free().
+ * Objects and strings are carved from separate chunk lists, so that consecutive objects (e.g. the lines of one node) stay adjacent.
+ */
+
+typedef struct tis_arena_chunk {
+    struct tis_arena_chunk* next;
+    size_t size; // usable bytes in data
+    size_t used;
+    _Alignas(16) unsigned char data[];
+} tis_arena_chunk_t;
+
+typedef struct tis_arena_region {
+    tis_arena_chunk_t* head; // current chunk, the rest are linked behind it
+    size_t next_size; // size of the next chunk to allocate, grows geometrically
+} tis_arena_region_t;
+
+typedef struct tis_arena {
+    tis_arena_region_t objects;
+    tis_arena_region_t strings;
+    char** interned; // open-addressed hash set of interned strings
+    size_t interned_slots; // zero or a power of two
+    size_t interned_count;
+} tis_arena_t;
+
+void* arena_alloc(tis_arena_t* arena, size_t size);
+void* arena_calloc(tis_arena_t* arena, size_t count, size_t size);
+char* arena_strdup(tis_arena_t* arena, const char* str);
+size_t arena_bytes(tis_arena_t* arena);
+void arena_free(tis_arena_t* arena);
+
+#endif /* _TIS_ARENA_ */
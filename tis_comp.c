@@ -0,0 +1,489 @@
+#define _POSIX_C_SOURCE 200809L // for sysconf()
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tis_comp.h"
+#include "tis_io.h"
+#include "tis_node.h"
+#include "tis_types.h"
+
+/*
+ * How the groups are kept in step:
+ *
+ * Two nodes are linked if one of them can write to a port that the other reads from; an input is linked to the node
+ * below it if that reads up, and an output to the node above it if that writes down. Reading or writing ANY counts as
+ * every direction, and so does LAST in a node that uses ANY. Stack nodes read and write every direction. Io nodes that
+ * share a stream (the same FILE*, file name or ring) are linked too, so that everything written to one stream comes
+ * from one thread, in order. Nodes that can never run link nothing. The connected components of this graph never
+ * exchange a value, and since tick() only runs each node once per stage, a component run on its own (in the same
+ * order) goes through exactly the states it has in the whole machine.
+ *
+ * What does depend on the other components is when the run ends. Quiescence is no problem: a component that is
+ * quiescent stays that way, so each group simply stops at its own. But HCF (and a jump to a missing label, which also
+ * ends the run) stops everything at once, and nothing may be written after it. So all components that can halt are
+ * put in the same group, which therefore halts at the right place, and it publishes how many cycles it has finished.
+ * Groups with outputs only start a cycle once the halting group has finished it, or has stopped without halting.
+ * Groups without outputs can't be observed, and run freely until the run has halted.
+ */
+
+#define PORTS_ALL 0xF
+#define PORT(reg) (1 << ((reg) - TIS_REGISTER_UP)) // for UP, DOWN, LEFT and RIGHT
+
+typedef struct comp_group {
+    tis_t tis; // the machine, with only the nodes and io of this group
+    size_t weight; // nodes that can run and io nodes, for balancing
+    int halting; // holds every component that can halt the run
+    int gated; // has outputs, so must not run ahead of the halting group
+    pthread_t thread;
+    jmp_buf resume; // where comp_halt() returns to
+} comp_group_t;
+
+typedef struct comp_component {
+    size_t root;
+    size_t weight;
+} comp_component_t;
+
+typedef struct comp_stream {
+    const void* file;
+    const char* name;
+    size_t index;
+} comp_stream_t;
+
+static pthread_mutex_t comp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t comp_moved = PTHREAD_COND_INITIALIZER; // signalled when any of the below change
+static _Atomic long long comp_progress = 0; // cycles finished by the halting group
+static _Atomic int comp_finished = 0; // the halting group has stopped without halting
+static _Atomic int comp_stopped = 0; // the run has halted
+static int comp_status = EXIT_SUCCESS; // of the halt, under comp_lock
+static long long comp_timelimit = 0;
+static _Thread_local comp_group_t* halt_group = NULL; // the group run by this thread, for comp_halt()
+
+static size_t find_root(size_t* parent, size_t i) {
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+static void unite(size_t* parent, size_t a, size_t b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if(a != b) {
+        parent[a < b ? b : a] = a < b ? a : b;
+    }
+}
+
+static int reg_ports(tis_register_t reg, int any) {
+    switch(reg) {
+        case TIS_REGISTER_UP:
+        case TIS_REGISTER_DOWN:
+        case TIS_REGISTER_LEFT:
+        case TIS_REGISTER_RIGHT:
+            return PORT(reg);
+        case TIS_REGISTER_ANY:
+            return PORTS_ALL;
+        case TIS_REGISTER_LAST:
+            return any ? PORTS_ALL : 0; // LAST stays NIL unless the node uses ANY
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Find the ports this node can read from and write to.
+ * Returns a true value if it can halt the run.
+ */
+static int node_ports(tis_node_t* node, int* reads, int* writes) {
+    *reads = 0;
+    *writes = 0;
+    if(node->type == TIS_NODE_TYPE_MEMORY_STACK) {
+        *reads = PORTS_ALL;
+        *writes = PORTS_ALL;
+        return 0;
+    } else if(node->type != TIS_NODE_TYPE_COMPUTE) {
+        return 0;
+    }
+    int any = 0;
+    for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
+        tis_op_t* op = node->code[idx];
+        if(op != NULL && op->type != TIS_OP_TYPE_INVALID) {
+            any = any || (op->src.type == TIS_OP_ARG_TYPE_REGISTER && op->src.reg == TIS_REGISTER_ANY) ||
+                         (op->dst.type == TIS_OP_ARG_TYPE_REGISTER && op->dst.reg == TIS_REGISTER_ANY);
+        }
+    }
+    int halts = 0;
+    for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
+        tis_op_t* op = node->code[idx];
+        if(op == NULL) {
+            continue;
+        }
+        switch(op->type) {
+            case TIS_OP_TYPE_HCF:
+                halts = 1;
+                break;
+            case TIS_OP_TYPE_MOV:
+                if(op->dst.type == TIS_OP_ARG_TYPE_REGISTER) {
+                    *writes |= reg_ports(op->dst.reg, any);
+                }
+                // fall through
+            case TIS_OP_TYPE_ADD:
+            case TIS_OP_TYPE_SUB:
+            case TIS_OP_TYPE_JRO:
+                if(op->src.type == TIS_OP_ARG_TYPE_REGISTER) {
+                    *reads |= reg_ports(op->src.reg, any);
+                }
+                break;
+            default:
+                if(op->src.type == TIS_OP_ARG_TYPE_LABEL && op->src.target < 0) {
+                    halts = 1; // jumping there is an error
+                }
+                break;
+        }
+    }
+    return halts;
+}
+
+static int compare_files(const void* a, const void* b) {
+    uintptr_t fa = (uintptr_t)((const comp_stream_t*)a)->file;
+    uintptr_t fb = (uintptr_t)((const comp_stream_t*)b)->file;
+    return (fa > fb) - (fa < fb);
+}
+
+static int compare_names(const void* a, const void* b) {
+    const char* na = ((const comp_stream_t*)a)->name;
+    const char* nb = ((const comp_stream_t*)b)->name;
+    if(na == NULL || nb == NULL) {
+        return (na == NULL) - (nb == NULL);
+    }
+    return strcmp(na, nb);
+}
+
+/*
+ * Link io nodes that share a stream, by sorting them on each way a stream can be shared
+ */
+static void link_streams(tis_t* tis, size_t* parent) {
+    comp_stream_t* streams = malloc(2 * tis->cols * sizeof(comp_stream_t) + 1);
+    if(streams == NULL) {
+        error("Unable to allocate memory for components\n");
+        bork();
+    }
+    size_t count = 0;
+    for(size_t i = 0; i < 2 * tis->cols; i++) {
+        tis_io_node_t* io = i < tis->cols ? tis->inputs[i] : tis->outputs[i - tis->cols];
+        if(io == NULL) {
+            continue;
+        } else if(is_file_io(io->type)) {
+            streams[count++] = (comp_stream_t){ .file = io->file.file, .name = io->file.path, .index = tis->size + i };
+        } else if(io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+            streams[count++] = (comp_stream_t){ .file = NULL, .name = io->shm.name, .index = tis->size + i };
+        }
+    }
+    qsort(streams, count, sizeof(comp_stream_t), compare_files);
+    for(size_t k = 1; k < count; k++) {
+        if(streams[k].file != NULL && streams[k].file == streams[k-1].file) {
+            unite(parent, streams[k-1].index, streams[k].index);
+        }
+    }
+    qsort(streams, count, sizeof(comp_stream_t), compare_names);
+    for(size_t k = 1; k < count; k++) {
+        if(streams[k].name != NULL && streams[k-1].name != NULL && strcmp(streams[k].name, streams[k-1].name) == 0) {
+            unite(parent, streams[k-1].index, streams[k].index);
+        }
+    }
+    free(streams);
+}
+
+/*
+ * Returns the components of the machine in parent, indexed by node, then input, then output.
+ * A component that can halt the run is marked in halts, at its root.
+ */
+static void find_components(tis_t* tis, size_t* parent, char* halts) {
+    size_t count = tis->size + 2 * tis->cols;
+    int* reads = calloc(tis->size + 1, sizeof(int));
+    int* writes = calloc(tis->size + 1, sizeof(int));
+    if(reads == NULL || writes == NULL) {
+        error("Unable to allocate memory for components\n");
+        bork();
+    }
+    for(size_t i = 0; i < count; i++) {
+        parent[i] = i;
+    }
+    for(size_t i = 0; i < tis->size; i++) {
+        if(node_can_run(tis->nodes[i])) {
+            halts[i] = node_ports(tis->nodes[i], &(reads[i]), &(writes[i]));
+        }
+    }
+    for(size_t i = 0; i < tis->size; i++) {
+        size_t col = i % tis->cols;
+        if(col + 1 < tis->cols &&
+           (((writes[i] & PORT(TIS_REGISTER_RIGHT)) && (reads[i+1] & PORT(TIS_REGISTER_LEFT))) ||
+            ((reads[i] & PORT(TIS_REGISTER_RIGHT)) && (writes[i+1] & PORT(TIS_REGISTER_LEFT))))) {
+            unite(parent, i, i+1);
+        }
+        size_t below = i + tis->cols;
+        if(below < tis->size &&
+           (((writes[i] & PORT(TIS_REGISTER_DOWN)) && (reads[below] & PORT(TIS_REGISTER_UP))) ||
+            ((reads[i] & PORT(TIS_REGISTER_DOWN)) && (writes[below] & PORT(TIS_REGISTER_UP))))) {
+            unite(parent, i, below);
+        }
+    }
+    for(size_t col = 0; col < tis->cols; col++) {
+        size_t in = tis->size + col;
+        size_t out = tis->size + tis->cols + col;
+        if(tis->rows == 0) {
+            if(tis->inputs[col] != NULL && tis->outputs[col] != NULL) {
+                unite(parent, in, out); // outputs read straight from the inputs
+            }
+            continue;
+        }
+        if(tis->inputs[col] != NULL && (reads[col] & PORT(TIS_REGISTER_UP))) {
+            unite(parent, in, col);
+        }
+        size_t last = (tis->rows - 1) * tis->cols + col;
+        if(tis->outputs[col] != NULL && (writes[last] & PORT(TIS_REGISTER_DOWN))) {
+            unite(parent, out, last);
+        }
+    }
+    link_streams(tis, parent);
+    for(size_t col = 0; col < tis->cols; col++) {
+        // RANDOM only waits once its values run out, the other generators are not implemented yet and fail when used
+        tis_io_node_t* in = tis->inputs[col];
+        halts[tis->size + col] = in != NULL && !is_file_io(in->type) && in->type != TIS_IO_TYPE_IOSTREAM_SHM &&
+                                 in->type != TIS_IO_TYPE_IGENERATOR_RANDOM;
+        tis_io_node_t* out = tis->outputs[col];
+        halts[tis->size + tis->cols + col] = out != NULL && !is_file_io(out->type) && out->type != TIS_IO_TYPE_IOSTREAM_SHM;
+    }
+    for(size_t i = 0; i < count; i++) {
+        size_t root = find_root(parent, i);
+        halts[root] = halts[root] || halts[i];
+    }
+    free(reads);
+    free(writes);
+}
+
+static int compare_weights(const void* a, const void* b) {
+    size_t wa = ((const comp_component_t*)a)->weight;
+    size_t wb = ((const comp_component_t*)b)->weight;
+    return (wa < wb) - (wa > wb); // heaviest first
+}
+
+/*
+ * The tis_halt_hook of a group's thread
+ */
+static void comp_halt(int status) {
+    comp_group_t* g = halt_group;
+    pthread_mutex_lock(&comp_lock);
+    if(!atomic_load(&comp_stopped)) {
+        comp_status = status;
+        atomic_store(&comp_stopped, 1);
+    }
+    pthread_cond_broadcast(&comp_moved);
+    pthread_mutex_unlock(&comp_lock);
+    longjmp(g->resume, 1);
+}
+
+static void publish(int finished, long long progress) {
+    pthread_mutex_lock(&comp_lock);
+    if(finished) {
+        atomic_store(&comp_finished, 1);
+    } else {
+        atomic_store(&comp_progress, progress);
+    }
+    pthread_cond_broadcast(&comp_moved);
+    pthread_mutex_unlock(&comp_lock);
+}
+
+/*
+ * Returns a true value if this group may run this cycle, or a false one if the run has halted
+ */
+static int may_run(comp_group_t* g, long long time) {
+    if(!g->gated) {
+        return !atomic_load(&comp_stopped);
+    } else if(atomic_load(&comp_progress) > time || atomic_load(&comp_finished)) {
+        return 1;
+    }
+    pthread_mutex_lock(&comp_lock);
+    while(atomic_load(&comp_progress) <= time && !atomic_load(&comp_finished) && !atomic_load(&comp_stopped)) {
+        pthread_cond_wait(&comp_moved, &comp_lock);
+    }
+    int ok = atomic_load(&comp_progress) > time || atomic_load(&comp_finished);
+    pthread_mutex_unlock(&comp_lock);
+    return ok;
+}
+
+static void* run_group(void* arg) {
+    comp_group_t* g = arg;
+    halt_group = g;
+    tis_halt_hook = comp_halt;
+    if(setjmp(g->resume) == 0) {
+        for(long long time = 0; may_run(g, time); time++) {
+            int quiescent = tick(&(g->tis));
+            if(g->halting) {
+                publish(0, time + 1);
+            }
+            if(quiescent || (comp_timelimit != 0 && time >= comp_timelimit)) {
+                break;
+            }
+        }
+        if(g->halting) {
+            publish(1, 0);
+        }
+    }
+    tis_halt_hook = NULL;
+    halt_group = NULL;
+    return NULL;
+}
+
+/*
+ * Set up the view of the machine for each group, from the group of each component root
+ */
+static void setup_groups(tis_t* tis, comp_group_t* groups, size_t ngroups, size_t* parent, size_t* group_of) {
+    for(size_t k = 0; k < ngroups; k++) {
+        groups[k].tis = *tis;
+        groups[k].tis.nactive = 0;
+        groups[k].tis.inputs = arena_calloc(&(tis->arena), tis->cols, sizeof(tis_io_node_t*));
+        groups[k].tis.outputs = arena_calloc(&(tis->arena), tis->cols, sizeof(tis_io_node_t*));
+    }
+    size_t* index = malloc(tis->nactive * sizeof(size_t) + 1); // grid index of each active node
+    if(index == NULL) {
+        error("Unable to allocate memory for components\n");
+        bork();
+    }
+    for(size_t k = 0; k < tis->nactive; k++) {
+        // active may be in tile order, so look up each node by its position
+        index[k] = tis->active[k]->row * tis->cols + tis->active[k]->col;
+        groups[group_of[find_root(parent, index[k])]].tis.nactive++;
+    }
+    for(size_t k = 0; k < ngroups; k++) {
+        groups[k].tis.active = arena_calloc(&(tis->arena), groups[k].tis.nactive, sizeof(tis_node_t*));
+        groups[k].tis.deferred = arena_calloc(&(tis->arena), tis->cols + groups[k].tis.nactive + tis->cols, sizeof(char));
+        groups[k].tis.nactive = 0;
+    }
+    for(size_t k = 0; k < tis->nactive; k++) {
+        tis_t* view = &(groups[group_of[find_root(parent, index[k])]].tis);
+        view->active[view->nactive++] = tis->active[k];
+    }
+    free(index);
+    for(size_t col = 0; col < tis->cols; col++) {
+        if(tis->inputs[col] != NULL) {
+            groups[group_of[find_root(parent, tis->size + col)]].tis.inputs[col] = tis->inputs[col];
+        }
+        if(tis->outputs[col] != NULL) {
+            comp_group_t* g = &(groups[group_of[find_root(parent, tis->size + tis->cols + col)]]);
+            g->tis.outputs[col] = tis->outputs[col];
+            g->gated = !g->halting && groups[0].halting; // nothing to wait for without a halting group
+        }
+    }
+}
+
+/*
+ * Run the machine (already set up by init_tick()) with one thread per group of components, in place of the loop
+ * over tick(). Exits with the status of the run once every thread has finished.
+ */
+void run_components(tis_t* tis, size_t threads, long long timelimit) {
+    size_t count = tis->size + 2 * tis->cols;
+    size_t* parent = malloc(count * sizeof(size_t) + 1);
+    size_t* group_of = malloc(count * sizeof(size_t) + 1);
+    size_t* weight = calloc(count + 1, sizeof(size_t));
+    char* halts = calloc(count + 1, sizeof(char));
+    comp_component_t* components = malloc(count * sizeof(comp_component_t) + 1);
+    if(parent == NULL || group_of == NULL || weight == NULL || halts == NULL || components == NULL) {
+        error("Unable to allocate memory for components\n");
+        bork();
+    }
+    find_components(tis, parent, halts);
+    for(size_t i = 0; i < count; i++) {
+        int present = i < tis->size ? node_can_run(tis->nodes[i]) :
+                      i < tis->size + tis->cols ? tis->inputs[i - tis->size] != NULL :
+                      tis->outputs[i - tis->size - tis->cols] != NULL;
+        weight[find_root(parent, i)] += present;
+    }
+
+    // The components that can halt all go in the first group, the others are balanced over the remaining threads
+    size_t ncomponents = 0;
+    size_t nhalting = 0;
+    size_t halting_weight = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(parent[i] != i || weight[i] == 0) {
+            continue;
+        } else if(halts[i]) {
+            nhalting++;
+            halting_weight += weight[i];
+        } else {
+            components[ncomponents++] = (comp_component_t){ .root = i, .weight = weight[i] };
+        }
+    }
+    size_t first = nhalting > 0;
+    size_t ngroups = first + (ncomponents < threads - first ? ncomponents : threads - first);
+    debug("Found %zu independent components (%zu of them can halt), running them as %zu groups\n", ncomponents + nhalting, nhalting, ngroups);
+    if(threads < 2 || ngroups < 2) {
+        warn("Machine has no independent components to run in parallel, running on one thread\n");
+        free(parent);
+        free(group_of);
+        free(weight);
+        free(halts);
+        free(components);
+        return;
+    }
+    comp_group_t* groups = calloc(ngroups, sizeof(comp_group_t));
+    if(groups == NULL) {
+        error("Unable to allocate memory for components\n");
+        bork();
+    }
+    if(first) {
+        groups[0].halting = 1;
+        groups[0].weight = halting_weight;
+    }
+    qsort(components, ncomponents, sizeof(comp_component_t), compare_weights);
+    for(size_t i = 0; i < count; i++) {
+        if(parent[i] == i && halts[i]) {
+            group_of[i] = 0;
+        }
+    }
+    for(size_t c = 0; c < ncomponents; c++) {
+        size_t lightest = first;
+        for(size_t k = first + 1; k < ngroups; k++) {
+            if(groups[k].weight < groups[lightest].weight) {
+                lightest = k;
+            }
+        }
+        groups[lightest].weight += components[c].weight;
+        group_of[components[c].root] = lightest;
+    }
+    setup_groups(tis, groups, ngroups, parent, group_of);
+    for(size_t k = 0; k < ngroups; k++) {
+        debug("Group %zu: %zu nodes that can run, weight %zu%s%s\n", k, groups[k].tis.nactive, groups[k].weight,
+              groups[k].halting ? ", can halt" : "", groups[k].gated ? ", has outputs" : "");
+    }
+    free(parent);
+    free(group_of);
+    free(weight);
+    free(halts);
+    free(components);
+
+    comp_timelimit = timelimit;
+    size_t started = 0;
+    for(; started < ngroups; started++) {
+        if(pthread_create(&(groups[started].thread), NULL, run_group, &(groups[started])) != 0) {
+            error("Unable to start the thread for group %zu\n", started);
+            pthread_mutex_lock(&comp_lock);
+            comp_status = EXIT_FAILURE;
+            atomic_store(&comp_stopped, 1);
+            pthread_cond_broadcast(&comp_moved);
+            pthread_mutex_unlock(&comp_lock);
+            break;
+        }
+    }
+    for(size_t k = 0; k < started; k++) {
+        pthread_join(groups[k].thread, NULL);
+    }
+    int status = atomic_load(&comp_stopped) ? comp_status : EXIT_SUCCESS;
+    free(groups);
+    exit(status);
+}
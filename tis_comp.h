@@ -0,0 +1,17 @@
+#ifndef _TIS_COMP_
+#define _TIS_COMP_
+
+#include "tis_types.h"
+
+/*
+ * Component execution (--components), for machines made of several independent parts.
+ *
+ * Nodes are only connected where one can write to a port that the other reads from, so a grid often falls apart into
+ * sub-grids that never exchange a value. These are found from the code of the nodes, balanced into groups, and each
+ * group is run by its own thread with no synchronisation, except for what is needed to keep halting exact; tis_comp.c
+ * describes that. The results are those of tick(), although outputs to different files may interleave differently.
+ */
+
+void run_components(tis_t* tis, size_t threads, long long timelimit); // only returns if there is nothing to split
+
+#endif /* _TIS_COMP_ */
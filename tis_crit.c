@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tis_crit.h"
+#include "tis_link.h"
+#include "tis_types.h"
+
+#define CRIT_NONE ((size_t)-1)
+
+/*
+ * Nodes are numbered as the grid, then the inputs, then the outputs
+ */
+typedef struct crit_state {
+    tis_t* tis;
+    tis_link_event_t* events;
+    size_t nevents;
+    size_t* first; // per node, the start of its events in list (length = nodes + 1)
+    size_t* list; // event indices, by node and then in order
+    size_t nodes;
+} crit_state_t;
+
+typedef struct crit_hop {
+    size_t node;
+    int line; // -1 if not a line of code
+    unsigned long long start; // the node's previous handoff
+    unsigned long long end; // when it wrote the value, or started reading it
+} crit_hop_t;
+
+typedef struct crit_node {
+    size_t node;
+    int line;
+    unsigned long long cycles; // on the critical path
+    unsigned long long gated; // output values
+    unsigned long long written; // values
+    unsigned long long slack; // cycles its values waited to be taken, beyond the one needed
+} crit_node_t;
+
+static size_t reader_node(tis_t* tis, size_t reader) {
+    return reader < tis->size ? reader : reader + tis->cols;
+}
+
+static int node_line(tis_t* tis, size_t node, int line) {
+    if(node >= tis->size || tis->nodes[node] == NULL || tis->nodes[node]->type != TIS_NODE_TYPE_COMPUTE) {
+        return -1;
+    }
+    return line;
+}
+
+static void crit_name(tis_t* tis, size_t node, char* buf, size_t len) {
+    if(node < tis->size) {
+        snprintf(buf, len, "%s", node_name(tis->nodes[node]));
+    } else if(node < tis->size + tis->cols) {
+        snprintf(buf, len, "I%zu", node - tis->size);
+    } else {
+        snprintf(buf, len, "O%zu", node - tis->size - tis->cols);
+    }
+}
+
+static const char* line_text(tis_t* tis, size_t node, int line) {
+    if(line < 0 || line >= TIS_NODE_LINE_COUNT || tis->nodes[node]->code[line] == NULL) {
+        return "";
+    }
+    return tis->nodes[node]->code[line]->linetext;
+}
+
+/*
+ * The last event of this node before event e that happened no later than cycle t, or CRIT_NONE
+ */
+static size_t previous(crit_state_t* c, size_t node, size_t e, unsigned long long t) {
+    size_t lo = c->first[node];
+    size_t hi = c->first[node + 1];
+    // Events of a node are in order, so first cut off e and everything after it...
+    size_t a = lo, b = hi;
+    while(a < b) {
+        size_t mid = a + (b - a) / 2;
+        if(c->list[mid] < e) {
+            a = mid + 1;
+        } else {
+            b = mid;
+        }
+    }
+    // ...then everything after t, since the cycles only go up
+    b = a;
+    a = lo;
+    while(a < b) {
+        size_t mid = a + (b - a) / 2;
+        if(c->events[c->list[mid]].taken <= t) {
+            a = mid + 1;
+        } else {
+            b = mid;
+        }
+    }
+    return a == lo ? CRIT_NONE : c->list[a - 1];
+}
+
+/*
+ * Follow the chain back from event e, down to cycle floor, into hops (which must have room for e + 1 of them).
+ * Returns the number of hops, latest first. The cycles of each handoff itself are added to handoff.
+ */
+static size_t follow(crit_state_t* c, size_t e, unsigned long long floor, crit_hop_t* hops, unsigned long long* handoff) {
+    size_t count = 0;
+    while(e != CRIT_NONE) {
+        tis_link_event_t* event = &(c->events[e]);
+        size_t node;
+        unsigned long long end;
+        int line;
+        if(event->since < event->taken) { // the reader was waiting, so the writer was late
+            node = event->writer;
+            end = event->posted;
+            line = event->writer_line;
+        } else {
+            node = reader_node(c->tis, event->reader);
+            end = event->since;
+            line = event->reader_line;
+        }
+        if(end <= floor) {
+            break;
+        }
+        size_t prev = previous(c, node, e, end);
+        unsigned long long start = prev == CRIT_NONE ? 0 : c->events[prev].taken;
+        hops[count++] = (crit_hop_t){ .node = node, .line = node_line(c->tis, node, line), .start = start < floor ? floor : start, .end = end };
+        *handoff += event->taken - end;
+        e = start <= floor ? CRIT_NONE : prev;
+    }
+    return count;
+}
+
+static int compare_cycles(const void* a, const void* b) {
+    unsigned long long ca = ((const crit_node_t*)a)->cycles;
+    unsigned long long cb = ((const crit_node_t*)b)->cycles;
+    return (ca < cb) - (ca > cb);
+}
+
+static int compare_gated(const void* a, const void* b) {
+    const crit_node_t* na = a;
+    const crit_node_t* nb = b;
+    if(na->gated != nb->gated) {
+        return (na->gated < nb->gated) - (na->gated > nb->gated);
+    }
+    return (na->node > nb->node) - (na->node < nb->node);
+}
+
+static void write_json(crit_state_t* c, const char* filename, crit_hop_t* path, size_t npath, crit_node_t* nodes, unsigned long long handoff) {
+    tis_t* tis = c->tis;
+    FILE* file = fopen(filename, "w");
+    if(file == NULL) {
+        error("Unable to open %s to write the critical path\n", filename);
+        return;
+    }
+    char name[128];
+    fprintf(file, "{\n  \"cycles\": %llu,\n  \"handoffs\": %zu,\n", tis->links->cycle, c->nevents);
+    fprintf(file, "  \"critical_path\": {\n    \"end\": %llu,\n    \"handoff_cycles\": %llu,\n    \"hops\": [",
+            npath > 0 ? c->events[c->nevents - 1].taken : 0, handoff);
+    for(size_t h = npath; h-- > 0;) {
+        crit_name(tis, path[h].node, name, sizeof(name));
+        fprintf(file, "%s\n      {\"node\": ", h + 1 == npath ? "" : ",");
+        json_string(file, name);
+        fprintf(file, ", \"line\": %d, \"text\": ", path[h].line);
+        json_string(file, path[h].line >= 0 ? line_text(tis, path[h].node, path[h].line) : "");
+        fprintf(file, ", \"start\": %llu, \"end\": %llu}", path[h].start, path[h].end);
+    }
+    fprintf(file, "\n    ]\n  },\n  \"nodes\": [");
+    int first = 1;
+    for(size_t n = 0; n < c->nodes; n++) {
+        if(c->first[n] == c->first[n + 1]) {
+            continue;
+        }
+        crit_name(tis, n, name, sizeof(name));
+        fprintf(file, "%s\n    {\"name\": ", first ? "" : ",");
+        json_string(file, name);
+        fprintf(file, ", \"critical_cycles\": %llu, \"gated_values\": %llu, \"values_written\": %llu, \"slack_per_value\": %g}",
+                nodes[n].cycles, nodes[n].gated, nodes[n].written, nodes[n].written == 0 ? 0.0 : (double)nodes[n].slack / nodes[n].written);
+        first = 0;
+    }
+    fprintf(file, "\n  ]\n}\n");
+    if(fclose(file) != 0) {
+        error("Unable to write the critical path to %s\n", filename);
+    }
+}
+
+/*
+ * Print the critical path and the nodes that gate the outputs on stderr, and write them to filename as JSON if that
+ * is not NULL. Called at exit, before free_links().
+ */
+void report_critical_path(tis_t* tis, const char* filename) {
+    if(tis->links == NULL || tis->links->events == NULL) {
+        return;
+    }
+    crit_state_t c = {
+        .tis = tis,
+        .events = tis->links->events,
+        .nevents = tis->links->nevents,
+        .nodes = tis->size + 2 * tis->cols,
+    };
+    c.first = calloc(c.nodes + 1, sizeof(size_t));
+    c.list = malloc(2 * c.nevents * sizeof(size_t) + 1);
+    crit_hop_t* hops = malloc((c.nevents + 1) * sizeof(crit_hop_t));
+    crit_node_t* nodes = calloc(c.nodes + 1, sizeof(crit_node_t));
+    unsigned long long* last_output = calloc(tis->cols + 1, sizeof(unsigned long long));
+    if(c.first == NULL || c.list == NULL || hops == NULL || nodes == NULL || last_output == NULL) {
+        error("Unable to allocate memory for the critical path\n");
+        goto done;
+    }
+
+    // Index the events by node
+    for(size_t e = 0; e < c.nevents; e++) {
+        c.first[c.events[e].writer + 1]++;
+        c.first[reader_node(tis, c.events[e].reader) + 1]++;
+    }
+    for(size_t n = 0; n < c.nodes; n++) {
+        c.first[n + 1] += c.first[n];
+    }
+    for(size_t e = 0; e < c.nevents; e++) {
+        // first[n] is moved up as the list fills, and ends up at the start of the next node
+        c.list[c.first[c.events[e].writer]++] = e;
+        c.list[c.first[reader_node(tis, c.events[e].reader)]++] = e;
+    }
+    for(size_t n = c.nodes; n > 0; n--) {
+        c.first[n] = c.first[n - 1];
+    }
+    c.first[0] = 0;
+
+    for(size_t n = 0; n < c.nodes; n++) {
+        nodes[n].node = n;
+        nodes[n].line = -1;
+    }
+    size_t last = CRIT_NONE;
+    for(size_t e = 0; e < c.nevents; e++) {
+        tis_link_event_t* event = &(c.events[e]);
+        nodes[event->writer].written++;
+        nodes[event->writer].slack += event->taken - event->posted - 1;
+        if(event->reader < tis->size) {
+            continue;
+        }
+        // Which node did the most work between the previous value of this output and this one?
+        size_t col = event->reader - tis->size;
+        unsigned long long ignored = 0;
+        size_t count = follow(&c, e, last_output[col], hops, &ignored);
+        size_t gate = CRIT_NONE;
+        for(size_t h = 0; h < count; h++) {
+            if(hops[h].node < tis->size + tis->cols && (gate == CRIT_NONE || hops[h].end - hops[h].start > hops[gate].end - hops[gate].start)) {
+                gate = h;
+            }
+        }
+        if(gate != CRIT_NONE) {
+            nodes[hops[gate].node].gated++;
+        }
+        last_output[col] = event->taken;
+        last = e;
+    }
+
+    if(last == CRIT_NONE) {
+        fprintf(stderr, "Critical path: no output values in %llu cycles\n", tis->links->cycle);
+        goto done;
+    }
+    unsigned long long handoff = 0;
+    size_t npath = follow(&c, last, 0, hops, &handoff);
+    for(size_t h = 0; h < npath; h++) {
+        nodes[hops[h].node].cycles += hops[h].end - hops[h].start;
+    }
+    char name[128];
+    crit_name(tis, reader_node(tis, c.events[last].reader), name, sizeof(name));
+    fprintf(stderr, "Critical path: last value reached %s at cycle %llu, after %zu stretches of work and %llu cycles of handoffs\n",
+            name, c.events[last].taken, npath, handoff);
+
+    // The path by line of code, longest first
+    crit_node_t* lines = calloc(npath + 1, sizeof(crit_node_t));
+    size_t nlines = 0;
+    for(size_t h = 0; lines != NULL && h < npath; h++) {
+        size_t l = 0;
+        while(l < nlines && !(lines[l].node == hops[h].node && lines[l].line == hops[h].line)) {
+            l++;
+        }
+        if(l == nlines) {
+            lines[nlines++] = (crit_node_t){ .node = hops[h].node, .line = hops[h].line };
+        }
+        lines[l].cycles += hops[h].end - hops[h].start;
+    }
+    if(lines != NULL) {
+        qsort(lines, nlines, sizeof(crit_node_t), compare_cycles);
+        size_t shown = (opts.verbose > 0 || nlines < TIS_CRIT_TABLE_ROWS) ? nlines : TIS_CRIT_TABLE_ROWS;
+        fprintf(stderr, "%-32s %4s  %-24s %10s\n", "node", "line", "text", "cycles");
+        for(size_t l = 0; l < shown; l++) {
+            crit_name(tis, lines[l].node, name, sizeof(name));
+            if(lines[l].line >= 0) {
+                fprintf(stderr, "%-32s %4d  %-24.24s %10llu\n", name, lines[l].line, line_text(tis, lines[l].node, lines[l].line), lines[l].cycles);
+            } else {
+                fprintf(stderr, "%-32s %4s  %-24s %10llu\n", name, "", "", lines[l].cycles);
+            }
+        }
+        if(shown < nlines) {
+            fprintf(stderr, "(%zu more lines, use -v to show all)\n", nlines - shown);
+        }
+        free(lines);
+    }
+
+    // The nodes that gated output values, most first, with their slack
+    crit_node_t* gating = malloc(c.nodes * sizeof(crit_node_t) + 1);
+    if(gating != NULL) {
+        memcpy(gating, nodes, c.nodes * sizeof(crit_node_t));
+        qsort(gating, c.nodes, sizeof(crit_node_t), compare_gated);
+        fprintf(stderr, "%-32s %12s %12s\n", "node", "gated values", "slack/value");
+        for(size_t n = 0; n < c.nodes && gating[n].gated > 0; n++) {
+            crit_name(tis, gating[n].node, name, sizeof(name));
+            fprintf(stderr, "%-32s %12llu %12.2f\n", name, gating[n].gated, gating[n].written == 0 ? 0.0 : (double)gating[n].slack / gating[n].written);
+        }
+        free(gating);
+    }
+
+    if(filename != NULL) {
+        write_json(&c, filename, hops, npath, nodes, handoff);
+    }
+
+done:
+    free(c.first);
+    free(c.list);
+    free(hops);
+    free(nodes);
+    free(last_output);
+}
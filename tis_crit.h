@@ -0,0 +1,20 @@
+#ifndef _TIS_CRIT_
+#define _TIS_CRIT_
+
+#include "tis_types.h"
+
+/*
+ * Critical path analysis (--critical-path), after the run.
+ *
+ * The run keeps a log of every value handed from one node to another (see tis_link.h). Every handoff waited for one of
+ * its two ends: if the reader was already waiting, the writer was late, and otherwise the reader was. Following the
+ * late end back to its previous handoff, and so on, gives the chain of work that an output value had to wait for. The
+ * chain behind the last output value is the critical path of the run. Between two values of one output, the node
+ * with the longest stretch of work on the chain is the one that gated that value.
+ */
+
+#define TIS_CRIT_TABLE_ROWS 20 // lines of the critical path shown, unless verbose
+
+void report_critical_path(tis_t* tis, const char* filename);
+
+#endif /* _TIS_CRIT_ */
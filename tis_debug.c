@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "tis_debug.h"
+#include "tis_lex.h"
+#include "tis_link.h"
+#include "tis_node.h"
+#include "tis_travel.h"
+#include "tis_types.h"
+
+static const char* cmp_names[] = { "", "==", "!=", "<", ">", "<=", ">=" };
+static const tis_register_t ports[4] = { TIS_REGISTER_UP, TIS_REGISTER_DOWN, TIS_REGISTER_LEFT, TIS_REGISTER_RIGHT };
+static const tis_register_t opposite[4] = { TIS_REGISTER_DOWN, TIS_REGISTER_UP, TIS_REGISTER_RIGHT, TIS_REGISTER_LEFT };
+
+static int compare(tis_debug_cmp_t cmp, long long a, long long b) {
+    switch(cmp) {
+        case TIS_DEBUG_CMP_EQ: return a == b;
+        case TIS_DEBUG_CMP_NE: return a != b;
+        case TIS_DEBUG_CMP_LT: return a < b;
+        case TIS_DEBUG_CMP_GT: return a > b;
+        case TIS_DEBUG_CMP_LE: return a <= b;
+        case TIS_DEBUG_CMP_GE: return a >= b;
+        case TIS_DEBUG_CMP_NONE:
+        default: return 1;
+    }
+}
+
+static const char* slot_name(tis_t* tis, size_t slot) {
+    static char name[32];
+    if(slot < tis->nactive) {
+        return node_name(tis->active[slot]);
+    }
+    size_t c = slot - tis->nactive;
+    snprintf(name, sizeof(name), "%c%zu", c < tis->cols ? 'I' : 'O', c % tis->cols);
+    return name;
+}
+
+static size_t grid_index(tis_t* tis, tis_node_t* node) {
+    return node->row * tis->cols + node->col;
+}
+
+/*
+ * The neighbors written through, and what each was writing
+ */
+static void read_writers(tis_t* tis, tis_debug_point_t* p) {
+    for(int d = 0; d < 4; d++) {
+        size_t w = p->writer[d];
+        tis_node_t* node = w < tis->size ? tis->nodes[w] : NULL;
+        tis_io_node_t* io = w >= tis->size && w < tis->size + tis->cols ? tis->inputs[w - tis->size] : NULL;
+        p->writereg[d] = node != NULL ? node->writereg : io != NULL ? io->writereg : TIS_REGISTER_INVALID;
+        p->writebuf[d] = node != NULL ? node->writebuf : io != NULL ? io->writebuf : 0;
+    }
+}
+
+/*
+ * Begin patching
+ */
+
+static void patch(tis_t* tis, tis_node_t* node, int line) {
+    tis_debug_t* debug = tis->travel->debug;
+    size_t id = grid_index(tis, node);
+    if(debug->original[id] == NULL) {
+        // the code may be shared with other nodes, so patch a copy of its own
+        debug->original[id] = node->code;
+        node->code = arena_calloc(&(tis->arena), TIS_NODE_LINE_COUNT, sizeof(tis_op_t*));
+        memcpy(node->code, debug->original[id], TIS_NODE_LINE_COUNT * sizeof(tis_op_t*));
+    }
+    if(node->code[line]->type != TIS_OP_TYPE_BREAK) {
+        tis_op_t* op = arena_alloc(&(tis->arena), sizeof(tis_op_t));
+        *op = *(debug->original[id][line]);
+        op->type = TIS_OP_TYPE_BREAK;
+        node->code[line] = op;
+    }
+}
+
+static void unpatch(tis_t* tis, tis_node_t* node, int line) {
+    tis_debug_t* debug = tis->travel->debug;
+    for(size_t i = 0; i < debug->npoints; i++) {
+        tis_debug_point_t* p = &(debug->points[i]);
+        if(p->number != 0 && p->kind == TIS_DEBUG_BREAK && p->node == node && p->line == line) {
+            return; // another breakpoint is still on the line
+        }
+    }
+    node->code[line] = debug->original[grid_index(tis, node)][line];
+}
+
+tis_op_t* debug_original(tis_t* tis, tis_node_t* node) {
+    return tis->travel->debug->original[grid_index(tis, node)][node->index];
+}
+
+/*
+ * A node runs a patched line. This is called again each cycle it waits on the line, which only counts as arriving at
+ * it if the node was not already waiting at the end of the last cycle.
+ */
+tis_op_t* debug_break(tis_t* tis, tis_node_t* node) {
+    tis_debug_t* debug = tis->travel->debug;
+    if(node->laststate != TIS_NODE_STATE_READ_WAIT && node->laststate != TIS_NODE_STATE_WRITE_WAIT) {
+        for(size_t i = 0; i < debug->npoints; i++) {
+            tis_debug_point_t* p = &(debug->points[i]);
+            if(p->number != 0 && p->kind == TIS_DEBUG_BREAK && p->node == node && p->line == node->index) {
+                p->hit = p->hit || compare(p->cmp, travel_field_value(tis, p->slot, p->cond_field), p->value);
+            }
+        }
+    }
+    return debug_original(tis, node);
+}
+
+/*
+ * Begin points
+ */
+
+static tis_debug_point_t* add_point(tis_t* tis, tis_debug_kind_t kind, size_t slot) {
+    tis_debug_t* debug = tis->travel->debug;
+    if(debug->npoints == debug->maxpoints) {
+        size_t maxpoints = debug->maxpoints == 0 ? 16 : 2 * debug->maxpoints;
+        tis_debug_point_t* points = realloc(debug->points, maxpoints * sizeof(tis_debug_point_t));
+        if(points == NULL) {
+            error("Unable to allocate memory for breakpoints\n");
+            bork();
+        }
+        debug->points = points;
+        debug->maxpoints = maxpoints;
+    }
+    tis_debug_point_t* p = &(debug->points[debug->npoints++]);
+    memset(p, 0, sizeof(tis_debug_point_t));
+    p->number = ++debug->numbered;
+    p->kind = kind;
+    p->slot = slot;
+    return p;
+}
+
+static void print_point(tis_t* tis, tis_debug_point_t* p) {
+    if(p->kind == TIS_DEBUG_BREAK) {
+        fprintf(stderr, "break %s line %d (%s)", node_name(p->node), p->line, p->node->code[p->line]->linetext);
+        if(p->cmp != TIS_DEBUG_CMP_NONE) {
+            fprintf(stderr, " if %s %s %d", travel_field_names[p->cond_field], cmp_names[p->cmp], p->value);
+        }
+    } else if(p->kind == TIS_DEBUG_FIELD) {
+        fprintf(stderr, "watch %s %s", slot_name(tis, p->slot), travel_field_names[p->field]);
+        if(p->cmp != TIS_DEBUG_CMP_NONE) {
+            fprintf(stderr, " %s %d", cmp_names[p->cmp], p->value);
+        }
+    } else {
+        fprintf(stderr, "watch %s %s", slot_name(tis, p->slot), reg_to_string(p->port));
+        if(p->cmp != TIS_DEBUG_CMP_NONE) {
+            fprintf(stderr, " %s %d", cmp_names[p->cmp], p->value);
+        }
+    }
+}
+
+static int add_break(tis_t* tis, long slot, int line, int cond_field, tis_debug_cmp_t cmp, int value) {
+    tis_node_t* node = slot >= 0 && (size_t)slot < tis->nactive ? tis->active[slot] : NULL;
+    if(node == NULL || node->type != TIS_NODE_TYPE_COMPUTE) {
+        error("Breakpoints can only be on compute nodes\n");
+        return -1;
+    }
+    if(line < 0 || line >= TIS_NODE_LINE_COUNT || node->code[line] == NULL || node->code[line]->type == TIS_OP_TYPE_INVALID) {
+        error("There is no instruction on line %d of %s\n", line, node_name(node));
+        return -1;
+    }
+    tis_debug_point_t* p = add_point(tis, TIS_DEBUG_BREAK, slot);
+    p->node = node;
+    p->line = line;
+    p->cond_field = cond_field;
+    p->cmp = cmp;
+    p->value = value;
+    patch(tis, node, line);
+    fprintf(stderr, "Breakpoint %d: ", p->number);
+    print_point(tis, p);
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+static int parse_cmp(const char* arg, const char* value, tis_debug_cmp_t* cmp, int* v) {
+    char* end;
+    *cmp = TIS_DEBUG_CMP_NONE;
+    for(int k = TIS_DEBUG_CMP_EQ; arg != NULL && k <= TIS_DEBUG_CMP_GE; k++) {
+        if(strcmp(arg, cmp_names[k]) == 0) {
+            *cmp = k;
+        }
+    }
+    if(*cmp == TIS_DEBUG_CMP_NONE || value == NULL) {
+        error("A condition is <op> <value>, with one of == != < > <= >=\n");
+        return -1;
+    }
+    *v = strtol(value, &end, 10);
+    if(end == value || *end != '\0') {
+        error("Invalid number '%s'\n", value);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * break <node> <line> [if <field> <op> <value>]
+ */
+static void command_break(tis_t* tis, char** args) {
+    tis_debug_cmp_t cmp = TIS_DEBUG_CMP_NONE;
+    int value = 0, field = TRAVEL_FIELD_ACC;
+    char* end;
+    if(args[0] == NULL || args[1] == NULL) {
+        error("break needs a node and a line\n");
+        return;
+    }
+    long slot = travel_find_node(tis, args[0]);
+    long line = strtol(args[1], &end, 10);
+    if(slot < 0) {
+        return;
+    } else if(end == args[1] || *end != '\0') {
+        error("Invalid line '%s'\n", args[1]);
+        return;
+    } else if(args[2] != NULL) {
+        if(strcmp(args[2], "if") != 0 || args[3] == NULL) {
+            error("A breakpoint condition is if <field> <op> <value>\n");
+            return;
+        } else if((field = travel_field_named(args[3])) < 0 || parse_cmp(args[4], args[5], &cmp, &value) < 0) {
+            return;
+        }
+    }
+    add_break(tis, slot, line, field, cmp, value);
+}
+
+/*
+ * watch <node> line|acc|bak|<port> [<op> <value>], or watch O<col> [<op> <value>]
+ */
+static void command_watch(tis_t* tis, char** args) {
+    tis_debug_cmp_t cmp = TIS_DEBUG_CMP_NONE;
+    int value = 0;
+    long slot = args[0] == NULL ? -1 : travel_find_node(tis, args[0]);
+    if(args[0] == NULL) {
+        error("watch needs a node\n");
+        return;
+    } else if(slot < 0) {
+        return;
+    }
+    int output = (size_t)slot >= tis->nactive + tis->cols;
+    char** rest = output ? &(args[1]) : &(args[2]);
+    if((size_t)slot >= tis->nactive && !output) {
+        error("Inputs cannot be watched; watch the port that reads them\n");
+        return;
+    } else if(!output && args[1] == NULL) {
+        error("watch needs line, acc, bak or a port of the node\n");
+        return;
+    } else if(rest[0] != NULL && parse_cmp(rest[0], rest[1], &cmp, &value) < 0) {
+        return;
+    }
+    tis_register_t port = output ? TIS_REGISTER_UP : lex_register(args[1]);
+    int field = -1;
+    if(port != TIS_REGISTER_UP && port != TIS_REGISTER_DOWN && port != TIS_REGISTER_LEFT && port != TIS_REGISTER_RIGHT && port != TIS_REGISTER_ANY) {
+        field = strcasecmp(args[1], "line") == 0 ? TRAVEL_FIELD_LINE : strcasecmp(args[1], "acc") == 0 ? TRAVEL_FIELD_ACC : strcasecmp(args[1], "bak") == 0 ? TRAVEL_FIELD_BAK : -1;
+        if(field < 0) {
+            error("There is no field or port '%s'; give line, acc, bak, UP, DOWN, LEFT, RIGHT or ANY\n", args[1]);
+            return;
+        }
+    }
+    tis_debug_point_t* p = add_point(tis, field < 0 ? TIS_DEBUG_PORT : TIS_DEBUG_FIELD, slot);
+    p->field = field;
+    p->port = port;
+    p->cmp = cmp;
+    p->value = value;
+    if(field < 0) {
+        // readers are numbered as in tis_link.h: grid, then outputs
+        tis_node_t* node = output ? NULL : tis->active[slot];
+        size_t reader = output ? tis->size + (slot - tis->nactive - tis->cols) : grid_index(tis, node);
+        for(int d = 0; d < 4; d++) {
+            int edge = node == NULL ? d != 0 :
+                (d == 1 && node->row + 1 == tis->rows) || (d == 2 && node->col == 0) || (d == 3 && node->col + 1 == tis->cols);
+            p->writer[d] = edge || (port != TIS_REGISTER_ANY && port != ports[d]) ? tis->size + tis->cols : link_writer(tis, reader, ports[d]);
+        }
+    }
+    fprintf(stderr, "Watchpoint %d: ", p->number);
+    print_point(tis, p);
+    fprintf(stderr, "\n");
+}
+
+static void command_delete(tis_t* tis, char** args) {
+    tis_debug_t* debug = tis->travel->debug;
+    char* end;
+    long number = args[0] == NULL ? 0 : strtol(args[0], &end, 10);
+    for(size_t i = 0; number > 0 && *end == '\0' && i < debug->npoints; i++) {
+        tis_debug_point_t* p = &(debug->points[i]);
+        if(p->number == number) {
+            p->number = 0;
+            if(p->kind == TIS_DEBUG_BREAK) {
+                unpatch(tis, p->node, p->line);
+            }
+            return;
+        }
+    }
+    error("There is no breakpoint or watchpoint '%s'; see info\n", args[0] == NULL ? "" : args[0]);
+}
+
+/*
+ * Run one of the commands of this module. Returns a true value if it was one.
+ */
+int debug_command(tis_t* tis, const char* cmd, char** args) {
+    tis_debug_t* debug = tis->travel->debug;
+    if(strcmp(cmd, "break") == 0 || strcmp(cmd, "bp") == 0) {
+        command_break(tis, args);
+    } else if(strcmp(cmd, "watch") == 0 || strcmp(cmd, "w") == 0) {
+        command_watch(tis, args);
+    } else if(strcmp(cmd, "delete") == 0 || strcmp(cmd, "d") == 0) {
+        command_delete(tis, args);
+    } else if(strcmp(cmd, "info") == 0 || strcmp(cmd, "i") == 0) {
+        size_t shown = 0;
+        for(size_t i = 0; i < debug->npoints; i++) {
+            tis_debug_point_t* p = &(debug->points[i]);
+            if(p->number != 0) {
+                fprintf(stderr, "%-3d ", p->number);
+                print_point(tis, p);
+                fprintf(stderr, "  hit %llu time%s\n", p->hits, p->hits == 1 ? "" : "s");
+                shown++;
+            }
+        }
+        if(shown == 0) {
+            fprintf(stderr, "No breakpoints or watchpoints\n");
+        }
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Begin running
+ */
+
+/*
+ * Take the state the watchpoints compare with from this cycle, before running on
+ */
+void debug_arm(tis_t* tis) {
+    tis_debug_t* debug = tis->travel->debug;
+    for(size_t i = 0; i < debug->npoints; i++) {
+        tis_debug_point_t* p = &(debug->points[i]);
+        p->hit = 0;
+        if(p->skip != tis->travel->cycle + 1) {
+            p->skip = 0;
+        }
+        if(p->kind == TIS_DEBUG_FIELD) {
+            p->before = travel_field_value(tis, p->slot, p->field);
+        } else if(p->kind == TIS_DEBUG_PORT) {
+            read_writers(tis, p);
+        }
+    }
+}
+
+/*
+ * After a cycle of run, report the points hit by it, and take the state for the next. Returns the node to show, or -1
+ * to run on. back is set if a breakpoint was hit, and the cycle should be undone to stop before the line runs.
+ */
+long debug_check(tis_t* tis, int* back) {
+    tis_debug_t* debug = tis->travel->debug;
+    unsigned long long cycle = tis->travel->cycle;
+    long show = -1;
+    *back = 0;
+    for(size_t i = 0; i < debug->npoints; i++) {
+        tis_debug_point_t* p = &(debug->points[i]);
+        int hit = 0;
+        if(p->number == 0) {
+            continue;
+        } else if(p->kind == TIS_DEBUG_BREAK) {
+            if(p->hit && p->skip != cycle) {
+                fprintf(stderr, "Breakpoint %d, %s line %d (%s), in cycle %llu\n", p->number, node_name(p->node), p->line, p->node->code[p->line]->linetext, cycle);
+                p->skip = cycle;
+                *back = 1;
+                hit = 1;
+            } else {
+                p->skip = 0;
+            }
+            p->hit = 0;
+        } else if(p->kind == TIS_DEBUG_FIELD) {
+            long long now = travel_field_value(tis, p->slot, p->field);
+            hit = p->cmp == TIS_DEBUG_CMP_NONE ? now != p->before : compare(p->cmp, now, p->value) && !compare(p->cmp, p->before, p->value);
+            if(hit) {
+                fprintf(stderr, "Watchpoint %d, %s of %s: %lld -> %lld, in cycle %llu\n", p->number, travel_field_names[p->field], slot_name(tis, p->slot), p->before, now, cycle);
+            }
+            p->before = now;
+        } else {
+            tis_register_t writereg[4];
+            int writebuf[4];
+            memcpy(writereg, p->writereg, sizeof(writereg));
+            memcpy(writebuf, p->writebuf, sizeof(writebuf));
+            read_writers(tis, p);
+            for(int d = 0; d < 4; d++) {
+                size_t w = p->writer[d];
+                if(p->writereg[d] != TIS_REGISTER_INVALID || !(writereg[d] == opposite[d] || writereg[d] == TIS_REGISTER_ANY)) {
+                    continue; // not taken, or not written this way
+                } else if(writereg[d] == TIS_REGISTER_ANY && (w >= tis->size || tis->nodes[w]->last != opposite[d])) {
+                    continue; // taken by another neighbor
+                } else if(compare(p->cmp, writebuf[d], p->value)) {
+                    fprintf(stderr, "Watchpoint %d, %s took %d from %s, in cycle %llu\n", p->number, slot_name(tis, p->slot), writebuf[d], reg_to_string(ports[d]), cycle);
+                    hit = 1;
+                }
+            }
+        }
+        if(hit) {
+            p->hits++;
+            show = show < 0 ? (long)p->slot : show;
+        }
+    }
+    return show;
+}
+
+/*
+ * Begin setting up
+ */
+
+/*
+ * Set a breakpoint on every line marked with '!' in the source
+ */
+void init_debug(tis_t* tis) {
+    tis_debug_t* debug = calloc(1, sizeof(tis_debug_t));
+    if(debug == NULL || (debug->original = calloc(tis->size + 1, sizeof(tis_op_t**))) == NULL) {
+        error("Unable to allocate memory for breakpoints\n");
+        bork();
+    }
+    tis->travel->debug = debug;
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        for(int line = 0; node->type == TIS_NODE_TYPE_COMPUTE && line < TIS_NODE_LINE_COUNT; line++) {
+            tis_op_t* op = node->code[line];
+            if(op != NULL && op->type != TIS_OP_TYPE_INVALID && op->linetext != NULL && lex_breakpoint(op->linetext) != NULL) {
+                add_break(tis, i, line, TRAVEL_FIELD_ACC, TIS_DEBUG_CMP_NONE, 0);
+            }
+        }
+    }
+}
+
+void free_debug(tis_t* tis) {
+    tis_debug_t* debug = tis->travel == NULL ? NULL : tis->travel->debug;
+    if(debug == NULL) {
+        return;
+    }
+    safe_free(debug->points);
+    safe_free(debug->original);
+    safe_free(tis->travel->debug);
+}
@@ -0,0 +1,74 @@
+#ifndef _TIS_DEBUG_
+#define _TIS_DEBUG_
+
+#include "tis_types.h"
+
+/*
+ * Breakpoints and watchpoints, in the --travel command loop.
+ *
+ * A breakpoint is set on a line of a compute node, from the loop or by starting the line with '!' in the source (as
+ * in the game), optionally with a condition on the node. Lines with a breakpoint are patched in the decoded program:
+ * the node gets a copy of its code in which that line is an op of type TIS_OP_TYPE_BREAK, which step() hands to
+ * debug_break() and then runs the original op in its place. Nothing else is checked while running, so a machine
+ * without breakpoints runs the same code as one without --travel.
+ *
+ * A watchpoint is on a field of a node (line, acc or bak), which stops when it changes or when a condition on it
+ * becomes true, or on a port of a node or an output, which stops when a value is taken through it. Ports are watched
+ * from the side of the writer: a value written always waits at the end of at least one cycle, and if the writer was
+ * waiting on the port at the end of the last cycle and is not writing at the end of this one, the reader took it.
+ * Watchpoints are checked after each cycle of run, and only then.
+ */
+
+typedef enum tis_debug_kind {
+    TIS_DEBUG_BREAK,
+    TIS_DEBUG_FIELD,
+    TIS_DEBUG_PORT,
+} tis_debug_kind_t;
+
+typedef enum tis_debug_cmp {
+    TIS_DEBUG_CMP_NONE = 0,
+    TIS_DEBUG_CMP_EQ,
+    TIS_DEBUG_CMP_NE,
+    TIS_DEBUG_CMP_LT,
+    TIS_DEBUG_CMP_GT,
+    TIS_DEBUG_CMP_LE,
+    TIS_DEBUG_CMP_GE,
+} tis_debug_cmp_t;
+
+typedef struct tis_debug_point {
+    int number; // as shown, from 1; 0 once deleted
+    tis_debug_kind_t kind;
+    size_t slot; // the node, see travel_find_node()
+    tis_node_t* node; // the compute node of a breakpoint
+    int line; // of a breakpoint
+    int field; // of a field watchpoint, see travel_field_t
+    tis_register_t port; // of a port watchpoint, ANY for all four
+    int cond_field; // of a breakpoint condition
+    tis_debug_cmp_t cmp;
+    int value;
+    unsigned long long hits; // times it stopped the machine
+    unsigned long long skip; // a breakpoint stopped before this cycle, and is not hit by it when continuing
+    int hit; // a breakpoint was hit in the last cycle run
+    long long before; // a field as of the last cycle
+    size_t writer[4]; // the neighbors of a port (UP, DOWN, LEFT, RIGHT), size + cols if none, see link_writer()
+    tis_register_t writereg[4]; // their writereg as of the last cycle
+    int writebuf[4];
+} tis_debug_point_t;
+
+typedef struct tis_debug {
+    tis_debug_point_t* points;
+    size_t npoints;
+    size_t maxpoints;
+    int numbered; // points numbered so far
+    tis_op_t*** original; // per grid index, the code before patching, or NULL if not patched
+} tis_debug_t;
+
+void init_debug(tis_t* tis);
+void free_debug(tis_t* tis);
+int debug_command(tis_t* tis, const char* cmd, char** args);
+void debug_arm(tis_t* tis);
+long debug_check(tis_t* tis, int* back);
+tis_op_t* debug_break(tis_t* tis, tis_node_t* node);
+tis_op_t* debug_original(tis_t* tis, tis_node_t* node);
+
+#endif /* _TIS_DEBUG_ */
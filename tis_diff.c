@@ -0,0 +1,469 @@
+#define _POSIX_C_SOURCE 200809L // for fork() and waitpid()
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tis_diff.h"
+#include "tis_io.h"
+#include "tis_node.h"
+#include "tis_prof.h"
+#include "tis_types.h"
+
+/*
+ * Begin engines
+ */
+
+/*
+ * Visit the nodes in tile order (see tile_order()), which must give the same results as row-major order
+ */
+static void prepare_tiled(tis_t* tis) {
+    size_t* order = tile_order(tis, 0, tis->rows);
+    for(size_t j = 0, k = 0; j < tis->size; j++) {
+        if(node_can_run(tis->nodes[order[j]])) {
+            tis->active[k++] = tis->nodes[order[j]];
+        }
+    }
+    free(order);
+}
+
+static void finish_profiled(tis_t* tis) {
+    free_profile(tis);
+}
+
+const tis_engine_t tis_engines[] = {
+    { "tick", "tick() itself, which must agree with itself", NULL, tick, NULL },
+    { "profiled", "tick_profiled(), the same code with the counting of --profile", init_profile, tick_profiled, finish_profiled },
+    { "tiled", "tick() visiting the nodes in tile order, as the bands of --partitions do", prepare_tiled, tick, NULL },
+    { NULL, NULL, NULL, NULL, NULL },
+};
+
+const tis_engine_t* find_engine(const char* name) {
+    for(const tis_engine_t* engine = tis_engines; engine->name != NULL; engine++) {
+        if(strcmp(engine->name, name) == 0) {
+            return engine;
+        }
+    }
+    error("There is no engine called '%s', the engines are:\n", name);
+    for(const tis_engine_t* engine = tis_engines; engine->name != NULL; engine++) {
+        error("    %-10s %s\n", engine->name, engine->about);
+    }
+    return NULL;
+}
+
+/*
+ * Begin lockstep
+ */
+
+typedef struct diff_result {
+    int quiescent;
+    int halted;
+    int status;
+} diff_result_t;
+
+static jmp_buf diff_resume;
+static int diff_status;
+
+static void diff_halt(int status) {
+    diff_status = status;
+    longjmp(diff_resume, 1);
+}
+
+/*
+ * Run one cycle, catching HCF and errors rather than exiting
+ */
+static diff_result_t step_engine(tis_t* tis, int (*tick_fn)(tis_t*)) {
+    diff_result_t result = { 0, 0, 0 };
+    tis_halt_hook = diff_halt;
+    if(setjmp(diff_resume) == 0) {
+        result.quiescent = tick_fn(tis);
+    } else {
+        result.halted = 1;
+        result.status = diff_status;
+    }
+    tis_halt_hook = NULL;
+    return result;
+}
+
+#define DIFF_FIELD(name, x, y) do { \
+    if((x) != (y)) {                \
+        field = name;               \
+        va = (x);                   \
+        vb = (y);                   \
+        goto differ;                \
+    }                               \
+} while(0)
+
+/*
+ * Compare the state of the two copies, and describe the first difference in buf. Returns 0 if they are the same.
+ */
+static int compare_state(tis_t* a, tis_t* b, char* buf, size_t len) {
+    const char* field;
+    long va, vb;
+    tis_node_t* na = NULL;
+    tis_io_node_t* ia = NULL;
+    for(size_t i = 0; i < a->size; i++) {
+        na = a->nodes[i];
+        tis_node_t* nb = b->nodes[i];
+        if(na == NULL || nb == NULL) {
+            DIFF_FIELD("presence", na != NULL, nb != NULL);
+            continue;
+        }
+        DIFF_FIELD("type", na->type, nb->type);
+        DIFF_FIELD("state", na->laststate, nb->laststate);
+        DIFF_FIELD("pending write", na->writereg, nb->writereg);
+        if(na->writereg != TIS_REGISTER_INVALID) {
+            DIFF_FIELD("value being written", na->writebuf, nb->writebuf);
+        }
+        if(na->type == TIS_NODE_TYPE_COMPUTE) {
+            DIFF_FIELD("instruction pointer", na->index, nb->index);
+            DIFF_FIELD("ACC", na->acc, nb->acc);
+            DIFF_FIELD("BAK", na->bak, nb->bak);
+            DIFF_FIELD("LAST", na->last, nb->last);
+        } else if(na->type == TIS_NODE_TYPE_MEMORY_STACK) {
+            DIFF_FIELD("stack depth", na->index, nb->index);
+            for(int cell = 0; cell < na->index && cell < TIS_MEM_CELL_COUNT; cell++) {
+                DIFF_FIELD("stack contents", na->data[cell], nb->data[cell]);
+            }
+        }
+    }
+    na = NULL;
+    for(size_t c = 0; c < 2 * a->cols; c++) {
+        int is_output = c >= a->cols;
+        size_t col = is_output ? c - a->cols : c;
+        ia = (is_output ? a->outputs : a->inputs)[col];
+        tis_io_node_t* ib = (is_output ? b->outputs : b->inputs)[col];
+        if(ia == NULL || ib == NULL) {
+            DIFF_FIELD("presence", ia != NULL, ib != NULL);
+            continue;
+        }
+        DIFF_FIELD("state", ia->laststate, ib->laststate);
+        DIFF_FIELD("pending write", ia->writereg, ib->writereg);
+        if(ia->writereg != TIS_REGISTER_INVALID) {
+            DIFF_FIELD("value being written", ia->writebuf, ib->writebuf);
+        }
+        DIFF_FIELD("values", (long)ia->values, (long)ib->values);
+        if(is_output && ia->values > 0) {
+            DIFF_FIELD("last value taken", ia->last, ib->last); // every value, when comparing after every cycle
+        }
+    }
+    return 0;
+
+differ:
+    if(na != NULL) {
+        tis_op_t* op = na->type == TIS_NODE_TYPE_COMPUTE && na->index >= 0 && na->index < TIS_NODE_LINE_COUNT ? na->code[na->index] : NULL;
+        if(op != NULL && op->type != TIS_OP_TYPE_INVALID) {
+            snprintf(buf, len, "%s on line %d (%s): %s is %ld, but %ld", node_name(na), na->index, op->linetext, field, va, vb);
+        } else {
+            snprintf(buf, len, "%s: %s is %ld, but %ld", node_name(na), field, va, vb);
+        }
+    } else if(ia != NULL) {
+        snprintf(buf, len, "%c%zu: %s is %ld, but %ld", ia == a->outputs[ia->col] ? 'O' : 'I', ia->col, field, va, vb);
+    } else {
+        snprintf(buf, len, "%s is %ld, but %ld", field, va, vb);
+    }
+    return 1;
+}
+
+/*
+ * Returns 0 if the copies can be run side by side, that is if neither reads a stream that they would share
+ */
+static int check_io(tis_t* tis) {
+    for(size_t c = 0; c < tis->cols; c++) {
+        tis_io_node_t* io = tis->inputs[c];
+        if(io != NULL && (!is_file_io(io->type) || io->file.file == stdin)) {
+            error("Lockstep runs need every input to read a file, I%zu does not\n", c);
+            return -1;
+        }
+        io = tis->outputs[c];
+        if(io != NULL && !is_file_io(io->type)) {
+            error("Lockstep runs need every output to write a file, O%zu does not\n", c);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Run ref with tick() and alt with the engine, which must be two fresh copies of the same machine, and compare them
+ * every so many cycles, and at the end. Returns 0 if they agree to the end, 1 if they differ (which is reported), or
+ * -1 if they cannot be compared. *status is set as the machine would exit.
+ */
+int run_lockstep(tis_t* ref, tis_t* alt, const tis_engine_t* engine, size_t every, long long cycles, int* status) {
+    *status = EXIT_SUCCESS;
+    if(check_io(ref) != 0) {
+        return -1;
+    }
+    for(size_t c = 0; c < alt->cols; c++) {
+        if(alt->outputs[c] != NULL) {
+            alt->outputs[c]->file.file = NULL; // dropped silently, and the handle is still closed at exit
+        }
+    }
+    init_tick(ref);
+    init_tick(alt);
+    if(engine->prepare != NULL) {
+        engine->prepare(alt);
+    }
+
+    int differ = 0;
+    char what[256];
+    long long time;
+    for(time = 0; cycles == 0 || time <= cycles; time++) {
+        diff_result_t ra = step_engine(ref, tick);
+        diff_result_t rb = step_engine(alt, engine->tick);
+        int last = ra.quiescent || ra.halted || (cycles != 0 && time == cycles);
+        if(ra.halted != rb.halted || ra.status != rb.status) {
+            snprintf(what, sizeof(what), "tick() %s, but %s %s", ra.halted ? "halted" : "did not halt", engine->name, rb.halted ? "halted" : "did not halt");
+            differ = 1;
+        } else if(ra.quiescent != rb.quiescent) {
+            snprintf(what, sizeof(what), "tick() %s quiescent, but %s %s", ra.quiescent ? "was" : "was not", engine->name, rb.quiescent ? "was" : "was not");
+            differ = 1;
+        } else if(!ra.halted && (last || (time + 1) % every == 0)) {
+            differ = compare_state(ref, alt, what, sizeof(what));
+        }
+        if(differ) {
+            error("The %s engine differs from tick() after cycle %lld: %s\n", engine->name, time + 1, what);
+            break;
+        }
+        if(last) {
+            *status = ra.halted ? ra.status : EXIT_SUCCESS;
+            break;
+        }
+    }
+    if(!differ) {
+        debug("The %s engine agrees with tick() for %lld cycles\n", engine->name, time + 1);
+    }
+    if(engine->finish != NULL) {
+        engine->finish(alt);
+    }
+    return differ;
+}
+
+/*
+ * Begin end to end
+ */
+
+/*
+ * Run this program on the machine as a process of its own, with one more option if not NULL, stdout going to path
+ * and stdin and stderr to /dev/null. Returns its wait status, or -1 if it could not be run.
+ */
+static int run_process(const char* option, long long cycles, const char* source, const char* layout, const char* path) {
+    char limit[32], tile[32];
+    snprintf(limit, sizeof(limit), "%lld", cycles);
+    snprintf(tile, sizeof(tile), "--tile-size=%zu", opts.tile_size);
+    char* argv[] = { "tis", "-c", limit, tile, (char*)source, (char*)layout, NULL, NULL };
+    if(option != NULL) {
+        memmove(&argv[5], &argv[4], 2 * sizeof(char*));
+        argv[4] = (char*)option;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0) {
+        int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int null = open("/dev/null", O_RDWR);
+        if(out >= 0 && null >= 0 && dup2(null, STDIN_FILENO) >= 0 && dup2(out, STDOUT_FILENO) >= 0 && dup2(null, STDERR_FILENO) >= 0) {
+            execv("/proc/self/exe", argv);
+        }
+        _exit(127);
+    } else if(pid < 0) {
+        error("Unable to start a process to run %s\n", source);
+        return -1;
+    }
+    int status;
+    while(waitpid(pid, &status, 0) < 0) {
+        if(errno != EINTR) {
+            return -1;
+        }
+    }
+    return status;
+}
+
+/*
+ * Returns 0 if the two files have the same contents, 1 if not, or -1 if one cannot be read
+ */
+static int compare_files(const char* a, const char* b) {
+    FILE* fa = fopen(a, "rb");
+    FILE* fb = fopen(b, "rb");
+    int result = fa == NULL || fb == NULL ? -1 : 0;
+    while(result == 0) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        if(ca != cb) {
+            result = 1;
+        } else if(ca == EOF) {
+            break;
+        }
+    }
+    if(fa != NULL) {
+        fclose(fa);
+    }
+    if(fb != NULL) {
+        fclose(fb);
+    }
+    return result;
+}
+
+int run_end_to_end(const char* dir, const char* source, const char* layout, long long cycles, char* option, size_t len) {
+    char reference[4096], path[4096];
+    snprintf(reference, sizeof(reference), "%s/out.txt", dir);
+    int expected = run_process(NULL, cycles, source, layout, reference);
+    if(expected < 0) {
+        return -1;
+    }
+    debug("The plain run of %s ends with wait status %d\n", source, expected);
+    const char* names[] = { "partitions", "components" };
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(option, len, "--%s=%d", names[i], TIS_FUZZ_WORKERS);
+        snprintf(path, sizeof(path), "%s/out-%s.txt", dir, names[i]);
+        int status = run_process(option, cycles, source, layout, path);
+        if(status < 0) {
+            return -1;
+        }
+        int differ = compare_files(reference, path);
+        if(differ < 0) {
+            error("Unable to read the outputs of %s\n", source);
+            return -1;
+        } else if(status != expected) {
+            error("The run with %s ends with wait status %d, but the plain run with %d\n", option, status, expected);
+            return 1;
+        } else if(differ) {
+            error("The run with %s writes %s, which differs from %s of the plain run\n", option, path, reference);
+            return 1;
+        }
+        unlink(path);
+    }
+    unlink(reference);
+    return 0;
+}
+
+/*
+ * Begin fuzzing
+ */
+
+static unsigned fuzz_next(unsigned* state) {
+    // xorshift32, so that a seed gives the same machine everywhere
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static unsigned fuzz_pick(unsigned* state, unsigned n) {
+    return fuzz_next(state) % n;
+}
+
+static const char* fuzz_source(unsigned* state, int jro) {
+    static const char* regs[] = { "ACC", "NIL", "UP", "DOWN", "LEFT", "RIGHT", "ANY", "LAST" };
+    static _Thread_local char buf[8];
+    if(fuzz_pick(state, 3) == 0) {
+        return regs[fuzz_pick(state, 8)];
+    }
+    int value = jro ? (int)fuzz_pick(state, 7) - 3 : fuzz_pick(state, 4) == 0 ? (int)fuzz_pick(state, 1999) - 999 : (int)fuzz_pick(state, 21) - 10;
+    snprintf(buf, sizeof(buf), "%d", value);
+    return buf;
+}
+
+static void fuzz_code(FILE* file, unsigned* state) {
+    static const char* dests[] = { "ACC", "NIL", "UP", "DOWN", "LEFT", "RIGHT", "ANY", "LAST" };
+    static const char* plain[] = { "NEG", "NOP", "SAV", "SWP" };
+    static const char* jumps[] = { "JMP", "JEZ", "JNZ", "JGZ", "JLZ" };
+    int lines = fuzz_pick(state, 9);
+    int labelled[TIS_NODE_LINE_COUNT];
+    int nlabels = 0;
+    for(int line = 0; line < lines; line++) {
+        if(fuzz_pick(state, 3) == 0) {
+            labelled[nlabels++] = line;
+        }
+    }
+    for(int line = 0, l = 0; line < lines; line++) {
+        if(l < nlabels && labelled[l] == line) {
+            fprintf(file, "%c:", 'A' + line); // short enough for any instruction to fit the line
+            l++;
+        }
+        unsigned kind = fuzz_pick(state, 100);
+        if(kind < 35) {
+            const char* src = fuzz_source(state, 0);
+            fprintf(file, "MOV %s, %s\n", src, dests[fuzz_pick(state, 8)]);
+        } else if(kind < 50) {
+            fprintf(file, "%s %s\n", fuzz_pick(state, 2) ? "ADD" : "SUB", fuzz_source(state, 0));
+        } else if(kind < 56) {
+            fprintf(file, "JRO %s\n", fuzz_source(state, 1));
+        } else if(kind < 72 && nlabels > 0) {
+            fprintf(file, "%s %c\n", jumps[fuzz_pick(state, 5)], 'A' + labelled[fuzz_pick(state, nlabels)]);
+        } else if(kind < 98) {
+            fprintf(file, "%s\n", plain[fuzz_pick(state, 4)]);
+        } else {
+            fprintf(file, "HCF\n");
+        }
+    }
+}
+
+/*
+ * Generate the random machine for this seed in dir: the code in source, the layout in layout, and the inputs that it
+ * reads. The names of the files are written to source and layout, which must hold len bytes, and the tile size to
+ * run it with to tile_size. Returns 0 on success.
+ */
+int fuzz_machine(unsigned seed, const char* dir, char* source, char* layout, size_t len, size_t* tile_size) {
+    unsigned state = seed * 2654435761u + 1; // never 0
+    size_t rows = 1 + fuzz_pick(&state, TIS_FUZZ_MAX_SIDE);
+    size_t cols = 1 + fuzz_pick(&state, TIS_FUZZ_MAX_SIDE);
+    snprintf(source, len, "%s/fuzz.tisasm", dir);
+    snprintf(layout, len, "%s/fuzz.tiscfg", dir);
+    FILE* code = fopen(source, "w");
+    FILE* config = fopen(layout, "w");
+    if(code == NULL || config == NULL) {
+        error("Unable to write a random machine in %s\n", dir);
+        if(code != NULL) {
+            fclose(code);
+        }
+        if(config != NULL) {
+            fclose(config);
+        }
+        return -1;
+    }
+
+    fprintf(config, "%zu %zu ", rows, cols);
+    int ncompute = 0;
+    for(size_t i = 0; i < rows * cols; i++) {
+        unsigned kind = fuzz_pick(&state, 20);
+        fputc(kind < 14 ? 'C' : kind < 17 ? 'S' : 'D', config);
+        ncompute += kind < 14;
+    }
+    for(size_t c = 0; c < cols; c++) {
+        if(fuzz_pick(&state, 2) == 0) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/in%zu.txt", dir, c);
+            FILE* input = fopen(path, "w");
+            if(input == NULL) {
+                error("Unable to write %s\n", path);
+                continue;
+            }
+            for(unsigned n = fuzz_pick(&state, 20); n > 0; n--) {
+                fprintf(input, "%d ", (int)fuzz_pick(&state, 1999) - 999);
+            }
+            fclose(input);
+            fprintf(config, " I%zu NUMERIC %s", c, path);
+        }
+        if(fuzz_pick(&state, 2) == 0) {
+            fprintf(config, " O%zu NUMERIC - 10", c); // all to stdout, one value a line, for the end to end runs
+        }
+    }
+    fprintf(config, "\n");
+    for(int id = 0; id < ncompute; id++) {
+        fprintf(code, "@%d\n", id);
+        fuzz_code(code, &state);
+        fprintf(code, "\n");
+    }
+    *tile_size = 1 + fuzz_pick(&state, 2); // picked last, so that each seed still gives the same machine
+    int failed = ferror(code) || ferror(config);
+    failed |= fclose(code) != 0;
+    failed |= fclose(config) != 0;
+    if(failed) {
+        error("Unable to write a random machine in %s\n", dir);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef _TIS_DIFF_
+#define _TIS_DIFF_
+
+#include "tis_types.h"
+
+/*
+ * Differential testing of engines against tick() (--lockstep and --fuzz).
+ *
+ * An engine is another way of running a machine one cycle at a time. To check one, the same machine is loaded twice,
+ * one copy is run by tick() and the other by the engine, and after every cycle (or every few) the whole state of the
+ * two is compared: registers, instruction pointers, pending writes, stack contents, the state of every node and io
+ * node and the values taken by each output (the last one, and how many), as well as quiescence and halting. The first
+ * difference is reported with the node and the line it was on. Outputs of the second copy are not written, so both
+ * copies must read their inputs from files.
+ *
+ * The fuzzer generates small random machines with every node type and instruction, including ANY, LAST and JRO from
+ * a register, and checks every engine on each of them. Each machine also gets a tile size of 1 or 2, so that the
+ * tiled engine and the bands of --partitions cut even these small grids into several tiles. --partitions and --components run across processes and
+ * threads, and cannot be stopped after a given cycle to compare, so they are checked end to end instead: the machine
+ * is run by this program in a process of its own as is, then with each of them, and what the runs write to their
+ * outputs (all on stdout) and their exit status must be the same.
+ */
+
+#ifndef TIS_FUZZ_CYCLES
+#define TIS_FUZZ_CYCLES 1000 // cycles to run each random machine, if there is no cycle limit
+#endif
+#define TIS_FUZZ_MAX_SIDE 4 // rows and columns of the random machines
+#define TIS_FUZZ_WORKERS 2 // partitions and threads of the end to end runs
+
+typedef struct tis_engine {
+    const char* name;
+    const char* about;
+    void (*prepare)(tis_t* tis); // after init_tick(), may be NULL
+    int (*tick)(tis_t* tis); // like tick()
+    void (*finish)(tis_t* tis); // may be NULL
+} tis_engine_t;
+
+extern const tis_engine_t tis_engines[]; // ends with a NULL name
+
+const tis_engine_t* find_engine(const char* name); // reports the engines and returns NULL if there is none by that name
+int run_lockstep(tis_t* ref, tis_t* alt, const tis_engine_t* engine, size_t every, long long cycles, int* status);
+int fuzz_machine(unsigned seed, const char* dir, char* source, char* layout, size_t len, size_t* tile_size);
+// Returns 0 if the end to end runs agree, 1 if one differs (reported, with its option in option), or -1 on error
+int run_end_to_end(const char* dir, const char* source, const char* layout, long long cycles, char* option, size_t len);
+
+#endif /* _TIS_DIFF_ */
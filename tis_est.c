@@ -0,0 +1,438 @@
+#define _POSIX_C_SOURCE 200809L // for clock_gettime()
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "tis_est.h"
+#include "tis_io.h"
+#include "tis_link.h"
+#include "tis_node.h"
+#include "tis_types.h"
+
+#define EST_NONE ((size_t)-1)
+#define EST_INPUT_COST 2 // cycles per value of an input, which writes like a MOV to a port
+#define EST_OUTPUT_COST 1
+
+/*
+ * Nodes are numbered as the grid, then the inputs, then the outputs.
+ * Ports are numbered as the registers, from UP.
+ */
+typedef struct est_node {
+    int modeled; // a compute node with a loop, or an io node
+    int halts; // reaches HCF, or a jump to a missing label
+    int approximate; // took a conditional jump as not taken, or uses ANY or LAST
+    unsigned cost; // cycles per pass through the loop
+    unsigned reads[4]; // per pass, by port
+    unsigned writes[4];
+    size_t part; // connected part, EST_NONE until reached
+    double rate; // passes per cycle
+} est_node_t;
+
+typedef struct est_row {
+    size_t node;
+    double load; // fraction of cycles busy
+} est_row_t;
+
+static jmp_buf est_resume;
+
+static int is_port(tis_register_t reg) {
+    return reg >= TIS_REGISTER_UP && reg <= TIS_REGISTER_RIGHT;
+}
+
+static int opposite(int port) {
+    return port ^ 1; // UP and DOWN, LEFT and RIGHT
+}
+_Static_assert(TIS_REGISTER_DOWN - TIS_REGISTER_UP == 1 && TIS_REGISTER_RIGHT - TIS_REGISTER_LEFT == 1 &&
+               TIS_REGISTER_LEFT - TIS_REGISTER_UP == 2, "ports must come in opposite pairs");
+
+static void est_name(tis_t* tis, size_t node, char* buf, size_t len) {
+    if(node < tis->size) {
+        snprintf(buf, len, "%s", node_name(tis->nodes[node]));
+    } else if(node < tis->size + tis->cols) {
+        snprintf(buf, len, "I%zu", node - tis->size);
+    } else {
+        snprintf(buf, len, "O%zu", node - tis->size - tis->cols);
+    }
+}
+
+/*
+ * The node on the other side of this port, or EST_NONE
+ */
+static size_t neighbor(tis_t* tis, size_t node, int port) {
+    if(tis->rows == 0) { // only io nodes, with no grid between them to estimate
+        return EST_NONE;
+    } else if(node >= tis->size + tis->cols) { // output
+        size_t col = node - tis->size - tis->cols;
+        return port == TIS_REGISTER_UP - TIS_REGISTER_UP ? (tis->rows - 1) * tis->cols + col : EST_NONE;
+    } else if(node >= tis->size) { // input
+        return port == TIS_REGISTER_DOWN - TIS_REGISTER_UP ? node - tis->size : EST_NONE;
+    }
+    size_t row = node / tis->cols, col = node % tis->cols;
+    switch(port + TIS_REGISTER_UP) {
+        case TIS_REGISTER_UP: return row > 0 ? node - tis->cols : tis->size + col;
+        case TIS_REGISTER_DOWN: return row + 1 < tis->rows ? node + tis->cols : tis->size + tis->cols + col;
+        case TIS_REGISTER_LEFT: return col > 0 ? node - 1 : EST_NONE;
+        case TIS_REGISTER_RIGHT: return col + 1 < tis->cols ? node + 1 : EST_NONE;
+        default: return EST_NONE;
+    }
+}
+
+/*
+ * The line that runs from index, as run() skips empty ones, or -1 if there is none
+ */
+static int valid_line(tis_op_t** code, int index) {
+    for(int n = 0; n < TIS_NODE_LINE_COUNT; n++) {
+        int line = (index + n) % TIS_NODE_LINE_COUNT;
+        if(code[line] != NULL && code[line]->type != TIS_OP_TYPE_INVALID) {
+            return line;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Where JRO by a constant lands, which does not wrap
+ */
+static int relative_line(tis_op_t** code, int index, int offset) {
+    int step = offset >= 0 ? 1 : -1;
+    for(int idx = index; offset != 0; offset -= step) {
+        do {
+            idx = (idx + step + TIS_NODE_LINE_COUNT) % TIS_NODE_LINE_COUNT;
+        } while(code[idx] == NULL || code[idx]->type == TIS_OP_TYPE_INVALID);
+        if(step > 0 ? idx <= index : idx >= index) {
+            break;
+        }
+        index = idx;
+    }
+    return index;
+}
+
+static void count_read(est_node_t* e, tis_op_arg_t* arg) {
+    if(arg->type != TIS_OP_ARG_TYPE_REGISTER) {
+        return;
+    } else if(is_port(arg->reg)) {
+        e->reads[arg->reg - TIS_REGISTER_UP]++;
+    } else if(arg->reg == TIS_REGISTER_ANY || arg->reg == TIS_REGISTER_LAST) {
+        e->approximate = 1;
+    }
+}
+
+/*
+ * Follow the code of a compute node to the loop it settles into, and count its cycles and port operations
+ */
+static void model_code(tis_node_t* node, est_node_t* e) {
+    int at[TIS_NODE_LINE_COUNT]; // the step each line was reached at, or -1
+    int order[TIS_NODE_LINE_COUNT];
+    int steps = 0;
+    for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
+        at[idx] = -1;
+    }
+    int line = valid_line(node->code, 0);
+    while(line >= 0 && at[line] < 0) {
+        tis_op_t* op = node->code[line];
+        at[line] = steps;
+        order[steps++] = line;
+        int next = valid_line(node->code, line + 1);
+        switch(op->type) {
+            case TIS_OP_TYPE_HCF:
+                e->halts = 1;
+                return;
+            case TIS_OP_TYPE_JEZ:
+            case TIS_OP_TYPE_JGZ:
+            case TIS_OP_TYPE_JLZ:
+            case TIS_OP_TYPE_JNZ:
+                e->approximate = 1; // and fall through
+                break;
+            case TIS_OP_TYPE_JMP:
+                if(op->src.target < 0) {
+                    e->halts = 1;
+                    return;
+                }
+                next = valid_line(node->code, op->src.target);
+                break;
+            case TIS_OP_TYPE_JRO:
+                if(op->src.type == TIS_OP_ARG_TYPE_CONSTANT) {
+                    next = valid_line(node->code, relative_line(node->code, line, op->src.con));
+                } else {
+                    e->approximate = 1;
+                }
+                break;
+            default:
+                break;
+        }
+        line = next;
+    }
+    if(line < 0) {
+        return;
+    }
+    int read_port[TIS_NODE_LINE_COUNT]; // of each step of the loop, or -1
+    int cost[TIS_NODE_LINE_COUNT];
+    for(int s = at[line]; s < steps; s++) {
+        tis_op_t* op = node->code[order[s]];
+        tis_op_arg_t* src = &(op->src);
+        cost[s] = 1;
+        switch(op->type) {
+            case TIS_OP_TYPE_MOV:
+                if(op->dst.type == TIS_OP_ARG_TYPE_REGISTER && is_port(op->dst.reg)) {
+                    e->writes[op->dst.reg - TIS_REGISTER_UP]++;
+                    cost[s]++;
+                } else if(op->dst.type == TIS_OP_ARG_TYPE_REGISTER && (op->dst.reg == TIS_REGISTER_ANY || op->dst.reg == TIS_REGISTER_LAST)) {
+                    e->approximate = 1;
+                    cost[s]++;
+                }
+                // fall through
+            case TIS_OP_TYPE_ADD:
+            case TIS_OP_TYPE_SUB:
+            case TIS_OP_TYPE_JRO:
+                count_read(e, src);
+                break;
+            default:
+                src = NULL;
+                break;
+        }
+        read_port[s] = src != NULL && src->type == TIS_OP_ARG_TYPE_REGISTER && is_port(src->reg) ? (int)(src->reg - TIS_REGISTER_UP) : -1;
+    }
+    for(int s = at[line]; s < steps; s++) {
+        // A writer takes a cycle to post its next value after one is taken, so reading a port again straight away waits
+        int prev = s > at[line] ? s - 1 : steps - 1;
+        e->cost += cost[s] + (read_port[s] >= 0 && read_port[s] == read_port[prev] && cost[prev] == 1);
+    }
+    e->modeled = 1;
+}
+
+/*
+ * Give every node reachable from start over balanced links its rate relative to start, then scale the part so that
+ * its busiest node is busy every cycle. Returns that node.
+ */
+static size_t solve_part(tis_t* tis, est_node_t* est, size_t nnodes, size_t start, size_t* queue, int* balanced) {
+    size_t head = 0, tail = 0;
+    est[start].part = start;
+    est[start].rate = 1.0;
+    queue[tail++] = start;
+    while(head < tail) {
+        size_t u = queue[head++];
+        for(int port = 0; port < 4; port++) {
+            size_t v = neighbor(tis, u, port);
+            if(v == EST_NONE || v >= nnodes || !est[v].modeled) {
+                continue;
+            }
+            // values u writes to v per pass, and v reads from u
+            unsigned uv = est[u].writes[port], vu = est[v].reads[opposite(port)];
+            unsigned ur = est[u].reads[port], vw = est[v].writes[opposite(port)];
+            double rate;
+            if(uv > 0 && vu > 0) {
+                rate = est[u].rate * uv / vu;
+            } else if(ur > 0 && vw > 0) {
+                rate = est[u].rate * ur / vw;
+            } else {
+                continue;
+            }
+            if(est[v].part == EST_NONE) {
+                est[v].part = start;
+                est[v].rate = rate;
+                queue[tail++] = v;
+            } else if(rate < est[v].rate * 0.999999 || rate > est[v].rate * 1.000001) {
+                *balanced = 0;
+            }
+        }
+    }
+    double most = 0.0;
+    size_t bottleneck = start;
+    for(size_t t = 0; t < tail; t++) {
+        double load = est[queue[t]].rate * est[queue[t]].cost;
+        if(load > most) {
+            most = load;
+            bottleneck = queue[t];
+        }
+    }
+    for(size_t t = 0; most > 0.0 && t < tail; t++) {
+        est[queue[t]].rate /= most;
+    }
+    return bottleneck;
+}
+
+/*
+ * Returns a true value if something in the same part writes to this output, so that its rate is an estimate
+ */
+static int output_is_fed(tis_t* tis, est_node_t* est, size_t out) {
+    size_t writer = neighbor(tis, out, TIS_REGISTER_UP - TIS_REGISTER_UP);
+    return est[out].modeled && writer != EST_NONE && est[writer].modeled && est[writer].part == est[out].part;
+}
+
+static int compare_load(const void* a, const void* b) {
+    double la = ((const est_row_t*)a)->load;
+    double lb = ((const est_row_t*)b)->load;
+    return (la < lb) - (la > lb); // busiest first
+}
+
+/*
+ * The tis_halt_hook of the checking run
+ */
+static void est_halt(int status) {
+    (void)status;
+    longjmp(est_resume, 1);
+}
+
+static void run_checked(tis_t* tis, long long cycles) {
+    tis_halt_hook = est_halt;
+    if(setjmp(est_resume) == 0) {
+        for(long long time = 0; !tick(tis) && time < cycles; time++) {
+            // nothing
+        }
+    }
+    tis_halt_hook = NULL;
+}
+
+/*
+ * Run the machine for a while with the outputs dropped, and compare the cycles between values on each output with the
+ * estimate, over the second half of its values to leave out the start of the pipeline
+ */
+static void check_estimate(tis_t* tis, est_node_t* est, long long timelimit) {
+    for(size_t c = 0; c < tis->cols; c++) {
+        tis_io_node_t* io = tis->outputs[c];
+        if(io != NULL && !is_file_io(io->type)) {
+            warn("Not checking the estimate by running, O%zu does not write to a file\n", c);
+            return;
+        }
+    }
+    for(size_t c = 0; c < tis->cols; c++) {
+        if(tis->outputs[c] != NULL) {
+            tis->outputs[c]->file.file = NULL; // dropped silently, and the handle is still closed at exit
+        }
+    }
+    init_links(tis, 1);
+    run_checked(tis, timelimit > 0 ? timelimit : TIS_ESTIMATE_CYCLES);
+
+    tis_links_t* links = tis->links;
+    fprintf(stderr, "Checked by running %llu cycles:\n", links->cycle);
+    for(size_t c = 0; c < tis->cols; c++) {
+        size_t reader = tis->size + c; // outputs follow the grid as readers
+        size_t count = 0, half = 0;
+        unsigned long long from = 0, to = 0;
+        for(size_t i = 0; i < links->nevents; i++) {
+            count += links->events[i].reader == reader;
+        }
+        if(count == 0) {
+            continue;
+        }
+        for(size_t i = 0, seen = 0; i < links->nevents; i++) {
+            if(links->events[i].reader != reader) {
+                continue;
+            }
+            if(seen == count / 2) {
+                from = links->events[i].taken;
+            }
+            to = links->events[i].taken;
+            seen++;
+        }
+        half = count - 1 - count / 2;
+        size_t out = tis->size + tis->cols + c;
+        double predicted = output_is_fed(tis, est, out) && est[out].rate > 0.0 ? 1.0 / est[out].rate : 0.0;
+        if(half == 0) {
+            fprintf(stderr, "    O%zu: %zu value%s, too few to measure\n", c, count, count == 1 ? "" : "s");
+        } else if(predicted > 0.0) {
+            double measured = (double)(to - from) / half;
+            fprintf(stderr, "    O%zu: %zu values, one every %.2f cycles (estimated %.2f, %+.1f%%)\n",
+                    c, count, measured, predicted, 100.0 * (predicted - measured) / measured);
+        } else {
+            fprintf(stderr, "    O%zu: %zu values, one every %.2f cycles (not estimated)\n", c, count, (double)(to - from) / half);
+        }
+    }
+    free_links(tis);
+}
+
+/*
+ * Estimate the steady-state cycles per value of each output from the code alone, print it with the bottleneck on
+ * stderr, check it by running, and exit
+ */
+void run_estimate(tis_t* tis, long long timelimit) {
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    size_t nnodes = tis->size + 2 * tis->cols;
+    est_node_t* est = calloc(nnodes + 1, sizeof(est_node_t));
+    size_t* queue = malloc(nnodes * sizeof(size_t) + 1);
+    size_t* bottleneck = malloc(nnodes * sizeof(size_t) + 1);
+    est_row_t* rows = malloc(nnodes * sizeof(est_row_t) + 1);
+    if(est == NULL || queue == NULL || bottleneck == NULL || rows == NULL) {
+        error("Unable to allocate memory for the estimate\n");
+        bork();
+    }
+    for(size_t n = 0; n < nnodes; n++) {
+        est[n].part = EST_NONE;
+        bottleneck[n] = EST_NONE;
+        if(n < tis->size) {
+            if(tis->nodes[n] != NULL && tis->nodes[n]->type == TIS_NODE_TYPE_COMPUTE) {
+                model_code(tis->nodes[n], &(est[n]));
+            }
+        } else if(n < tis->size + tis->cols) {
+            if(tis->inputs[n - tis->size] != NULL) {
+                est[n] = (est_node_t){ .modeled = 1, .cost = EST_INPUT_COST, .part = EST_NONE };
+                est[n].writes[TIS_REGISTER_DOWN - TIS_REGISTER_UP] = 1;
+            }
+        } else if(tis->outputs[n - tis->size - tis->cols] != NULL) {
+            est[n] = (est_node_t){ .modeled = 1, .cost = EST_OUTPUT_COST, .part = EST_NONE };
+            est[n].reads[TIS_REGISTER_UP - TIS_REGISTER_UP] = 1;
+        }
+    }
+    int balanced = 1;
+    // Parts are solved from their outputs first, so that an output that is not connected to anything is left alone
+    for(size_t i = 0; i < nnodes; i++) {
+        size_t n = (i + tis->size + tis->cols) % nnodes;
+        if(est[n].modeled && est[n].part == EST_NONE) {
+            bottleneck[n] = solve_part(tis, est, nnodes, n, queue, &balanced);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double usec = (end.tv_sec - begin.tv_sec) * 1e6 + (end.tv_nsec - begin.tv_nsec) / 1e3;
+    char name[128];
+    fprintf(stderr, "Estimate (%.1f us):\n", usec);
+    int any = 0;
+    for(size_t c = 0; c < tis->cols; c++) {
+        size_t out = tis->size + tis->cols + c;
+        if(!output_is_fed(tis, est, out)) {
+            continue; // nothing writes to it
+        }
+        size_t neck = bottleneck[est[out].part];
+        est_name(tis, neck, name, sizeof(name));
+        fprintf(stderr, "    O%zu: one value every %.2f cycles, limited by %s (%u cycles per pass, %.2f values of O%zu)\n",
+                c, 1.0 / est[out].rate, name, est[neck].cost, est[out].rate / est[neck].rate, c);
+        any = 1;
+    }
+    if(!any) {
+        fprintf(stderr, "    no output is fed by a loop\n");
+    }
+
+    size_t nrows = 0;
+    for(size_t n = 0; n < tis->size; n++) {
+        if(est[n].modeled && est[n].part != EST_NONE) {
+            rows[nrows++] = (est_row_t){ .node = n, .load = est[n].rate * est[n].cost };
+        } else if(est[n].halts) {
+            est_name(tis, n, name, sizeof(name));
+            fprintf(stderr, "    %s halts the machine, which the estimate does not model\n", name);
+        }
+    }
+    qsort(rows, nrows, sizeof(est_row_t), compare_load);
+    size_t shown = (opts.verbose > 0 || nrows < TIS_ESTIMATE_TABLE_ROWS) ? nrows : TIS_ESTIMATE_TABLE_ROWS;
+    fprintf(stderr, "%-32s %12s %12s %6s\n", "node", "cycles/pass", "passes/100", "busy");
+    for(size_t r = 0; r < shown; r++) {
+        est_node_t* e = &(est[rows[r].node]);
+        est_name(tis, rows[r].node, name, sizeof(name));
+        fprintf(stderr, "%-32s %12u %12.2f %5.1f%%%s\n", name, e->cost, 100.0 * e->rate, 100.0 * rows[r].load, e->approximate ? " (approximate)" : "");
+    }
+    if(shown < nrows) {
+        fprintf(stderr, "(%zu more nodes, use -v to show all)\n", nrows - shown);
+    }
+    if(!balanced) {
+        warn("Some links carry values at different rates on their two ends, so the estimate is only a bound\n");
+    }
+
+    check_estimate(tis, est, timelimit);
+    free(est);
+    free(queue);
+    free(bottleneck);
+    free(rows);
+    exit(EXIT_SUCCESS);
+}
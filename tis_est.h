@@ -0,0 +1,24 @@
+#ifndef _TIS_EST_
+#define _TIS_EST_
+
+#include "tis_types.h"
+
+/*
+ * Static throughput estimate (--estimate), for pipeline-shaped programs.
+ *
+ * Each compute node's code is followed from its first line until it comes back around, taking conditional jumps as not
+ * taken, which gives the loop it settles into: its cycles (one per instruction, plus one for each write to a port,
+ * which completes the cycle after, and one for reading a port again straight after reading it) and how many values it
+ * reads and writes on each port per pass. A link between two nodes then fixes the ratio of their rates, and in each connected part of the grid the node with the most cycles of
+ * work per value bounds everything else. This predicts the cycles between values on each output, and the bottleneck.
+ * The model is then checked by running the machine for a short while with the outputs dropped.
+ */
+
+#ifndef TIS_ESTIMATE_CYCLES
+#define TIS_ESTIMATE_CYCLES 10000 // length of the checking run, if there is no cycle limit
+#endif
+#define TIS_ESTIMATE_TABLE_ROWS 20 // nodes shown in the table, unless verbose
+
+void run_estimate(tis_t* tis, long long timelimit);
+
+#endif /* _TIS_EST_ */
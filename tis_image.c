@@ -0,0 +1,571 @@
+#define _POSIX_C_SOURCE 200809L // for mmap()
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tis_image.h"
+#include "tis_io.h"
+#include "tis_node.h"
+#include "tis_types.h"
+
+/*
+ * Layout of an image, all offsets in bytes:
+ *
+ *   header, IMAGE_HEADER_SIZE bytes
+ *      0  magic      TIS_IMAGE_MAGIC
+ *      8  version    TIS_IMAGE_VERSION
+ *     12  (zero)
+ *     16  rows       u64
+ *     24  cols       u64
+ *     32  ops        u64, number of op records
+ *     40  strings    u64, size of the string table
+ *     48  name       string, the title of the machine
+ *     52  (zero)
+ *     56  size       u64, size of the whole file
+ *
+ *   rows*cols node records in row-major order, IMAGE_NODE_SIZE bytes each
+ *      0  type       tis_node_type_t
+ *      4  (zero)
+ *      8  id         i64
+ *     16  name       string
+ *     20  lines      bit n is set if line n of a compute node holds an op
+ *     24  first      index of the op for the lowest line, the rest follow in order;
+ *                    nodes with the same code may refer to the same ops
+ *
+ *   cols input records then cols output records, IMAGE_IO_SIZE bytes each
+ *      0  present    non-zero if the io node is defined
+ *      4  type       tis_io_type_t
+ *      8  sep        i32, for NUMERIC outputs, or the number of values of a RANDOM input
+ *     12  capacity   for SHM, or the least value of a RANDOM input
+ *     16  path       string, the file for stream types or the ring name for SHM
+ *     20  expect     string, the EXPECT file of an output
+ *     24  count      u32, the COUNT of an output, or 0
+ *     28  max        i32, the greatest value of a RANDOM input
+ *
+ *   op records, IMAGE_OP_SIZE bytes each
+ *      0  type       tis_op_type_t
+ *      4  linenum    in-node, 1-indexed
+ *      8  linetext   string
+ *     12  label      string
+ *     16  src type   tis_op_arg_type_t
+ *     20  src value  i32, the constant, register, or resolved line of a label
+ *     24  src label  string
+ *     28  dst type   tis_op_arg_type_t
+ *     32  dst value  i32, the constant or register
+ *
+ *   string table, NUL-terminated strings
+ *
+ * A string is an offset into the string table, or IMAGE_NO_STRING for NULL.
+ */
+
+#define IMAGE_HEADER_SIZE 64
+#define IMAGE_NODE_SIZE 28
+#define IMAGE_IO_SIZE 32
+#define IMAGE_OP_SIZE 36
+#define IMAGE_NO_STRING UINT32_MAX
+
+static void put32(unsigned char* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static void put64(unsigned char* p, uint64_t v) {
+    put32(p, (uint32_t)v);
+    put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const unsigned char* p) {
+    return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+/*
+ * String table under construction.
+ * Strings from the arena are interned, so they are deduplicated by address.
+ */
+typedef struct image_strings {
+    char* data;
+    size_t len;
+    size_t cap;
+    const char** keys; // open-addressed by address
+    uint32_t* offsets;
+    size_t slots; // zero or a power of two
+    size_t count;
+} image_strings_t;
+
+static size_t hash_pointer(const char* str) {
+    return (size_t)(((uintptr_t)str >> 3) * 0x9E3779B97F4A7C15ULL);
+}
+
+static void strings_grow(image_strings_t* strings) {
+    size_t slots = strings->slots == 0 ? 256 : strings->slots * 2;
+    const char** keys = calloc(slots, sizeof(char*));
+    uint32_t* offsets = calloc(slots, sizeof(uint32_t));
+    if(keys == NULL || offsets == NULL) {
+        error("Unable to allocate string table\n");
+        bork();
+    }
+    for(size_t i = 0; i < strings->slots; i++) {
+        if(strings->keys[i] != NULL) {
+            size_t j = hash_pointer(strings->keys[i]) & (slots - 1);
+            while(keys[j] != NULL) {
+                j = (j + 1) & (slots - 1);
+            }
+            keys[j] = strings->keys[i];
+            offsets[j] = strings->offsets[i];
+        }
+    }
+    free(strings->keys);
+    free(strings->offsets);
+    strings->keys = keys;
+    strings->offsets = offsets;
+    strings->slots = slots;
+}
+
+static uint32_t strings_add(image_strings_t* strings, const char* str) {
+    if(str == NULL) {
+        return IMAGE_NO_STRING;
+    }
+    if(2 * (strings->count + 1) > strings->slots) {
+        strings_grow(strings);
+    }
+    size_t i = hash_pointer(str) & (strings->slots - 1);
+    while(strings->keys[i] != NULL) {
+        if(strings->keys[i] == str) {
+            return strings->offsets[i];
+        }
+        i = (i + 1) & (strings->slots - 1);
+    }
+    size_t len = strlen(str) + 1;
+    if(strings->len + len >= IMAGE_NO_STRING) {
+        error("Too much text to save in an image\n");
+        bork();
+    }
+    if(strings->len + len > strings->cap) {
+        size_t cap = strings->cap == 0 ? 4096 : strings->cap;
+        while(cap < strings->len + len) {
+            cap *= 2;
+        }
+        char* data = realloc(strings->data, cap);
+        if(data == NULL) {
+            error("Unable to allocate string table\n");
+            bork();
+        }
+        strings->data = data;
+        strings->cap = cap;
+    }
+    memcpy(&(strings->data[strings->len]), str, len);
+    strings->keys[i] = str;
+    strings->offsets[i] = (uint32_t)strings->len;
+    strings->count++;
+    strings->len += len;
+    return strings->offsets[i];
+}
+
+static void put_arg(unsigned char* p, tis_op_arg_t* arg) {
+    put32(p, arg->type);
+    switch(arg->type) {
+        case TIS_OP_ARG_TYPE_CONSTANT: put32(p + 4, (uint32_t)arg->con); break;
+        case TIS_OP_ARG_TYPE_REGISTER: put32(p + 4, arg->reg); break;
+        case TIS_OP_ARG_TYPE_LABEL: put32(p + 4, (uint32_t)arg->target); break;
+        case TIS_OP_ARG_TYPE_NONE:
+        default: put32(p + 4, 0); break;
+    }
+}
+
+static void put_io(unsigned char* p, tis_io_node_t* io, image_strings_t* strings) {
+    if(io == NULL) {
+        return; // left zeroed, not present
+    }
+    put32(p, 1);
+    put32(p + 4, io->type);
+    if(is_file_io(io->type)) {
+        put32(p + 8, (uint32_t)io->file.sep);
+        put32(p + 16, strings_add(strings, io->file.path != NULL ? io->file.path : "-")); // the default layout uses stdin/stdout
+    } else if(io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        put32(p + 12, io->shm.capacity);
+        put32(p + 16, strings_add(strings, io->shm.name));
+    } else if(io->type == TIS_IO_TYPE_IGENERATOR_RANDOM) {
+        put32(p + 8, (uint32_t)io->random.count);
+        put32(p + 12, (uint32_t)io->random.min);
+        put32(p + 16, IMAGE_NO_STRING);
+        put32(p + 28, (uint32_t)io->random.max);
+    } else {
+        put32(p + 16, IMAGE_NO_STRING);
+    }
+    put32(p + 20, strings_add(strings, io->expect.path));
+    put32(p + 24, (uint32_t)io->expect.count); // a COUNT, since EXPECT files are not read by --compile
+}
+
+/*
+ * Nodes given their code by one @A..B section hold the same lines, which are written once
+ */
+static int shares_code(tis_node_t* node, tis_node_t* prev) {
+    return prev != NULL && node->code == prev->code;
+}
+
+/*
+ * Write the loaded machine to an image file. Returns 0 on success.
+ */
+int save_image(tis_t* tis, const char* filename) {
+    size_t nops = 0;
+    tis_node_t* prev = NULL;
+    for(size_t i = 0; i < tis->size; i++) {
+        if(tis->nodes[i] != NULL && tis->nodes[i]->type == TIS_NODE_TYPE_COMPUTE) {
+            if(!shares_code(tis->nodes[i], prev)) {
+                for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+                    nops += tis->nodes[i]->code[line] != NULL;
+                }
+            }
+            prev = tis->nodes[i];
+        }
+    }
+
+    size_t fixed = IMAGE_HEADER_SIZE + tis->size * IMAGE_NODE_SIZE + 2 * tis->cols * IMAGE_IO_SIZE + nops * IMAGE_OP_SIZE;
+    unsigned char* buf = calloc(1, fixed);
+    if(buf == NULL) {
+        error("Unable to allocate %zu bytes for the image\n", fixed);
+        return -1;
+    }
+    image_strings_t strings = {0};
+
+    unsigned char* p = buf + IMAGE_HEADER_SIZE;
+    unsigned char* q = buf + IMAGE_HEADER_SIZE + tis->size * IMAGE_NODE_SIZE + 2 * tis->cols * IMAGE_IO_SIZE;
+    size_t op = 0, prevop = 0;
+    uint32_t prevlines = 0;
+    prev = NULL;
+    for(size_t i = 0; i < tis->size; i++, p += IMAGE_NODE_SIZE) {
+        tis_node_t* node = tis->nodes[i];
+        uint32_t lines = 0;
+        if(node == NULL) {
+            put32(p, TIS_NODE_TYPE_DAMAGED);
+            put64(p + 8, (uint64_t)-1);
+            put32(p + 16, IMAGE_NO_STRING);
+            continue;
+        }
+        put32(p, node->type);
+        put64(p + 8, (uint64_t)node->id);
+        put32(p + 16, strings_add(&strings, node->name));
+        put32(p + 24, (uint32_t)op);
+        if(node->type != TIS_NODE_TYPE_COMPUTE) {
+            continue;
+        }
+        if(shares_code(node, prev)) {
+            put32(p + 20, prevlines);
+            put32(p + 24, (uint32_t)prevop);
+            continue;
+        }
+        prev = node;
+        prevop = op;
+        for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+            tis_op_t* code = node->code[line];
+            if(code == NULL) {
+                continue;
+            }
+            lines |= 1u << line;
+            put32(q, code->type);
+            put32(q + 4, (uint32_t)code->linenum);
+            put32(q + 8, strings_add(&strings, code->linetext));
+            put32(q + 12, strings_add(&strings, code->label));
+            put_arg(q + 16, &(code->src));
+            put32(q + 24, strings_add(&strings, code->src.type == TIS_OP_ARG_TYPE_LABEL ? code->src.label : NULL));
+            put_arg(q + 28, &(code->dst));
+            op++;
+            q += IMAGE_OP_SIZE;
+        }
+        put32(p + 20, lines);
+        prevlines = lines;
+    }
+    for(size_t i = 0; i < tis->cols; i++, p += IMAGE_IO_SIZE) {
+        put_io(p, tis->inputs[i], &strings);
+    }
+    for(size_t i = 0; i < tis->cols; i++, p += IMAGE_IO_SIZE) {
+        put_io(p, tis->outputs[i], &strings);
+    }
+
+    put32(buf + 48, strings_add(&strings, tis->name));
+    memcpy(buf, TIS_IMAGE_MAGIC, TIS_IMAGE_MAGIC_SIZE);
+    put32(buf + 8, TIS_IMAGE_VERSION);
+    put64(buf + 16, tis->rows);
+    put64(buf + 24, tis->cols);
+    put64(buf + 32, nops);
+    put64(buf + 40, strings.len);
+    put64(buf + 56, fixed + strings.len);
+
+    int result = 0;
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL) {
+        error("Unable to open image file '%s' for writing\n", filename);
+        result = -1;
+    } else {
+        if(fwrite(buf, fixed, 1, file) != 1 || (strings.len > 0 && fwrite(strings.data, strings.len, 1, file) != 1)) {
+            error("An error occurred when writing image file '%s'\n", filename);
+            result = -1;
+        }
+        if(fclose(file) != 0 && result == 0) {
+            error("An error occurred when writing image file '%s'\n", filename);
+            result = -1;
+        }
+    }
+    if(result == 0) {
+        debug("Wrote image '%s' with %zu nodes, %zu lines of code and %zu bytes of text\n", filename, tis->size, nops, strings.len);
+    }
+
+    free(buf);
+    free(strings.data);
+    free(strings.keys);
+    free(strings.offsets);
+    return result;
+}
+
+int is_image(const char* filename) {
+    char magic[TIS_IMAGE_MAGIC_SIZE];
+    if(strcmp(filename, "-") == 0) {
+        return 0; // can't peek at stdin without consuming it
+    }
+    FILE* file = fopen(filename, "rb");
+    if(file == NULL) {
+        return 0;
+    }
+    int result = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, TIS_IMAGE_MAGIC, TIS_IMAGE_MAGIC_SIZE) == 0;
+    fclose(file);
+    return result;
+}
+
+/*
+ * Resolve a string reference into the mapped table. Returns 0 if the reference is out of range.
+ */
+static int get_string(const char* table, size_t size, uint32_t ref, char** str) {
+    if(ref == IMAGE_NO_STRING) {
+        *str = NULL;
+        return 1;
+    }
+    if(ref >= size) {
+        return 0;
+    }
+    *str = (char*)&table[ref]; // never modified, the mapping is private and read-only
+    return 1;
+}
+
+static int get_arg(const unsigned char* p, tis_op_arg_t* arg) {
+    arg->type = get32(p);
+    int32_t value = (int32_t)get32(p + 4);
+    switch(arg->type) {
+        case TIS_OP_ARG_TYPE_NONE:
+            return 1;
+        case TIS_OP_ARG_TYPE_CONSTANT:
+            arg->con = value;
+            return value == clamp(value);
+        case TIS_OP_ARG_TYPE_REGISTER:
+            arg->reg = value;
+            return value >= TIS_REGISTER_ACC && value <= TIS_REGISTER_LAST;
+        case TIS_OP_ARG_TYPE_LABEL:
+            arg->target = value;
+            return value >= -1 && value < TIS_NODE_LINE_COUNT;
+        default:
+            return 0;
+    }
+}
+
+static int get_io(tis_t* tis, const unsigned char* p, size_t col, const char* table, size_t size, tis_io_node_t** slot, int is_output) {
+    if(get32(p) == 0) {
+        return 1;
+    }
+    tis_io_node_t* io = arena_alloc(&(tis->arena), sizeof(tis_io_node_t));
+    io->col = col;
+    io->type = get32(p + 4);
+    io->writereg = TIS_REGISTER_INVALID;
+    *slot = io;
+    char *path, *expect;
+    if(!get_string(table, size, get32(p + 16), &path) || !get_string(table, size, get32(p + 20), &expect)) {
+        return 0;
+    }
+    if(is_file_io(io->type)) {
+        io->file.sep = (int32_t)get32(p + 8);
+        if(path == NULL) {
+            return 0;
+        }
+        open_io_file(io, path, is_output);
+    } else if(io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        io->shm.capacity = get32(p + 12);
+        io->shm.name = path;
+    } else if(io->type == TIS_IO_TYPE_IGENERATOR_RANDOM && !is_output) {
+        io->random.count = get32(p + 8);
+        io->random.min = (int32_t)get32(p + 12);
+        io->random.max = (int32_t)get32(p + 28);
+        if(io->random.min < -999 || io->random.min > io->random.max || io->random.max > 999) {
+            return 0;
+        }
+        seed_random_input(io, opts.seed);
+    } else if(io->type != TIS_IO_TYPE_INVALID) {
+        return 0;
+    }
+    if((expect != NULL || get32(p + 24) != 0) && !is_output) {
+        return 0;
+    }
+    io->expect.count = get32(p + 24);
+    if(expect != NULL) {
+        open_expect(io, expect);
+    }
+    return 1;
+}
+
+/*
+ * Map an image and build the machine from it. Returns 0 on success.
+ * The strings are used in place, so the mapping stays until unmap_image().
+ */
+int load_image(tis_t* tis, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        error("Unable to open image file '%s' for reading\n", filename);
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < IMAGE_HEADER_SIZE) {
+        error("Image file '%s' is truncated\n", filename);
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    const unsigned char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        error("Unable to map image file '%s'\n", filename);
+        return -1;
+    }
+    tis->image = (void*)map;
+    tis->image_size = size;
+
+    if(memcmp(map, TIS_IMAGE_MAGIC, TIS_IMAGE_MAGIC_SIZE) != 0) {
+        error("File '%s' is not a TIS image\n", filename);
+        return -1;
+    }
+    if(get32(map + 8) != TIS_IMAGE_VERSION) {
+        error("Image file '%s' has version %u, but only version %u is supported; compile it again\n", filename, get32(map + 8), TIS_IMAGE_VERSION);
+        return -1;
+    }
+    uint64_t rows = get64(map + 16), cols = get64(map + 24), nops = get64(map + 32), nstrings = get64(map + 40);
+    // bound everything by the file size first, so that none of the products below can overflow
+    if(get64(map + 56) != size || rows > size || cols > size || nops > size || nstrings > size ||
+       (cols != 0 && rows > size / cols) || cols == 0) {
+        error("Image file '%s' is corrupt\n", filename);
+        return -1;
+    }
+    uint64_t nodes = rows * cols;
+    if(nodes > size / IMAGE_NODE_SIZE || 2 * cols > size / IMAGE_IO_SIZE || nops > size / IMAGE_OP_SIZE ||
+       IMAGE_HEADER_SIZE + nodes * IMAGE_NODE_SIZE + 2 * cols * IMAGE_IO_SIZE + nops * IMAGE_OP_SIZE + nstrings != size ||
+       (nstrings > 0 && map[size - 1] != '\0')) {
+        error("Image file '%s' is corrupt\n", filename);
+        return -1;
+    }
+
+    tis->rows = rows;
+    tis->cols = cols;
+    tis->size = nodes;
+    const unsigned char* p = map + IMAGE_HEADER_SIZE;
+    const unsigned char* ops = p + nodes * IMAGE_NODE_SIZE + 2 * cols * IMAGE_IO_SIZE;
+    const char* table = (const char*)(ops + nops * IMAGE_OP_SIZE);
+    if(!get_string(table, nstrings, get32(map + 48), &(tis->name))) {
+        error("Image file '%s' is corrupt\n", filename);
+        return -1;
+    }
+
+    tis->nodes = arena_calloc(&(tis->arena), tis->size, sizeof(tis_node_t*));
+    tis->inputs = arena_calloc(&(tis->arena), tis->cols, sizeof(tis_io_node_t*));
+    tis->outputs = arena_calloc(&(tis->arena), tis->cols, sizeof(tis_io_node_t*));
+    tis->nocode = arena_calloc(&(tis->arena), TIS_NODE_LINE_COUNT, sizeof(tis_op_t*));
+    tis_op_t* code = arena_calloc(&(tis->arena), nops, sizeof(tis_op_t)); // all lines together, in node order
+
+    uint32_t prevlines = 0, prevop = 0;
+    tis_op_t** prevcode = NULL;
+    for(size_t i = 0; i < tis->size; i++, p += IMAGE_NODE_SIZE) {
+        tis_node_type_t type = get32(p);
+        char* name;
+        if(type == TIS_NODE_TYPE_DAMAGED) {
+            continue; // left NULL
+        } else if((type != TIS_NODE_TYPE_COMPUTE && type != TIS_NODE_TYPE_MEMORY_STACK) ||
+                  !get_string(table, nstrings, get32(p + 16), &name)) {
+            goto corrupt;
+        }
+        tis_node_t* node = new_node(tis, i, type, name);
+        node->id = (long long)get64(p + 8);
+        if(type != TIS_NODE_TYPE_COMPUTE) {
+            continue;
+        }
+        uint32_t lines = get32(p + 20);
+        uint32_t op = get32(p + 24);
+        if(lines >> TIS_NODE_LINE_COUNT != 0) {
+            goto corrupt;
+        } else if(lines == 0) {
+            continue; // keeps tis->nocode
+        } else if(prevcode != NULL && lines == prevlines && op == prevop) {
+            node->code = prevcode; // shares the lines of the previous compute node
+            continue;
+        }
+        node->code = arena_calloc(&(tis->arena), TIS_NODE_LINE_COUNT, sizeof(tis_op_t*));
+        prevcode = node->code;
+        prevlines = lines;
+        prevop = op;
+        for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+            if(!(lines & (1u << line))) {
+                continue;
+            }
+            if(op >= nops) {
+                goto corrupt;
+            }
+            const unsigned char* q = ops + op * IMAGE_OP_SIZE;
+            tis_op_t* dst = &code[op++];
+            node->code[line] = dst;
+            if(dst->linenum != 0) {
+                continue; // already decoded for another node sharing this code
+            }
+            dst->type = get32(q);
+            dst->linenum = get32(q + 4);
+            if(dst->type > TIS_OP_TYPE_SWP || dst->linenum == 0 ||
+               !get_string(table, nstrings, get32(q + 8), &(dst->linetext)) ||
+               !get_string(table, nstrings, get32(q + 12), &(dst->label)) ||
+               !get_arg(q + 16, &(dst->src)) || !get_arg(q + 28, &(dst->dst))) {
+                goto corrupt;
+            }
+            if(dst->src.type == TIS_OP_ARG_TYPE_LABEL) {
+                if(!get_string(table, nstrings, get32(q + 24), &(dst->src.label)) || dst->src.label == NULL) {
+                    goto corrupt;
+                }
+            }
+        }
+    }
+    for(size_t i = 0; i < tis->cols; i++, p += IMAGE_IO_SIZE) {
+        if(!get_io(tis, p, i, table, nstrings, &(tis->inputs[i]), 0)) {
+            goto corrupt;
+        }
+    }
+    for(size_t i = 0; i < tis->cols; i++, p += IMAGE_IO_SIZE) {
+        if(!get_io(tis, p, i, table, nstrings, &(tis->outputs[i]), 1)) {
+            goto corrupt;
+        }
+    }
+
+    debug("Loaded image '%s' with dimensions %zur %zuc and %zu lines of code\n", filename, tis->rows, tis->cols, (size_t)nops);
+    return 0;
+
+corrupt:
+    error("Image file '%s' is corrupt\n", filename);
+    return -1;
+}
+
+void unmap_image(tis_t* tis) {
+    if(tis->image != NULL) {
+        munmap(tis->image, tis->image_size);
+        tis->image = NULL;
+        tis->image_size = 0;
+    }
+}
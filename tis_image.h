@@ -0,0 +1,24 @@
+#ifndef _TIS_IMAGE_
+#define _TIS_IMAGE_
+
+#include "tis_types.h"
+
+/*
+ * Precompiled machine images (.tisbin), written by --compile.
+ *
+ * An image holds a fully parsed machine: the layout, the io definitions, and the decoded code with jump labels
+ * already resolved to line indices. All integers are little-endian, and every reference is either an index into
+ * a table or an offset into the string table, so the file is position-independent and is simply mapped to load.
+ * The record layouts are described in tis_image.c; any change to them must bump TIS_IMAGE_VERSION.
+ */
+
+#define TIS_IMAGE_MAGIC "TISBIN\0\n"
+#define TIS_IMAGE_MAGIC_SIZE 8
+#define TIS_IMAGE_VERSION 5
+
+int is_image(const char* filename); // true if the file starts with TIS_IMAGE_MAGIC
+int save_image(tis_t* tis, const char* filename);
+int load_image(tis_t* tis, const char* filename);
+void unmap_image(tis_t* tis);
+
+#endif /* _TIS_IMAGE_ */
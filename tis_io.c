@@ -1,14 +1,305 @@
 
+#define _POSIX_C_SOURCE 200809L // for shm_open()
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <strings.h>
 
+#include "tis_io.h"
+#include "tis_link.h"
+#include "tis_shm.h"
+#include "tis_trace.h"
+#include "tis_travel.h"
 #include "tis_types.h"
 
-// These are duplicated from the header
-tis_op_result_t input(tis_io_node_t* io, int* value);
-tis_op_result_t output(tis_io_node_t* io, int value);
+#define BINARY_IO_BUFSIZE (1 << 16) // binary streams are read and written in blocks of this size
+
+/*
+ * This is a linked list of file handles to close when destroying things.
+ * This is to be used only for file handles that are non-trivial to close the normal way.
+ * This can cause double-frees if not used with care.
+ */
+typedef struct file_list {
+    FILE* file;
+    struct file_list* next;
+} file_list_t;
+static file_list_t* files_to_close = NULL;
+void register_file_handle(FILE* file) {
+    file_list_t* temp = calloc(1, sizeof(file_list_t));
+    temp->file = file;
+    temp->next = files_to_close;
+    files_to_close = temp;
+}
+void close_file_handles() {
+    while(files_to_close != NULL) {
+        fclose(files_to_close->file);
+        file_list_t* temp = files_to_close->next;
+        free(files_to_close);
+        files_to_close = temp;
+    }
+}
+
+/*
+ * Open the stream named by path for this file io node, as given in a layout.
+ * The name is kept in io->file.path (which must outlive the node), so that the layout can be saved again.
+ * A file that cannot be opened is reported, and the node is left without a stream.
+ */
+void open_io_file(tis_io_node_t* io, char* path, int is_output) {
+    char dir = is_output ? 'O' : 'I';
+    io->file.path = path;
+    if(!is_output && (strcasecmp(path, "STDIN") == 0 || strcasecmp(path, "-") == 0)) {
+        debug("Set %c%zu to use stdin\n", dir, io->col);
+        io->file.file = stdin;
+    } else if(is_output && (strcasecmp(path, "STDOUT") == 0 || strcasecmp(path, "-") == 0)) {
+        debug("Set %c%zu to use stdout\n", dir, io->col);
+        io->file.file = stdout;
+    } else if(is_output && strcasecmp(path, "STDERR") == 0) {
+        debug("Set %c%zu to use stderr\n", dir, io->col);
+        io->file.file = stderr;
+    } else {
+        debug("Set %c%zu to use file %s\n", dir, io->col, path);
+        if(opts.compile) {
+            return; // not needed until the saved machine is run
+        }
+        if((io->file.file = fopen(path, is_output ? "a" : "r")) == NULL) {
+            if(is_output) {
+                error("Unable to open %s for writing, will silently drop data instead\n", path);
+            } else {
+                error("Unable to open %s for reading, will provide no data instead\n", path);
+            }
+        } else {
+            if(is_binary_io(io->type)) {
+                setvbuf(io->file.file, NULL, _IOFBF, BINARY_IO_BUFSIZE);
+            }
+            register_file_handle(io->file.file);
+        }
+    }
+}
+
+/*
+ * Load the values that this output must take, from the EXPECT file at path, read as an input of the output's type
+ * would read it (NUMERIC for SHM). The name is kept in io->expect.path, as for open_io_file().
+ * A file that cannot be read fails the run, rather than leave the output unchecked.
+ */
+void open_expect(tis_io_node_t* io, char* path) {
+    io->expect.path = path;
+    if(opts.compile) {
+        return; // not needed until the saved machine is run
+    }
+    FILE* file = fopen(path, "r");
+    if(file == NULL) {
+        error("Unable to open %s for the values expected from O%zu\n", path, io->col);
+        bork();
+    }
+    tis_io_node_t reader = { .type = io->type == TIS_IO_TYPE_IOSTREAM_SHM ? TIS_IO_TYPE_IOSTREAM_NUMERIC : io->type };
+    reader.file.file = file;
+    size_t capacity = 0;
+    int value;
+    while(input(&reader, &value) == TIS_OP_RESULT_OK) {
+        if(io->expect.nvalues == capacity) {
+            capacity = capacity == 0 ? 256 : 2 * capacity;
+            int* values = realloc(io->expect.values, capacity * sizeof(int));
+            if(values == NULL) {
+                error("Unable to allocate memory for the values expected from O%zu\n", io->col);
+                bork();
+            }
+            io->expect.values = values;
+        }
+        io->expect.values[io->expect.nvalues++] = value;
+    }
+    if(!feof(file)) {
+        warn("Stopped reading %s at something that is not a value, O%zu expects only the %zu before it\n", path, io->col, io->expect.nvalues);
+    }
+    fclose(file);
+    if(io->expect.nvalues == 0) {
+        warn("%s holds no values, O%zu will not be checked\n", path, io->col);
+        safe_free(io->expect.values);
+    } else if(io->expect.count == 0) {
+        io->expect.count = io->expect.nvalues; // unless given a COUNT
+    }
+    debug("Set O%zu to expect %zu values from %s\n", io->col, io->expect.nvalues, path);
+}
+
+/*
+ * Start a RANDOM input over, on the values given by this seed; each column gets values of its own
+ */
+void seed_random_input(tis_io_node_t* io, unsigned long long seed) {
+    uint64_t z = seed * 0x9E3779B97F4A7C15ULL + io->col + 1; // splitmix64
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    io->random.state = z != 0 ? z : 1;
+    io->random.left = io->random.count;
+}
+
+/*
+ * Give the cycle count of a run stopped by a termination policy, the way the game does: the cycle in which the
+ * output that finished it took its last value, counting from 1
+ */
+static void report_cycles(tis_t* tis, unsigned long long cycle) {
+    if(tis->stop != NULL) {
+        tis->stop->cycles = cycle; // for --score
+    }
+    if(opts.verbose >= 0 && opts.score == 0) {
+        fprintf(stderr, "Cycles: %llu\n", cycle);
+    }
+}
+
+/*
+ * Count a value taken by an output with a COUNT or an EXPECT file, and check it against the file. The run stops at
+ * the first difference, or once every such output (any one, with --stop-any) has taken all its values.
+ */
+static void count_output(tis_t* tis, tis_io_node_t* io, int value) {
+    size_t index = io->expect.next++;
+    unsigned long long cycle = tis->travel != NULL ? tis->travel->cycle + 1 : io->expect.cycles; // going back with --travel runs cycles again
+    if(io->expect.values != NULL) {
+        int actual = io->type == TIS_IO_TYPE_IOSTREAM_ASCII ? (unsigned char)value : value; // as written
+        if(index >= io->expect.nvalues) {
+            error("O%zu took %d at cycle %llu, but expected only %zu values\n", io->col, actual, cycle, io->expect.nvalues);
+            bork();
+        }
+        if(actual != io->expect.values[index]) {
+            error("O%zu took %d at cycle %llu, but expected %d (index %zu)\n", io->col, actual, cycle, io->expect.values[index], index);
+            bork();
+        }
+    }
+    if(io->expect.next == io->expect.count) {
+        debug("O%zu took all %zu of its values\n", io->col, io->expect.count);
+        for(size_t i = 0; !opts.stop_any && i < tis->cols; i++) {
+            if(tis->outputs[i] != NULL && tis->outputs[i]->expect.next < tis->outputs[i]->expect.count) {
+                return;
+            }
+        }
+        report_cycles(tis, cycle);
+        halt();
+    }
+}
+
+/*
+ * Once a run is over, report each output that took fewer values than its count. Returns how many did.
+ */
+size_t expected_missing(tis_t* tis) {
+    size_t missing = 0;
+    for(size_t i = 0; tis->outputs != NULL && i < tis->cols; i++) {
+        tis_io_node_t* io = tis->outputs[i];
+        if(io != NULL && io->expect.next < io->expect.count) {
+            error("O%zu took %zu values, but expected %zu\n", io->col, io->expect.next, io->expect.count);
+            missing++;
+        }
+    }
+    return missing;
+}
+
+/*
+ * Set up --stop-idle: the run stops once every input has ended, and no output has taken a value for idle cycles
+ */
+void init_stop(tis_t* tis, unsigned long long idle) {
+    tis->stop = calloc(1, sizeof(tis_stop_t));
+    if(tis->stop == NULL) {
+        error("Unable to allocate memory for --stop-idle\n");
+        bork();
+    }
+    tis->stop->idle = idle;
+}
+
+/*
+ * Called by tick() after each cycle, with --stop-idle. An input has ended once it waits to read, which a file does
+ * only at its end, and a SHM ring only once it is closed and drained. As with HCF, the run stops with success unless
+ * an output is short of its count; the cycles given are up to the last value taken, which is what the game counts.
+ */
+void stop_cycle(tis_t* tis) {
+    tis_stop_t* stop = tis->stop;
+    stop->cycle++;
+    unsigned long long taken = 0;
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->outputs[i] != NULL) {
+            taken += tis->outputs[i]->values;
+        }
+    }
+    if(taken != stop->taken) {
+        stop->taken = taken;
+        stop->last = stop->cycle;
+        return;
+    }
+    if(stop->cycle - stop->last < stop->idle) {
+        return;
+    }
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->inputs[i] != NULL && tis->inputs[i]->laststate != TIS_NODE_STATE_READ_WAIT) {
+            return;
+        }
+    }
+    debug("Every input has ended, and no output took a value for %llu cycles\n", stop->idle);
+    report_cycles(tis, stop->last);
+    tis_halt(expected_missing(tis) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void free_stop(tis_t* tis) {
+    safe_free(tis->stop);
+}
+
+/*
+ * Attach the shared-memory ring for this node, if not already done.
+ * On failure the name is cleared, so that the error is only reported once.
+ */
+static tis_shm_ring_t* shm_ring(tis_io_node_t* io) {
+    if(io->shm.ring == NULL && io->shm.name != NULL) {
+        io->shm.ring = tis_shm_attach(io->shm.name, io->shm.capacity != 0 ? io->shm.capacity : TIS_SHM_DEFAULT_CAPACITY, &(io->shm.mapped));
+        if(io->shm.ring == NULL) {
+            error("Unable to attach shared memory ring %s (or its creator never finished setting it up), it will be treated as closed\n", io->shm.name);
+            io->shm.name = NULL;
+        } else {
+            debug("Attached shared memory ring %s with capacity %u\n", io->shm.name, io->shm.ring->capacity);
+        }
+    }
+    return io->shm.ring;
+}
+
+/*
+ * Returns a true value if this input has no value right now, but may have one later.
+ * Such an input is waiting on its producer, and must not let the system become quiescent.
+ */
+static int input_pending(tis_io_node_t* io) {
+    if(io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        return io->shm.ring != NULL && !tis_shm_drained(io->shm.ring);
+    }
+    return 0;
+}
+
+/*
+ * Returns a true value if this output cannot accept a value right now.
+ */
+static int output_blocked(tis_io_node_t* io) {
+    if(io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        return shm_ring(io) != NULL && tis_shm_full(io->shm.ring);
+    }
+    return 0;
+}
+
+/*
+ * Release anything held by these io nodes, other than plain file handles.
+ * An output ring is closed first, so that its consumer sees the end of the stream.
+ */
+void close_input(tis_io_node_t* io) {
+    if(io != NULL && io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        tis_shm_detach(io->shm.ring, io->shm.mapped);
+        io->shm.ring = NULL;
+    }
+}
+void close_output(tis_io_node_t* io) {
+    if(io != NULL) {
+        safe_free(io->expect.values);
+    }
+    if(io != NULL && io->type == TIS_IO_TYPE_IOSTREAM_SHM) {
+        if(io->shm.ring != NULL) {
+            tis_shm_close(io->shm.ring);
+        }
+        tis_shm_detach(io->shm.ring, io->shm.mapped);
+        io->shm.ring = NULL;
+    }
+}
 
 tis_node_state_t run_input(tis_t* tis, tis_io_node_t* io) {
-    (void)tis;
     if(io == NULL) {
         return TIS_NODE_STATE_IDLE;
     }
@@ -17,16 +308,30 @@ tis_node_state_t run_input(tis_t* tis, tis_io_node_t* io) {
         return TIS_NODE_STATE_WRITE_WAIT;
     }
     spam("Input node I%zu attempting to write\n", io->col);
+    tis_node_state_t state;
+    if(tis->travel != NULL && travel_replay_input(tis, io, &state)) {
+        return state; // re-running a cycle that has been run before, see tis_travel.h
+    }
     tis_op_result_t result = input(io, &(io->writebuf));
     if(result == TIS_OP_RESULT_OK) {
-        return TIS_NODE_STATE_WRITE_WAIT;
+        io->values++;
+        state = TIS_NODE_STATE_WRITE_WAIT;
     } else if(result == TIS_OP_RESULT_READ_WAIT) {
-        return TIS_NODE_STATE_READ_WAIT;
+        if(input_pending(io)) {
+            sched_yield(); // give the producer a chance, in case it shares this cpu
+            state = TIS_NODE_STATE_RUNNING; // the producer is still open, so this is not the end of the input
+        } else {
+            state = TIS_NODE_STATE_READ_WAIT;
+        }
     } else {
         // BAD INTERNAL ERROR BAD this is out of sync with the enum
         error("INTERNAL: An error has occurred!!!\n");
         bork();
     }
+    if(tis->travel != NULL) {
+        travel_log_input(tis, io, state);
+    }
+    return state;
 }
 
 tis_node_state_t run_output(tis_t* tis, tis_io_node_t* io) {
@@ -34,13 +339,42 @@ tis_node_state_t run_output(tis_t* tis, tis_io_node_t* io) {
         return TIS_NODE_STATE_IDLE;
     }
     spam("Output node O%zu attempting to read\n", io->col);
+    if(io->expect.count != 0) {
+        io->expect.cycles++;
+    }
+    int blocked;
+    if(tis->travel == NULL || !travel_replay_blocked(tis, io, &blocked)) {
+        blocked = output_blocked(io);
+        if(tis->travel != NULL) {
+            travel_log_blocked(tis, io, blocked);
+        }
+    }
+    if(blocked) {
+        sched_yield(); // give the consumer a chance, in case it shares this cpu
+        return TIS_NODE_STATE_RUNNING; // waiting on the consumer, which is not the end of the output
+    }
     tis_op_result_t result;
     if(tis->rows == 0) { // if reading up with no rows, read input instead
         if(tis->inputs[io->col] == NULL || tis->inputs[io->col]->writereg != TIS_REGISTER_DOWN) {
+            if(tis->links != NULL) {
+                link_read(tis, tis->size + io->col, TIS_REGISTER_UP, TIS_OP_RESULT_READ_WAIT);
+            }
             return TIS_NODE_STATE_READ_WAIT;
         }
-        result = output(io, tis->inputs[io->col]->writebuf);
+        if(tis->links != NULL) {
+            link_read(tis, tis->size + io->col, TIS_REGISTER_UP, TIS_OP_RESULT_OK);
+        }
+        if(tis->trace != NULL) {
+            trace_value(tis, tis->size + io->col, TIS_REGISTER_UP, tis->inputs[io->col]->writebuf);
+        }
+        int muted = tis->travel != NULL && travel_mute_output(tis, io);
+        result = muted ? TIS_OP_RESULT_OK : output(io, tis->inputs[io->col]->writebuf);
         tis->inputs[io->col]->writereg = TIS_REGISTER_NIL;
+        io->values++;
+        io->last = tis->inputs[io->col]->writebuf;
+        if(io->expect.count != 0 && !muted) {
+            count_output(tis, io, tis->inputs[io->col]->writebuf);
+        }
         if(result == TIS_OP_RESULT_OK) {
             spam("Output node O%zu read success\n", io->col);
             return TIS_NODE_STATE_RUNNING;
@@ -52,13 +386,28 @@ tis_node_state_t run_output(tis_t* tis, tis_io_node_t* io) {
     }
     tis_node_t* neigh = tis->nodes[(tis->rows-1)*tis->cols + io->col];
     if(neigh == NULL || !(neigh->writereg == TIS_REGISTER_DOWN || neigh->writereg == TIS_REGISTER_ANY)) {
+        if(tis->links != NULL) {
+            link_read(tis, tis->size + io->col, TIS_REGISTER_UP, TIS_OP_RESULT_READ_WAIT);
+        }
         return TIS_NODE_STATE_READ_WAIT;
     }
-    result = output(io, neigh->writebuf);
+    if(tis->links != NULL) {
+        link_read(tis, tis->size + io->col, TIS_REGISTER_UP, TIS_OP_RESULT_OK);
+    }
+    if(tis->trace != NULL) {
+        trace_value(tis, tis->size + io->col, TIS_REGISTER_UP, neigh->writebuf);
+    }
+    int muted = tis->travel != NULL && travel_mute_output(tis, io);
+    result = muted ? TIS_OP_RESULT_OK : output(io, neigh->writebuf);
     if(neigh->writereg == TIS_REGISTER_ANY) {
         neigh->last = TIS_REGISTER_DOWN;
     }
     neigh->writereg = TIS_REGISTER_NIL;
+    io->values++;
+    io->last = neigh->writebuf;
+    if(io->expect.count != 0 && !muted) {
+        count_output(tis, io, neigh->writebuf);
+    }
     if(result == TIS_OP_RESULT_OK) {
         spam("Output node O%zu read success\n", io->col);
         return TIS_NODE_STATE_RUNNING;
@@ -70,7 +419,6 @@ tis_node_state_t run_output(tis_t* tis, tis_io_node_t* io) {
 }
 
 tis_node_state_t run_input_defer(tis_t* tis, tis_io_node_t* io) {
-    (void)tis;
     spam("Input node I%zu attempting to write (defer)\n", io->col);
     if(1 /* TODO is input */ ) {
         if(io->writereg == TIS_REGISTER_NIL) { // if NIL, the previous write was handled, reset it all
@@ -78,6 +426,9 @@ tis_node_state_t run_input_defer(tis_t* tis, tis_io_node_t* io) {
             spam("Input node I%zu write deferred success\n", io->col);
             return TIS_NODE_STATE_RUNNING;
         } else {
+            if(io->writereg == TIS_REGISTER_INVALID && tis->links != NULL) {
+                link_posted(tis, tis->size + io->col);
+            }
             io->writereg = TIS_REGISTER_DOWN;
             return TIS_NODE_STATE_WRITE_WAIT;
         }
@@ -112,9 +463,45 @@ tis_op_result_t input(tis_io_node_t* io, int* value) {
             }
             *value = clamp(in);
             break;
+        case TIS_IO_TYPE_IOSTREAM_BINARY16: {
+            unsigned char b[2];
+            if(fread(b, sizeof(b), 1, io->file.file) != 1) {
+                return TIS_OP_RESULT_READ_WAIT; // a trailing partial value is dropped
+            }
+            *value = clamp((int16_t)(b[0] | (uint16_t)b[1] << 8));
+            break;
+        }
+        case TIS_IO_TYPE_IOSTREAM_BINARY32: {
+            unsigned char b[4];
+            if(fread(b, sizeof(b), 1, io->file.file) != 1) {
+                return TIS_OP_RESULT_READ_WAIT; // a trailing partial value is dropped
+            }
+            *value = clamp((int32_t)(b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24));
+            break;
+        }
+        case TIS_IO_TYPE_IOSTREAM_SHM: {
+            int32_t val;
+            if(shm_ring(io) == NULL || !tis_shm_pop(io->shm.ring, &val)) {
+                return TIS_OP_RESULT_READ_WAIT;
+            }
+            *value = clamp(val);
+            break;
+        }
+        case TIS_IO_TYPE_IGENERATOR_RANDOM: {
+            if(io->random.left == 0) {
+                return TIS_OP_RESULT_READ_WAIT;
+            }
+            io->random.left--;
+            uint64_t x = io->random.state; // xorshift64*
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            io->random.state = x;
+            *value = io->random.min + (int)((x * 0x2545F4914F6CDD1DULL >> 32) % (uint64_t)(io->random.max - io->random.min + 1));
+            break;
+        }
         case TIS_IO_TYPE_IGENERATOR_LIST:
         case TIS_IO_TYPE_IGENERATOR_CYCLIC:
-        case TIS_IO_TYPE_IGENERATOR_RANDOM:
         case TIS_IO_TYPE_IGENERATOR_ALGEBRAIC:
         case TIS_IO_TYPE_IGENERATOR_GEOMETRIC:
         case TIS_IO_TYPE_IGENERATOR_HARMONIC:
@@ -157,6 +544,31 @@ tis_op_result_t output(tis_io_node_t* io, int value) {
                 spam("Output silently dropping value %d\n", value);
             }
             break;
+        case TIS_IO_TYPE_IOSTREAM_BINARY16:
+        case TIS_IO_TYPE_IOSTREAM_BINARY32:
+            if(io->file.file != NULL) {
+                unsigned char b[4] = {
+                    (uint32_t)value & 0xFF, ((uint32_t)value >> 8) & 0xFF,
+                    ((uint32_t)value >> 16) & 0xFF, ((uint32_t)value >> 24) & 0xFF,
+                };
+                if(fwrite(b, io->type == TIS_IO_TYPE_IOSTREAM_BINARY16 ? 2 : 4, 1, io->file.file) != 1) {
+                    error("An error occurred when writing value %d to file, silently dropping future values\n", value);
+                    io->file.file = NULL; // this file handle is still closeable by the normal method
+                }
+            } else {
+                spam("Output silently dropping value %d\n", value);
+            }
+            break;
+        case TIS_IO_TYPE_IOSTREAM_SHM:
+            if(shm_ring(io) != NULL) {
+                if(!tis_shm_push(io->shm.ring, value)) {
+                    // run_output checks for space before taking the value, so this should not happen
+                    error("INTERNAL: Shared memory ring %s is full, dropping value %d\n", io->shm.name, value);
+                }
+            } else {
+                spam("Output silently dropping value %d\n", value);
+            }
+            break;
         case TIS_IO_TYPE_OSTREAM_IMAGE:
         default:
             error("Not yet implemented\n");
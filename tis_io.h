@@ -1,8 +1,48 @@
 #ifndef _TIS_IO_
 #define _TIS_IO_
 
+#include <stdio.h>
+
 #include "tis_types.h"
 
+/*
+ * Io types that read or write raw integers
+ */
+static inline int is_binary_io(tis_io_type_t type) {
+    return type == TIS_IO_TYPE_IOSTREAM_BINARY16 ||
+           type == TIS_IO_TYPE_IOSTREAM_BINARY32;
+}
+
+/*
+ * Io types that read or write through a FILE*
+ */
+static inline int is_file_io(tis_io_type_t type) {
+    return type == TIS_IO_TYPE_IOSTREAM_ASCII ||
+           type == TIS_IO_TYPE_IOSTREAM_NUMERIC ||
+           is_binary_io(type);
+}
+
+/*
+ * With --stop-idle or --score, set up by init_stop() and run by stop_cycle() after each cycle of tick()
+ */
+typedef struct tis_stop {
+    unsigned long long idle; // cycles without a value taken, once the inputs have ended
+    unsigned long long cycle; // cycles run
+    unsigned long long taken; // values taken by all outputs, as of the last cycle
+    unsigned long long last; // the cycle in which an output last took a value, or 0
+    unsigned long long cycles; // the cycle count given when a termination policy stopped the run, or 0
+} tis_stop_t;
+
+void register_file_handle(FILE* file);
+void close_file_handles();
+void open_io_file(tis_io_node_t* io, char* path, int is_output);
+void open_expect(tis_io_node_t* io, char* path);
+size_t expected_missing(tis_t* tis);
+void seed_random_input(tis_io_node_t* io, unsigned long long seed);
+void init_stop(tis_t* tis, unsigned long long idle);
+void stop_cycle(tis_t* tis);
+void free_stop(tis_t* tis);
+
 tis_node_state_t run_input(tis_t* tis, tis_io_node_t* io);
 tis_node_state_t run_output(tis_t* tis, tis_io_node_t* io);
 
@@ -12,4 +52,7 @@ tis_node_state_t run_output_defer(tis_t* tis, tis_io_node_t* io);
 tis_op_result_t input(tis_io_node_t* io, int* value);
 tis_op_result_t output(tis_io_node_t* io, int value);
 
+void close_input(tis_io_node_t* io);
+void close_output(tis_io_node_t* io);
+
 #endif /* _TIS_IO_ */
@@ -0,0 +1,354 @@
+#define _POSIX_C_SOURCE 200809L // for fileno()
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tis_lex.h"
+#include "tis_types.h"
+
+/*
+ * Read everything remaining on this descriptor into an owned buffer
+ */
+static int text_read(tis_text_t* text, int fd) {
+    size_t cap = 4096, len = 0;
+    char* buf = malloc(cap);
+    if(buf == NULL) {
+        return -1;
+    }
+    for(;;) {
+        if(len == cap) {
+            char* temp = realloc(buf, cap * 2);
+            if(temp == NULL) {
+                free(buf);
+                return -1;
+            }
+            buf = temp;
+            cap *= 2;
+        }
+        ssize_t got = read(fd, &buf[len], cap - len);
+        if(got < 0) {
+            free(buf);
+            return -1;
+        } else if(got == 0) {
+            break;
+        }
+        len += got;
+    }
+    text->buf = buf;
+    text->data = buf;
+    text->len = len;
+    return 0;
+}
+
+/*
+ * Load a whole file; regular files are mapped, anything else (pipes, stdin) is read into memory
+ */
+int text_open(tis_text_t* text, const char* filename) {
+    memset(text, 0, sizeof(tis_text_t));
+    text->data = "";
+    if(strcmp(filename, "-") == 0) {
+        return text_read(text, fileno(stdin));
+    }
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    int result = 0;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if(st.st_size > 0) {
+            void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                text->map = map;
+                text->data = map;
+                text->len = st.st_size;
+            } else {
+                result = text_read(text, fd);
+            }
+        }
+    } else {
+        result = text_read(text, fd);
+    }
+    close(fd);
+    return result;
+}
+
+void text_from_string(tis_text_t* text, const char* str) {
+    memset(text, 0, sizeof(tis_text_t));
+    text->data = str;
+    text->len = strlen(str);
+}
+
+void text_close(tis_text_t* text) {
+    if(text->map != NULL) {
+        munmap(text->map, text->len);
+    }
+    safe_free(text->buf);
+    text->map = NULL;
+    text->data = "";
+    text->len = 0;
+}
+
+int scan_eof(tis_scan_t* scan) {
+    return scan->p >= scan->end;
+}
+
+void scan_space(tis_scan_t* scan) {
+    while(scan->p < scan->end && isspace((unsigned char)*scan->p)) {
+        scan->p++;
+    }
+}
+
+int scan_getc(tis_scan_t* scan) {
+    if(scan->p >= scan->end) {
+        return EOF;
+    }
+    return (unsigned char)*(scan->p++);
+}
+
+/*
+ * Matches the behavior of "%zu": leading whitespace and a sign are allowed, and consumed even if no digits follow
+ */
+int scan_size(tis_scan_t* scan, size_t* value) {
+    scan_space(scan);
+    if(scan->p >= scan->end) {
+        return EOF;
+    }
+    int negative = 0;
+    if(*scan->p == '+' || *scan->p == '-') {
+        negative = (*scan->p == '-');
+        scan->p++;
+        if(scan->p >= scan->end) {
+            return EOF;
+        }
+    }
+    if(!isdigit((unsigned char)*scan->p)) {
+        return 0;
+    }
+    size_t val = 0;
+    int overflow = 0;
+    while(scan->p < scan->end && isdigit((unsigned char)*scan->p)) {
+        size_t digit = *scan->p - '0';
+        if(val > ((size_t)-1 - digit) / 10) {
+            overflow = 1;
+        }
+        val = val * 10 + digit;
+        scan->p++;
+    }
+    if(overflow) {
+        *value = (size_t)-1;
+    } else {
+        *value = negative ? (size_t)0 - val : val;
+    }
+    return 1;
+}
+
+/*
+ * Matches the behavior of " <prefix>%zu ": the prefix stays consumed if the number does not match
+ */
+int scan_prefixed_size(tis_scan_t* scan, char prefix, size_t* value) {
+    scan_space(scan);
+    if(scan->p >= scan->end) {
+        return EOF;
+    }
+    if(*scan->p != prefix) {
+        return 0;
+    }
+    scan->p++;
+    int result = scan_size(scan, value);
+    if(result == 1) {
+        scan_space(scan);
+    }
+    return result;
+}
+
+/*
+ * Matches an optional range end "..<prefix><n>" or "..<n>" right after an index, then any whitespace.
+ * Returns 0 and consumes nothing if there is no range.
+ */
+int scan_range(tis_scan_t* scan, char prefix, size_t* value) {
+    const char* start = scan->p;
+    if(scan->end - scan->p < 3 || scan->p[0] != '.' || scan->p[1] != '.') {
+        return 0;
+    }
+    scan->p += 2;
+    if(*scan->p == prefix) {
+        scan->p++;
+    }
+    if(scan->p >= scan->end || !isdigit((unsigned char)*scan->p) || scan_size(scan, value) != 1) {
+        scan->p = start;
+        return 0;
+    }
+    scan_space(scan);
+    return 1;
+}
+
+/*
+ * Matches the behavior of " %<maxlen>s ", buf must hold maxlen+1 characters
+ */
+int scan_word(tis_scan_t* scan, char* buf, size_t maxlen) {
+    scan_space(scan);
+    if(scan->p >= scan->end) {
+        return EOF;
+    }
+    size_t len = 0;
+    while(len < maxlen && scan->p < scan->end && !isspace((unsigned char)*scan->p)) {
+        buf[len++] = *(scan->p++);
+    }
+    buf[len] = '\0';
+    scan_space(scan);
+    return 1;
+}
+
+#define KEY3(a, b, c) (((unsigned)(a) << 16) | ((unsigned)(b) << 8) | (unsigned)(c))
+
+tis_op_type_t lex_opcode(const char* tok) {
+    if(tok[0] == '\0' || tok[1] == '\0' || tok[2] == '\0' || tok[3] != '\0') {
+        return TIS_OP_TYPE_INVALID;
+    }
+    switch(KEY3(toupper((unsigned char)tok[0]), toupper((unsigned char)tok[1]), toupper((unsigned char)tok[2]))) {
+        case KEY3('A', 'D', 'D'): return TIS_OP_TYPE_ADD;
+        case KEY3('H', 'C', 'F'): return TIS_OP_TYPE_HCF;
+        case KEY3('J', 'E', 'Z'): return TIS_OP_TYPE_JEZ;
+        case KEY3('J', 'G', 'Z'): return TIS_OP_TYPE_JGZ;
+        case KEY3('J', 'L', 'Z'): return TIS_OP_TYPE_JLZ;
+        case KEY3('J', 'M', 'P'): return TIS_OP_TYPE_JMP;
+        case KEY3('J', 'N', 'Z'): return TIS_OP_TYPE_JNZ;
+        case KEY3('J', 'R', 'O'): return TIS_OP_TYPE_JRO;
+        case KEY3('M', 'O', 'V'): return TIS_OP_TYPE_MOV;
+        case KEY3('N', 'E', 'G'): return TIS_OP_TYPE_NEG;
+        case KEY3('N', 'O', 'P'): return TIS_OP_TYPE_NOP;
+        case KEY3('S', 'A', 'V'): return TIS_OP_TYPE_SAV;
+        case KEY3('S', 'U', 'B'): return TIS_OP_TYPE_SUB;
+        case KEY3('S', 'W', 'P'): return TIS_OP_TYPE_SWP;
+        default: return TIS_OP_TYPE_INVALID;
+    }
+}
+
+/*
+ * Compare tok against an upper case keyword of known length, ignoring case
+ */
+static int keyword_eq(const char* tok, const char* keyword, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        if(toupper((unsigned char)tok[i]) != keyword[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+tis_register_t lex_register(const char* tok) {
+    switch(strlen(tok)) {
+        case 2:
+            if(keyword_eq(tok, "UP", 2)) return TIS_REGISTER_UP;
+            break;
+        case 3:
+            switch(toupper((unsigned char)tok[0])) {
+                case 'A':
+                    if(keyword_eq(tok, "ACC", 3)) return TIS_REGISTER_ACC;
+                    if(keyword_eq(tok, "ANY", 3)) return TIS_REGISTER_ANY;
+                    break;
+                case 'N':
+                    if(keyword_eq(tok, "NIL", 3)) return TIS_REGISTER_NIL;
+                    break;
+            }
+            break;
+        case 4:
+            switch(toupper((unsigned char)tok[0])) {
+                case 'D':
+                    if(keyword_eq(tok, "DOWN", 4)) return TIS_REGISTER_DOWN;
+                    break;
+                case 'L':
+                    if(keyword_eq(tok, "LEFT", 4)) return TIS_REGISTER_LEFT;
+                    if(keyword_eq(tok, "LAST", 4)) return TIS_REGISTER_LAST;
+                    break;
+            }
+            break;
+        case 5:
+            if(keyword_eq(tok, "RIGHT", 5)) return TIS_REGISTER_RIGHT;
+            break;
+    }
+    return TIS_REGISTER_INVALID;
+}
+
+int op_arg_count(tis_op_type_t type) {
+    switch(type) {
+        case TIS_OP_TYPE_MOV:
+            return 2;
+        case TIS_OP_TYPE_ADD:
+        case TIS_OP_TYPE_JEZ:
+        case TIS_OP_TYPE_JGZ:
+        case TIS_OP_TYPE_JLZ:
+        case TIS_OP_TYPE_JMP:
+        case TIS_OP_TYPE_JNZ:
+        case TIS_OP_TYPE_JRO:
+        case TIS_OP_TYPE_SUB:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Jumps whose operand is a label (JRO doesn't qualify)
+ */
+int op_takes_label(tis_op_type_t type) {
+    switch(type) {
+        case TIS_OP_TYPE_JEZ:
+        case TIS_OP_TYPE_JGZ:
+        case TIS_OP_TYPE_JLZ:
+        case TIS_OP_TYPE_JMP:
+        case TIS_OP_TYPE_JNZ:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+char* lex_token(char** cursor) {
+    char* p = *cursor;
+    while(*p == ' ' || *p == ',') {
+        p++;
+    }
+    if(*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    char* tok = p;
+    while(*p != '\0' && *p != ' ' && *p != ',') {
+        p++;
+    }
+    if(*p != '\0') {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return tok;
+}
+
+/*
+ * As in the game, a line is marked as a breakpoint by a '!' before the instruction: first on the line, or first after
+ * its label
+ */
+char* lex_breakpoint(char* line) {
+    char* p = line;
+    char* colon = strchr(line, ':');
+    char* comment = strchr(line, '#');
+    if(colon != NULL && (comment == NULL || colon < comment)) {
+        p = colon + 1;
+    }
+    while(*p == ' ') {
+        p++;
+    }
+    if(*p == '!') {
+        return p;
+    }
+    p = line;
+    while(*p == ' ') {
+        p++;
+    }
+    return *p == '!' ? p : NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef _TIS_LEX_
+#define _TIS_LEX_
+
+#include <stddef.h>
+
+#include "tis_types.h"
+
+/*
+ * A whole input file held in memory, either mapped or read into a buffer.
+ * The contents are not NUL-terminated and must not be modified.
+ */
+typedef struct tis_text {
+    const char* data;
+    size_t len;
+    void* map; // non-NULL if data is an mmap() of a regular file
+    char* buf; // non-NULL if data was read into an owned buffer
+} tis_text_t;
+
+int text_open(tis_text_t* text, const char* filename); // "-" is stdin
+void text_from_string(tis_text_t* text, const char* str);
+void text_close(tis_text_t* text);
+
+/*
+ * Cursor over a tis_text_t, with fscanf-like primitives used by the layout parser
+ */
+typedef struct tis_scan {
+    const char* p;
+    const char* end;
+} tis_scan_t;
+
+int scan_eof(tis_scan_t* scan);
+void scan_space(tis_scan_t* scan);
+int scan_getc(tis_scan_t* scan); // returns EOF at the end
+int scan_size(tis_scan_t* scan, size_t* value); // like "%zu": 1 on success, 0 on mismatch, EOF at the end
+int scan_prefixed_size(tis_scan_t* scan, char prefix, size_t* value); // like " <prefix>%zu "
+int scan_range(tis_scan_t* scan, char prefix, size_t* value); // "..<prefix><n>" after an index, 0 if absent
+int scan_word(tis_scan_t* scan, char* buf, size_t maxlen); // like " %<maxlen>s "
+
+/*
+ * Keyword lookup for assembly tokens, case insensitive
+ */
+tis_op_type_t lex_opcode(const char* tok);
+tis_register_t lex_register(const char* tok); // only the registers valid as operands; BAK is INVALID
+int op_arg_count(tis_op_type_t type);
+int op_takes_label(tis_op_type_t type);
+
+char* lex_token(char** cursor); // like strtok(_, " ,") on a private cursor
+char* lex_breakpoint(char* line); // the '!' marking a breakpoint on this line, or NULL
+
+#endif /* _TIS_LEX_ */
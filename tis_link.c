@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tis_link.h"
+#include "tis_types.h"
+
+#define TIS_LINK_TABLE_ROWS 10 // busiest links listed, unless verbose
+
+typedef struct link_row {
+    size_t reader;
+    tis_register_t reg;
+    tis_link_t* link;
+} link_row_t;
+
+/*
+ * Set up tis->links, after init_tick()
+ */
+void init_links(tis_t* tis, int log) {
+    tis_links_t* links = calloc(1, sizeof(tis_links_t));
+    if(links != NULL) {
+        links->posted = malloc((tis->size + tis->cols) * sizeof(unsigned long long) + 1);
+        links->waiting = malloc((tis->size + tis->cols) * sizeof(unsigned long long) + 1);
+        links->links = calloc(4 * (tis->size + tis->cols) + 1, sizeof(tis_link_t*));
+        if(log) {
+            links->posted_line = calloc(tis->size + tis->cols + 1, sizeof(int));
+            links->maxevents = 1024;
+            links->events = malloc(links->maxevents * sizeof(tis_link_event_t));
+        }
+    }
+    if(links == NULL || links->posted == NULL || links->waiting == NULL || links->links == NULL ||
+       (log && (links->posted_line == NULL || links->events == NULL))) {
+        error("Unable to allocate memory for the link counters\n");
+        bork();
+    }
+    for(size_t i = 0; i < tis->size + tis->cols; i++) {
+        links->posted[i] = TIS_LINK_NEVER;
+        links->waiting[i] = TIS_LINK_NEVER;
+    }
+    tis->links = links;
+}
+
+/*
+ * The writer (grid, then inputs) at the other end of the link that this reader (grid, then outputs) reads from
+ */
+size_t link_writer(tis_t* tis, size_t reader, tis_register_t reg) {
+    if(reader >= tis->size) {
+        size_t col = reader - tis->size;
+        return tis->rows == 0 ? tis->size + col : (tis->rows - 1) * tis->cols + col;
+    }
+    switch(reg) {
+        case TIS_REGISTER_UP: return reader < tis->cols ? tis->size + reader : reader - tis->cols;
+        case TIS_REGISTER_DOWN: return reader + tis->cols;
+        case TIS_REGISTER_LEFT: return reader - 1;
+        default: return reader + 1;
+    }
+}
+
+static int bucket(unsigned long long cycles) {
+    int b = 0;
+    while(cycles > 0 && b < TIS_LINK_BUCKETS - 1) {
+        cycles >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/*
+ * A writer (grid, then inputs) has made a value available, in the second stage of this cycle
+ */
+void link_posted(tis_t* tis, size_t writer) {
+    tis->links->posted[writer] = tis->links->cycle;
+    if(tis->links->posted_line != NULL) {
+        tis->links->posted_line[writer] = writer < tis->size ? tis->nodes[writer]->index : -1;
+    }
+}
+
+static void log_event(tis_t* tis, size_t reader, size_t writer) {
+    tis_links_t* links = tis->links;
+    if(links->nevents == links->maxevents) {
+        tis_link_event_t* events = realloc(links->events, 2 * links->maxevents * sizeof(tis_link_event_t));
+        if(events == NULL) {
+            error("Unable to allocate memory for the dependency log\n");
+            bork();
+        }
+        links->events = events;
+        links->maxevents *= 2;
+    }
+    links->events[links->nevents++] = (tis_link_event_t){
+        .taken = links->cycle,
+        .posted = links->posted[writer],
+        .since = links->waiting[reader] == TIS_LINK_NEVER ? links->cycle : links->waiting[reader],
+        .writer = writer,
+        .reader = reader,
+        .writer_line = links->posted_line[writer],
+        .reader_line = reader < tis->size ? tis->nodes[reader]->index : -1,
+    };
+}
+
+/*
+ * A reader (grid, then outputs) has tried to read from a port; reg is the port the value came from if it succeeded
+ */
+void link_read(tis_t* tis, size_t reader, tis_register_t reg, tis_op_result_t result) {
+    tis_links_t* links = tis->links;
+    if(result == TIS_OP_RESULT_READ_WAIT) {
+        if(links->waiting[reader] == TIS_LINK_NEVER) {
+            links->waiting[reader] = links->cycle;
+        }
+        return;
+    } else if(result != TIS_OP_RESULT_OK || reg < TIS_REGISTER_UP || reg > TIS_REGISTER_RIGHT) {
+        return;
+    }
+    tis_link_t** slot = &(links->links[4 * reader + (reg - TIS_REGISTER_UP)]);
+    if(*slot == NULL && (*slot = calloc(1, sizeof(tis_link_t))) == NULL) {
+        error("Unable to allocate memory for the link counters\n");
+        bork();
+    }
+    size_t writer = link_writer(tis, reader, reg);
+    if(links->events != NULL) {
+        log_event(tis, reader, writer);
+    }
+    unsigned long long since[2] = { links->posted[writer], links->waiting[reader] };
+    (*slot)->values++;
+    for(int k = 0; k < 2; k++) {
+        unsigned long long cycles = since[k] == TIS_LINK_NEVER ? 0 : links->cycle - since[k];
+        (*slot)->wait_total[k] += cycles;
+        (*slot)->wait[k][bucket(cycles)]++;
+    }
+    links->posted[writer] = TIS_LINK_NEVER;
+    links->waiting[reader] = TIS_LINK_NEVER;
+}
+
+static unsigned long long values(tis_t* tis, size_t reader, tis_register_t reg) {
+    tis_link_t* link = tis->links->links[4 * reader + (reg - TIS_REGISTER_UP)];
+    return link == NULL ? 0 : link->values;
+}
+
+/*
+ * Traffic in both directions between grid index i and its neighbor below (or to the right)
+ */
+static unsigned long long traffic(tis_t* tis, size_t i, int below) {
+    if(below) {
+        return values(tis, i + tis->cols, TIS_REGISTER_UP) + values(tis, i, TIS_REGISTER_DOWN);
+    }
+    return values(tis, i + 1, TIS_REGISTER_LEFT) + values(tis, i, TIS_REGISTER_RIGHT);
+}
+
+static double utilization(tis_t* tis, unsigned long long count) {
+    return tis->links->cycle == 0 ? 0.0 : (double)count / tis->links->cycle;
+}
+
+static char map_char(tis_t* tis, unsigned long long count) {
+    if(count == 0) {
+        return ' ';
+    }
+    int tenths = (int)(10 * utilization(tis, count));
+    return '0' + (tenths > 9 ? 9 : tenths);
+}
+
+static char node_char(tis_node_t* node) {
+    if(node == NULL) {
+        return '#';
+    }
+    switch(node->type) {
+        case TIS_NODE_TYPE_COMPUTE: return 'C';
+        case TIS_NODE_TYPE_MEMORY_STACK: return 'S';
+        case TIS_NODE_TYPE_MEMORY_RAM: return 'R';
+        default: return '#';
+    }
+}
+
+static void print_map(tis_t* tis) {
+    fprintf(stderr, "Link map (digits are tenths of cycles with a value crossing, # is damaged):\n");
+    for(size_t col = 0; col < tis->cols; col++) {
+        fprintf(stderr, "%c ", map_char(tis, values(tis, col, TIS_REGISTER_UP)));
+    }
+    fprintf(stderr, "\n");
+    for(size_t row = 0; row < tis->rows; row++) {
+        for(size_t col = 0; col < tis->cols; col++) {
+            size_t i = row * tis->cols + col;
+            fprintf(stderr, "%c%c", node_char(tis->nodes[i]), col + 1 < tis->cols ? map_char(tis, traffic(tis, i, 0)) : ' ');
+        }
+        fprintf(stderr, "\n");
+        for(size_t col = 0; col < tis->cols; col++) {
+            size_t i = row * tis->cols + col;
+            unsigned long long count = row + 1 < tis->rows ? traffic(tis, i, 1) : values(tis, tis->size + col, TIS_REGISTER_UP);
+            fprintf(stderr, "%c ", map_char(tis, count));
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static void end_name(tis_t* tis, size_t index, int is_writer, char* buf, size_t len) {
+    if(index < tis->size) {
+        snprintf(buf, len, "%s", tis->nodes[index] != NULL ? node_name(tis->nodes[index]) : "?");
+    } else {
+        snprintf(buf, len, "%c%zu", is_writer ? 'I' : 'O', index - tis->size);
+    }
+}
+
+static int compare_rows(const void* a, const void* b) {
+    unsigned long long va = ((const link_row_t*)a)->link->values;
+    unsigned long long vb = ((const link_row_t*)b)->link->values;
+    return (va < vb) - (va > vb); // busiest first
+}
+
+static void json_map(tis_t* tis, FILE* file) {
+    fprintf(file, "  \"map\": {\n    \"inputs\": [");
+    for(size_t col = 0; col < tis->cols; col++) {
+        fprintf(file, "%s%g", col == 0 ? "" : ", ", utilization(tis, tis->rows == 0 ? 0 : values(tis, col, TIS_REGISTER_UP)));
+    }
+    fprintf(file, "],\n    \"right\": [");
+    for(size_t row = 0; row < tis->rows; row++) {
+        fprintf(file, "%s\n      [", row == 0 ? "" : ",");
+        for(size_t col = 0; col + 1 < tis->cols; col++) {
+            fprintf(file, "%s%g", col == 0 ? "" : ", ", utilization(tis, traffic(tis, row * tis->cols + col, 0)));
+        }
+        fprintf(file, "]");
+    }
+    fprintf(file, "\n    ],\n    \"down\": [");
+    for(size_t row = 0; row + 1 < tis->rows; row++) {
+        fprintf(file, "%s\n      [", row == 0 ? "" : ",");
+        for(size_t col = 0; col < tis->cols; col++) {
+            fprintf(file, "%s%g", col == 0 ? "" : ", ", utilization(tis, traffic(tis, row * tis->cols + col, 1)));
+        }
+        fprintf(file, "]");
+    }
+    fprintf(file, "\n    ],\n    \"outputs\": [");
+    for(size_t col = 0; col < tis->cols; col++) {
+        fprintf(file, "%s%g", col == 0 ? "" : ", ", utilization(tis, values(tis, tis->size + col, TIS_REGISTER_UP)));
+    }
+    fprintf(file, "]\n  },\n");
+}
+
+static int write_json(tis_t* tis, link_row_t* rows, size_t count, const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if(file == NULL) {
+        error("Unable to open %s to write the link counters\n", filename);
+        return -1;
+    }
+    fprintf(file, "{\n  \"cycles\": %llu,\n", tis->links->cycle);
+    json_map(tis, file);
+    fprintf(file, "  \"links\": [");
+    for(size_t r = 0; r < count; r++) {
+        char from[128], to[128];
+        end_name(tis, link_writer(tis, rows[r].reader, rows[r].reg), 1, from, sizeof(from));
+        end_name(tis, rows[r].reader, 0, to, sizeof(to));
+        fprintf(file, "%s\n    {\"from\": ", r == 0 ? "" : ",");
+        json_string(file, from);
+        fprintf(file, ", \"to\": ");
+        json_string(file, to);
+        fprintf(file, ", \"port\": \"%s\", \"values\": %llu", reg_to_string(rows[r].reg), rows[r].link->values);
+        for(int k = 0; k < 2; k++) {
+            fprintf(file, ", \"%s_wait\": {\"total\": %llu, \"histogram\": [", k == 0 ? "write" : "read", rows[r].link->wait_total[k]);
+            for(int b = 0; b < TIS_LINK_BUCKETS; b++) {
+                fprintf(file, "%s%llu", b == 0 ? "" : ", ", rows[r].link->wait[k][b]);
+            }
+            fprintf(file, "]}");
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    if(fclose(file) != 0) {
+        error("Unable to write the link counters to %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Print the link map and the busiest links on stderr, and write everything to filename as JSON if that is not NULL.
+ * Called at exit, so that a run that halts is also reported; free_links() comes after.
+ */
+void report_links(tis_t* tis, const char* filename) {
+    tis_links_t* links = tis->links;
+    if(links == NULL) {
+        return;
+    }
+    size_t slots = 4 * (tis->size + tis->cols);
+    size_t count = 0;
+    for(size_t s = 0; s < slots; s++) {
+        count += links->links[s] != NULL;
+    }
+    link_row_t* rows = malloc(count * sizeof(link_row_t) + 1);
+    if(rows == NULL) {
+        error("Unable to allocate memory for the link report\n");
+        return;
+    }
+    for(size_t s = 0, r = 0; s < slots; s++) {
+        if(links->links[s] != NULL) {
+            rows[r++] = (link_row_t){ .reader = s / 4, .reg = TIS_REGISTER_UP + s % 4, .link = links->links[s] };
+        }
+    }
+
+    fprintf(stderr, "Links: %zu in use over %llu cycles\n", count, links->cycle);
+    if(tis->rows > 0 && tis->cols <= TIS_LINK_MAP_COLS) {
+        print_map(tis);
+    }
+    if(filename != NULL && write_json(tis, rows, count, filename) == 0) {
+        debug("Wrote the link counters to %s\n", filename);
+    }
+    qsort(rows, count, sizeof(link_row_t), compare_rows);
+    size_t shown = (opts.verbose > 0 || count < TIS_LINK_TABLE_ROWS) ? count : TIS_LINK_TABLE_ROWS;
+    if(shown > 0) {
+        fprintf(stderr, "%-32s %-32s %10s %11s %10s\n", "from", "to", "values", "write_wait", "read_wait");
+    }
+    for(size_t r = 0; r < shown; r++) {
+        char from[128], to[128];
+        tis_link_t* link = rows[r].link;
+        end_name(tis, link_writer(tis, rows[r].reader, rows[r].reg), 1, from, sizeof(from));
+        end_name(tis, rows[r].reader, 0, to, sizeof(to));
+        fprintf(stderr, "%-32s %-32s %10llu %11.2f %10.2f\n", from, to, link->values,
+                (double)link->wait_total[0] / link->values, (double)link->wait_total[1] / link->values);
+    }
+    if(shown < count) {
+        fprintf(stderr, "(%zu more links, use -v to show all)\n", count - shown);
+    }
+
+    free(rows);
+}
+
+void free_links(tis_t* tis) {
+    tis_links_t* links = tis->links;
+    if(links == NULL) {
+        return;
+    }
+    for(size_t s = 0; s < 4 * (tis->size + tis->cols); s++) {
+        safe_free(links->links[s]);
+    }
+    safe_free(links->links);
+    safe_free(links->posted);
+    safe_free(links->waiting);
+    safe_free(links->posted_line);
+    safe_free(links->events);
+    safe_free(tis->links);
+}
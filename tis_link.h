@@ -0,0 +1,57 @@
+#ifndef _TIS_LINK_
+#define _TIS_LINK_
+
+#include "tis_types.h"
+
+/*
+ * Link traffic counters (--links).
+ *
+ * A link is one direction between two neighbors, or between an io node and the edge of the grid. For each link that
+ * is used, this counts the values that crossed it, how many cycles each value waited after it was written before it
+ * was taken (write wait), and how many cycles the reader had been waiting for it (read wait). Waits go into log2
+ * histograms. When logging, every value taken is also kept as an event, for the critical path. The handshake in
+ * tis_node.c and tis_io.c calls in here only if tis->links is set, which is one branch per read and per write.
+ */
+
+#ifndef TIS_LINK_BUCKETS
+#define TIS_LINK_BUCKETS 16 // histogram buckets: 0, 1, 2-3, 4-7, ..., and the rest in the last one
+#endif
+#define TIS_LINK_NEVER ((unsigned long long)-1)
+#define TIS_LINK_MAP_COLS 100 // widest grid drawn as a text map
+
+typedef struct tis_link {
+    unsigned long long values;
+    unsigned long long wait_total[2]; // cycles of write wait, then of read wait, over all values
+    unsigned long long wait[2][TIS_LINK_BUCKETS]; // histograms of write wait, then of read wait
+} tis_link_t;
+
+typedef struct tis_link_event {
+    unsigned long long taken; // the cycle the reader took the value
+    unsigned long long posted; // the cycle the writer made it available
+    unsigned long long since; // the cycle the reader started waiting for it, or taken if it did not wait
+    size_t writer; // grid, then inputs
+    size_t reader; // grid, then outputs
+    int writer_line; // instruction pointer of the writer when it wrote, -1 for inputs
+    int reader_line; // instruction pointer of the reader when it read, -1 for outputs
+} tis_link_event_t;
+
+typedef struct tis_links {
+    unsigned long long cycle; // counted by tick()
+    unsigned long long* posted; // per writer (grid, then inputs), the cycle its value was written, or TIS_LINK_NEVER
+    unsigned long long* waiting; // per reader (grid, then outputs), the cycle it started waiting, or TIS_LINK_NEVER
+    tis_link_t** links; // per reader and direction read from (UP, DOWN, LEFT, RIGHT), set up on first use
+    // Only when logging, for the critical path (see tis_crit.h)
+    int* posted_line; // per writer, its instruction pointer when it wrote
+    tis_link_event_t* events; // every value taken, in order
+    size_t nevents;
+    size_t maxevents;
+} tis_links_t;
+
+void init_links(tis_t* tis, int log);
+void free_links(tis_t* tis);
+size_t link_writer(tis_t* tis, size_t reader, tis_register_t reg);
+void link_posted(tis_t* tis, size_t writer);
+void link_read(tis_t* tis, size_t reader, tis_register_t reg, tis_op_result_t result);
+void report_links(tis_t* tis, const char* filename);
+
+#endif /* _TIS_LINK_ */
@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L // for clock_gettime() and sigaction()
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tis_metrics.h"
+#include "tis_node.h"
+#include "tis_types.h"
+
+static const char* state_labels[] = { "running", "read_wait", "write_wait", "idle" };
+
+static volatile sig_atomic_t dump_wanted = 0;
+
+static void want_dump(int sig) {
+    (void)sig;
+    dump_wanted = 1;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Begin the state dump
+ */
+
+static void dump_state(tis_t* tis) {
+    tis_metrics_t* metrics = tis->metrics;
+    FILE* out = metrics->dump_path == NULL ? stderr : fopen(metrics->dump_path, "w");
+    if(out == NULL) {
+        error("Unable to open %s for the state dump\n", metrics->dump_path);
+        return;
+    }
+    fprintf(out, "Cycle %llu\n", metrics->cycles);
+    for(size_t c = 0; c < tis->cols; c++) {
+        if(tis->inputs[c] != NULL) {
+            print_io_state(out, tis->inputs[c], 'I');
+        }
+    }
+    for(size_t i = 0; i < tis->nactive; i++) {
+        print_node_state(out, tis->active[i]);
+    }
+    for(size_t c = 0; c < tis->cols; c++) {
+        if(tis->outputs[c] != NULL) {
+            print_io_state(out, tis->outputs[c], 'O');
+        }
+    }
+    if(out != stderr) {
+        fclose(out);
+    } else {
+        fflush(stderr);
+    }
+    metrics->dumps++;
+}
+
+/*
+ * Begin the metrics file
+ */
+
+static void node_labels(tis_t* tis, FILE* out, size_t i) {
+    tis_node_t* node = tis->active[i];
+    fprintf(out, "row=\"%zu\",col=\"%zu\"", node->row, node->col);
+    if(node->type == TIS_NODE_TYPE_COMPUTE) {
+        fprintf(out, ",id=\"%lld\"", node->id);
+    }
+}
+
+static void write_metrics(tis_t* tis) {
+    tis_metrics_t* metrics = tis->metrics;
+    double time = now();
+    if(time > metrics->written) {
+        metrics->rate = (metrics->cycles - metrics->written_cycles) / (time - metrics->written);
+    }
+    metrics->written = time;
+    metrics->written_cycles = metrics->cycles;
+    FILE* out = fopen(metrics->temp, "w");
+    if(out == NULL) {
+        error("Unable to open %s for the metrics\n", metrics->temp);
+        return;
+    }
+    fprintf(out, "# HELP tis_cycles_total Cycles run.\n# TYPE tis_cycles_total counter\n");
+    fprintf(out, "tis_cycles_total %llu\n", metrics->cycles);
+    fprintf(out, "# HELP tis_cycles_per_second Cycles run a second, since the metrics were last written.\n# TYPE tis_cycles_per_second gauge\n");
+    fprintf(out, "tis_cycles_per_second %.1f\n", metrics->rate);
+    fprintf(out, "# HELP tis_run_seconds Seconds since the machine started.\n# TYPE tis_run_seconds gauge\n");
+    fprintf(out, "tis_run_seconds %.3f\n", time - metrics->start);
+    fprintf(out, "# HELP tis_io_values_total Values given by each input and taken by each output.\n# TYPE tis_io_values_total counter\n");
+    for(size_t c = 0; c < 2 * tis->cols; c++) {
+        tis_io_node_t* io = c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols];
+        if(io != NULL) {
+            fprintf(out, "tis_io_values_total{io=\"%c%zu\"} %llu\n", c < tis->cols ? 'I' : 'O', io->col, io->values);
+        }
+    }
+    fprintf(out, "# HELP tis_node_state_samples_total Times each node was seen in each state, sampled at random intervals of about %d cycles.\n# TYPE tis_node_state_samples_total counter\n", TIS_METRICS_SAMPLE);
+    for(size_t i = 0; i < tis->nactive; i++) {
+        for(int s = 0; s < 4; s++) {
+            fprintf(out, "tis_node_state_samples_total{");
+            node_labels(tis, out, i);
+            fprintf(out, ",state=\"%s\"} %llu\n", state_labels[s], metrics->states[4 * i + s]);
+        }
+    }
+    fprintf(out, "# HELP tis_state_dumps_total State dumps written on SIGUSR1.\n# TYPE tis_state_dumps_total counter\n");
+    fprintf(out, "tis_state_dumps_total %llu\n", metrics->dumps);
+    if(fclose(out) != 0 || rename(metrics->temp, metrics->path) != 0) {
+        error("Unable to write the metrics to %s\n", metrics->path);
+    }
+}
+
+/*
+ * Set the cycle of the next sample, between half and one and a half TIS_METRICS_SAMPLE cycles away
+ */
+static void next_sample(tis_metrics_t* metrics) {
+    unsigned x = metrics->jitter; // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    metrics->jitter = x;
+    metrics->next = metrics->cycles + TIS_METRICS_SAMPLE / 2 + x % TIS_METRICS_SAMPLE + 1;
+}
+
+/*
+ * Called by tick() when the cycle of the next sample comes
+ */
+void sample_metrics(tis_t* tis) {
+    tis_metrics_t* metrics = tis->metrics;
+    next_sample(metrics);
+    for(size_t i = 0; i < tis->nactive; i++) {
+        metrics->states[4 * i + tis->active[i]->laststate]++;
+    }
+    if(dump_wanted) {
+        dump_wanted = 0;
+        dump_state(tis);
+    }
+    if(metrics->path != NULL && now() - metrics->written >= metrics->every) {
+        write_metrics(tis);
+    }
+}
+
+void init_metrics(tis_t* tis, char* path, double every, char* dump_path) {
+    tis_metrics_t* metrics = calloc(1, sizeof(tis_metrics_t));
+    if(metrics == NULL || (metrics->states = calloc(4 * tis->nactive + 1, sizeof(unsigned long long))) == NULL) {
+        error("Unable to allocate memory for the metrics\n");
+        bork();
+    }
+    metrics->path = path;
+    metrics->dump_path = dump_path;
+    metrics->every = every;
+    metrics->start = metrics->written = now();
+    metrics->jitter = 0x9E3779B9u; // fixed, so that a run samples the same cycles every time
+    next_sample(metrics);
+    if(path != NULL) {
+        metrics->temp = malloc(strlen(path) + 5);
+        if(metrics->temp == NULL) {
+            error("Unable to allocate memory for the metrics\n");
+            bork();
+        }
+        sprintf(metrics->temp, "%s.tmp", path);
+    }
+    tis->metrics = metrics;
+    struct sigaction action = { .sa_handler = want_dump };
+    sigemptyset(&(action.sa_mask));
+    action.sa_flags = SA_RESTART; // so that a blocking read of an input goes on
+    if(sigaction(SIGUSR1, &action, NULL) != 0) {
+        warn("Unable to handle SIGUSR1, there will be no state dumps\n");
+    }
+    if(path != NULL) {
+        write_metrics(tis);
+    }
+}
+
+/*
+ * Write the metrics one last time, on exit
+ */
+void finish_metrics(tis_t* tis) {
+    tis_metrics_t* metrics = tis->metrics;
+    if(metrics == NULL) {
+        return;
+    }
+    if(metrics->path != NULL) {
+        write_metrics(tis);
+    }
+    safe_free(metrics->temp);
+    safe_free(metrics->states);
+    safe_free(tis->metrics);
+}
@@ -0,0 +1,48 @@
+#ifndef _TIS_METRICS_
+#define _TIS_METRICS_
+
+#include "tis_types.h"
+
+/*
+ * Live metrics (--metrics) and state dumps on SIGUSR1 (--dump), for long runs.
+ *
+ * About every TIS_METRICS_SAMPLE cycles, tick() calls in here to count the state of every node, and to see if a dump
+ * was asked for or the metrics file is due to be written again. The cycles between samples are drawn at random from
+ * half to one and a half times that, so that a loop whose period divides the interval is not always seen at the same
+ * point of it. The metrics file is written every so many seconds (--metrics-every), in the Prometheus text format, to
+ * a temporary file that is then renamed over it, so a reader never sees half of it. Values through io nodes are
+ * counted by the io nodes themselves. A run without --metrics or --dump pays one branch per cycle, and with them one
+ * increment more.
+ *
+ * SIGUSR1 only sets a flag, and the dump of the whole state is written at the next sample, to stderr or the --dump
+ * file. A machine blocked reading an input dumps once the input gives a value.
+ */
+
+#ifndef TIS_METRICS_SAMPLE
+#define TIS_METRICS_SAMPLE 1024 // mean cycles between samples
+#endif
+#ifndef TIS_METRICS_EVERY
+#define TIS_METRICS_EVERY 10 // seconds between writes of the metrics file
+#endif
+
+typedef struct tis_metrics {
+    unsigned long long cycles; // counted by tick()
+    unsigned long long next; // the cycle of the next sample
+    unsigned jitter; // xorshift32 state for the cycles between samples
+    unsigned long long* states; // per active node, samples in each state
+    char* path; // the metrics file, or NULL
+    char* temp; // written, then renamed to path
+    char* dump_path; // where dumps go, or NULL for stderr
+    double every; // seconds between writes
+    double start; // clock at the start
+    double written; // clock when the file was last written
+    unsigned long long written_cycles; // cycles when the file was last written
+    double rate; // cycles a second, between the last two writes
+    unsigned long long dumps;
+} tis_metrics_t;
+
+void init_metrics(tis_t* tis, char* path, double every, char* dump_path);
+void sample_metrics(tis_t* tis);
+void finish_metrics(tis_t* tis);
+
+#endif /* _TIS_METRICS_ */
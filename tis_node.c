@@ -1,12 +1,261 @@
-
+#define _POSIX_C_SOURCE 200809L // for clock_gettime()
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "tis_io.h"
+#include "tis_link.h"
+#include "tis_metrics.h"
 #include "tis_node.h"
 #include "tis_ops.h"
+#include "tis_perf.h"
+#include "tis_prof.h"
+#include "tis_trace.h"
 #include "tis_types.h"
 
+/*
+ * Grid indices in tile order, for the bands of --partitions. The grid is cut into bands along its anti-diagonals, opts.tile_size
+ * diagonals wide, and each band is visited in row-major order; on a wide grid each band is a run of parallelogram
+ * tiles. Running one node only touches that node and its four neighbors, so two nodes can only affect each other
+ * within a cycle if they are at most two steps apart. Of any such pair, the one that comes first in row-major order
+ * never has a larger row+col, so it also comes first here, and the results are exactly those of row-major order.
+ * Only the rows first_row up to (not including) end_row are listed; this is the same as leaving the other rows out
+ * of the order for the whole grid. Returns a malloc'd array of (end_row - first_row) * cols indices.
+ */
+size_t* tile_order(tis_t* tis, size_t first_row, size_t end_row) {
+    size_t count = (end_row - first_row) * tis->cols;
+    size_t* order = malloc(count * sizeof(size_t) + 1);
+    if(order == NULL) {
+        error("Unable to allocate the tile order for %zu nodes\n", count);
+        bork();
+    }
+    size_t k = 0;
+    size_t width = opts.tile_size;
+    for(size_t lo = first_row / width * width; k < count; lo += width) {
+        size_t hi = lo + width; // this band holds the diagonals lo <= row+col < hi
+        for(size_t row = first_row; row < end_row && row < hi; row++) {
+            size_t first = lo > row ? lo - row : 0;
+            size_t last = hi - row < tis->cols ? hi - row : tis->cols;
+            for(size_t col = first; col < last; col++) {
+                order[k++] = row * tis->cols + col;
+            }
+        }
+    }
+    return order;
+}
+
+/*
+ * Allocate the node at this position in the grid, with no code or data yet
+ */
+tis_node_t* new_node(tis_t* tis, size_t i, tis_node_type_t type, char* name) {
+    tis_node_t* node = arena_alloc(&(tis->arena), sizeof(tis_node_t));
+    node->type = type;
+    node->id = -1; // This is overwritten for compute nodes only
+    node->row = i / tis->cols;
+    node->col = i % tis->cols;
+    node->name = name;
+    node->writereg = TIS_REGISTER_INVALID;
+    if(type == TIS_NODE_TYPE_COMPUTE) {
+        node->code = tis->nocode;
+        node->last = TIS_REGISTER_NIL; // LAST behaves like NIL until an ANY occurs
+    } else {
+        node->data = arena_calloc(&(tis->arena), TIS_MEM_CELL_COUNT, sizeof(int));
+    }
+    tis->nodes[i] = node;
+    return node;
+}
+
+/*
+ * Returns a true value if this node can ever do anything: compute nodes with no instructions
+ * are idle forever, just as damaged nodes are, so tick() need not visit them.
+ */
+int node_can_run(tis_node_t* node) {
+    if(node == NULL) {
+        return 0;
+    } else if(node->type != TIS_NODE_TYPE_COMPUTE) {
+        return 1;
+    }
+    for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
+        if(node->code[idx] != NULL && node->code[idx]->type != TIS_OP_TYPE_INVALID) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Set up the list of nodes for tick() to visit, and its scratch space, once the machine is loaded
+ */
+void init_tick(tis_t* tis) {
+    tis->nactive = 0;
+    for(size_t i = 0; i < tis->size; i++) {
+        tis->nactive += node_can_run(tis->nodes[i]);
+    }
+    tis->active = arena_calloc(&(tis->arena), tis->nactive, sizeof(tis_node_t*));
+    for(size_t i = 0, k = 0; i < tis->size; i++) {
+        if(node_can_run(tis->nodes[i])) {
+            tis->active[k++] = tis->nodes[i];
+        }
+    }
+    tis->deferred = arena_calloc(&(tis->arena), tis->cols + tis->nactive + tis->cols, sizeof(char));
+}
+
+/*
+ * Print how much memory the loaded machine takes (--footprint), once init_tick() has run
+ */
+void report_footprint(tis_t* tis) {
+    size_t present = 0;
+    for(size_t i = 0; i < tis->size; i++) {
+        present += tis->nodes[i] != NULL;
+    }
+    fprintf(stderr, "Footprint: %zu of %zu nodes are allocated (%zu bytes each) and %zu of them can run\n", present, tis->size, sizeof(tis_node_t), tis->nactive);
+    fprintf(stderr, "Footprint: %zu bytes of memory in use for the machine, %zu bytes mapped from an image\n", arena_bytes(&(tis->arena)), tis->image_size);
+}
+
+static unsigned long long elapsed_nsec(struct timespec* from, struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000ULL + to->tv_nsec - from->tv_nsec;
+}
+
+/*
+ * The body of tick() and tick_profiled(). It is inlined into both, so that the counting disappears from tick().
+ */
+static inline __attribute__((always_inline)) int tick_with(tis_t* tis, tis_profile_t* profile) {
+    int quiescent = 1;
+    char *deferred_i = tis->deferred;
+    char *deferred_n = tis->deferred + tis->cols;
+    char *deferred_o = tis->deferred + tis->cols + tis->nactive;
+    struct timespec start, middle, end;
+    int timed = profile != NULL && profile->cycles % TIS_PROFILE_SAMPLE == 0;
+    if(timed) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+
+    // First stage: run most things
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->inputs[i] != NULL) {
+            tis_node_state_t state = run_input(tis, tis->inputs[i]);
+            deferred_i[i] = (state == TIS_NODE_STATE_WRITE_WAIT);
+            if(!deferred_i[i]) {
+                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->inputs[i]->laststate;
+                tis->inputs[i]->laststate = state;
+                if(profile != NULL) {
+                    profile->inputs[i].counts[0][state]++;
+                }
+            }
+        }
+    }
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        int index = node->index;
+        tis_node_state_t state = run(tis, node);
+        deferred_n[i] = (state == TIS_NODE_STATE_WRITE_WAIT);
+        if(!deferred_n[i]) {
+            quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == node->laststate;
+            node->laststate = state;
+            if(profile != NULL) {
+                profile_node(&(profile->nodes[i]), index, state);
+            }
+        }
+    }
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->outputs[i] != NULL) {
+            tis_node_state_t state = run_output(tis, tis->outputs[i]);
+            deferred_o[i] = (state == TIS_NODE_STATE_WRITE_WAIT);
+            if(!deferred_o[i]) {
+                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->outputs[i]->laststate;
+                tis->outputs[i]->laststate = state;
+                if(profile != NULL) {
+                    profile->outputs[i].counts[0][state]++;
+                }
+            }
+        }
+    }
+    if(timed) {
+        clock_gettime(CLOCK_MONOTONIC, &middle);
+    }
+
+    // Second stage: run deferrals
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->inputs[i] != NULL) {
+            if(deferred_i[i]) {
+                tis_node_state_t state = run_input_defer(tis, tis->inputs[i]);
+                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->inputs[i]->laststate;
+                tis->inputs[i]->laststate = state;
+                if(profile != NULL) {
+                    profile->inputs[i].counts[0][state]++;
+                }
+            }
+        }
+    }
+    for(size_t i = 0; i < tis->nactive; i++) {
+        if(deferred_n[i]) {
+            tis_node_t* node = tis->active[i];
+            int index = node->index;
+            tis_node_state_t state = run_defer(tis, node);
+            quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == node->laststate;
+            node->laststate = state;
+            if(profile != NULL) {
+                profile_node(&(profile->nodes[i]), index, state);
+            }
+        }
+    }
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->outputs[i] != NULL) {
+            if(deferred_o[i]) {
+                tis_node_state_t state = run_output_defer(tis, tis->outputs[i]);
+                quiescent = quiescent && state != TIS_NODE_STATE_RUNNING && state == tis->outputs[i]->laststate;
+                tis->outputs[i]->laststate = state;
+                if(profile != NULL) {
+                    profile->outputs[i].counts[0][state]++;
+                }
+            }
+        }
+    }
+
+    if(profile != NULL) {
+        if(timed) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            profile->nsec[0] += elapsed_nsec(&start, &middle);
+            profile->nsec[1] += elapsed_nsec(&middle, &end);
+            profile->timed++;
+        }
+        profile->cycles++;
+    }
+    if(tis->links != NULL) {
+        tis->links->cycle++;
+    }
+    if(tis->perf != NULL) {
+        tis->perf->cycles++;
+    }
+    if(tis->trace != NULL) {
+        trace_cycle(tis);
+    }
+    if(tis->metrics != NULL && ++tis->metrics->cycles == tis->metrics->next) {
+        sample_metrics(tis);
+    }
+    if(tis->stop != NULL) {
+        stop_cycle(tis);
+    }
+    spam("System quiescent? %d\n", quiescent);
+    return quiescent;
+}
+
+/*
+ * Returns a true value if the system is quiescent.
+ * This means that no node is actively running.
+ * Unless waiting for additional input, the execution is done.
+ */
+int tick(tis_t* tis) {
+    return tick_with(tis, NULL);
+}
+
+/*
+ * The same as tick(), also counting into tis->profile (see tis_prof.h)
+ */
+int tick_profiled(tis_t* tis) {
+    return tick_with(tis, tis->profile);
+}
+
 tis_node_state_t run(tis_t* tis, tis_node_t* node) {
     if(node->type == TIS_NODE_TYPE_COMPUTE) {
         int start_index = node->index;
@@ -213,10 +462,11 @@ tis_op_result_t write_port_register_maybe(tis_t* tis, tis_node_t* node, tis_regi
     return TIS_OP_RESULT_WRITE_WAIT;
 }
 tis_op_result_t write_port_register_defer_maybe(tis_t* tis, tis_node_t* node, tis_register_t reg) {
-    (void)tis;
     if(node->writereg == TIS_REGISTER_NIL) { // if NIL, the previous write was handled, reset it all
         node->writereg = TIS_REGISTER_INVALID;
         return TIS_OP_RESULT_OK;
+    } else if(node->writereg == TIS_REGISTER_INVALID && tis->links != NULL) {
+        link_posted(tis, node->row * tis->cols + node->col);
     }
     node->writereg = reg;
     return TIS_OP_RESULT_WRITE_WAIT;
@@ -240,13 +490,21 @@ tis_op_result_t read_register(tis_t* tis, tis_node_t* node, tis_register_t reg,
         case TIS_REGISTER_LEFT:
         case TIS_REGISTER_RIGHT:
         case TIS_REGISTER_ANY:
-            return read_port_register_maybe(tis, node, reg, value);
         case TIS_REGISTER_LAST:
-            if(node->last == TIS_REGISTER_INVALID) {
+            if(reg == TIS_REGISTER_LAST && node->last == TIS_REGISTER_INVALID) {
                 error("Attempted to reference LAST before ANY on node %s\n", node_name(node));
                 return TIS_OP_RESULT_ERR;
+            } else {
+                tis_op_result_t result = read_port_register_maybe(tis, node, reg == TIS_REGISTER_LAST ? node->last : reg, value);
+                if(tis->links != NULL) {
+                    // after reading from ANY, last is the port that was read
+                    link_read(tis, node->row * tis->cols + node->col, reg == TIS_REGISTER_ANY || reg == TIS_REGISTER_LAST ? node->last : reg, result);
+                }
+                if(tis->trace != NULL && result == TIS_OP_RESULT_OK) {
+                    trace_value(tis, node->row * tis->cols + node->col, reg == TIS_REGISTER_ANY || reg == TIS_REGISTER_LAST ? node->last : reg, *value);
+                }
+                return result;
             }
-            return read_port_register_maybe(tis, node, node->last, value);
         case TIS_REGISTER_INVALID:
         default:
             // internal error
@@ -325,3 +583,48 @@ tis_op_result_t write_register_defer(tis_t* tis, tis_node_t* node, tis_register_
     error("INTERNAL: switch out of sync with enum\n");
     return TIS_OP_RESULT_ERR;
 }
+
+static const char* state_names[] = { "running", "read_wait", "write_wait", "idle" };
+
+static void print_writing(FILE* out, tis_register_t writereg, int writebuf) {
+    if(writereg == TIS_REGISTER_INVALID) {
+        fprintf(out, "  not writing");
+    } else if(writereg == TIS_REGISTER_NIL) {
+        fprintf(out, "  write taken");
+    } else {
+        fprintf(out, "  writing %d to %s", writebuf, reg_to_string(writereg));
+    }
+}
+
+/*
+ * One line with the whole state of a node, for --travel and the state dump of --metrics
+ */
+void print_node_state(FILE* out, tis_node_t* node) {
+    fprintf(out, "%s", node_name(node));
+    if(node->type == TIS_NODE_TYPE_COMPUTE) {
+        tis_op_t* op = node->code[node->index];
+        fprintf(out, "  line %d", node->index);
+        if(op != NULL && op->type != TIS_OP_TYPE_INVALID) {
+            fprintf(out, " (%s)", op->linetext);
+        }
+        fprintf(out, "  acc %d  bak %d  last %s", node->acc, node->bak, reg_to_string(node->last));
+    } else {
+        fprintf(out, "  depth %d [", node->index);
+        for(int i = 0; i < node->index && i < TIS_MEM_CELL_COUNT; i++) {
+            fprintf(out, i == 0 ? "%d" : " %d", node->data[i]);
+        }
+        fprintf(out, "]");
+    }
+    fprintf(out, "  %s", state_names[node->laststate]);
+    print_writing(out, node->writereg, node->writebuf);
+    fprintf(out, "\n");
+}
+
+/*
+ * The same for an io node, kind is I or O
+ */
+void print_io_state(FILE* out, tis_io_node_t* io, char kind) {
+    fprintf(out, "%c%zu  %s", kind, io->col, state_names[io->laststate]);
+    print_writing(out, io->writereg, io->writebuf);
+    fprintf(out, "\n");
+}
@@ -1,8 +1,19 @@
 #ifndef _TIS_NODE_
 #define _TIS_NODE_
 
+#include <stdio.h>
+
 #include "tis_types.h"
 
+tis_node_t* new_node(tis_t* tis, size_t i, tis_node_type_t type, char* name);
+size_t* tile_order(tis_t* tis, size_t first_row, size_t end_row);
+int node_can_run(tis_node_t* node);
+
+void init_tick(tis_t* tis);
+void report_footprint(tis_t* tis);
+int tick(tis_t* tis);
+int tick_profiled(tis_t* tis);
+
 tis_node_state_t run(tis_t* tis, tis_node_t* node);
 tis_node_state_t run_defer(tis_t* tis, tis_node_t* node);
 
@@ -10,4 +21,7 @@ tis_op_result_t read_register(tis_t* tis, tis_node_t* node, tis_register_t reg,
 tis_op_result_t write_register(tis_t* tis, tis_node_t* node, tis_register_t reg, int value);
 tis_op_result_t write_register_defer(tis_t* tis, tis_node_t* node, tis_register_t reg);
 
+void print_node_state(FILE* out, tis_node_t* node);
+void print_io_state(FILE* out, tis_io_node_t* io, char kind);
+
 #endif /* _TIS_NODE_ */
@@ -1,14 +1,14 @@
 
 #include <stdio.h>
-#include <string.h>
 
 #include "tis_types.h"
+#include "tis_debug.h"
 #include "tis_node.h"
 
 tis_op_result_t step(tis_t* tis, tis_node_t* node, tis_op_t* op) {
     if(node->type == TIS_NODE_TYPE_COMPUTE) {
         tis_op_result_t result = TIS_OP_RESULT_OK;
-        char* jump = NULL;
+        tis_op_arg_t* jump = NULL;
         int value = 0, idx;
         spam("Run instruction %s on node %s\n", op_to_string(op->type), node_name(node));
         // TODO assert correct nargs? This is checked when parsing though...
@@ -29,6 +29,9 @@ tis_op_result_t step(tis_t* tis, tis_node_t* node, tis_op_t* op) {
             case TIS_OP_TYPE_HCF:
                 halt();
                 break;
+            case TIS_OP_TYPE_BREAK:
+                // only under --travel; runs the line that was patched
+                return step(tis, node, debug_break(tis, node));
             case TIS_OP_TYPE_JEZ:
                 if(node->acc == 0) {
                     goto jump_label;
@@ -47,7 +50,7 @@ tis_op_result_t step(tis_t* tis, tis_node_t* node, tis_op_t* op) {
             case TIS_OP_TYPE_JMP:
 jump_label:
                 if(op->src.type == TIS_OP_ARG_TYPE_LABEL) {
-                    jump = op->src.label;
+                    jump = &(op->src);
                 } else {
                     error("INTERNAL: Unable to jump to non-label argument on node %s\n", node_name(node));
                     result = TIS_OP_RESULT_ERR;
@@ -156,17 +159,12 @@ jump_label:
                 break;
         }
         if(jump != NULL) {
-            spam("Jumping to label %.20s on node %s\n", jump, node_name(node));
-            idx = 0;
-            for(; idx < TIS_NODE_LINE_COUNT; idx++) {
-                if(node->code[idx]->label != NULL && strcmp(jump, node->code[idx]->label) == 0) {
-                    node->index = idx - 1; // jump to instuction *before* label to account for the instruction pointer increment later on
-                    break;
-                }
-            }
-            if(idx == TIS_NODE_LINE_COUNT) {
+            spam("Jumping to label %.20s on node %s\n", jump->label, node_name(node));
+            if(jump->target >= 0) { // labels are resolved to lines when loading
+                node->index = jump->target - 1; // jump to instuction *before* label to account for the instruction pointer increment later on
+            } else {
                 // unable to jump to missing label
-                error("Label %.20s not found in node %s, unable to jump\n", jump, node_name(node));
+                error("Label %.20s not found in node %s, unable to jump\n", jump->label, node_name(node));
                 result = TIS_OP_RESULT_ERR;
             }
         }
@@ -185,6 +183,9 @@ tis_op_result_t step_defer(tis_t* tis, tis_node_t* node, tis_op_t* op) {
         tis_op_result_t result;
         spam("Run instruction %s on node %s (defer)\n", op_to_string(op->type), node_name(node));
         if(op->type != TIS_OP_TYPE_MOV) {
+            if(op->type == TIS_OP_TYPE_BREAK) {
+                return step_defer(tis, node, debug_original(tis, node));
+            }
             error("INTERNAL: Only MOV instructions may be deferred; node %s\n", node_name(node));
             result = TIS_OP_RESULT_ERR;
         } else {
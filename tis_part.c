@@ -0,0 +1,638 @@
+#define _GNU_SOURCE // for sched_setaffinity(), CPU_SET() and syscall()
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tis_io.h"
+#include "tis_node.h"
+#include "tis_part.h"
+#include "tis_types.h"
+
+/*
+ * How the bands are kept in step:
+ *
+ * tick() runs the first stage in row-major order, and that order matters: when several readers compete for one
+ * write to ANY the first one wins, and stack nodes refresh their write buffer as they run. Within its band, each
+ * worker runs its nodes in tile order (see tile_order()), which gives the same results. A node can only affect
+ * nodes at most two steps away, so across bands only the first two rows of a band depend on the band above, and
+ * each node there only on nodes of the band above with no larger row+col, which are in the same or an earlier tile.
+ * So before running a tile that has nodes in its first two rows, a worker waits for the band above to finish that
+ * tile, and the bands run as a wavefront, a tile apart. Every band has at least two rows, so that no band depends on
+ * the band two above. The outputs come after every node in tick(), so the last band only runs them once every band has
+ * finished its nodes. The second stage only touches each node itself, and runs between two barriers.
+ *
+ * A node that halts or fails must not end the run at once: a node earlier in row-major order may do the same later
+ * in this stage (in another band, or later in tile order), and in tick() that one would have ended the run first.
+ * So part_halt() records the failure, keeping the earliest one in row-major order, and the worker carries on with its
+ * next node. At the next barrier every worker sees it, and the run ends with the status of the earliest failure.
+ * Only its messages are not exact: other failures in the same cycle also print theirs.
+ */
+
+#define PART_SPIN 64 // polls of a shared counter before sleeping on it
+#define PART_DONE UINT32_MAX // progress of a band that has finished its nodes in the first stage
+#define PART_NO_FAILURE UINT64_MAX
+#define PART_CHECK_NSEC 50000000 // how often the first worker checks that the others are still there, while it waits
+
+typedef struct part_progress {
+    _Alignas(64) _Atomic uint32_t tile; // tiles of this band finished in the first stage of this cycle, or PART_DONE
+    _Atomic uint32_t waiting; // set by a band below (the next one, or the last) before it sleeps on tile
+} part_progress_t;
+
+typedef struct part_shared {
+    _Atomic uint64_t failure[2]; // by cycle parity: earliest failure as key << 1, plus 1 if not a halt, or PART_NO_FAILURE
+    _Atomic uint32_t broken; // a worker has died, so everyone gives up (set by the first worker)
+    size_t bands;
+    _Alignas(64) _Atomic uint32_t arrived; // for barrier()
+    _Atomic uint32_t generation;
+    _Alignas(64) _Atomic int quiescent[2]; // by cycle parity, see cycle()
+    part_progress_t progress[]; // one per band
+} part_shared_t;
+
+typedef struct part_tile {
+    size_t end; // index in active just past the last node of this tile
+    int wait; // has nodes in the first two rows of the band, which must wait for the band above
+} part_tile_t;
+
+typedef enum part_stage {
+    PART_STAGE_INPUTS,
+    PART_STAGE_NODES,
+    PART_STAGE_OUTPUTS,
+} part_stage_t;
+
+typedef struct part_worker {
+    tis_t* tis;
+    part_shared_t* shared;
+    size_t band;
+    size_t bands;
+    size_t first_row;
+    size_t end_row;
+    tis_node_t** active; // nodes of this band that can run, in tile order
+    size_t nactive;
+    part_tile_t* tiles;
+    size_t ntiles;
+    size_t first_tile; // the index of tiles[0] among the tiles of the whole grid
+    char* deferred; // length = cols + nactive + cols, as in tick()
+    // The position in the current stage is kept here rather than in locals, so that it survives part_halt()
+    jmp_buf resume;
+    int parity; // of the cycle
+    int second;
+    part_stage_t stage;
+    size_t pos;
+    size_t tile;
+    int quiescent;
+} part_worker_t;
+
+static _Thread_local part_worker_t* halt_worker = NULL; // the worker whose stage is running, for part_halt()
+static pid_t* child_pids = NULL; // indexed by band, in the first worker
+
+static size_t band_row(size_t rows, size_t bands, size_t band) {
+    return band * rows / bands;
+}
+
+static size_t round_up(size_t size, size_t align) {
+    return (size + align - 1) / align * align;
+}
+
+/*
+ * Sleep while *addr == value; the first worker only sleeps a while at a time, so that it can check on the others.
+ * It never waits for a band above, so only barrier() needs to check.
+ */
+static void futex_wait(part_worker_t* w, _Atomic uint32_t* addr, uint32_t value) {
+    struct timespec timeout = {0, PART_CHECK_NSEC};
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, value, w->band == 0 ? &timeout : NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* addr) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void wake_all(part_shared_t* shared) {
+    futex_wake(&(shared->generation));
+    for(size_t b = 0; b < shared->bands; b++) {
+        futex_wake(&(shared->progress[b].tile));
+    }
+}
+
+/*
+ * Returns the position of the running node in the row-major order of tick(), counting both stages
+ */
+static uint64_t failure_key(part_worker_t* w) {
+    tis_t* tis = w->tis;
+    uint64_t key;
+    if(w->stage == PART_STAGE_INPUTS) {
+        key = w->pos;
+    } else if(w->stage == PART_STAGE_NODES) {
+        tis_node_t* node = w->active[w->pos];
+        key = tis->cols + node->row * tis->cols + node->col;
+    } else {
+        key = tis->cols + tis->size + w->pos;
+    }
+    if(w->second) {
+        key += tis->cols + tis->size + tis->cols;
+    }
+    return key;
+}
+
+/*
+ * The tis_halt_hook of a worker while its stage runs
+ */
+static void part_halt(int status) {
+    part_worker_t* w = halt_worker;
+    uint64_t failure = (failure_key(w) << 1) | (status != EXIT_SUCCESS);
+    _Atomic uint64_t* earliest = &(w->shared->failure[w->parity]);
+    uint64_t seen = atomic_load(earliest);
+    while(failure < seen && !atomic_compare_exchange_weak(earliest, &seen, failure)) {
+        // retry
+    }
+    longjmp(w->resume, 1);
+}
+
+/*
+ * End this worker; the first one also collects the others, so that all output is written when it exits
+ */
+static _Noreturn void worker_exit(part_worker_t* w, int status) {
+    halt_worker = NULL;
+    tis_halt_hook = NULL;
+    if(w->band != 0) {
+        exit(status);
+    }
+    for(size_t b = 1; b < w->bands; b++) {
+        int wstatus;
+        while(waitpid(child_pids[b], &wstatus, 0) < 0 && errno == EINTR) {
+            // retry
+        }
+        if(WIFSIGNALED(wstatus)) {
+            error("The worker for rows %zu..%zu was killed by signal %d\n", band_row(w->tis->rows, w->bands, b), band_row(w->tis->rows, w->bands, b+1) - 1, WTERMSIG(wstatus));
+            status = EXIT_FAILURE;
+        } else if(!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != EXIT_SUCCESS) {
+            status = EXIT_FAILURE;
+        }
+    }
+    safe_free(child_pids);
+    exit(status);
+}
+
+static _Noreturn void give_up(part_worker_t* w) {
+    debug("Partition %zu giving up, another worker has died\n", w->band);
+    worker_exit(w, EXIT_FAILURE);
+}
+
+/*
+ * In the first worker: returns a true value if another worker has exited.
+ * That is fine at the end of the run, but if it happens while waiting at a barrier, the worker has died.
+ */
+static int child_exited(part_worker_t* w) {
+    for(size_t b = 1; w->band == 0 && b < w->bands; b++) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if(waitid(P_PID, child_pids[b], &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void barrier(part_worker_t* w) {
+    part_shared_t* shared = w->shared;
+    uint32_t generation = atomic_load(&(shared->generation));
+    if(atomic_fetch_add(&(shared->arrived), 1) + 1 == w->bands) {
+        atomic_store(&(shared->arrived), 0);
+        atomic_fetch_add(&(shared->generation), 1);
+        futex_wake(&(shared->generation));
+        return;
+    }
+    for(int spin = 0; atomic_load(&(shared->generation)) == generation; spin++) {
+        if(atomic_load(&(shared->broken))) {
+            give_up(w);
+        }
+        if(spin >= PART_SPIN) {
+            futex_wait(w, &(shared->generation), generation);
+            // a worker that has left this barrier may exit at once, so it only died if the barrier is still closed
+            if(child_exited(w) && atomic_load(&(shared->generation)) == generation) {
+                atomic_store(&(shared->broken), 1);
+                wake_all(shared);
+                give_up(w);
+            }
+        }
+    }
+}
+
+/*
+ * Wait until a band above has finished this many tiles of the first stage, or all of its nodes with PART_DONE
+ */
+static void wait_above(part_worker_t* w, size_t band, uint32_t tiles) {
+    part_progress_t* above = &(w->shared->progress[band]);
+    for(int spin = 0; ; spin++) {
+        uint32_t seen = atomic_load(&(above->tile));
+        if(seen >= tiles) {
+            return;
+        }
+        if(atomic_load(&(w->shared->broken))) {
+            give_up(w);
+        }
+        if(spin >= PART_SPIN) {
+            atomic_store(&(above->waiting), 1);
+            futex_wait(w, &(above->tile), seen); // returns at once if the band above has moved on since
+        }
+    }
+}
+
+static void post_progress(part_worker_t* w, uint32_t tiles) {
+    part_progress_t* own = &(w->shared->progress[w->band]);
+    atomic_store(&(own->tile), tiles);
+    if(atomic_load(&(own->waiting))) {
+        atomic_store(&(own->waiting), 0);
+        futex_wake(&(own->tile));
+    }
+}
+
+/*
+ * The first stage of tick() for this band: inputs in the first band, the nodes, then outputs in the last band
+ */
+static void first_stage(part_worker_t* w) {
+    tis_t* tis = w->tis;
+    char *deferred_i = w->deferred;
+    char *deferred_n = w->deferred + tis->cols;
+    char *deferred_o = w->deferred + tis->cols + w->nactive;
+
+    halt_worker = w;
+    tis_halt_hook = part_halt;
+    if(setjmp(w->resume) != 0) {
+        w->pos++; // carry on after the one that halted, see part_halt()
+    }
+    if(w->stage == PART_STAGE_INPUTS) {
+        for(; w->band == 0 && w->pos < tis->cols; w->pos++) {
+            tis_io_node_t* io = tis->inputs[w->pos];
+            if(io != NULL) {
+                tis_node_state_t state = run_input(tis, io);
+                deferred_i[w->pos] = (state == TIS_NODE_STATE_WRITE_WAIT);
+                if(!deferred_i[w->pos]) {
+                    w->quiescent = w->quiescent && state != TIS_NODE_STATE_RUNNING && state == io->laststate;
+                    io->laststate = state;
+                }
+            }
+        }
+        w->stage = PART_STAGE_NODES;
+        w->pos = 0;
+    }
+    if(w->stage == PART_STAGE_NODES) {
+        for(; w->tile < w->ntiles; w->tile++) {
+            part_tile_t* tile = &(w->tiles[w->tile]);
+            uint32_t done = (uint32_t)(w->first_tile + w->tile + 1);
+            if(w->band > 0 && tile->wait && w->pos < tile->end) {
+                wait_above(w, w->band - 1, done);
+            }
+            for(; w->pos < tile->end; w->pos++) {
+                tis_node_t* node = w->active[w->pos];
+                tis_node_state_t state = run(tis, node);
+                deferred_n[w->pos] = (state == TIS_NODE_STATE_WRITE_WAIT);
+                if(!deferred_n[w->pos]) {
+                    w->quiescent = w->quiescent && state != TIS_NODE_STATE_RUNNING && state == node->laststate;
+                    node->laststate = state;
+                }
+            }
+            post_progress(w, done);
+        }
+        post_progress(w, PART_DONE);
+        for(size_t b = 0; w->band + 1 == w->bands && b < w->band; b++) {
+            wait_above(w, b, PART_DONE); // the bands above need not have finished, and any node there may yet halt
+        }
+        w->stage = PART_STAGE_OUTPUTS;
+        w->pos = 0;
+    }
+    // Every band has finished its nodes by now, and in tick() nothing after a failure runs
+    for(; w->band + 1 == w->bands && w->pos < tis->cols && atomic_load(&(w->shared->failure[w->parity])) == PART_NO_FAILURE; w->pos++) {
+        tis_io_node_t* io = tis->outputs[w->pos];
+        if(io != NULL) {
+            tis_node_state_t state = run_output(tis, io);
+            deferred_o[w->pos] = (state == TIS_NODE_STATE_WRITE_WAIT);
+            if(!deferred_o[w->pos]) {
+                w->quiescent = w->quiescent && state != TIS_NODE_STATE_RUNNING && state == io->laststate;
+                io->laststate = state;
+            }
+        }
+    }
+    halt_worker = NULL;
+    tis_halt_hook = NULL;
+}
+
+/*
+ * The second stage of tick() for this band, running the deferred writes
+ */
+static void second_stage(part_worker_t* w) {
+    tis_t* tis = w->tis;
+    char *deferred_i = w->deferred;
+    char *deferred_n = w->deferred + tis->cols;
+    char *deferred_o = w->deferred + tis->cols + w->nactive;
+
+    halt_worker = w;
+    tis_halt_hook = part_halt;
+    if(setjmp(w->resume) != 0) {
+        w->pos++; // carry on after the one that failed, see part_halt()
+    }
+    if(w->stage == PART_STAGE_INPUTS) {
+        for(; w->band == 0 && w->pos < tis->cols; w->pos++) {
+            tis_io_node_t* io = tis->inputs[w->pos];
+            if(io != NULL && deferred_i[w->pos]) {
+                tis_node_state_t state = run_input_defer(tis, io);
+                w->quiescent = w->quiescent && state != TIS_NODE_STATE_RUNNING && state == io->laststate;
+                io->laststate = state;
+            }
+        }
+        w->stage = PART_STAGE_NODES;
+        w->pos = 0;
+    }
+    if(w->stage == PART_STAGE_NODES) {
+        for(; w->pos < w->nactive; w->pos++) {
+            if(deferred_n[w->pos]) {
+                tis_node_t* node = w->active[w->pos];
+                tis_node_state_t state = run_defer(tis, node);
+                w->quiescent = w->quiescent && state != TIS_NODE_STATE_RUNNING && state == node->laststate;
+                node->laststate = state;
+            }
+        }
+        w->stage = PART_STAGE_OUTPUTS;
+        w->pos = 0;
+    }
+    for(; w->band + 1 == w->bands && w->pos < tis->cols; w->pos++) {
+        tis_io_node_t* io = tis->outputs[w->pos];
+        if(io != NULL && deferred_o[w->pos]) {
+            tis_node_state_t state = run_output_defer(tis, io);
+            w->quiescent = w->quiescent && state != TIS_NODE_STATE_RUNNING && state == io->laststate;
+            io->laststate = state;
+        }
+    }
+    halt_worker = NULL;
+    tis_halt_hook = NULL;
+}
+
+/*
+ * If anything halted or failed in the stage that just finished, end the run as tick() would have.
+ * After the first stage, failures from the second may already be showing, but not everyone has got that far yet.
+ */
+static void check_failure(part_worker_t* w, int second) {
+    tis_t* tis = w->tis;
+    uint64_t failure = atomic_load(&(w->shared->failure[w->parity]));
+    if(failure != PART_NO_FAILURE && (second || (failure >> 1) < tis->cols + tis->size + tis->cols)) {
+        worker_exit(w, (failure & 1) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+}
+
+/*
+ * One call to tick(), for this band; returns a true value if the whole system is quiescent
+ */
+static int cycle(part_worker_t* w, long long time) {
+    part_shared_t* shared = w->shared;
+    int parity = time & 1;
+
+    w->parity = parity;
+    w->quiescent = 1;
+    w->second = 0;
+    w->stage = PART_STAGE_INPUTS;
+    w->pos = 0;
+    w->tile = 0;
+    first_stage(w);
+    barrier(w);
+    check_failure(w, 0);
+
+    // Everyone has read the flags for the last cycle by now, and nobody writes them until the next one
+    if(w->band == 0) {
+        atomic_store(&(shared->quiescent[!parity]), 1);
+        atomic_store(&(shared->failure[!parity]), PART_NO_FAILURE);
+    }
+    w->second = 1;
+    w->stage = PART_STAGE_INPUTS;
+    w->pos = 0;
+    second_stage(w);
+    atomic_store(&(shared->progress[w->band].tile), 0); // the band below is done with it until the next cycle
+    if(!w->quiescent) {
+        atomic_store(&(shared->quiescent[parity]), 0);
+    }
+    barrier(w);
+    check_failure(w, 1);
+
+    int quiescent = atomic_load(&(shared->quiescent[parity]));
+    if(w->band == 0) {
+        spam("System quiescent? %d\n", quiescent);
+    }
+    return quiescent;
+}
+
+/*
+ * Parse a Linux cpu list such as "0-3,8,10-11" into a set
+ */
+static int read_cpulist(const char* filename, cpu_set_t* set) {
+    char buf[4096];
+    FILE* file = fopen(filename, "r");
+    if(file == NULL) {
+        return -1;
+    }
+    int ok = fgets(buf, sizeof(buf), file) != NULL;
+    fclose(file);
+    if(!ok) {
+        return -1;
+    }
+    CPU_ZERO(set);
+    char* p = buf;
+    while(*p >= '0' && *p <= '9') {
+        long first = strtol(p, &p, 10);
+        long last = first;
+        if(*p == '-') {
+            last = strtol(p + 1, &p, 10);
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if(*p == ',') {
+            p++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Bind this worker to the cpus of one NUMA node, spreading neighboring bands over the nodes in order
+ */
+static void pin_worker(part_worker_t* w) {
+    cpu_set_t nodes;
+    if(read_cpulist("/sys/devices/system/node/online", &nodes) != 0 || CPU_COUNT(&nodes) < 2) {
+        return; // a single node (or no NUMA information), so there is nothing to gain
+    }
+    size_t want = w->band * CPU_COUNT(&nodes) / w->bands;
+    int numa = 0;
+    for(size_t seen = 0; numa < CPU_SETSIZE; numa++) {
+        if(CPU_ISSET(numa, &nodes) && seen++ == want) {
+            break;
+        }
+    }
+    char filename[64];
+    cpu_set_t cpus;
+    snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%d/cpulist", numa);
+    if(read_cpulist(filename, &cpus) != 0 || CPU_COUNT(&cpus) == 0) {
+        warn("Unable to read the cpus of NUMA node %d, partition %zu is not pinned\n", numa, w->band);
+    } else if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        warn("Unable to pin partition %zu to NUMA node %d\n", w->band, numa);
+    } else {
+        debug("Partition %zu runs on NUMA node %d\n", w->band, numa);
+    }
+}
+
+/*
+ * Move this band's nodes into its slice of the shared mapping, and list the ones to run
+ */
+static void setup_worker(part_worker_t* w, tis_node_t** private) {
+    tis_t* tis = w->tis;
+    size_t count = (w->end_row - w->first_row) * tis->cols;
+    size_t* order = tile_order(tis, w->first_row, w->end_row);
+
+    w->nactive = 0;
+    for(size_t k = 0; k < count; k++) {
+        size_t i = order[k];
+        if(private[i] != NULL) {
+            *(tis->nodes[i]) = *(private[i]); // the first touch of this memory, so it is local to this worker
+            w->nactive += node_can_run(tis->nodes[i]);
+        }
+    }
+    w->first_tile = w->first_row / opts.tile_size;
+    w->ntiles = (w->end_row - 1 + tis->cols - 1) / opts.tile_size - w->first_tile + 1;
+    w->active = arena_calloc(&(tis->arena), w->nactive, sizeof(tis_node_t*));
+    w->tiles = arena_calloc(&(tis->arena), w->ntiles, sizeof(part_tile_t));
+    w->deferred = arena_calloc(&(tis->arena), tis->cols + w->nactive + tis->cols, sizeof(char));
+    for(size_t k = 0, n = 0; k < count; k++) {
+        tis_node_t* node = tis->nodes[order[k]];
+        size_t t = (order[k] / tis->cols + order[k] % tis->cols) / opts.tile_size - w->first_tile;
+        if(node_can_run(node)) {
+            w->active[n++] = node;
+            w->tiles[t].wait |= node->row < w->first_row + 2;
+        }
+        w->tiles[t].end = n; // every tile has at least one position in it, so all of them get set
+    }
+    free(order);
+    debug("Partition %zu has rows %zu..%zu, %zu nodes that can run and %zu tiles\n", w->band, w->first_row, w->end_row - 1, w->nactive, w->ntiles);
+}
+
+static _Noreturn void run_worker(part_worker_t* w, tis_node_t** private, long long timelimit) {
+    tis_t* tis = w->tis;
+    // The inputs belong to the first band and the outputs to the last, and only their owner may close them
+    if(w->band != 0) {
+        tis->inputs = NULL;
+    }
+    if(w->band + 1 != w->bands) {
+        tis->outputs = NULL;
+    }
+    pin_worker(w);
+    setup_worker(w, private);
+    free(private);
+    barrier(w); // every band is in place before anyone looks at its neighbors
+
+    for(long long time = 0; !cycle(w, time) && (timelimit == 0 || time < timelimit); time++) {
+        // nothing
+    }
+    worker_exit(w, expected_missing(tis) == 0 ? EXIT_SUCCESS : EXIT_FAILURE); // only the last band has outputs to check
+}
+
+/*
+ * Run the machine (already set up by init_tick()) in this many worker processes, in place of the loop over tick().
+ * This process runs the first band, and exits with the status of the run once every worker has finished.
+ */
+void run_partitioned(tis_t* tis, size_t partitions, long long timelimit) {
+    size_t bands = partitions;
+    if(bands > tis->rows / 2) {
+        bands = tis->rows / 2; // every band needs two rows, see above
+    }
+    if(bands < 2 || tis->cols == 0) {
+        warn("Grid of %zur %zuc is too small to split into partitions, running in one process\n", tis->rows, tis->cols);
+        return;
+    } else if(bands < partitions) {
+        warn("Grid of %zur %zuc only has room for %zu partitions\n", tis->rows, tis->cols, bands);
+    }
+
+    // The mapping holds the shared state, then one page-aligned slice per band for its nodes, in tile order
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t header = round_up(sizeof(part_shared_t) + bands * sizeof(part_progress_t), page);
+    size_t mapsize = header;
+    for(size_t b = 0; b < bands; b++) {
+        size_t band_rows = band_row(tis->rows, bands, b+1) - band_row(tis->rows, bands, b);
+        mapsize += round_up(band_rows * tis->cols * sizeof(tis_node_t), page);
+    }
+    char* map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(map == MAP_FAILED) {
+        error("Unable to map %zu bytes of shared memory for partitions\n", mapsize);
+        bork();
+    }
+    part_shared_t* shared = (part_shared_t*)map;
+    atomic_store(&(shared->failure[0]), PART_NO_FAILURE);
+    atomic_store(&(shared->failure[1]), PART_NO_FAILURE);
+    atomic_store(&(shared->quiescent[0]), 1);
+    atomic_store(&(shared->quiescent[1]), 1);
+    shared->bands = bands;
+
+    // Point every node at its place in the mapping; each worker copies its own band there, from this list
+    tis_node_t** private = malloc(tis->size * sizeof(tis_node_t*) + 1);
+    child_pids = calloc(bands, sizeof(pid_t));
+    if(private == NULL || child_pids == NULL) {
+        error("Unable to allocate memory for partitions\n");
+        bork();
+    }
+    memcpy(private, tis->nodes, tis->size * sizeof(tis_node_t*));
+    tis_node_t* slice = (tis_node_t*)(map + header);
+    for(size_t b = 0; b < bands; b++) {
+        size_t first_row = band_row(tis->rows, bands, b);
+        size_t end_row = band_row(tis->rows, bands, b+1);
+        size_t count = (end_row - first_row) * tis->cols;
+        size_t* order = tile_order(tis, first_row, end_row);
+        for(size_t k = 0; k < count; k++) {
+            if(tis->nodes[order[k]] != NULL) {
+                tis->nodes[order[k]] = &(slice[k]);
+            }
+        }
+        free(order);
+        slice = (tis_node_t*)((char*)slice + round_up(count * sizeof(tis_node_t), page));
+    }
+
+    part_worker_t worker = {
+        .tis = tis,
+        .shared = shared,
+        .bands = bands,
+    };
+    fflush(NULL); // nothing buffered may be written twice
+    pid_t parent = getpid();
+    for(size_t b = 1; b < bands; b++) {
+        pid_t pid = fork();
+        if(pid < 0) {
+            error("Unable to start the worker for partition %zu\n", b);
+            atomic_store(&(shared->broken), 1);
+            wake_all(shared);
+            bands = b; // only collect the ones that did start
+            worker.bands = b;
+            worker_exit(&worker, EXIT_FAILURE);
+        } else if(pid == 0) {
+            safe_free(child_pids);
+            prctl(PR_SET_PDEATHSIG, SIGKILL); // don't outlive the first worker
+            if(getppid() != parent) {
+                _exit(EXIT_FAILURE);
+            }
+            worker.band = b;
+            worker.first_row = band_row(tis->rows, bands, b);
+            worker.end_row = band_row(tis->rows, bands, b+1);
+            run_worker(&worker, private, timelimit);
+        }
+        child_pids[b] = pid;
+    }
+    worker.band = 0;
+    worker.first_row = 0;
+    worker.end_row = band_row(tis->rows, bands, 1);
+    run_worker(&worker, private, timelimit);
+}
@@ -0,0 +1,19 @@
+#ifndef _TIS_PART_
+#define _TIS_PART_
+
+#include "tis_types.h"
+
+/*
+ * Partitioned execution (--partitions), for grids too large to run well in one process.
+ *
+ * The rows of the grid are split into bands, and each band is run by its own worker process, pinned to a NUMA node
+ * when the machine has more than one. All node state lives in one shared mapping, and each band's slice of it is
+ * first touched by its own worker, so that the kernel places it in memory local to that worker. The results are
+ * exactly those of tick(), cycle for cycle; tis_part.c describes how the bands are kept in step. So is the exit status:
+ * the last band runs the outputs, which stop the run once they have their COUNT or EXPECT values, and fail it if it
+ * ends short of them.
+ */
+
+void run_partitioned(tis_t* tis, size_t partitions, long long timelimit); // only returns if the grid is too small
+
+#endif /* _TIS_PART_ */
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE // for syscall()
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tis_link.h"
+#include "tis_perf.h"
+#include "tis_prof.h"
+#include "tis_types.h"
+
+typedef struct perf_read {
+    uint64_t value;
+    uint64_t enabled; // time the counter was enabled, and
+    uint64_t running; // time it was counting, which is less if the hardware was shared
+} perf_read_t;
+
+static const char* counter_names[TIS_PERF_COUNTERS] = { "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses" };
+
+static int open_counter(tis_perf_counter_t counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch(counter) {
+        case TIS_PERF_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case TIS_PERF_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case TIS_PERF_BRANCH_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case TIS_PERF_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case TIS_PERF_LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default:
+            return -1;
+    }
+    // this thread, any cpu, no group
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * Open the counters and start them, with the clock, right before the main loop
+ */
+void init_perf(tis_t* tis) {
+    tis_perf_t* perf = calloc(1, sizeof(tis_perf_t));
+    if(perf == NULL) {
+        error("Unable to allocate memory for the perf counters\n");
+        bork();
+    }
+    int opened = 0, reason = 0;
+    for(int c = 0; c < TIS_PERF_COUNTERS; c++) {
+        perf->fd[c] = open_counter(c);
+        if(perf->fd[c] < 0) {
+            reason = errno;
+            debug("Perf counter %s is not available: %s\n", counter_names[c], strerror(errno));
+        } else {
+            opened++;
+        }
+    }
+    if(opened == 0) {
+        warn("No perf counters are available (%s), only timing the run\n", strerror(reason));
+        if(reason == EACCES || reason == EPERM) {
+            warn("Counting may need a lower /proc/sys/kernel/perf_event_paranoid\n");
+        }
+    }
+    tis->perf = perf;
+    clock_gettime(CLOCK_MONOTONIC, &(perf->start));
+    for(int c = 0; c < TIS_PERF_COUNTERS; c++) {
+        if(perf->fd[c] >= 0) {
+            ioctl(perf->fd[c], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf->fd[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/*
+ * Sum of the instructions run by compute nodes, if profiling, or 0
+ */
+static unsigned long long simulated_instructions(tis_t* tis) {
+    unsigned long long total = 0;
+    for(size_t i = 0; tis->profile != NULL && i < tis->nactive; i++) {
+        for(int line = 0; tis->active[i]->type == TIS_NODE_TYPE_COMPUTE && line < TIS_NODE_LINE_COUNT; line++) {
+            total += tis->profile->nodes[i].counts[line][TIS_NODE_STATE_RUNNING];
+        }
+    }
+    return total;
+}
+
+/*
+ * The peak resident set of this process in KiB, or -1. This is the high water mark of its own memory, unlike
+ * getrusage(), which also counts the memory of whatever exec'd it.
+ */
+static long peak_rss(void) {
+    FILE* file = fopen("/proc/self/status", "r");
+    char line[256];
+    long kib = -1;
+    while(file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if(sscanf(line, "VmHWM: %ld kB", &kib) == 1) {
+            break;
+        }
+    }
+    if(file != NULL) {
+        fclose(file);
+    }
+    return kib;
+}
+
+/*
+ * Stop the counters and print them on stderr. Called at exit, before the profile is freed.
+ */
+void report_perf(tis_t* tis) {
+    tis_perf_t* perf = tis->perf;
+    if(perf == NULL) {
+        return;
+    }
+    for(int c = 0; c < TIS_PERF_COUNTERS; c++) {
+        if(perf->fd[c] >= 0) {
+            ioctl(perf->fd[c], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - perf->start.tv_sec) + (end.tv_nsec - perf->start.tv_nsec) / 1e9;
+
+    unsigned long long cycles = perf->cycles;
+    unsigned long long instructions = simulated_instructions(tis);
+    fprintf(stderr, "Perf counters: %llu simulated cycles in %.3f s, %.0f cycles/s", cycles, seconds, seconds > 0.0 ? cycles / seconds : 0.0);
+    if(instructions > 0) {
+        fprintf(stderr, ", %.0f instructions/s", instructions / seconds);
+    }
+    long rss = peak_rss();
+    if(rss >= 0) {
+        fprintf(stderr, ", peak RSS %ld KiB", rss);
+    }
+    fprintf(stderr, "\n");
+
+    double counts[TIS_PERF_COUNTERS];
+    int opened = 0;
+    for(int c = 0; c < TIS_PERF_COUNTERS; c++) {
+        opened += perf->fd[c] >= 0;
+    }
+    if(opened > 0) {
+        fprintf(stderr, "%-16s %16s %14s%s\n", "counter", "total", "per cycle", instructions > 0 ? "      per instr" : "");
+    }
+    for(int c = 0; opened > 0 && c < TIS_PERF_COUNTERS; c++) {
+        perf_read_t r;
+        counts[c] = -1.0;
+        int ok = perf->fd[c] >= 0 && read(perf->fd[c], &r, sizeof(r)) == sizeof(r);
+        if(perf->fd[c] >= 0) {
+            close(perf->fd[c]);
+        }
+        if(!ok) {
+            fprintf(stderr, "%-16s %16s\n", counter_names[c], "n/a");
+            continue;
+        }
+        // scale up if the counter only ran part of the time
+        counts[c] = r.running == 0 ? 0.0 : (double)r.value * r.enabled / r.running;
+        fprintf(stderr, "%-16s %16.0f %14.2f", counter_names[c], counts[c], cycles == 0 ? 0.0 : counts[c] / cycles);
+        if(instructions > 0) {
+            fprintf(stderr, " %14.2f", counts[c] / instructions);
+        }
+        fprintf(stderr, "%s\n", r.running < r.enabled ? " (multiplexed)" : "");
+    }
+    if(opened > 0 && counts[TIS_PERF_CYCLES] > 0.0 && counts[TIS_PERF_INSTRUCTIONS] >= 0.0) {
+        fprintf(stderr, "IPC: %.2f\n", counts[TIS_PERF_INSTRUCTIONS] / counts[TIS_PERF_CYCLES]);
+    }
+    safe_free(tis->perf);
+}
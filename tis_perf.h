@@ -0,0 +1,35 @@
+#ifndef _TIS_PERF_
+#define _TIS_PERF_
+
+#include <time.h>
+
+#include "tis_types.h"
+
+/*
+ * Hardware performance counters (--perf-counters), on Linux.
+ *
+ * The counters are opened with perf_event_open() just before the main loop and read at exit, for this thread only and
+ * in user space only, so that the default perf_event_paranoid setting allows them. Counters that the machine or the
+ * kernel does not provide are left out, and if none can be opened only the wall clock time is reported. Totals are
+ * divided by the simulated cycles, and by the simulated instructions when profiling, which is what counts them.
+ */
+
+typedef enum tis_perf_counter {
+    TIS_PERF_CYCLES,
+    TIS_PERF_INSTRUCTIONS,
+    TIS_PERF_BRANCH_MISSES,
+    TIS_PERF_L1D_MISSES,
+    TIS_PERF_LLC_MISSES,
+    TIS_PERF_COUNTERS,
+} tis_perf_counter_t;
+
+typedef struct tis_perf {
+    int fd[TIS_PERF_COUNTERS]; // -1 if not available
+    struct timespec start;
+    unsigned long long cycles; // simulated, counted by tick() whichever loop runs it
+} tis_perf_t;
+
+void init_perf(tis_t* tis);
+void report_perf(tis_t* tis);
+
+#endif /* _TIS_PERF_ */
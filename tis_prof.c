@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tis_prof.h"
+#include "tis_types.h"
+
+typedef struct prof_row {
+    tis_node_t* node;
+    tis_profile_node_t* counts;
+} prof_row_t;
+
+static const char* state_names[] = { "running", "read_wait", "write_wait", "idle" };
+
+/*
+ * Set up tis->profile, after init_tick()
+ */
+void init_profile(tis_t* tis) {
+    tis_profile_t* profile = calloc(1, sizeof(tis_profile_t));
+    if(profile != NULL) {
+        profile->nodes = calloc(tis->nactive + 1, sizeof(tis_profile_node_t));
+        profile->inputs = calloc(tis->cols + 1, sizeof(tis_profile_node_t));
+        profile->outputs = calloc(tis->cols + 1, sizeof(tis_profile_node_t));
+    }
+    if(profile == NULL || profile->nodes == NULL || profile->inputs == NULL || profile->outputs == NULL) {
+        error("Unable to allocate memory for the profile\n");
+        bork();
+    }
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        for(int idx = 0; node->type == TIS_NODE_TYPE_COMPUTE && idx < TIS_NODE_LINE_COUNT; idx++) {
+            // run() skips empty lines before the one that runs; a node that can run has at least one
+            int line = idx;
+            while(node->code[line] == NULL || node->code[line]->type == TIS_OP_TYPE_INVALID) {
+                line = (line + 1) % TIS_NODE_LINE_COUNT;
+            }
+            profile->nodes[i].line[idx] = line;
+        }
+    }
+    tis->profile = profile;
+}
+
+static unsigned long long state_count(tis_profile_node_t* counts, tis_node_state_t state) {
+    unsigned long long total = 0;
+    for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+        total += counts->counts[line][state];
+    }
+    return total;
+}
+
+static unsigned long long stall_count(tis_profile_node_t* counts, int line) {
+    return counts->counts[line][TIS_NODE_STATE_READ_WAIT] + counts->counts[line][TIS_NODE_STATE_WRITE_WAIT];
+}
+
+static int compare_rows(const void* a, const void* b) {
+    unsigned long long ba = state_count(((const prof_row_t*)a)->counts, TIS_NODE_STATE_RUNNING);
+    unsigned long long bb = state_count(((const prof_row_t*)b)->counts, TIS_NODE_STATE_RUNNING);
+    return (ba < bb) - (ba > bb); // busiest first
+}
+
+static double percent(unsigned long long part, unsigned long long whole) {
+    return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+static void json_states(FILE* file, tis_profile_node_t* counts) {
+    for(int s = 0; s <= TIS_NODE_STATE_IDLE; s++) {
+        fprintf(file, ", \"%s\": %llu", state_names[s], state_count(counts, s));
+    }
+}
+
+static int write_json(tis_t* tis, const char* filename) {
+    tis_profile_t* profile = tis->profile;
+    FILE* file = fopen(filename, "w");
+    if(file == NULL) {
+        error("Unable to open %s to write the profile\n", filename);
+        return -1;
+    }
+    fprintf(file, "{\n  \"cycles\": %llu,\n  \"timed_cycles\": %llu,\n", profile->cycles, profile->timed);
+    fprintf(file, "  \"first_stage_nsec\": %llu,\n  \"deferred_stage_nsec\": %llu,\n", profile->nsec[0], profile->nsec[1]);
+    fprintf(file, "  \"nodes\": [");
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        tis_profile_node_t* counts = &(profile->nodes[i]);
+        fprintf(file, "%s\n    {\"name\": ", i == 0 ? "" : ",");
+        json_string(file, node_name(node));
+        fprintf(file, ", \"row\": %zu, \"col\": %zu", node->row, node->col);
+        json_states(file, counts);
+        if(node->type == TIS_NODE_TYPE_COMPUTE) {
+            fprintf(file, ", \"lines\": [");
+            int first = 1;
+            for(int idx = 0; idx < TIS_NODE_LINE_COUNT; idx++) {
+                tis_op_t* op = node->code[idx];
+                if(op == NULL || op->type == TIS_OP_TYPE_INVALID) {
+                    continue;
+                }
+                fprintf(file, "%s\n      {\"line\": %d, \"text\": ", first ? "" : ",", idx);
+                json_string(file, op->linetext);
+                fprintf(file, ", \"runs\": %llu, \"stalls\": %llu}", counts->counts[idx][TIS_NODE_STATE_RUNNING], stall_count(counts, idx));
+                first = 0;
+            }
+            fprintf(file, "\n    ]");
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ],\n  \"io\": [");
+    int first = 1;
+    for(size_t i = 0; i < 2 * tis->cols; i++) {
+        int is_output = i >= tis->cols;
+        size_t col = is_output ? i - tis->cols : i;
+        if((is_output ? tis->outputs : tis->inputs)[col] == NULL) {
+            continue;
+        }
+        fprintf(file, "%s\n    {\"name\": \"%c%zu\"", first ? "" : ",", is_output ? 'O' : 'I', col);
+        json_states(file, &((is_output ? profile->outputs : profile->inputs)[col]));
+        fprintf(file, "}");
+        first = 0;
+    }
+    fprintf(file, "\n  ]\n}\n");
+    if(fclose(file) != 0) {
+        error("Unable to write the profile to %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Print the profile as a table on stderr, busiest nodes first, and write it to filename as JSON if that is not NULL.
+ * Called at exit, so that a run that halts is also reported.
+ */
+void report_profile(tis_t* tis, const char* filename) {
+    tis_profile_t* profile = tis->profile;
+    if(profile == NULL) {
+        return;
+    }
+    fprintf(stderr, "Profile: %llu cycles", profile->cycles);
+    if(profile->timed > 0) {
+        fprintf(stderr, ", %.1f ns per cycle in the first stage and %.1f ns in the deferred stage (timed 1 in %d)",
+                (double)profile->nsec[0] / profile->timed, (double)profile->nsec[1] / profile->timed, TIS_PROFILE_SAMPLE);
+    }
+    fprintf(stderr, "\n");
+
+    prof_row_t* rows = malloc(tis->nactive * sizeof(prof_row_t) + 1);
+    if(rows != NULL) {
+        for(size_t i = 0; i < tis->nactive; i++) {
+            rows[i] = (prof_row_t){ .node = tis->active[i], .counts = &(profile->nodes[i]) };
+        }
+        qsort(rows, tis->nactive, sizeof(prof_row_t), compare_rows);
+        size_t shown = (opts.verbose > 0 || tis->nactive < TIS_PROFILE_TABLE_ROWS) ? tis->nactive : TIS_PROFILE_TABLE_ROWS;
+        fprintf(stderr, "%-32s %9s %9s %10s %9s\n", "node", "running", "read_wait", "write_wait", "idle");
+        for(size_t r = 0; r < shown; r++) {
+            tis_profile_node_t* counts = rows[r].counts;
+            fprintf(stderr, "%-32s", node_name(rows[r].node));
+            for(int s = 0; s <= TIS_NODE_STATE_IDLE; s++) {
+                fprintf(stderr, " %*.1f%%", s == TIS_NODE_STATE_WRITE_WAIT ? 9 : 8, percent(state_count(counts, s), profile->cycles));
+            }
+            fprintf(stderr, "\n");
+            for(int idx = 0; rows[r].node->type == TIS_NODE_TYPE_COMPUTE && idx < TIS_NODE_LINE_COUNT; idx++) {
+                tis_op_t* op = rows[r].node->code[idx];
+                unsigned long long runs = counts->counts[idx][TIS_NODE_STATE_RUNNING];
+                if(op != NULL && op->type != TIS_OP_TYPE_INVALID && (runs > 0 || stall_count(counts, idx) > 0)) {
+                    fprintf(stderr, "    %2d: %-24.24s runs %llu, stalls %llu\n", idx, op->linetext, runs, stall_count(counts, idx));
+                }
+            }
+        }
+        if(shown < tis->nactive) {
+            fprintf(stderr, "(%zu more nodes, use -v to show all)\n", tis->nactive - shown);
+        }
+        free(rows);
+    }
+
+    if(filename != NULL && write_json(tis, filename) == 0) {
+        debug("Wrote the profile to %s\n", filename);
+    }
+    free_profile(tis);
+}
+
+void free_profile(tis_t* tis) {
+    if(tis->profile == NULL) {
+        return;
+    }
+    safe_free(tis->profile->nodes);
+    safe_free(tis->profile->inputs);
+    safe_free(tis->profile->outputs);
+    safe_free(tis->profile);
+}
@@ -0,0 +1,47 @@
+#ifndef _TIS_PROF_
+#define _TIS_PROF_
+
+#include "tis_types.h"
+
+/*
+ * Execution profile (--profile).
+ *
+ * With a profile, the main loop calls tick_profiled() instead of tick(). It is the same code with the counting
+ * compiled in, so an ordinary run does not pay for any of it. For each node that can run it counts the cycles ending
+ * in each state, split by the line of code it was on, which gives how often each line ran and how many cycles it
+ * stalled. For each io node it counts the cycles ending in each state. Every TIS_PROFILE_SAMPLE cycles, it also
+ * times both stages of tick().
+ */
+
+#ifndef TIS_PROFILE_SAMPLE
+#define TIS_PROFILE_SAMPLE 64 // time one cycle in this many, since reading the clock costs as much as a small cycle
+#endif
+#define TIS_PROFILE_TABLE_ROWS 20 // nodes shown in the table, unless verbose
+
+typedef struct tis_profile_node {
+    unsigned long long counts[TIS_NODE_LINE_COUNT][TIS_NODE_STATE_IDLE + 1]; // cycles ending in each state, by line
+    unsigned char line[TIS_MEM_CELL_COUNT + 1]; // the line that runs from each index (stack nodes use line 0)
+} tis_profile_node_t;
+_Static_assert(TIS_NODE_LINE_COUNT <= TIS_MEM_CELL_COUNT + 1, "line must cover every instruction pointer");
+
+typedef struct tis_profile {
+    tis_profile_node_t* nodes; // in the order of tis->active
+    tis_profile_node_t* inputs; // length = cols, only line 0 is used
+    tis_profile_node_t* outputs; // length = cols, only line 0 is used
+    unsigned long long cycles;
+    unsigned long long timed; // cycles that were timed
+    unsigned long long nsec[2]; // spent in each stage of the timed cycles
+} tis_profile_t;
+
+/*
+ * Count the state that a node ended the cycle in, having started the stage at this index
+ */
+static inline void profile_node(tis_profile_node_t* p, int index, tis_node_state_t state) {
+    p->counts[p->line[index]][state]++;
+}
+
+void init_profile(tis_t* tis);
+void report_profile(tis_t* tis, const char* filename);
+void free_profile(tis_t* tis);
+
+#endif /* _TIS_PROF_ */
@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L // for sysconf()
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tis_io.h"
+#include "tis_node.h"
+#include "tis_score.h"
+#include "tis_types.h"
+
+typedef struct score_result {
+    unsigned long long cycles;
+    int failed;
+} score_result_t;
+
+typedef struct score_pool {
+    tis_t* tis; // as loaded, never run itself
+    size_t runs;
+    long long timelimit;
+    atomic_size_t next; // the next run to take
+    score_result_t* results; // by run
+} score_pool_t;
+
+static _Thread_local jmp_buf score_resume; // where score_halt() returns to
+static _Thread_local int score_status;
+
+/*
+ * The tis_halt_hook of a thread of the pool
+ */
+static void score_halt(int status) {
+    score_status = status;
+    longjmp(score_resume, 1);
+}
+
+/*
+ * Make a machine of its own for one run, with the code and names of tis, and its inputs seeded for this run
+ */
+static void copy_machine(tis_t* copy, tis_t* tis, unsigned long long seed) {
+    copy->rows = tis->rows;
+    copy->cols = tis->cols;
+    copy->size = tis->size;
+    copy->name = tis->name;
+    copy->nocode = tis->nocode;
+    copy->nodes = arena_calloc(&(copy->arena), tis->size, sizeof(tis_node_t*));
+    for(size_t i = 0; i < tis->size; i++) {
+        if(tis->nodes[i] != NULL) {
+            tis_node_t* node = arena_alloc(&(copy->arena), sizeof(tis_node_t));
+            *node = *(tis->nodes[i]);
+            if(node->type != TIS_NODE_TYPE_COMPUTE) {
+                node->data = arena_calloc(&(copy->arena), TIS_MEM_CELL_COUNT, sizeof(int));
+                memcpy(node->data, tis->nodes[i]->data, TIS_MEM_CELL_COUNT * sizeof(int));
+            }
+            copy->nodes[i] = node;
+        }
+    }
+    copy->inputs = arena_calloc(&(copy->arena), tis->cols, sizeof(tis_io_node_t*));
+    copy->outputs = arena_calloc(&(copy->arena), tis->cols, sizeof(tis_io_node_t*));
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->inputs[i] != NULL) {
+            tis_io_node_t* io = arena_alloc(&(copy->arena), sizeof(tis_io_node_t));
+            *io = *(tis->inputs[i]);
+            if(io->type != TIS_IO_TYPE_IGENERATOR_RANDOM) {
+                io->type = TIS_IO_TYPE_IGENERATOR_RANDOM;
+                io->random.min = -999;
+                io->random.max = 999;
+                io->random.count = TIS_RANDOM_COUNT;
+            }
+            seed_random_input(io, seed);
+            copy->inputs[i] = io;
+        }
+        if(tis->outputs[i] != NULL) {
+            tis_io_node_t* io = arena_alloc(&(copy->arena), sizeof(tis_io_node_t));
+            *io = *(tis->outputs[i]);
+            io->type = TIS_IO_TYPE_IOSTREAM_NUMERIC; // with no file, so values are dropped
+            io->file.file = NULL;
+            io->file.path = NULL;
+            io->expect.values = NULL; // counted, not checked
+            io->expect.nvalues = 0;
+            copy->outputs[i] = io;
+        }
+    }
+}
+
+/*
+ * Returns a true value if an output took fewer values than its count
+ */
+static int short_of_count(tis_t* tis) {
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->outputs[i] != NULL && tis->outputs[i]->expect.next < tis->outputs[i]->expect.count) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* run_pool(void* arg) {
+    score_pool_t* pool = arg;
+    tis_halt_hook = score_halt;
+    for(size_t k; (k = atomic_fetch_add(&(pool->next), 1)) < pool->runs; ) {
+        tis_t run = { 0 };
+        copy_machine(&run, pool->tis, opts.seed + k);
+        init_tick(&run);
+        init_stop(&run, opts.stop_idle > 0 ? opts.stop_idle : ULLONG_MAX); // counts the cycles, and when values were taken
+        score_result_t* result = &(pool->results[k]);
+        if(setjmp(score_resume) == 0) {
+            while(!tick(&run) && (pool->timelimit == 0 || run.stop->cycle < (unsigned long long)pool->timelimit)) {
+                // nothing
+            }
+            result->failed = short_of_count(&run);
+            result->cycles = run.stop->last != 0 ? run.stop->last : run.stop->cycle;
+        } else {
+            result->failed = score_status != EXIT_SUCCESS;
+            result->cycles = run.stop->cycles != 0 ? run.stop->cycles : run.stop->cycle + 1; // HCF, in the cycle after the last one counted
+        }
+        free_stop(&run);
+        arena_free(&(run.arena));
+    }
+    tis_halt_hook = NULL;
+    return NULL;
+}
+
+_Noreturn void run_score(tis_t* tis, size_t runs, size_t threads, long long timelimit) {
+    for(size_t i = 0; i < tis->cols; i++) {
+        if(tis->inputs[i] != NULL && tis->inputs[i]->type != TIS_IO_TYPE_IGENERATOR_RANDOM) {
+            warn("Input I%zu is not RANDOM, it gives %d random values in -999..999 instead\n", i, TIS_RANDOM_COUNT);
+        }
+        if(tis->outputs[i] != NULL && tis->outputs[i]->expect.values != NULL) {
+            warn("Output O%zu is not checked against %s on random inputs, only counted\n", i, tis->outputs[i]->expect.path);
+        }
+    }
+    if(threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (size_t)cpus : 1;
+    }
+    if(threads > runs) {
+        threads = runs;
+    }
+    score_pool_t pool = { .tis = tis, .runs = runs, .timelimit = timelimit };
+    atomic_init(&(pool.next), 0);
+    pool.results = calloc(runs, sizeof(score_result_t));
+    pthread_t* pool_threads = calloc(threads, sizeof(pthread_t));
+    if(pool.results == NULL || pool_threads == NULL) {
+        error("Unable to allocate memory for the runs\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t started = 0;
+    for(; started + 1 < threads; started++) { // this thread is the last of the pool
+        if(pthread_create(&(pool_threads[started]), NULL, run_pool, &pool) != 0) {
+            warn("Unable to start more than %zu threads for the runs\n", started + 1);
+            break;
+        }
+    }
+    run_pool(&pool);
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(pool_threads[i], NULL);
+    }
+    free(pool_threads);
+
+    size_t nodes = 0, instructions = 0;
+    for(size_t i = 0; i < tis->size; i++) {
+        tis_node_t* node = tis->nodes[i];
+        if(node != NULL && node->type == TIS_NODE_TYPE_COMPUTE && node_can_run(node)) {
+            nodes++;
+            for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+                instructions += node->code[line] != NULL && node->code[line]->type != TIS_OP_TYPE_INVALID;
+            }
+        }
+    }
+    unsigned long long total = 0, least = ULLONG_MAX, most = 0;
+    size_t failed = 0;
+    for(size_t k = 0; k < runs; k++) {
+        if(pool.results[k].failed) {
+            error("The run with seed %llu fails\n", opts.seed + k);
+            failed++;
+            continue;
+        }
+        total += pool.results[k].cycles;
+        least = pool.results[k].cycles < least ? pool.results[k].cycles : least;
+        most = pool.results[k].cycles > most ? pool.results[k].cycles : most;
+    }
+    if(failed < runs) {
+        printf("Cycles: %.2f (average of %zu runs, %llu to %llu)\n", (double)total / (runs - failed), runs - failed, least, most);
+    } else {
+        printf("Cycles: none (every run fails)\n");
+    }
+    printf("Nodes: %zu\n", nodes);
+    printf("Instructions: %zu\n", instructions);
+    free(pool.results);
+    exit(failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,22 @@
+#ifndef _TIS_SCORE_
+#define _TIS_SCORE_
+
+#include "tis_types.h"
+
+/*
+ * The game's metrics for a solution (--score): cycles, averaged over a number of runs on random inputs, then the
+ * number of compute nodes with code, and the number of instructions.
+ *
+ * Run k gives every input the values of seed + k (see --seed): RANDOM inputs keep their interval and count, and any
+ * other input becomes a RANDOM one with the defaults. Outputs write nothing, and EXPECT files are only used for their
+ * count, since the values cannot match random inputs. The runs are shared out among a pool of threads; each runs its
+ * own copy of the nodes, stacks and io nodes, and all share the code, which running never changes.
+ *
+ * A run ends as it would without --score: once the outputs with COUNT or EXPECT are done, on HCF, when quiescent, after
+ * --stop-idle or at the -c limit. Its cycles are counted as the game does, up to the cycle in which the last value was
+ * taken, and it fails if an output is short of its count or the run ends with an error.
+ */
+
+_Noreturn void run_score(tis_t* tis, size_t runs, size_t threads, long long timelimit);
+
+#endif /* _TIS_SCORE_ */
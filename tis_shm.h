@@ -0,0 +1,210 @@
+#ifndef _TIS_SHM_
+#define _TIS_SHM_
+
+/*
+ * Shared-memory ring used by the SHM input/output type.
+ *
+ * This header is standalone, so that external producers and consumers may include it without the rest of TIS.
+ * Each ring is a POSIX shared memory object (see shm_open(3)) holding a single-producer/single-consumer queue of
+ * 32-bit signed values in native byte order. For a TIS input, TIS is the consumer; for a TIS output, TIS is the producer.
+ *
+ * Layout of the object, all offsets in bytes:
+ *     0  magic     TIS_SHM_MAGIC once the header is initialized, 0 before
+ *     4  version   TIS_SHM_VERSION
+ *     8  capacity  number of value slots, always a power of two
+ *    12  closed    set to non-zero by the producer when no more values will be pushed
+ *    64  head      count of values ever pushed, only written by the producer
+ *   128  tail      count of values ever popped, only written by the consumer
+ *   192  values    capacity slots, value n lives in slot n % capacity
+ *
+ * The producer writes the value, then publishes it with a release store to head.
+ * The consumer reads the value after an acquire load of head, then frees the slot with a release store to tail.
+ * Either side may create the object. Whoever creates it (with O_CREAT | O_EXCL) sizes it and initializes the header;
+ * whoever finds it already there waits for the magic, and never resizes it, since that could shrink it under the
+ * mapping of the creator.
+ *
+ * This needs POSIX.1-2008 (shm_open, ftruncate, nanosleep): define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE)
+ * before including any header, or build in a mode that defines it, such as gcc's default gnu11.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#error "tis_shm.h needs _POSIX_C_SOURCE 200809L, defined before any header is included"
+#endif
+
+#define TIS_SHM_MAGIC 0x52534954u // "TISR", little-endian
+#define TIS_SHM_VERSION 1u
+#define TIS_SHM_DEFAULT_CAPACITY 65536u
+#ifndef TIS_SHM_INIT_WAIT_MS
+#define TIS_SHM_INIT_WAIT_MS 1000 // longest wait for another process to size the object and initialize the header
+#endif
+
+typedef struct tis_shm_ring {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    _Atomic uint32_t closed;
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) _Atomic uint64_t tail;
+    _Alignas(64) int32_t values[];
+} tis_shm_ring_t;
+
+static inline size_t tis_shm_size(uint32_t capacity) {
+    return sizeof(tis_shm_ring_t) + (size_t)capacity * sizeof(int32_t);
+}
+
+/*
+ * Sleep for a millisecond while another process sets up a ring
+ */
+static inline void tis_shm_nap(void) {
+    struct timespec ms = { .tv_sec = 0, .tv_nsec = 1000000 };
+    nanosleep(&ms, NULL);
+}
+
+/*
+ * Open (creating if needed) and map the ring with the given name, e.g. "/tis-in0".
+ * The capacity is rounded up to a power of two, and only used if this call creates the ring.
+ * The size of the mapping is stored in *mapped, to be given back to tis_shm_detach().
+ * Returns NULL on failure, which includes a ring left unsized or half initialized by a process that died.
+ */
+static inline tis_shm_ring_t* tis_shm_attach(const char* name, uint32_t capacity, size_t* mapped) {
+    uint32_t cap = 1;
+    while(cap < capacity && cap < (1u << 30)) {
+        cap <<= 1;
+    }
+    size_t size = tis_shm_size(cap);
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if(fd < 0) {
+        return NULL;
+    }
+    int waited = 0;
+    if(created) {
+        if(ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else {
+        struct stat st;
+        for(;; waited++) {
+            // the creator may not have sized it yet
+            if(fstat(fd, &st) != 0 || waited >= TIS_SHM_INIT_WAIT_MS) {
+                close(fd);
+                return NULL;
+            } else if(st.st_size != 0) {
+                break;
+            }
+            tis_shm_nap();
+        }
+        size = (size_t)st.st_size;
+        if(size < sizeof(tis_shm_ring_t)) {
+            close(fd);
+            return NULL;
+        }
+    }
+    tis_shm_ring_t* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED) {
+        return NULL;
+    }
+    uint32_t magic;
+    if(created) {
+        ring->version = TIS_SHM_VERSION;
+        ring->capacity = cap;
+        atomic_store_explicit(&ring->magic, TIS_SHM_MAGIC, memory_order_release);
+    }
+    for(; (magic = atomic_load_explicit(&ring->magic, memory_order_acquire)) == 0; waited++) {
+        // the creator is initializing the header
+        if(waited >= TIS_SHM_INIT_WAIT_MS) {
+            munmap(ring, size);
+            return NULL;
+        }
+        tis_shm_nap();
+    }
+    if(magic != TIS_SHM_MAGIC || ring->version != TIS_SHM_VERSION ||
+       ring->capacity == 0 || (ring->capacity & (ring->capacity - 1)) != 0 ||
+       tis_shm_size(ring->capacity) > size) {
+        munmap(ring, size);
+        return NULL;
+    }
+    *mapped = size;
+    return ring;
+}
+
+/*
+ * Unmap a ring, given the size stored by tis_shm_attach() rather than one read from the shared header
+ */
+static inline void tis_shm_detach(tis_shm_ring_t* ring, size_t mapped) {
+    if(ring != NULL) {
+        munmap(ring, mapped);
+    }
+}
+
+/*
+ * Producer side: returns 1 if the value was queued, 0 if the ring is full.
+ */
+static inline int tis_shm_push(tis_shm_ring_t* ring, int32_t value) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= ring->capacity) {
+        return 0;
+    }
+    ring->values[head & (ring->capacity - 1)] = value;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+/*
+ * Producer side: check for space without pushing.
+ */
+static inline int tis_shm_full(tis_shm_ring_t* ring) {
+    return atomic_load_explicit(&ring->head, memory_order_relaxed) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire) >= ring->capacity;
+}
+
+/*
+ * Producer side: mark that no more values will follow.
+ */
+static inline void tis_shm_close(tis_shm_ring_t* ring) {
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+/*
+ * Consumer side: returns 1 if a value was taken, 0 if the ring is empty.
+ */
+static inline int tis_shm_pop(tis_shm_ring_t* ring, int32_t* value) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if(tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+        return 0;
+    }
+    *value = ring->values[tail & (ring->capacity - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+/*
+ * Consumer side: true once the producer has closed the ring and every value has been taken.
+ * Check this only after tis_shm_pop() fails, since values may be pushed before the close.
+ */
+static inline int tis_shm_drained(tis_shm_ring_t* ring) {
+    if(!atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+        return 0;
+    }
+    return atomic_load_explicit(&ring->tail, memory_order_relaxed) ==
+           atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+#endif /* _TIS_SHM_ */
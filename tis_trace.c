@@ -0,0 +1,676 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tis_link.h"
+#include "tis_trace.h"
+#include "tis_types.h"
+
+/*
+ * Layout of a trace. Numbers are LEB128 varints, signed ones zigzag encoded first. A string is its length, then its
+ * bytes without a NUL.
+ *
+ *   header
+ *      magic      TIS_TRACE_MAGIC, 8 bytes
+ *      version    TIS_TRACE_VERSION
+ *      rows, cols, nactive
+ *      keyframe   cycles between keyframes
+ *      name       string, the title of the machine
+ *      nactive node descriptions, in the order of tis->active
+ *         grid index, type, id (signed), name (string)
+ *         for compute nodes, TIS_NODE_LINE_COUNT strings, the text of each line or empty
+ *      cols bytes, non-zero if the input is defined, then the same for outputs
+ *
+ *   records, each a tag byte and then
+ *      'C'  cycles since the previous C or K record; what follows happened in that cycle
+ *      'V'  writer (grid, then inputs), reader (grid, then outputs), value (signed): a value was taken
+ *      'N'  slot, mask byte, then the fields in the mask in bit order (see TRACE_*), each signed
+ *      'K'  cycle, then every field of every slot, in order: the whole state at the end of that cycle
+ *      'E'  the end of the trace
+ *
+ * A slot is the index of an active node, then nactive + col for inputs, then nactive + cols + col for outputs. Cycle 0
+ * is the state before the first cycle, which is always written as a keyframe.
+ */
+
+#define TIS_TRACE_MAGIC "TISTRACE"
+#define TIS_TRACE_VERSION 1
+#define TIS_TRACE_STRING_MAX 255 // longer names and lines are cut
+#define TIS_TRACE_RECORD_MAX (1 + 2 * 10 + 1 + 8 * 5) // longest record, other than strings
+
+enum {
+    TRACE_INDEX = 1 << 0,
+    TRACE_ACC = 1 << 1,
+    TRACE_BAK = 1 << 2,
+    TRACE_LAST = 1 << 3,
+    TRACE_STATE = 1 << 4,
+    TRACE_WRITEREG = 1 << 5,
+    TRACE_WRITEBUF = 1 << 6,
+    TRACE_TOP = 1 << 7,
+    TRACE_ALL = 0xFF,
+};
+
+static const char* state_names[] = { "running", "read_wait", "write_wait", "idle" };
+
+static void* write_buffers(void* arg) {
+    tis_trace_t* trace = arg;
+    pthread_mutex_lock(&(trace->lock));
+    for(;;) {
+        while(trace->pending == NULL && !trace->done) {
+            pthread_cond_wait(&(trace->moved), &(trace->lock));
+        }
+        if(trace->pending == NULL) {
+            break;
+        }
+        unsigned char* buffer = trace->pending;
+        size_t used = trace->pending_used;
+        pthread_mutex_unlock(&(trace->lock));
+        int failed = fwrite(buffer, 1, used, trace->file) != used;
+        pthread_mutex_lock(&(trace->lock));
+        trace->failed = trace->failed || failed;
+        trace->pending = NULL;
+        pthread_cond_broadcast(&(trace->moved));
+    }
+    pthread_mutex_unlock(&(trace->lock));
+    return NULL;
+}
+
+/*
+ * Hand the buffer being filled to the writer thread, once it is done with the other one, and fill that instead
+ */
+static void swap_buffers(tis_trace_t* trace) {
+    pthread_mutex_lock(&(trace->lock));
+    while(trace->pending != NULL) {
+        pthread_cond_wait(&(trace->moved), &(trace->lock));
+    }
+    trace->pending = trace->buffer[trace->current];
+    trace->pending_used = trace->used;
+    pthread_cond_broadcast(&(trace->moved));
+    pthread_mutex_unlock(&(trace->lock));
+    trace->current ^= 1;
+    trace->used = 0;
+}
+
+static void reserve(tis_trace_t* trace, size_t bytes) {
+    if(trace->used + bytes > TIS_TRACE_BUFFER) {
+        swap_buffers(trace);
+    }
+}
+
+static void put_byte(tis_trace_t* trace, unsigned char byte) {
+    trace->buffer[trace->current][trace->used++] = byte;
+}
+
+static void put_varint(tis_trace_t* trace, unsigned long long value) {
+    unsigned char* out = trace->buffer[trace->current];
+    while(value >= 0x80) {
+        out[trace->used++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[trace->used++] = value;
+}
+
+static void put_signed(tis_trace_t* trace, long long value) {
+    put_varint(trace, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+}
+
+static void put_string(tis_trace_t* trace, const char* str) {
+    size_t len = str == NULL ? 0 : strlen(str);
+    len = len > TIS_TRACE_STRING_MAX ? TIS_TRACE_STRING_MAX : len;
+    reserve(trace, len + 2);
+    put_varint(trace, len);
+    memcpy(&(trace->buffer[trace->current][trace->used]), str, len);
+    trace->used += len;
+}
+
+static void get_state(tis_t* tis, size_t slot, tis_trace_state_t* state) {
+    memset(state, 0, sizeof(*state));
+    if(slot < tis->nactive) {
+        tis_node_t* node = tis->active[slot];
+        state->index = node->index;
+        state->laststate = node->laststate;
+        state->writereg = node->writereg;
+        state->writebuf = node->writebuf;
+        if(node->type == TIS_NODE_TYPE_COMPUTE) {
+            state->acc = node->acc;
+            state->bak = node->bak;
+            state->last = node->last;
+        } else if(node->type == TIS_NODE_TYPE_MEMORY_STACK && node->index > 0) {
+            state->top = node->data[node->index - 1];
+        }
+        return;
+    }
+    slot -= tis->nactive;
+    tis_io_node_t* io = slot < tis->cols ? tis->inputs[slot] : tis->outputs[slot - tis->cols];
+    if(io != NULL) {
+        state->laststate = io->laststate;
+        state->writereg = io->writereg;
+        state->writebuf = io->writebuf;
+    }
+}
+
+static int state_field(const tis_trace_state_t* state, int bit) {
+    switch(bit) {
+        case TRACE_INDEX: return state->index;
+        case TRACE_ACC: return state->acc;
+        case TRACE_BAK: return state->bak;
+        case TRACE_LAST: return state->last;
+        case TRACE_STATE: return state->laststate;
+        case TRACE_WRITEREG: return state->writereg;
+        case TRACE_WRITEBUF: return state->writebuf;
+        default: return state->top;
+    }
+}
+
+static void set_field(tis_trace_state_t* state, int bit, int value) {
+    switch(bit) {
+        case TRACE_INDEX: state->index = value; break;
+        case TRACE_ACC: state->acc = value; break;
+        case TRACE_BAK: state->bak = value; break;
+        case TRACE_LAST: state->last = value; break;
+        case TRACE_STATE: state->laststate = value; break;
+        case TRACE_WRITEREG: state->writereg = value; break;
+        case TRACE_WRITEBUF: state->writebuf = value; break;
+        default: state->top = value; break;
+    }
+}
+
+static int changed_fields(const tis_trace_state_t* a, const tis_trace_state_t* b) {
+    return (a->index != b->index ? TRACE_INDEX : 0) |
+        (a->acc != b->acc ? TRACE_ACC : 0) |
+        (a->bak != b->bak ? TRACE_BAK : 0) |
+        (a->last != b->last ? TRACE_LAST : 0) |
+        (a->laststate != b->laststate ? TRACE_STATE : 0) |
+        (a->writereg != b->writereg ? TRACE_WRITEREG : 0) |
+        (a->writebuf != b->writebuf ? TRACE_WRITEBUF : 0) |
+        (a->top != b->top ? TRACE_TOP : 0);
+}
+
+/*
+ * Start the records of the current cycle, if not yet started
+ */
+static void mark_cycle(tis_trace_t* trace) {
+    if(trace->marked != trace->cycle) {
+        reserve(trace, TIS_TRACE_RECORD_MAX);
+        put_byte(trace, 'C');
+        put_varint(trace, trace->cycle - trace->marked);
+        trace->marked = trace->cycle;
+    }
+}
+
+static size_t slot_count(tis_t* tis) {
+    return tis->nactive + 2 * tis->cols;
+}
+
+/*
+ * Write an N record for each slot that changed since it was last recorded
+ */
+static void record_changes(tis_t* tis) {
+    tis_trace_t* trace = tis->trace;
+    for(size_t slot = 0; slot < slot_count(tis); slot++) {
+        tis_trace_state_t now;
+        get_state(tis, slot, &now);
+        int mask = changed_fields(&now, &(trace->state[slot]));
+        if(mask == 0) {
+            continue;
+        }
+        mark_cycle(trace);
+        reserve(trace, TIS_TRACE_RECORD_MAX);
+        put_byte(trace, 'N');
+        put_varint(trace, slot);
+        put_byte(trace, mask);
+        for(int bit = 1; bit <= TRACE_TOP; bit <<= 1) {
+            if(mask & bit) {
+                put_signed(trace, state_field(&now, bit));
+            }
+        }
+        trace->state[slot] = now;
+    }
+}
+
+static void record_keyframe(tis_t* tis) {
+    tis_trace_t* trace = tis->trace;
+    reserve(trace, TIS_TRACE_RECORD_MAX);
+    put_byte(trace, 'K');
+    put_varint(trace, trace->cycle);
+    for(size_t slot = 0; slot < slot_count(tis); slot++) {
+        reserve(trace, TIS_TRACE_RECORD_MAX);
+        get_state(tis, slot, &(trace->state[slot]));
+        for(int bit = 1; bit <= TRACE_TOP; bit <<= 1) {
+            put_signed(trace, state_field(&(trace->state[slot]), bit));
+        }
+    }
+    trace->marked = trace->cycle;
+}
+
+static void record_header(tis_t* tis) {
+    tis_trace_t* trace = tis->trace;
+    reserve(trace, TIS_TRACE_RECORD_MAX);
+    memcpy(trace->buffer[trace->current], TIS_TRACE_MAGIC, 8);
+    trace->used = 8;
+    put_varint(trace, TIS_TRACE_VERSION);
+    put_varint(trace, tis->rows);
+    put_varint(trace, tis->cols);
+    put_varint(trace, tis->nactive);
+    put_varint(trace, TIS_TRACE_KEYFRAME);
+    put_string(trace, tis->name);
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        reserve(trace, TIS_TRACE_RECORD_MAX);
+        put_varint(trace, node->row * tis->cols + node->col);
+        put_varint(trace, node->type);
+        put_signed(trace, node->id);
+        put_string(trace, node->name);
+        for(int line = 0; node->type == TIS_NODE_TYPE_COMPUTE && line < TIS_NODE_LINE_COUNT; line++) {
+            tis_op_t* op = node->code[line];
+            put_string(trace, op == NULL || op->type == TIS_OP_TYPE_INVALID ? NULL : op->linetext);
+        }
+    }
+    for(size_t c = 0; c < 2 * tis->cols; c++) {
+        reserve(trace, 1);
+        put_byte(trace, (c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols]) != NULL);
+    }
+}
+
+/*
+ * Open the trace, start the writer thread, and record the header and the starting state, after init_tick()
+ */
+void init_trace(tis_t* tis, char* filename) {
+    tis_trace_t* trace = calloc(1, sizeof(tis_trace_t));
+    if(trace != NULL) {
+        trace->buffer[0] = malloc(TIS_TRACE_BUFFER);
+        trace->buffer[1] = malloc(TIS_TRACE_BUFFER);
+        trace->state = calloc(tis->nactive + 2 * tis->cols + 1, sizeof(tis_trace_state_t));
+    }
+    if(trace == NULL || trace->buffer[0] == NULL || trace->buffer[1] == NULL || trace->state == NULL) {
+        error("Unable to allocate memory for the trace\n");
+        bork();
+    }
+    if((trace->file = fopen(filename, "wb")) == NULL) {
+        error("Unable to open %s for writing the trace\n", filename);
+        bork();
+    }
+    trace->path = filename;
+    pthread_mutex_init(&(trace->lock), NULL);
+    pthread_cond_init(&(trace->moved), NULL);
+    if(pthread_create(&(trace->thread), NULL, write_buffers, trace) != 0) {
+        error("Unable to start the thread writing the trace\n");
+        bork();
+    }
+    tis->trace = trace;
+    record_header(tis);
+    record_keyframe(tis);
+    trace->cycle = 1;
+}
+
+/*
+ * The end of a cycle, called by tick()
+ */
+void trace_cycle(tis_t* tis) {
+    tis_trace_t* trace = tis->trace;
+    record_changes(tis);
+    if(trace->cycle % TIS_TRACE_KEYFRAME == 0) {
+        record_keyframe(tis);
+    }
+    trace->cycle++;
+}
+
+/*
+ * A reader (grid, then outputs) has taken a value from the port reg
+ */
+void trace_value(tis_t* tis, size_t reader, tis_register_t reg, int value) {
+    tis_trace_t* trace = tis->trace;
+    mark_cycle(trace);
+    reserve(trace, TIS_TRACE_RECORD_MAX);
+    put_byte(trace, 'V');
+    put_varint(trace, link_writer(tis, reader, reg));
+    put_varint(trace, reader);
+    put_signed(trace, value);
+}
+
+/*
+ * Record what changed in the cycle that was running, if the run stopped within one, and write out the rest of the
+ * trace. Called at exit.
+ */
+void finish_trace(tis_t* tis) {
+    tis_trace_t* trace = tis->trace;
+    if(trace == NULL) {
+        return;
+    }
+    record_changes(tis);
+    reserve(trace, 1);
+    put_byte(trace, 'E');
+    swap_buffers(trace);
+    pthread_mutex_lock(&(trace->lock));
+    trace->done = 1;
+    pthread_cond_broadcast(&(trace->moved));
+    pthread_mutex_unlock(&(trace->lock));
+    pthread_join(trace->thread, NULL);
+    if(fclose(trace->file) != 0 || trace->failed) {
+        error("Unable to write the trace to %s\n", trace->path);
+    }
+    pthread_mutex_destroy(&(trace->lock));
+    pthread_cond_destroy(&(trace->moved));
+    safe_free(trace->buffer[0]);
+    safe_free(trace->buffer[1]);
+    safe_free(trace->state);
+    safe_free(tis->trace);
+}
+
+/*
+ * Begin replay
+ */
+
+typedef struct replay_node {
+    size_t grid;
+    tis_node_type_t type;
+    long long id;
+    char* name;
+    char* lines[TIS_NODE_LINE_COUNT];
+} replay_node_t;
+
+typedef struct replay {
+    FILE* file;
+    int failed; // set on a short or malformed read
+    int truncated; // set if the short read was the end of the file
+    size_t rows;
+    size_t cols;
+    size_t nactive;
+    replay_node_t* nodes;
+    size_t* active_of; // grid index to slot, or SIZE_MAX
+    unsigned char* present; // per slot, non-zero if it is a node, or an io node that is defined
+    tis_trace_state_t* state;
+    char label[128];
+} replay_t;
+
+static unsigned long long get_varint(replay_t* replay) {
+    unsigned long long value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(replay->file);
+        if(c == EOF) {
+            replay->failed = 1;
+            replay->truncated = 1;
+            return 0;
+        }
+        value |= (unsigned long long)(c & 0x7F) << shift;
+        if(!(c & 0x80)) {
+            return value;
+        }
+    }
+    replay->failed = 1;
+    return 0;
+}
+
+static long long get_signed(replay_t* replay) {
+    unsigned long long value = get_varint(replay);
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+static char* get_string(replay_t* replay) {
+    size_t len = get_varint(replay);
+    if(replay->failed || len == 0 || len > TIS_TRACE_STRING_MAX) {
+        replay->failed = replay->failed || len > TIS_TRACE_STRING_MAX;
+        return NULL;
+    }
+    char* str = calloc(len + 1, 1);
+    if(str == NULL || fread(str, 1, len, replay->file) != len) {
+        replay->failed = 1;
+        replay->truncated = feof(replay->file);
+        safe_free(str);
+    }
+    return str;
+}
+
+/*
+ * The name of a slot, or of a unified writer or reader (grid, then io) if io is 'I' or 'O'
+ */
+static const char* replay_label(replay_t* replay, size_t index, int io) {
+    size_t slot = index;
+    if(io != 0) {
+        if(index >= replay->rows * replay->cols) {
+            snprintf(replay->label, sizeof(replay->label), "%c%zu", io, index - replay->rows * replay->cols);
+            return replay->label;
+        }
+        slot = replay->active_of[index];
+    } else if(slot >= replay->nactive) {
+        slot -= replay->nactive;
+        snprintf(replay->label, sizeof(replay->label), "%c%zu", slot < replay->cols ? 'I' : 'O', slot % replay->cols);
+        return replay->label;
+    }
+    if(slot >= replay->nactive) {
+        snprintf(replay->label, sizeof(replay->label), "(%zu,%zu)", index / replay->cols, index % replay->cols);
+        return replay->label;
+    }
+    replay_node_t* node = &(replay->nodes[slot]);
+    size_t ix = 0;
+    if(node->id >= 0) {
+        ix += snprintf(&(replay->label[ix]), sizeof(replay->label) - ix, "@%lld|", node->id);
+    }
+    if(node->name != NULL) {
+        ix += snprintf(&(replay->label[ix]), sizeof(replay->label) - ix, "%s|", node->name);
+    }
+    snprintf(&(replay->label[ix]), sizeof(replay->label) - ix, "(%zu,%zu)", node->grid / replay->cols, node->grid % replay->cols);
+    return replay->label;
+}
+
+static void print_change(replay_t* replay, unsigned long long cycle, size_t slot, int mask) {
+    tis_trace_state_t* state = &(replay->state[slot]);
+    replay_node_t* node = slot < replay->nactive ? &(replay->nodes[slot]) : NULL;
+    // only the fields that the kind of node has
+    if(node == NULL) {
+        mask &= TRACE_STATE | TRACE_WRITEREG | TRACE_WRITEBUF;
+    } else if(node->type == TIS_NODE_TYPE_COMPUTE) {
+        mask &= ~TRACE_TOP;
+    } else {
+        mask &= TRACE_INDEX | TRACE_STATE | TRACE_WRITEREG | TRACE_WRITEBUF | TRACE_TOP;
+    }
+    printf("%llu\t%s", cycle, replay_label(replay, slot, 0));
+    if(mask & TRACE_INDEX) {
+        if(node != NULL && node->type == TIS_NODE_TYPE_COMPUTE) {
+            const char* text = state->index >= 0 && state->index < TIS_NODE_LINE_COUNT ? node->lines[state->index] : NULL;
+            printf(text == NULL ? "\tline %d" : "\tline %d (%s)", state->index, text);
+        } else {
+            printf("\tdepth %d", state->index);
+        }
+    }
+    if(mask & TRACE_ACC) {
+        printf("\tacc %d", state->acc);
+    }
+    if(mask & TRACE_BAK) {
+        printf("\tbak %d", state->bak);
+    }
+    if(mask & TRACE_LAST) {
+        printf("\tlast %s", reg_to_string(state->last));
+    }
+    if(mask & TRACE_STATE) {
+        printf("\t%s", state->laststate < 4 ? state_names[state->laststate] : "?");
+    }
+    if(mask & (TRACE_WRITEREG | TRACE_WRITEBUF)) {
+        if(state->writereg == TIS_REGISTER_INVALID) {
+            printf("\tnot writing");
+        } else if(state->writereg == TIS_REGISTER_NIL) {
+            printf("\twrite taken");
+        } else {
+            printf("\twriting %d to %s", state->writebuf, reg_to_string(state->writereg));
+        }
+    }
+    if(mask & TRACE_TOP) {
+        printf("\ttop %d", state->top);
+    }
+    printf("\n");
+}
+
+static void free_replay(replay_t* replay) {
+    for(size_t i = 0; replay->nodes != NULL && i < replay->nactive; i++) {
+        safe_free(replay->nodes[i].name);
+        for(int line = 0; line < TIS_NODE_LINE_COUNT; line++) {
+            safe_free(replay->nodes[i].lines[line]);
+        }
+    }
+    safe_free(replay->nodes);
+    safe_free(replay->active_of);
+    safe_free(replay->present);
+    safe_free(replay->state);
+    if(replay->file != NULL) {
+        fclose(replay->file);
+    }
+}
+
+static int read_header(replay_t* replay, const char* filename) {
+    char magic[8];
+    if(fread(magic, 1, 8, replay->file) != 8 || memcmp(magic, TIS_TRACE_MAGIC, 8) != 0) {
+        error("%s is not a trace\n", filename);
+        return -1;
+    }
+    unsigned long long version = get_varint(replay);
+    if(version != TIS_TRACE_VERSION) {
+        error("%s is a trace of version %llu, but only version %d can be read\n", filename, version, TIS_TRACE_VERSION);
+        return -1;
+    }
+    replay->rows = get_varint(replay);
+    replay->cols = get_varint(replay);
+    replay->nactive = get_varint(replay);
+    unsigned long long keyframe = get_varint(replay);
+    char* name = get_string(replay);
+    size_t size = replay->rows * replay->cols;
+    if(replay->failed || replay->nactive > size || (replay->cols != 0 && size / replay->cols != replay->rows)) {
+        safe_free(name);
+        error("The header of %s is damaged\n", filename);
+        return -1;
+    }
+    replay->nodes = calloc(replay->nactive + 1, sizeof(replay_node_t));
+    replay->active_of = malloc((size + 1) * sizeof(size_t));
+    replay->state = calloc(replay->nactive + 2 * replay->cols + 1, sizeof(tis_trace_state_t));
+    replay->present = calloc(replay->nactive + 2 * replay->cols + 1, 1);
+    if(replay->nodes == NULL || replay->active_of == NULL || replay->state == NULL || replay->present == NULL) {
+        safe_free(name);
+        error("Unable to allocate memory for the replay\n");
+        return -1;
+    }
+    for(size_t i = 0; i < size; i++) {
+        replay->active_of[i] = SIZE_MAX;
+    }
+    for(size_t i = 0; i < replay->nactive && !replay->failed; i++) {
+        replay_node_t* node = &(replay->nodes[i]);
+        node->grid = get_varint(replay);
+        node->type = get_varint(replay);
+        node->id = get_signed(replay);
+        node->name = get_string(replay);
+        for(int line = 0; node->type == TIS_NODE_TYPE_COMPUTE && line < TIS_NODE_LINE_COUNT; line++) {
+            node->lines[line] = get_string(replay);
+        }
+        if(node->grid >= size) {
+            replay->failed = 1;
+        } else {
+            replay->active_of[node->grid] = i;
+        }
+        replay->present[i] = 1;
+    }
+    size_t ios[2] = { 0, 0 };
+    for(size_t c = 0; c < 2 * replay->cols; c++) {
+        int present = fgetc(replay->file);
+        replay->failed = replay->failed || present == EOF;
+        ios[c >= replay->cols] += present > 0;
+        replay->present[replay->nactive + c] = present > 0;
+    }
+    if(replay->failed) {
+        safe_free(name);
+        error("The header of %s is damaged\n", filename);
+        return -1;
+    }
+    printf("Trace of %s: %zu rows, %zu cols, %zu nodes that run, %zu inputs, %zu outputs, keyframes every %llu cycles\n",
+        name == NULL ? "(unnamed)" : name, replay->rows, replay->cols, replay->nactive, ios[0], ios[1], keyframe);
+    safe_free(name);
+    return 0;
+}
+
+/*
+ * Print the trace in filename as text on stdout, one change per line, prefixed by its cycle. Keyframes are checked
+ * against the state built up from the changes before them. Returns 0 if the whole trace was read.
+ */
+int replay_trace(const char* filename) {
+    replay_t replay;
+    memset(&replay, 0, sizeof(replay));
+    if((replay.file = fopen(filename, "rb")) == NULL) {
+        error("Unable to open %s for reading the trace\n", filename);
+        return -1;
+    }
+    if(read_header(&replay, filename) != 0) {
+        free_replay(&replay);
+        return -1;
+    }
+    size_t slots = replay.nactive + 2 * replay.cols;
+    size_t size = replay.rows * replay.cols;
+    unsigned long long cycle = 0, values = 0, keyframes = 0;
+    int tag, ended = 0;
+    while(!ended && !replay.failed && (tag = fgetc(replay.file)) != EOF) {
+        if(tag == 'C') {
+            cycle += get_varint(&replay);
+        } else if(tag == 'V') {
+            size_t writer = get_varint(&replay);
+            size_t reader = get_varint(&replay);
+            long long value = get_signed(&replay);
+            if(replay.failed || writer >= size + replay.cols || reader >= size + replay.cols) {
+                replay.failed = 1;
+                break;
+            }
+            printf("%llu\t%s", cycle, replay_label(&replay, writer, 'I'));
+            printf(" -> %s\t%lld\n", replay_label(&replay, reader, 'O'), value);
+            values++;
+        } else if(tag == 'N') {
+            size_t slot = get_varint(&replay);
+            int mask = fgetc(replay.file);
+            if(slot >= slots || mask == EOF) {
+                replay.failed = 1;
+                replay.truncated = mask == EOF;
+                break;
+            }
+            for(int bit = 1; bit <= TRACE_TOP; bit <<= 1) {
+                if(mask & bit) {
+                    set_field(&(replay.state[slot]), bit, get_signed(&replay));
+                }
+            }
+            print_change(&replay, cycle, slot, mask);
+        } else if(tag == 'K') {
+            cycle = get_varint(&replay);
+            int mismatch = 0;
+            for(size_t slot = 0; slot < slots; slot++) {
+                tis_trace_state_t state;
+                memset(&state, 0, sizeof(state));
+                for(int bit = 1; bit <= TRACE_TOP; bit <<= 1) {
+                    set_field(&state, bit, get_signed(&replay));
+                }
+                if(cycle > 0 && changed_fields(&state, &(replay.state[slot])) != 0) {
+                    mismatch = 1;
+                }
+                replay.state[slot] = state;
+            }
+            if(cycle == 0) {
+                for(size_t slot = 0; slot < slots; slot++) {
+                    if(replay.present[slot]) {
+                        print_change(&replay, cycle, slot, TRACE_ALL);
+                    }
+                }
+            } else {
+                printf("%llu\tkeyframe%s\n", cycle, mismatch ? "\tDIFFERS" : "");
+            }
+            if(mismatch) {
+                warn("The keyframe at cycle %llu does not match the changes before it\n", cycle);
+            }
+            keyframes++;
+        } else if(tag == 'E') {
+            ended = 1;
+        } else {
+            replay.failed = 1;
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "Replayed %llu cycles, %llu values taken, %llu keyframes\n", cycle, values, keyframes);
+    if(replay.failed && !replay.truncated) {
+        error("The trace in %s is damaged after cycle %llu\n", filename, cycle);
+    } else if(!ended) {
+        warn("The trace in %s ends early, after cycle %llu; the run may have been killed\n", filename, cycle);
+    }
+    int status = replay.failed && !replay.truncated ? -1 : 0;
+    free_replay(&replay);
+    return status;
+}
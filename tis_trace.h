@@ -0,0 +1,64 @@
+#ifndef _TIS_TRACE_
+#define _TIS_TRACE_
+
+#include <pthread.h>
+
+#include "tis_types.h"
+
+/*
+ * Binary execution trace (--trace) and its replay (--replay).
+ *
+ * After each cycle, the state of every node is compared with what was last recorded, and only the fields that changed
+ * are written, along with every value handed between nodes (including those taken from inputs and given to outputs).
+ * Every TIS_TRACE_KEYFRAME cycles the whole state is written again, so that a reader can start from there. Records go
+ * into a buffer, and full buffers are written out by a thread of their own while the machine keeps running. tick()
+ * calls in here once per cycle if tis->trace is set, and the read handshake once per value taken, so a run without
+ * --trace pays one branch for each.
+ *
+ * The format is described in tis_trace.c.
+ */
+
+#ifndef TIS_TRACE_KEYFRAME
+#define TIS_TRACE_KEYFRAME 65536 // cycles between keyframes
+#endif
+#ifndef TIS_TRACE_BUFFER
+#define TIS_TRACE_BUFFER (1 << 20) // bytes in each of the two buffers
+#endif
+
+typedef struct tis_trace_state {
+    int index; // ip of compute nodes, depth of stack nodes
+    int acc;
+    int bak;
+    int writebuf;
+    int top; // the value on top of a stack node, if any
+    unsigned char last;
+    unsigned char laststate;
+    unsigned char writereg;
+} tis_trace_state_t;
+
+typedef struct tis_trace {
+    FILE* file;
+    char* path;
+    unsigned char* buffer[2];
+    int current; // the buffer being filled
+    size_t used;
+    unsigned long long cycle; // counted by tick()
+    unsigned long long marked; // the last cycle a cycle record was written for
+    tis_trace_state_t* state; // as last recorded: active nodes, then inputs, then outputs
+    // Shared with the writer thread
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t moved; // signalled when pending is taken or given
+    unsigned char* pending; // a full buffer waiting to be written, or NULL
+    size_t pending_used;
+    int done;
+    int failed;
+} tis_trace_t;
+
+void init_trace(tis_t* tis, char* filename);
+void trace_cycle(tis_t* tis);
+void trace_value(tis_t* tis, size_t reader, tis_register_t reg, int value);
+void finish_trace(tis_t* tis);
+int replay_trace(const char* filename);
+
+#endif /* _TIS_TRACE_ */
@@ -0,0 +1,625 @@
+#define _POSIX_C_SOURCE 200809L // for fileno()
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "tis_debug.h"
+#include "tis_node.h"
+#include "tis_travel.h"
+#include "tis_types.h"
+
+#define TIS_TRAVEL_NODE_VALUES 7 // index, acc, bak, last, writebuf, writereg, laststate
+#define TIS_TRAVEL_IO_VALUES 3 // writebuf, writereg, laststate
+#define TIS_TRAVEL_COMMAND 256 // longest command line
+#define TIS_TRAVEL_ARGS 8 // most arguments to a command
+
+const char* travel_field_names[TRAVEL_FIELD_COUNT] = { "line", "acc", "bak", "last", "mode", "write" };
+
+static jmp_buf travel_resume;
+static int travel_status;
+
+static void travel_halt(int status) {
+    travel_status = status;
+    longjmp(travel_resume, 1);
+}
+
+static int is_memory(tis_node_t* node) {
+    return node->type == TIS_NODE_TYPE_MEMORY_STACK || node->type == TIS_NODE_TYPE_MEMORY_RAM;
+}
+
+static tis_travel_io_t* travel_io(tis_t* tis, tis_io_node_t* io) {
+    return &(tis->travel->io[io == tis->inputs[io->col] ? io->col : tis->cols + io->col]);
+}
+
+/*
+ * Begin the io log
+ */
+
+/*
+ * Take the next call from the log, if it has been made before
+ */
+static tis_travel_entry_t* replay_call(tis_travel_io_t* tio) {
+    if(tio->entry == tio->nentries) {
+        return NULL;
+    }
+    tis_travel_entry_t* entry = &(tio->entries[tio->entry]);
+    tio->calls++;
+    if(tio->calls == entry->start + entry->count) {
+        tio->entry++;
+    }
+    return entry;
+}
+
+/*
+ * Add a call made for the first time to the log, merging it with the one before if it had the same result
+ */
+static void log_call(tis_travel_io_t* tio, int state, int value, int merge) {
+    tis_travel_entry_t* last = tio->nentries > 0 ? &(tio->entries[tio->nentries - 1]) : NULL;
+    if(last != NULL && merge && last->state == state && last->value == value) {
+        last->count++;
+    } else {
+        if(tio->nentries == tio->maxentries) {
+            size_t maxentries = tio->maxentries == 0 ? 64 : 2 * tio->maxentries;
+            tis_travel_entry_t* entries = realloc(tio->entries, maxentries * sizeof(tis_travel_entry_t));
+            if(entries == NULL) {
+                error("Unable to allocate memory for the io log\n");
+                bork();
+            }
+            tio->entries = entries;
+            tio->maxentries = maxentries;
+        }
+        tio->entries[tio->nentries++] = (tis_travel_entry_t){ .start = tio->calls, .count = 1, .state = state, .value = value };
+    }
+    tio->calls++;
+    tio->entry = tio->nentries;
+}
+
+/*
+ * Move the cursor of the log to this many calls
+ */
+static void seek_calls(tis_travel_io_t* tio, unsigned long long calls) {
+    size_t lo = 0, hi = tio->nentries;
+    while(lo < hi) { // the first entry that ends after calls
+        size_t mid = lo + (hi - lo) / 2;
+        if(tio->entries[mid].start + tio->entries[mid].count <= calls) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    tio->entry = lo;
+    tio->calls = calls;
+}
+
+/*
+ * If this input was run in this cycle before, give the same result again. Returns a true value if so.
+ */
+int travel_replay_input(tis_t* tis, tis_io_node_t* io, tis_node_state_t* state) {
+    tis_travel_entry_t* entry = replay_call(travel_io(tis, io));
+    if(entry == NULL) {
+        return 0;
+    }
+    *state = entry->state;
+    if(entry->state == TIS_NODE_STATE_WRITE_WAIT) {
+        io->writebuf = entry->value;
+    }
+    return 1;
+}
+
+void travel_log_input(tis_t* tis, tis_io_node_t* io, tis_node_state_t state) {
+    // each value is an entry of its own, waits are merged
+    log_call(travel_io(tis, io), state, state == TIS_NODE_STATE_WRITE_WAIT ? io->writebuf : 0, state != TIS_NODE_STATE_WRITE_WAIT);
+}
+
+int travel_replay_blocked(tis_t* tis, tis_io_node_t* io, int* blocked) {
+    tis_travel_entry_t* entry = replay_call(travel_io(tis, io));
+    if(entry == NULL) {
+        return 0;
+    }
+    *blocked = entry->state;
+    return 1;
+}
+
+void travel_log_blocked(tis_t* tis, tis_io_node_t* io, int blocked) {
+    log_call(travel_io(tis, io), blocked, 0, 1);
+}
+
+/*
+ * Count a value given to this output. Returns a true value if it was given before, and must not be written again.
+ */
+int travel_mute_output(tis_t* tis, tis_io_node_t* io) {
+    tis_travel_io_t* tio = travel_io(tis, io);
+    tio->written++;
+    if(tio->written <= tio->frontier) {
+        return 1;
+    }
+    tio->frontier = tio->written;
+    return 0;
+}
+
+/*
+ * Begin snapshots
+ */
+
+static void save_snapshot(tis_t* tis, tis_travel_snapshot_t* snap) {
+    tis_travel_t* travel = tis->travel;
+    int* v = snap->values;
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        *v++ = node->index;
+        *v++ = node->acc;
+        *v++ = node->bak;
+        *v++ = node->last;
+        *v++ = node->writebuf;
+        *v++ = node->writereg;
+        *v++ = node->laststate;
+        if(is_memory(node)) {
+            memcpy(v, node->data, TIS_MEM_CELL_COUNT * sizeof(int));
+            v += TIS_MEM_CELL_COUNT;
+        }
+    }
+    for(size_t c = 0; c < 2 * tis->cols; c++) {
+        tis_io_node_t* io = c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols];
+        *v++ = io != NULL ? io->writebuf : 0;
+        *v++ = io != NULL ? (int)io->writereg : 0;
+        *v++ = io != NULL ? (int)io->laststate : 0;
+        snap->io[2 * c] = travel->io[c].calls;
+        snap->io[2 * c + 1] = travel->io[c].written;
+    }
+    snap->cycle = travel->cycle;
+}
+
+static void restore_snapshot(tis_t* tis, tis_travel_snapshot_t* snap) {
+    tis_travel_t* travel = tis->travel;
+    int* v = snap->values;
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        node->index = *v++;
+        node->acc = *v++;
+        node->bak = *v++;
+        node->last = *v++;
+        node->writebuf = *v++;
+        node->writereg = *v++;
+        node->laststate = *v++;
+        if(is_memory(node)) {
+            memcpy(node->data, v, TIS_MEM_CELL_COUNT * sizeof(int));
+            v += TIS_MEM_CELL_COUNT;
+        }
+    }
+    for(size_t c = 0; c < 2 * tis->cols; c++) {
+        tis_io_node_t* io = c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols];
+        if(io != NULL) {
+            io->writebuf = v[0];
+            io->writereg = v[1];
+            io->laststate = v[2];
+        }
+        v += TIS_TRAVEL_IO_VALUES;
+        seek_calls(&(travel->io[c]), snap->io[2 * c]);
+        travel->io[c].written = snap->io[2 * c + 1];
+    }
+    travel->cycle = snap->cycle;
+}
+
+/*
+ * Drop every other snapshot, keeping the first, and double the interval
+ */
+static void thin_snapshots(tis_t* tis) {
+    tis_travel_t* travel = tis->travel;
+    size_t kept = 0;
+    for(size_t i = 0; i < travel->nsnapshots; i += 2, kept++) {
+        tis_travel_snapshot_t* from = &(travel->snapshots[i]);
+        tis_travel_snapshot_t* to = &(travel->snapshots[kept]);
+        if(from != to) {
+            memcpy(to->values, from->values, travel->nvalues * sizeof(int));
+            memcpy(to->io, from->io, 4 * tis->cols * sizeof(unsigned long long));
+            to->cycle = from->cycle;
+        }
+    }
+    travel->nsnapshots = kept;
+    travel->every *= 2;
+    debug("Keeping %zu snapshots, one every %llu cycles\n", kept, travel->every);
+}
+
+/*
+ * Take a snapshot if this cycle is due one and is past the last
+ */
+static void maybe_snapshot(tis_t* tis) {
+    tis_travel_t* travel = tis->travel;
+    if(travel->cycle % travel->every != 0 || travel->cycle <= travel->snapshots[travel->nsnapshots - 1].cycle) {
+        return;
+    }
+    if(travel->nsnapshots == travel->maxsnapshots) {
+        thin_snapshots(tis);
+        if(travel->cycle % travel->every != 0) {
+            return;
+        }
+    }
+    save_snapshot(tis, &(travel->snapshots[travel->nsnapshots++]));
+}
+
+/*
+ * Begin moving
+ */
+
+/*
+ * Run one cycle, catching HCF and errors. Returns -1 if the machine halts in this cycle, otherwise whether it was
+ * quiescent.
+ */
+static int step(tis_t* tis) {
+    tis_travel_t* travel = tis->travel;
+    if(travel->halts != 0 && travel->cycle + 1 >= travel->halts) {
+        warn("The machine halts in cycle %llu\n", travel->halts);
+        return -1;
+    }
+    volatile int quiescent = 0;
+    tis_halt_hook = travel_halt;
+    if(setjmp(travel_resume) == 0) {
+        quiescent = tick(tis);
+    } else {
+        tis_halt_hook = NULL;
+        travel->halts = travel->cycle + 1;
+        warn("The machine halts in cycle %llu, with status %d\n", travel->halts, travel_status);
+        // the state is that of a cycle left half done, so go back to its start
+        size_t k = travel->nsnapshots - 1;
+        while(travel->snapshots[k].cycle > travel->cycle) {
+            k--;
+        }
+        unsigned long long target = travel->cycle;
+        restore_snapshot(tis, &(travel->snapshots[k]));
+        while(travel->cycle < target) {
+            tick(tis);
+            travel->cycle++;
+        }
+        return -1;
+    }
+    tis_halt_hook = NULL;
+    travel->cycle++;
+    maybe_snapshot(tis);
+    return quiescent;
+}
+
+/*
+ * Go to the end of the target cycle, going back to a snapshot if needed. Returns -1 if the machine halts first.
+ */
+static int go_to(tis_t* tis, unsigned long long target) {
+    tis_travel_t* travel = tis->travel;
+    if(target < travel->cycle) {
+        size_t k = travel->nsnapshots - 1;
+        while(travel->snapshots[k].cycle > target) {
+            k--;
+        }
+        restore_snapshot(tis, &(travel->snapshots[k]));
+    }
+    while(travel->cycle < target) {
+        if(step(tis) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Begin the command loop
+ */
+
+/*
+ * A node given as @<id> or <row>,<col>, as its index in tis->active; or an io node as I<col> or O<col>, as
+ * nactive + col or nactive + cols + col. Returns -1 if there is no such node.
+ */
+long travel_find_node(tis_t* tis, const char* spec) {
+    size_t row, col;
+    long long id;
+    char c;
+    if(sscanf(spec, "@%lld %c", &id, &c) == 1) {
+        for(size_t i = 0; i < tis->nactive; i++) {
+            if(tis->active[i]->id == id) {
+                return i;
+            }
+        }
+    } else if(sscanf(spec, "%zu,%zu %c", &row, &col, &c) == 2) {
+        for(size_t i = 0; i < tis->nactive; i++) {
+            if(tis->active[i]->row == row && tis->active[i]->col == col) {
+                return i;
+            }
+        }
+    } else if((spec[0] == 'I' || spec[0] == 'O') && sscanf(spec + 1, "%zu %c", &col, &c) == 1 && col < tis->cols) {
+        tis_io_node_t* io = spec[0] == 'I' ? tis->inputs[col] : tis->outputs[col];
+        if(io != NULL) {
+            return tis->nactive + (spec[0] == 'O' ? tis->cols : 0) + col;
+        }
+    }
+    error("There is no node '%s' that runs; give @<id>, <row>,<col>, I<col> or O<col>\n", spec);
+    return -1;
+}
+
+/*
+ * A field by its name, or -1 if there is no such field
+ */
+int travel_field_named(const char* name) {
+    for(int field = 0; field < TRAVEL_FIELD_COUNT; field++) {
+        if(strcasecmp(name, travel_field_names[field]) == 0) {
+            return field;
+        }
+    }
+    error("There is no field '%s'; give line, acc, bak, last, mode or write\n", name);
+    return -1;
+}
+
+long long travel_field_value(tis_t* tis, size_t slot, travel_field_t field) {
+    int index = 0, acc = 0, bak = 0, writebuf;
+    tis_register_t last = TIS_REGISTER_INVALID, writereg;
+    tis_node_state_t laststate;
+    if(slot < tis->nactive) {
+        tis_node_t* node = tis->active[slot];
+        index = node->index;
+        acc = node->acc;
+        bak = node->bak;
+        last = node->last;
+        writebuf = node->writebuf;
+        writereg = node->writereg;
+        laststate = node->laststate;
+    } else {
+        size_t c = slot - tis->nactive;
+        tis_io_node_t* io = c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols];
+        writebuf = io->writebuf;
+        writereg = io->writereg;
+        laststate = io->laststate;
+    }
+    switch(field) {
+        case TRAVEL_FIELD_LINE: return index;
+        case TRAVEL_FIELD_ACC: return acc;
+        case TRAVEL_FIELD_BAK: return bak;
+        case TRAVEL_FIELD_LAST: return last;
+        case TRAVEL_FIELD_MODE: return laststate;
+        case TRAVEL_FIELD_WRITE:
+        default:
+            // the value only matters while it is being written
+            return writereg == TIS_REGISTER_INVALID || writereg == TIS_REGISTER_NIL ? -(long long)writereg : ((long long)writereg << 32) + (unsigned)writebuf;
+    }
+}
+
+static void print_node(tis_t* tis, size_t slot) {
+    if(slot >= tis->nactive) {
+        size_t c = slot - tis->nactive;
+        print_io_state(stderr, c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols], c < tis->cols ? 'I' : 'O');
+    } else {
+        print_node_state(stderr, tis->active[slot]);
+    }
+}
+
+/*
+ * Go back to the last cycle before the current one at the end of which a field of a node had just changed. Each
+ * stretch between snapshots is run again, latest first, until one holds a change.
+ */
+static void go_to_change(tis_t* tis, size_t slot, travel_field_t field) {
+    tis_travel_t* travel = tis->travel;
+    unsigned long long now = travel->cycle;
+    for(size_t k = travel->nsnapshots; k-- > 0;) {
+        if(travel->snapshots[k].cycle >= now) {
+            continue;
+        }
+        unsigned long long end = k + 1 < travel->nsnapshots && travel->snapshots[k + 1].cycle < now ? travel->snapshots[k + 1].cycle : now;
+        unsigned long long found = 0;
+        restore_snapshot(tis, &(travel->snapshots[k]));
+        long long value = travel_field_value(tis, slot, field);
+        while(travel->cycle < end && step(tis) >= 0) {
+            long long next = travel_field_value(tis, slot, field);
+            if(next != value && travel->cycle < now) {
+                found = travel->cycle;
+            }
+            value = next;
+        }
+        if(found != 0) {
+            go_to(tis, found);
+            fprintf(stderr, "Cycle %llu: %s last changed\n", found, travel_field_names[field]);
+            print_node(tis, slot);
+            return;
+        }
+    }
+    go_to(tis, now);
+    fprintf(stderr, "The %s of this node has not changed since the start\n", travel_field_names[field]);
+}
+
+static void print_help(void) {
+    fprintf(stderr, "Commands:\n"
+        "    step [<n>]             run n cycles forward, 1 by default (s)\n"
+        "    back [<n>]             go n cycles back, 1 by default (b)\n"
+        "    goto <cycle>           go to the end of that cycle, 0 is the start (g)\n"
+        "    run                    run until the machine is quiescent, halts, hits the -c limit, or stops\n"
+        "                               at a breakpoint or watchpoint (r, continue, c)\n"
+        "    last <node> <field>    go back to the last cycle in which the field of the node changed,\n"
+        "                               one of line, acc, bak, last, mode or write (l)\n"
+        "    print [<node>]         show a node, or all of them (p)\n"
+        "    break <node> <line> [if <field> <op> <value>]\n"
+        "                           stop run before the node runs the line (counting from 0), if the field\n"
+        "                               compares with the value by one of == != < > <= >= (bp)\n"
+        "    watch <node> <field> [<op> <value>]\n"
+        "                           stop run when line, acc or bak changes, or the condition becomes true (w)\n"
+        "    watch <node> <port> [<op> <value>]\n"
+        "                           stop run when the node takes a value (that compares) from UP, DOWN, LEFT,\n"
+        "                               RIGHT or ANY of them; an output O<col> takes no port (w)\n"
+        "    info                   show the breakpoints and watchpoints (i)\n"
+        "    delete <n>             delete breakpoint or watchpoint n (d)\n"
+        "    snapshots              show the snapshots kept\n"
+        "    quit                   stop (q)\n"
+        "Nodes are @<id>, <row>,<col>, I<col> or O<col>. Lines starting with ! in the source are breakpoints.\n");
+}
+
+static int parse_count(const char* arg, unsigned long long* n) {
+    char* end;
+    if(arg == NULL) {
+        return 0;
+    }
+    *n = strtoull(arg, &end, 10);
+    if(end == arg || *end != '\0' || arg[0] == '-') {
+        error("Invalid number '%s'\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Run one command. Returns a true value to stop.
+ */
+static int run_command(tis_t* tis, char* line, long long timelimit) {
+    tis_travel_t* travel = tis->travel;
+    char* cmd = strtok(line, " \t\r\n");
+    char* args[TIS_TRAVEL_ARGS + 1] = { NULL };
+    for(int k = 0; cmd != NULL && k < TIS_TRAVEL_ARGS && (args[k] = strtok(NULL, " \t\r\n")) != NULL; k++);
+    char* arg = args[0];
+    char* arg2 = args[1];
+    unsigned long long n = 1;
+    if(cmd == NULL || cmd[0] == '#') {
+        return 0;
+    } else if(debug_command(tis, cmd, args)) {
+        return 0;
+    } else if(strcmp(cmd, "step") == 0 || strcmp(cmd, "s") == 0) {
+        if(parse_count(arg, &n) == 0) {
+            go_to(tis, travel->cycle + n);
+        }
+    } else if(strcmp(cmd, "back") == 0 || strcmp(cmd, "b") == 0) {
+        if(parse_count(arg, &n) == 0) {
+            go_to(tis, n > travel->cycle ? 0 : travel->cycle - n);
+        }
+    } else if(strcmp(cmd, "goto") == 0 || strcmp(cmd, "g") == 0) {
+        if(arg == NULL) {
+            error("goto needs a cycle\n");
+        } else if(parse_count(arg, &n) == 0) {
+            go_to(tis, n);
+        }
+    } else if(strcmp(cmd, "run") == 0 || strcmp(cmd, "r") == 0 || strcmp(cmd, "continue") == 0 || strcmp(cmd, "c") == 0) {
+        // -c n runs n + 1 cycles
+        int quiescent = 0, back = 0;
+        long slot = -1;
+        debug_arm(tis);
+        while(quiescent == 0 && slot < 0 && (timelimit == 0 || travel->cycle <= (unsigned long long)timelimit)) {
+            quiescent = step(tis);
+            slot = quiescent < 0 ? -1 : debug_check(tis, &back);
+        }
+        if(back) {
+            go_to(tis, travel->cycle - 1);
+        }
+        if(slot >= 0) {
+            print_node(tis, slot);
+        } else if(quiescent > 0) {
+            fprintf(stderr, "The machine is quiescent\n");
+        }
+    } else if(strcmp(cmd, "last") == 0 || strcmp(cmd, "l") == 0) {
+        long slot = arg == NULL || arg2 == NULL ? -1 : travel_find_node(tis, arg);
+        int field = arg2 == NULL ? -1 : travel_field_named(arg2);
+        if(arg == NULL || arg2 == NULL) {
+            error("last needs a node and a field\n");
+        } else if(slot >= 0 && field >= 0) {
+            go_to_change(tis, slot, field);
+        }
+    } else if(strcmp(cmd, "print") == 0 || strcmp(cmd, "p") == 0) {
+        long slot = arg == NULL ? 0 : travel_find_node(tis, arg);
+        for(size_t i = arg == NULL ? 0 : (size_t)slot; slot >= 0 && i < (arg == NULL ? tis->nactive + 2 * tis->cols : (size_t)slot + 1); i++) {
+            tis_io_node_t* io = i < tis->nactive ? NULL : i < tis->nactive + tis->cols ? tis->inputs[i - tis->nactive] : tis->outputs[i - tis->nactive - tis->cols];
+            if(i < tis->nactive || io != NULL) {
+                print_node(tis, i);
+            }
+        }
+    } else if(strcmp(cmd, "snapshots") == 0) {
+        fprintf(stderr, "%zu snapshots of %zu, one every %llu cycles, from cycle %llu to %llu, %zu bytes each\n",
+            travel->nsnapshots, travel->maxsnapshots, travel->every, travel->snapshots[0].cycle,
+            travel->snapshots[travel->nsnapshots - 1].cycle, travel->nvalues * sizeof(int) + 4 * tis->cols * sizeof(unsigned long long));
+    } else if(strcmp(cmd, "help") == 0 || strcmp(cmd, "h") == 0) {
+        print_help();
+    } else if(strcmp(cmd, "quit") == 0 || strcmp(cmd, "q") == 0) {
+        return 1;
+    } else {
+        error("Unknown command '%s', try help\n", cmd);
+    }
+    return 0;
+}
+
+static void init_travel(tis_t* tis, unsigned long long every) {
+    tis_travel_t* travel = calloc(1, sizeof(tis_travel_t));
+    if(travel == NULL) {
+        error("Unable to allocate memory for the snapshots\n");
+        bork();
+    }
+    travel->every = every;
+    travel->nvalues = TIS_TRAVEL_NODE_VALUES * tis->nactive + TIS_TRAVEL_IO_VALUES * 2 * tis->cols;
+    for(size_t i = 0; i < tis->nactive; i++) {
+        travel->nvalues += is_memory(tis->active[i]) ? TIS_MEM_CELL_COUNT : 0;
+    }
+    size_t bytes = travel->nvalues * sizeof(int) + 4 * tis->cols * sizeof(unsigned long long) + sizeof(tis_travel_snapshot_t);
+    travel->maxsnapshots = TIS_TRAVEL_MEMORY / bytes;
+    travel->maxsnapshots = travel->maxsnapshots < 4 ? 4 : travel->maxsnapshots > 65536 ? 65536 : travel->maxsnapshots;
+    travel->snapshots = calloc(travel->maxsnapshots, sizeof(tis_travel_snapshot_t));
+    travel->io = calloc(2 * tis->cols + 1, sizeof(tis_travel_io_t));
+    int* values = malloc(travel->maxsnapshots * travel->nvalues * sizeof(int) + 1);
+    unsigned long long* io = malloc(travel->maxsnapshots * 4 * tis->cols * sizeof(unsigned long long) + 1);
+    if(travel->snapshots == NULL || travel->io == NULL || values == NULL || io == NULL) {
+        error("Unable to allocate memory for the snapshots\n");
+        bork();
+    }
+    for(size_t k = 0; k < travel->maxsnapshots; k++) {
+        travel->snapshots[k].values = values + k * travel->nvalues;
+        travel->snapshots[k].io = io + k * 4 * tis->cols;
+    }
+    tis->travel = travel;
+    save_snapshot(tis, &(travel->snapshots[0]));
+    travel->nsnapshots = 1;
+    debug("Keeping up to %zu snapshots of %zu bytes, one every %llu cycles at first\n", travel->maxsnapshots, bytes, every);
+}
+
+void free_travel(tis_t* tis) {
+    tis_travel_t* travel = tis->travel;
+    if(travel == NULL) {
+        return;
+    }
+    free(travel->snapshots[0].values);
+    free(travel->snapshots[0].io);
+    for(size_t c = 0; c < 2 * tis->cols; c++) {
+        safe_free(travel->io[c].entries);
+    }
+    safe_free(travel->io);
+    safe_free(travel->snapshots);
+    free_debug(tis);
+    safe_free(tis->travel);
+}
+
+/*
+ * Run the machine under the command loop, reading commands from the file given, - for stdin, or the terminal by
+ * default, since stdin may be an input. Does not return.
+ */
+void run_travel(tis_t* tis, const char* commands, unsigned long long every, long long timelimit) {
+    const char* path = commands == NULL ? "/dev/tty" : commands;
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if(in == NULL) {
+        error("Unable to open %s for reading commands\n", path);
+        exit(EXIT_FAILURE);
+    }
+    init_travel(tis, every);
+    init_debug(tis);
+    int prompt = isatty(fileno(in));
+    if(prompt) {
+        fprintf(stderr, "Stopped before the first cycle; try help\n");
+    }
+    char line[TIS_TRAVEL_COMMAND];
+    for(;;) {
+        if(prompt) {
+            fprintf(stderr, "(cycle %llu) ", tis->travel->cycle);
+        }
+        if(fgets(line, sizeof(line), in) == NULL) {
+            break;
+        }
+        unsigned long long before = tis->travel->cycle;
+        if(run_command(tis, line, timelimit)) {
+            break;
+        }
+        fflush(stdout);
+        if(tis->travel->cycle != before && !prompt) {
+            fprintf(stderr, "Cycle %llu\n", tis->travel->cycle);
+        }
+    }
+    if(in != stdin) {
+        fclose(in);
+    }
+    exit(EXIT_SUCCESS);
+}
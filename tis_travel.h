@@ -0,0 +1,89 @@
+#ifndef _TIS_TRAVEL_
+#define _TIS_TRAVEL_
+
+#include <stdio.h>
+
+#include "tis_types.h"
+
+/*
+ * Reverse execution (--travel).
+ *
+ * The machine is run under a small command loop, which can step forward and back, go to any cycle, or go back to the
+ * last cycle in which a field of a node changed. Going back restores the nearest earlier snapshot of the whole state
+ * and runs forward from there. Snapshots are taken every so many cycles (--travel-every), up to about
+ * TIS_TRAVEL_MEMORY bytes of them; when that is full, every other one is dropped and the interval doubles, so the
+ * cycles run to go back stay within a small multiple of the run so far divided by the number of snapshots.
+ *
+ * Running a cycle again must do exactly what it did the first time. The state of the nodes is all in the snapshot,
+ * but the io is not: so every result of an input, and whether each output was full, is logged (run-length encoded)
+ * the first time, and taken from the log when running that cycle again. Values given to outputs again are dropped,
+ * so each value is written once. The log of an input grows with the values it gives, which bounds how long a run
+ * with a busy input can be kept.
+ */
+
+#ifndef TIS_TRAVEL_MEMORY
+#define TIS_TRAVEL_MEMORY (64 << 20) // bytes of snapshots kept
+#endif
+#ifndef TIS_TRAVEL_EVERY
+#define TIS_TRAVEL_EVERY 1024 // cycles between snapshots, at first
+#endif
+
+typedef enum travel_field {
+    TRAVEL_FIELD_LINE, // ip of compute nodes, depth of stack nodes
+    TRAVEL_FIELD_ACC,
+    TRAVEL_FIELD_BAK,
+    TRAVEL_FIELD_LAST,
+    TRAVEL_FIELD_MODE,
+    TRAVEL_FIELD_WRITE, // the port written to and the value
+    TRAVEL_FIELD_COUNT,
+} travel_field_t;
+
+extern const char* travel_field_names[TRAVEL_FIELD_COUNT];
+
+typedef struct tis_travel_entry {
+    unsigned long long start; // the number of calls before this entry
+    unsigned long long count; // calls with this result
+    int state; // the state returned by an input, or for an output, whether it was full
+    int value; // the value given by an input
+} tis_travel_entry_t;
+
+typedef struct tis_travel_io {
+    tis_travel_entry_t* entries;
+    size_t nentries;
+    size_t maxentries;
+    size_t entry; // the entry holding the next call, or nentries if it has not been made yet
+    unsigned long long calls; // made so far, in this run of the cycles
+    unsigned long long written; // values given to an output, in this run of the cycles
+    unsigned long long frontier; // values given to an output, ever
+} tis_travel_io_t;
+
+typedef struct tis_travel_snapshot {
+    unsigned long long cycle;
+    int* values; // the fields of every node and io node, see save_snapshot()
+    unsigned long long* io; // calls, then written, of every io node
+} tis_travel_snapshot_t;
+
+typedef struct tis_travel {
+    unsigned long long cycle; // cycles run since the start
+    unsigned long long every; // cycles between snapshots
+    unsigned long long halts; // the cycle in which the machine halts, or 0 if not known to
+    tis_travel_snapshot_t* snapshots; // in order of cycle, the first is cycle 0
+    size_t nsnapshots;
+    size_t maxsnapshots;
+    size_t nvalues; // ints in each snapshot
+    tis_travel_io_t* io; // inputs, then outputs
+    struct tis_debug* debug; // breakpoints and watchpoints, see tis_debug.h
+} tis_travel_t;
+
+_Noreturn void run_travel(tis_t* tis, const char* commands, unsigned long long every, long long timelimit);
+void free_travel(tis_t* tis);
+int travel_replay_input(tis_t* tis, tis_io_node_t* io, tis_node_state_t* state);
+void travel_log_input(tis_t* tis, tis_io_node_t* io, tis_node_state_t state);
+int travel_replay_blocked(tis_t* tis, tis_io_node_t* io, int* blocked);
+void travel_log_blocked(tis_t* tis, tis_io_node_t* io, int blocked);
+int travel_mute_output(tis_t* tis, tis_io_node_t* io);
+long travel_find_node(tis_t* tis, const char* spec);
+int travel_field_named(const char* name);
+long long travel_field_value(tis_t* tis, size_t slot, travel_field_t field);
+
+#endif /* _TIS_TRAVEL_ */
@@ -0,0 +1,531 @@
+#define _POSIX_C_SOURCE 200809L // for clock_gettime() and nanosleep()
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tis_link.h"
+#include "tis_node.h"
+#include "tis_tui.h"
+#include "tis_types.h"
+
+#define TIS_TUI_BOX_WIDTH 20 // a node, with its border
+#define TIS_TUI_CELL_WIDTH 25 // a node, then the arrows to the next
+#define TIS_TUI_BOX_HEIGHT 5
+#define TIS_TUI_CELL_HEIGHT 6 // the arrows from the row above, then a node
+#define TIS_TUI_EXTRA_LINES 5 // inputs, arrows to the outputs, outputs, and two of status
+
+static const int speeds[] = { 1, 10, 100, 1000, 10000, 100000, 0 }; // cycles a second, 0 is full speed
+#define TIS_TUI_SPEEDS ((int)(sizeof(speeds) / sizeof(speeds[0])))
+static const char* state_names[] = { "RUN", "READ", "WRITE", "IDLE" };
+
+static jmp_buf tui_resume;
+static int tui_status;
+
+static void tui_halt(int status) {
+    tui_status = status;
+    longjmp(tui_resume, 1);
+}
+
+static long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec wait = { .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL };
+    nanosleep(&wait, NULL);
+}
+
+/*
+ * Begin the machine's side
+ */
+
+/*
+ * Write the state into the snapshot, under the sequence lock: a reader that sees the same even sequence number before
+ * and after copying it has a consistent copy
+ */
+static void publish(tis_t* tis, unsigned long long cycle) {
+    tis_tui_t* tui = tis->tui;
+    unsigned seq = atomic_load_explicit(&(tui->seq), memory_order_relaxed);
+    atomic_store_explicit(&(tui->seq), seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_int* v = tui->values;
+    for(size_t i = 0; i < tis->nactive; i++) {
+        tis_node_t* node = tis->active[i];
+        int memory = node->type != TIS_NODE_TYPE_COMPUTE;
+        atomic_store_explicit(v++, node->index, memory_order_relaxed);
+        atomic_store_explicit(v++, node->acc, memory_order_relaxed);
+        atomic_store_explicit(v++, node->bak, memory_order_relaxed);
+        atomic_store_explicit(v++, node->laststate, memory_order_relaxed);
+        atomic_store_explicit(v++, node->writereg, memory_order_relaxed);
+        atomic_store_explicit(v++, node->writebuf, memory_order_relaxed);
+        atomic_store_explicit(v++, memory && node->index > 0 ? node->data[node->index - 1] : 0, memory_order_relaxed);
+        atomic_store_explicit(v++, node->last, memory_order_relaxed);
+    }
+    for(size_t c = 0; c < 2 * tis->cols; c++) {
+        tis_io_node_t* io = c < tis->cols ? tis->inputs[c] : tis->outputs[c - tis->cols];
+        atomic_store_explicit(v++, io != NULL ? (int)io->laststate : 0, memory_order_relaxed);
+        atomic_store_explicit(v++, io != NULL ? (int)io->writereg : 0, memory_order_relaxed);
+        atomic_store_explicit(v++, io != NULL ? io->writebuf : 0, memory_order_relaxed);
+    }
+    for(size_t k = 0; k < tui->ntaken; k++) {
+        tis_link_t* link = tis->links->links[k];
+        atomic_store_explicit(&(tui->taken[k]), link != NULL ? link->values : 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&(tui->cycle), cycle, memory_order_relaxed);
+    atomic_store_explicit(&(tui->seq), seq + 2, memory_order_release);
+}
+
+/*
+ * Called after a cycle when the drawing thread has asked for attention: publish the state, then wait while paused, or
+ * as long as it takes to keep to the speed
+ */
+static void attend(tis_t* tis, unsigned long long cycle) {
+    tis_tui_t* tui = tis->tui;
+    static long long pace_start;
+    static unsigned long long pace_from;
+    static int pace_speed;
+    atomic_store_explicit(&(tui->attention), 0, memory_order_relaxed);
+    publish(tis, cycle);
+    while(atomic_load(&(tui->paused)) && atomic_load(&(tui->steps)) == 0 && !atomic_load(&(tui->quit))) {
+        pace_speed = 0;
+        sleep_ns(1000000000LL / (4 * TIS_TUI_FPS));
+    }
+    if(atomic_load(&(tui->quit))) {
+        exit(EXIT_SUCCESS);
+    }
+    int paused = atomic_load(&(tui->paused));
+    int speed = speeds[atomic_load(&(tui->speed))];
+    if(paused) {
+        if(atomic_load(&(tui->steps)) > 0) {
+            atomic_fetch_sub(&(tui->steps), 1);
+        }
+    } else if(speed != 0) {
+        if(speed != pace_speed) {
+            pace_speed = speed;
+            pace_start = now_ns();
+            pace_from = cycle;
+        }
+        long long wait = pace_start + (long long)((cycle - pace_from) * 1000000000ULL / speed) - now_ns();
+        if(wait > 0) {
+            sleep_ns(wait);
+        }
+    } else {
+        pace_speed = 0;
+    }
+    if(paused || speed != 0) {
+        atomic_store_explicit(&(tui->attention), 1, memory_order_relaxed);
+    }
+}
+
+/*
+ * Begin the drawing thread
+ */
+
+typedef struct tui_frame {
+    int* values;
+    unsigned long long* taken;
+    unsigned long long* before; // taken, as of the last frame
+    long* slot; // per grid index, the index in tis->active, or -1
+    unsigned long long cycle;
+    char* text; // lines of width + 1 bytes
+    size_t width;
+    size_t height;
+} tui_frame_t;
+
+static void read_snapshot(tis_tui_t* tui, tui_frame_t* frame) {
+    for(;;) {
+        unsigned seq = atomic_load_explicit(&(tui->seq), memory_order_acquire);
+        if(seq % 2 == 0) {
+            for(size_t k = 0; k < tui->nvalues; k++) {
+                frame->values[k] = atomic_load_explicit(&(tui->values[k]), memory_order_relaxed);
+            }
+            for(size_t k = 0; k < tui->ntaken; k++) {
+                frame->taken[k] = atomic_load_explicit(&(tui->taken[k]), memory_order_relaxed);
+            }
+            frame->cycle = atomic_load_explicit(&(tui->cycle), memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(&(tui->seq), memory_order_relaxed) == seq) {
+                return;
+            }
+        }
+        sleep_ns(10000);
+    }
+}
+
+/*
+ * Put text at a place in the frame, clipped to its width
+ */
+static void put(tui_frame_t* frame, size_t y, size_t x, const char* text) {
+    if(y >= frame->height) {
+        return;
+    }
+    char* line = frame->text + y * (frame->width + 1);
+    for(; *text != '\0' && x < frame->width; x++, text++) {
+        line[x] = *text;
+    }
+}
+
+/*
+ * The arrow of a link: the value waiting on it, or just the arrow if values were taken through it since the last
+ * frame. reader is -1 for none, otherwise as in tis_link.h, and dir is the port it reads from.
+ */
+static void put_arrow(tis_t* tis, tui_frame_t* frame, size_t y, size_t x, const char* arrow, tis_register_t writereg, int writebuf, tis_register_t toward, long reader, tis_register_t dir) {
+    char text[16];
+    if(writereg == toward || writereg == TIS_REGISTER_ANY) {
+        snprintf(text, sizeof(text), "%s%d", arrow, writebuf);
+        put(frame, y, x, text);
+    } else if(reader >= 0 && tis->links != NULL) {
+        size_t k = 4 * reader + (dir - TIS_REGISTER_UP);
+        if(frame->taken[k] != frame->before[k]) {
+            put(frame, y, x, arrow);
+        }
+    }
+}
+
+static void put_box(tis_t* tis, tui_frame_t* frame, size_t y, size_t x, size_t grid) {
+    tis_node_t* node = tis->nodes[grid];
+    long slot = frame->slot[grid];
+    int* v = slot >= 0 ? frame->values + slot * TIS_TUI_NODE_VALUES : NULL;
+    char text[64];
+    put(frame, y, x, "+------------------+");
+    put(frame, y + TIS_TUI_BOX_HEIGHT - 1, x, "+------------------+");
+    for(size_t k = 1; k < TIS_TUI_BOX_HEIGHT - 1; k++) {
+        put(frame, y + k, x, "|                  |");
+    }
+    if(node == NULL) {
+        put(frame, y, x + 2, "DAMAGED");
+        return;
+    } else if(node->type != TIS_NODE_TYPE_COMPUTE) {
+        put(frame, y, x + 2, "STACK");
+        if(v != NULL) {
+            put(frame, y, x + 14, state_names[v[3]]);
+            snprintf(text, sizeof(text), "DEPTH %d", v[0]);
+            put(frame, y + 1, x + 2, text);
+            if(v[0] > 0) {
+                snprintf(text, sizeof(text), "TOP %d", v[6]);
+                put(frame, y + 2, x + 2, text);
+            }
+        }
+        return;
+    }
+    snprintf(text, sizeof(text), "@%lld", node->id);
+    put(frame, y, x + 2, text);
+    if(v == NULL) {
+        return; // no code, so never runs
+    }
+    put(frame, y, x + 14, state_names[v[3]]);
+    tis_op_t* op = node->code[v[0]];
+    snprintf(text, sizeof(text), "%2d %.15s", v[0], op != NULL && op->type != TIS_OP_TYPE_INVALID ? op->linetext : "");
+    put(frame, y + 1, x + 1, text);
+    snprintf(text, sizeof(text), "ACC %-5d BAK %d", v[1], v[2]);
+    put(frame, y + 2, x + 2, text);
+    if(v[7] != TIS_REGISTER_INVALID && v[7] != TIS_REGISTER_NIL) {
+        snprintf(text, sizeof(text), "LAST %s", reg_to_string(v[7]));
+        put(frame, y + 3, x + 2, text);
+    }
+}
+
+static void draw(tis_t* tis, tui_frame_t* frame, double rate) {
+    tis_tui_t* tui = tis->tui;
+    struct winsize size;
+    if(ioctl(tui->tty, TIOCGWINSZ, &size) != 0 || size.ws_col == 0) {
+        size.ws_col = 80;
+        size.ws_row = 24;
+    }
+    if(frame->text == NULL || frame->width != size.ws_col || frame->height != size.ws_row) {
+        char* text = malloc((size_t)size.ws_row * (size.ws_col + 1));
+        if(text == NULL) {
+            return; // keep the old frame, and try again next time
+        }
+        free(frame->text);
+        frame->text = text;
+        frame->width = size.ws_col;
+        frame->height = size.ws_row;
+    }
+    memset(frame->text, ' ', frame->height * (frame->width + 1));
+    size_t cols = frame->width / TIS_TUI_CELL_WIDTH;
+    size_t rows = frame->height > TIS_TUI_EXTRA_LINES ? (frame->height - TIS_TUI_EXTRA_LINES) / TIS_TUI_CELL_HEIGHT : 0;
+    cols = cols < tis->cols ? cols : tis->cols;
+    rows = rows < tis->rows ? rows : tis->rows;
+    int* io = frame->values + tis->nactive * TIS_TUI_NODE_VALUES;
+    char text[64];
+
+    for(size_t c = 0; c < cols; c++) {
+        size_t x = c * TIS_TUI_CELL_WIDTH;
+        int* in = io + c * TIS_TUI_IO_VALUES;
+        if(tis->inputs[c] != NULL) {
+            snprintf(text, sizeof(text), "I%zu %s", c, state_names[in[0]]);
+            put(frame, 0, x + 2, text);
+            put_arrow(tis, frame, 1, x + 4, "v", in[1], in[2], TIS_REGISTER_DOWN, tis->rows == 0 ? (long)(tis->size + c) : (long)c, TIS_REGISTER_UP);
+        }
+        for(size_t r = 0; r < rows; r++) {
+            size_t grid = r * tis->cols + c;
+            size_t y = 1 + r * TIS_TUI_CELL_HEIGHT;
+            long slot = frame->slot[grid];
+            int* v = slot >= 0 ? frame->values + slot * TIS_TUI_NODE_VALUES : NULL;
+            put_box(tis, frame, y + 1, x, grid);
+            if(v == NULL) {
+                continue;
+            }
+            // arrows leaving this node: up into the gutter above, down into the one below, left and right beside it
+            if(r > 0) {
+                put_arrow(tis, frame, y, x + 12, "^", v[4], v[5], TIS_REGISTER_UP, grid - tis->cols, TIS_REGISTER_DOWN);
+            }
+            put_arrow(tis, frame, y + TIS_TUI_CELL_HEIGHT, x + 4, "v", v[4], v[5], TIS_REGISTER_DOWN,
+                r + 1 < tis->rows ? (long)(grid + tis->cols) : (long)(tis->size + c), TIS_REGISTER_UP);
+            if(c > 0) {
+                put_arrow(tis, frame, y + 4, x - 5, "<", v[4], v[5], TIS_REGISTER_LEFT, grid - 1, TIS_REGISTER_RIGHT);
+            }
+            if(c + 1 < tis->cols) {
+                put_arrow(tis, frame, y + 2, x + TIS_TUI_BOX_WIDTH, ">", v[4], v[5], TIS_REGISTER_RIGHT, grid + 1, TIS_REGISTER_LEFT);
+            }
+        }
+        if(rows == tis->rows && tis->outputs[c] != NULL) {
+            int* out = io + (tis->cols + c) * TIS_TUI_IO_VALUES;
+            snprintf(text, sizeof(text), "O%zu %s", c, state_names[out[0]]);
+            put(frame, 2 + rows * TIS_TUI_CELL_HEIGHT, x + 2, text);
+        }
+    }
+
+    int status = atomic_load(&(tui->status));
+    int speed = speeds[atomic_load(&(tui->speed))];
+    size_t y = frame->height - 2;
+    if(status == TIS_TUI_HALTED) {
+        snprintf(text, sizeof(text), "halted in cycle %llu, status %d", frame->cycle + 1, atomic_load(&(tui->halt_status)));
+    } else if(status == TIS_TUI_QUIESCENT) {
+        snprintf(text, sizeof(text), "quiescent after cycle %llu", frame->cycle);
+    } else if(status == TIS_TUI_LIMIT) {
+        snprintf(text, sizeof(text), "stopped by -c after cycle %llu", frame->cycle);
+    } else if(atomic_load(&(tui->paused))) {
+        snprintf(text, sizeof(text), "paused after cycle %llu", frame->cycle);
+    } else if(speed != 0) {
+        snprintf(text, sizeof(text), "cycle %llu, at %d a second", frame->cycle, speed);
+    } else {
+        snprintf(text, sizeof(text), "cycle %llu, %.0f a second", frame->cycle, rate);
+    }
+    put(frame, y, 0, text);
+    if(rows < tis->rows || cols < tis->cols) {
+        snprintf(text, sizeof(text), "showing %zu x %zu of %zu x %zu", rows, cols, tis->rows, tis->cols);
+        put(frame, y, frame->width > 40 ? frame->width - 30 : 0, text);
+    }
+    put(frame, y + 1, 0, status != TIS_TUI_RUNNING ? "q quit" : "space pause  s step  + faster  - slower  q quit");
+
+    // home, then each line cleared to its end, so nothing flickers
+    size_t len = 0;
+    char* out = malloc(frame->height * (frame->width + 8) + 16);
+    if(out == NULL) {
+        return;
+    }
+    len += sprintf(out, "\033[H");
+    for(size_t i = 0; i < frame->height; i++) {
+        char* line = frame->text + i * (frame->width + 1);
+        size_t end = frame->width;
+        while(end > 0 && line[end - 1] == ' ') {
+            end--;
+        }
+        memcpy(out + len, line, end);
+        len += end;
+        len += sprintf(out + len, i + 1 < frame->height ? "\033[K\r\n" : "\033[K");
+    }
+    if(write(tui->tty, out, len) < 0) {
+        debug("Unable to draw on the terminal\n");
+    }
+    free(out);
+}
+
+/*
+ * Wait up to this long for keys, and act on them
+ */
+static void read_keys(tis_tui_t* tui, long long ns) {
+    long long until = now_ns() + ns;
+    for(long long left = ns; left > 0; left = until - now_ns()) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(tui->tty, &fds);
+        struct timeval timeout = { .tv_sec = left / 1000000000LL, .tv_usec = (left % 1000000000LL) / 1000 };
+        char key;
+        if(select(tui->tty + 1, &fds, NULL, NULL, &timeout) <= 0 || read(tui->tty, &key, 1) != 1) {
+            continue;
+        }
+        int speed = atomic_load(&(tui->speed));
+        switch(key) {
+            case ' ':
+                atomic_store(&(tui->paused), !atomic_load(&(tui->paused)));
+                break;
+            case 's':
+            case 'n':
+                if(atomic_load(&(tui->paused))) {
+                    atomic_fetch_add(&(tui->steps), 1);
+                } else {
+                    atomic_store(&(tui->paused), 1);
+                }
+                break;
+            case '+':
+            case '=':
+                atomic_store(&(tui->speed), speed + 1 < TIS_TUI_SPEEDS ? speed + 1 : speed);
+                break;
+            case '-':
+                atomic_store(&(tui->speed), speed > 0 ? speed - 1 : 0);
+                break;
+            case 'q':
+                atomic_store(&(tui->quit), 1);
+                break;
+            default:
+                break;
+        }
+        atomic_store(&(tui->attention), 1);
+    }
+}
+
+static void* draw_loop(void* arg) {
+    tis_t* tis = arg;
+    tis_tui_t* tui = tis->tui;
+    tui_frame_t frame = { 0 };
+    frame.values = malloc(tui->nvalues * sizeof(int) + 1);
+    frame.taken = calloc(tui->ntaken + 1, sizeof(unsigned long long));
+    frame.before = calloc(tui->ntaken + 1, sizeof(unsigned long long));
+    frame.slot = malloc(tis->size * sizeof(long) + 1);
+    if(frame.values == NULL || frame.taken == NULL || frame.before == NULL || frame.slot == NULL) {
+        error("Unable to allocate memory for drawing\n");
+        atomic_store(&(tui->quit), 1);
+        return NULL;
+    }
+    for(size_t i = 0; i < tis->size; i++) {
+        frame.slot[i] = -1;
+    }
+    for(size_t i = 0; i < tis->nactive; i++) {
+        frame.slot[tis->active[i]->row * tis->cols + tis->active[i]->col] = i;
+    }
+    unsigned long long lastcycle = 0;
+    long long lasttime = now_ns();
+    double rate = 0;
+    while(!atomic_load(&(tui->done))) {
+        atomic_store(&(tui->attention), 1);
+        read_keys(tui, 1000000000LL / TIS_TUI_FPS);
+        read_snapshot(tui, &frame);
+        long long now = now_ns();
+        rate = (frame.cycle - lastcycle) * 1e9 / (now - lasttime > 0 ? now - lasttime : 1);
+        lastcycle = frame.cycle;
+        lasttime = now;
+        draw(tis, &frame, rate);
+        memcpy(frame.before, frame.taken, tui->ntaken * sizeof(unsigned long long));
+    }
+    free(frame.values);
+    free(frame.taken);
+    free(frame.before);
+    free(frame.slot);
+    free(frame.text);
+    return NULL;
+}
+
+/*
+ * Begin setting up
+ */
+
+static void init_tui(tis_t* tis) {
+    tis_tui_t* tui = calloc(1, sizeof(tis_tui_t));
+    if(tui == NULL) {
+        error("Unable to allocate memory for the terminal view\n");
+        bork();
+    }
+    if((tui->tty = open("/dev/tty", O_RDWR)) < 0 || tcgetattr(tui->tty, &(tui->saved)) != 0) {
+        error("Unable to open the terminal for --tui\n");
+        exit(EXIT_FAILURE);
+    }
+    // the link counters show which ports passed values
+    init_links(tis, 0);
+    tui->nvalues = TIS_TUI_NODE_VALUES * tis->nactive + TIS_TUI_IO_VALUES * 2 * tis->cols;
+    tui->ntaken = 4 * (tis->size + tis->cols);
+    tui->values = calloc(tui->nvalues + 1, sizeof(atomic_int));
+    tui->taken = calloc(tui->ntaken + 1, sizeof(atomic_ullong));
+    if(tui->values == NULL || tui->taken == NULL) {
+        error("Unable to allocate memory for the terminal view\n");
+        bork();
+    }
+    atomic_store(&(tui->speed), TIS_TUI_SPEEDS - 1);
+    tis->tui = tui;
+    publish(tis, 0);
+
+    struct termios raw = tui->saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(tui->tty, TCSANOW, &raw);
+    const char* enter = "\033[?1049h\033[?25l\033[2J"; // the alternate screen, without a cursor
+    if(write(tui->tty, enter, strlen(enter)) < 0) {
+        debug("Unable to draw on the terminal\n");
+    }
+    if(pthread_create(&(tui->thread), NULL, draw_loop, tis) != 0) {
+        error("Unable to start the drawing thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Stop drawing and put the terminal back; called on exit
+ */
+void finish_tui(tis_t* tis) {
+    tis_tui_t* tui = tis->tui;
+    if(tui == NULL) {
+        return;
+    }
+    atomic_store(&(tui->done), 1);
+    pthread_join(tui->thread, NULL);
+    const char* leave = "\033[?25h\033[?1049l";
+    if(write(tui->tty, leave, strlen(leave)) < 0) {
+        debug("Unable to restore the terminal\n");
+    }
+    tcsetattr(tui->tty, TCSANOW, &(tui->saved));
+    close(tui->tty);
+    free(tui->values);
+    free(tui->taken);
+    safe_free(tis->tui);
+}
+
+/*
+ * Show how the run ended, and wait for q
+ */
+static _Noreturn void finish_run(tis_t* tis, unsigned long long cycle, int status) {
+    tis_tui_t* tui = tis->tui;
+    atomic_store(&(tui->halt_status), tui_status);
+    publish(tis, cycle);
+    atomic_store(&(tui->status), status);
+    while(!atomic_load(&(tui->quit))) {
+        sleep_ns(1000000000LL / TIS_TUI_FPS);
+    }
+    exit(status == TIS_TUI_HALTED ? tui_status : EXIT_SUCCESS);
+}
+
+/*
+ * Run the machine with the terminal view, until it halts or is quiescent (then until q), or q. Does not return.
+ */
+void run_tui(tis_t* tis, long long timelimit) {
+    init_tui(tis);
+    tis_tui_t* tui = tis->tui;
+    volatile int status = TIS_TUI_QUIESCENT;
+    tis_halt_hook = tui_halt;
+    if(setjmp(tui_resume) == 0) {
+        // the link counters count the cycles; -c n runs n + 1 of them, as in main()
+        while(!tick(tis)) {
+            if(atomic_load_explicit(&(tui->attention), memory_order_relaxed)) {
+                attend(tis, tis->links->cycle);
+            }
+            if(timelimit != 0 && tis->links->cycle > (unsigned long long)timelimit) {
+                status = TIS_TUI_LIMIT;
+                break;
+            }
+        }
+    } else {
+        status = TIS_TUI_HALTED;
+    }
+    tis_halt_hook = NULL;
+    finish_run(tis, tis->links->cycle, status);
+}
@@ -0,0 +1,59 @@
+#ifndef _TIS_TUI_
+#define _TIS_TUI_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <termios.h>
+
+#include "tis_types.h"
+
+/*
+ * Live view of the machine in the terminal (--tui).
+ *
+ * The grid is drawn like the game's: each node with its current line, ACC and BAK, and what it is doing, with the
+ * values waiting to be taken and the ports that passed values since the last frame drawn on the arrows between nodes.
+ * Drawing is done by a thread of its own, at most TIS_TUI_FPS times a second, from a snapshot of the state that the
+ * machine publishes under a sequence lock when asked: the machine checks one flag per cycle, and never waits for the
+ * terminal. Keys: space pauses and resumes, s runs one cycle while paused, + and - change the speed (full speed by
+ * default, or a number of cycles a second), and q quits.
+ */
+
+#ifndef TIS_TUI_FPS
+#define TIS_TUI_FPS 20 // most frames drawn a second
+#endif
+#define TIS_TUI_NODE_VALUES 8 // index, acc, bak, laststate, writereg, writebuf, top of a stack node, last
+#define TIS_TUI_IO_VALUES 3 // laststate, writereg, writebuf
+
+typedef enum tis_tui_status {
+    TIS_TUI_RUNNING = 0,
+    TIS_TUI_HALTED,
+    TIS_TUI_QUIESCENT,
+    TIS_TUI_LIMIT,
+} tis_tui_status_t;
+
+typedef struct tis_tui {
+    int tty; // read for keys, and drawn on
+    struct termios saved; // the terminal settings to put back
+    pthread_t thread;
+    // Set by the drawing thread, read by the machine
+    atomic_int attention; // the machine must look at what follows after its next cycle
+    atomic_int paused;
+    atomic_int steps; // cycles to run while paused
+    atomic_int speed; // an index in speeds[] of tis_tui.c
+    atomic_int quit;
+    atomic_int done; // the drawing thread must stop
+    // Set by the machine, read by the drawing thread
+    atomic_int status;
+    atomic_int halt_status;
+    atomic_uint seq; // odd while the snapshot below is being written
+    atomic_ullong cycle;
+    atomic_int* values; // active nodes, then inputs, then outputs
+    atomic_ullong* taken; // values taken, per reader (grid, then outputs) and direction, see tis_link.h
+    size_t nvalues;
+    size_t ntaken;
+} tis_tui_t;
+
+_Noreturn void run_tui(tis_t* tis, long long timelimit);
+void finish_tui(tis_t* tis);
+
+#endif /* _TIS_TUI_ */
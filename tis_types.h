@@ -1,8 +1,11 @@
 #ifndef _TIS_TYPES_
 #define _TIS_TYPES_
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "tis_arena.h"
+
 /*
  * Begin constants
  */
@@ -10,6 +13,12 @@
 #define TIS_NODE_LINE_COUNT 15
 #define TIS_NODE_LINE_LENGTH 18
 #define TIS_MEM_CELL_COUNT 15
+#ifndef TIS_TILE_SIZE
+#define TIS_TILE_SIZE 64 // width of the diagonal bands that --partitions runs in unless --tile-size says, see tile_order()
+#endif
+#ifndef TIS_RANDOM_COUNT
+#define TIS_RANDOM_COUNT 39 // values given by a RANDOM input, unless the layout says, as in most puzzles of the game
+#endif
 
 /*
  * Begin enums
@@ -31,6 +40,7 @@ typedef enum tis_op_type {
     TIS_OP_TYPE_SAV,
     TIS_OP_TYPE_SUB,
     TIS_OP_TYPE_SWP,
+    TIS_OP_TYPE_BREAK, // a line patched with a breakpoint, never parsed, see tis_debug.h
 } tis_op_type_t;
 
 static inline char* op_to_string(tis_op_type_t op) {
@@ -49,6 +59,7 @@ static inline char* op_to_string(tis_op_type_t op) {
         case TIS_OP_TYPE_SAV: return "SAV";
         case TIS_OP_TYPE_SUB: return "SUB";
         case TIS_OP_TYPE_SWP: return "SWP";
+        case TIS_OP_TYPE_BREAK: return "BREAK";
         case TIS_OP_TYPE_INVALID:
         default: return "INVALID";
     }
@@ -126,10 +137,13 @@ typedef enum tis_io_type {
     TIS_IO_TYPE_INVALID = 0,
     TIS_IO_TYPE_IOSTREAM_ASCII,
     TIS_IO_TYPE_IOSTREAM_NUMERIC,
+    TIS_IO_TYPE_IOSTREAM_BINARY16, // little-endian 16-bit signed integers
+    TIS_IO_TYPE_IOSTREAM_BINARY32, // little-endian 32-bit signed integers
+    TIS_IO_TYPE_IOSTREAM_SHM, // shared-memory ring, see tis_shm.h
     TIS_IO_TYPE_OSTREAM_IMAGE,
     TIS_IO_TYPE_IGENERATOR_LIST, // echo given numbers once
     TIS_IO_TYPE_IGENERATOR_CYCLIC, // repeat given numbers forever
-    TIS_IO_TYPE_IGENERATOR_RANDOM, // on the interval specified, or -999..999 by default
+    TIS_IO_TYPE_IGENERATOR_RANDOM, // on the interval specified, or -999..999 by default, TIS_RANDOM_COUNT values unless given
     TIS_IO_TYPE_IGENERATOR_ALGEBRAIC, // need scale, start value and increment (scale is not necessary here, but keep for consistency)
     TIS_IO_TYPE_IGENERATOR_GEOMETRIC, // need scale, start value and multiplier
     TIS_IO_TYPE_IGENERATOR_HARMONIC, // need scale, start value and increment (reciprocal of ALGEBRAIC)
@@ -147,6 +161,7 @@ typedef struct tis_op_arg {
         tis_register_t reg;
         char* label;
     };
+    int target; // for labels, the index of the labelled line, or -1 if there is none (resolved after parsing)
 } tis_op_arg_t;
 
 typedef struct tis_op {
@@ -159,15 +174,15 @@ typedef struct tis_op {
 } tis_op_t;
 
 typedef struct tis_node {
-    tis_node_type_t type;
-    int id; // The id from the source, non-compute nodes are skipped (used by compute)
+    long long id; // The id from the source, non-compute nodes are skipped (used by compute), -1 for the others
     size_t row;
     size_t col;
     char* name; // optional (no equivalent in-game)
     union {
-        tis_op_t* code[TIS_NODE_LINE_COUNT]; // up to 15 lines of code (used by compute)
-        int data[TIS_MEM_CELL_COUNT]; // up to 15 cells for data (used by memory)
+        tis_op_t** code; // TIS_NODE_LINE_COUNT lines of code, shared by nodes given the same code (used by compute)
+        int* data; // TIS_MEM_CELL_COUNT cells for data (used by memory)
     };
+    tis_node_type_t type; // after the wider fields, so that it packs with the ints below
     int acc; // (used by compute)
     int bak; // (used by compute)
     tis_register_t last; // (used by compute)
@@ -177,6 +192,13 @@ typedef struct tis_node {
     tis_node_state_t laststate; // managed externally
 } tis_node_t;
 
+typedef struct tis_io_shm {
+    struct tis_shm_ring* ring; // attached on first use
+    size_t mapped; // size of the mapping of ring
+    char* name; // not owned, lives in the arena
+    unsigned int capacity; // only used if the ring does not exist yet
+} tis_io_shm_t;
+
 typedef struct tis_io_node {
     tis_io_type_t type;
     size_t col;
@@ -184,8 +206,18 @@ typedef struct tis_io_node {
     union {
         struct {
             FILE* file;
+            char* path; // as given in the layout, NULL for the default stdin/stdout
             int sep; // negative is none, otherwise cast to char
         } file;
+        tis_io_shm_t shm;
+        struct {
+            uint64_t state; // seeded by seed_random_input()
+            size_t left; // values still to give
+            size_t count; // values given in all
+            int min;
+            int max;
+            int args; // given in the layout so far, while parsing
+        } random;
         struct {
             int current; // current is unscaled and (in the case of HARMONIC) unreciprocated
             int scale; // scaling before casting to int and clamping
@@ -195,6 +227,17 @@ typedef struct tis_io_node {
     int writebuf; // (used by communicative types)
     tis_register_t writereg; // UpDownLeftRightAny -> ready, Nil -> complete, Invalid -> quiet (used by all types)
     tis_node_state_t laststate; // managed externally
+    unsigned long long values; // given by an input or taken by an output, for --metrics
+    int last; // the last value taken by an output, for --lockstep
+    struct {
+        char* path; // the EXPECT file of an output as given in the layout, or NULL
+        int* values; // what the output must take, in order, or NULL if not checked
+        size_t nvalues;
+        size_t count; // values the output takes before it is done (COUNT, or all of values), or 0 for no end
+        size_t next; // values taken so far
+        unsigned long long cycles; // run by the output, counted while it has a count
+        const char* keyword; // while parsing the layout, EXPECT or COUNT if its argument is the next token
+    } expect;
 } tis_io_node_t;
 
 typedef struct tis {
@@ -203,15 +246,62 @@ typedef struct tis {
     size_t size; // must be equal to rows*cols
     char* name; // optional
     // These are arrays of pointers, so that entries can be NULL
-    tis_node_t** nodes; // length = rows*cols = size
+    tis_node_t** nodes; // length = rows*cols = size, damaged nodes are NULL
     tis_io_node_t** inputs; // length = cols
     tis_io_node_t** outputs; // length = cols
+    tis_op_t** nocode; // the (empty) code of compute nodes without any
+    // These are set up by init_tick(), after loading
+    tis_node_t** active; // nodes that can ever run, in row-major order
+    size_t nactive;
+    char* deferred; // scratch for tick(), length = cols + nactive + cols
+    struct tis_profile* profile; // with --profile, set up by init_profile(), see tis_prof.h
+    struct tis_perf* perf; // with --perf-counters, set up by init_perf(), see tis_perf.h
+    struct tis_links* links; // with --links or --critical-path, set up by init_links(), see tis_link.h
+    struct tis_trace* trace; // with --trace, set up by init_trace(), see tis_trace.h
+    struct tis_travel* travel; // with --travel, set up by run_travel(), see tis_travel.h
+    struct tis_tui* tui; // with --tui, set up by run_tui(), see tis_tui.h
+    struct tis_metrics* metrics; // with --metrics or --dump, set up by init_metrics(), see tis_metrics.h
+    struct tis_stop* stop; // with --stop-idle or --score, set up by init_stop(), see tis_io.h
+    tis_arena_t arena; // owns the nodes, io nodes, code and strings above
+    void* image; // mapped .tisbin file, if loaded from one; strings point into it
+    size_t image_size;
 } tis_t;
 
 typedef struct tis_opt {
     int verbose;
     tis_io_type_t default_i_type; // if using a default layout, use this type for input
     tis_io_type_t default_o_type; // if using a default layout, use this type for output
+    int compile; // only parse and save the machine, don't open any io files
+    int footprint; // print the memory in use once loaded, see report_footprint()
+    size_t partitions; // run in this many worker processes, see tis_part.h
+    size_t tile_size; // diagonals in each band of tile_order(), TIS_TILE_SIZE by default
+    size_t components; // run independent components on up to this many threads, see tis_comp.h
+    int profile; // count where the cycles go, see tis_prof.h
+    char* profile_file; // with --profile, also write the counts here as JSON
+    int links; // count the traffic on each link, see tis_link.h
+    char* links_file; // with --links, also write the counts here as JSON
+    int critical; // log every handoff and report the critical path, see tis_crit.h
+    char* critical_file; // with --critical-path, also write the path here as JSON
+    int estimate; // predict the throughput from the code instead of running, see tis_est.h
+    int perf; // read the hardware performance counters around the main loop, see tis_perf.h
+    const struct tis_engine* lockstep; // run this engine beside tick() and compare, see tis_diff.h
+    size_t lockstep_every; // cycles between comparisons, 1 if 0
+    size_t fuzz; // check every engine on this many random machines
+    char* trace_file; // record a binary trace of the run here, see tis_trace.h
+    char* replay_file; // print this trace as text instead of running
+    int travel; // run under the command loop of tis_travel.h, which can go back
+    char* travel_file; // with --travel, read the commands from here instead of the terminal
+    unsigned long long travel_every; // cycles between snapshots, TIS_TRAVEL_EVERY if 0
+    int tui; // draw the machine live in the terminal, see tis_tui.h
+    char* metrics_file; // write live metrics here, see tis_metrics.h
+    double metrics_every; // seconds between writes of the metrics, TIS_METRICS_EVERY if 0
+    char* dump_file; // dump the state here on SIGUSR1, with --metrics stderr if NULL
+    int dump; // dump the state on SIGUSR1
+    unsigned long long stop_idle; // stop this many cycles after the inputs end and the outputs go quiet, see tis_io.h
+    int stop_any; // stop once any output with a COUNT or EXPECT is done, rather than all of them
+    unsigned long long seed; // for RANDOM inputs, and the first of the runs of --score
+    size_t score; // run this many times on random inputs and give the game's metrics, see tis_score.h
+    size_t score_threads; // threads for the runs of --score, one per cpu if 0
 } tis_opt_t;
 extern tis_opt_t opts;
 
@@ -226,59 +316,15 @@ extern tis_opt_t opts;
     }                       \
 } while(0)
 
-#define safe_free_list(ptr,len,subfree) do {    \
-    if(ptr != NULL) {                           \
-        for(size_t opi = 0; opi < len; opi++) { \
-            subfree(ptr[opi]);                  \
-        }                                       \
-        free(ptr);                              \
-        ptr = NULL;                             \
-    }                                           \
-} while(0)
-
-#define safe_free_op(ptr) do {                       \
-    if(ptr != NULL) {                                \
-        safe_free(ptr->linetext);                    \
-        safe_free(ptr->label);                       \
-        if(ptr->src.type == TIS_OP_ARG_TYPE_LABEL) { \
-            safe_free(ptr->src.label);               \
-        }                                            \
-        if(ptr->dst.type == TIS_OP_ARG_TYPE_LABEL) { \
-            safe_free(ptr->dst.label);               \
-        }                                            \
-        free(ptr);                                   \
-        ptr = NULL;                                  \
-    }                                                \
-} while(0)
-
-#define safe_free_node(ptr) do {                                          \
-    if(ptr != NULL) {                                                     \
-        safe_free(ptr->name);                                             \
-        if(ptr->type == TIS_NODE_TYPE_COMPUTE) {                          \
-            for(size_t nodei = 0; nodei < TIS_NODE_LINE_COUNT; nodei++) { \
-                safe_free_op(ptr->code[nodei]);                           \
-            }                                                             \
-        }                                                                 \
-        free(ptr);                                                        \
-        ptr = NULL;                                                       \
-    }                                                                     \
-} while(0)
-
-#define safe_free_io_node(ptr) do { \
-    if(ptr != NULL) {               \
-        safe_free(ptr->name);       \
-        free(ptr);                  \
-        ptr = NULL;                 \
-    }                               \
-} while(0)
-
 #define spam(...)  do { if(opts.verbose >=  2) { fprintf(stderr, "SPAM:\t"__VA_ARGS__); } } while(0)
 #define debug(...) do { if(opts.verbose >=  1) { fprintf(stderr, "DEBUG:\t"__VA_ARGS__); } } while(0)
 #define warn(...)  do { if(opts.verbose >=  0) { fprintf(stderr, "WARN:\t"__VA_ARGS__); } } while(0)
 #define error(...) do { if(opts.verbose >= -1) { fprintf(stderr, "ERROR:\t"__VA_ARGS__); } } while(0)
 
-#define bork() exit(EXIT_FAILURE)
-#define halt() exit(EXIT_SUCCESS)
+_Noreturn void tis_halt(int status); // exit, or stop the worker running this part of the machine
+extern _Thread_local void (*tis_halt_hook)(int status);
+#define bork() tis_halt(EXIT_FAILURE)
+#define halt() tis_halt(EXIT_SUCCESS)
 
 /*
  * Begin inlines
@@ -296,10 +342,10 @@ static inline int clamp(int x) {
  * Format node as string name; uses internal buffer, not necessarily safe for re-use
  */
 static inline char* node_name(tis_node_t* node) {
-    static char buf[128] = "";
+    static _Thread_local char buf[128] = "";
     size_t ix = 0;
     if(node->id >= 0) {
-        ix += snprintf(&buf[ix], 128-ix, "@%d", node->id);
+        ix += snprintf(&buf[ix], 128-ix, "@%lld", node->id);
     }
     if(node->name != NULL) {
         ix += snprintf(&buf[ix], 128-ix, ix==0 ? "%s" : "|%s", node->name);
@@ -308,4 +354,22 @@ static inline char* node_name(tis_node_t* node) {
     return &buf[0];
 }
 
+/*
+ * Write str to file as a JSON string, for the reports
+ */
+static inline void json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for(; str != NULL && *str != '\0'; str++) {
+        unsigned char c = *str;
+        if(c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if(c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
 #endif /* _TIS_TYPES_ */